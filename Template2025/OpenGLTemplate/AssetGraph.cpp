@@ -0,0 +1,182 @@
+#include "AssetGraph.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cstdio>
+
+CAssetGraph::CAssetGraph()
+{
+	m_pThreadPool = NULL;
+	m_iRemaining = 0;
+	m_fWallTime = 0.0;
+}
+
+int CAssetGraph::AddTask(const std::string& name, TaskThread thread, std::function<void()> task, std::initializer_list<int> dependencies)
+{
+	int iTask = (int)m_tasks.size();
+	Task newTask;
+	newTask.name = name;
+	newTask.thread = thread;
+	newTask.task = task;
+	newTask.iWaiting = 0;
+	newTask.fStart = newTask.fEnd = 0.0;
+	for (int iDependency : dependencies) {
+		if (iDependency < 0 || iDependency >= iTask)
+			continue;
+		newTask.dependencies.push_back(iDependency);
+		m_tasks[iDependency].dependents.push_back(iTask);
+	}
+	m_tasks.push_back(newTask);
+	return iTask;
+}
+
+void CAssetGraph::Run(CThreadPool* pThreadPool)
+{
+	m_pThreadPool = pThreadPool != NULL && pThreadPool->GetThreadCount() > 0 ? pThreadPool : NULL;
+	m_mainThreadId = std::this_thread::get_id();
+	m_startTime = std::chrono::steady_clock::now();
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_iRemaining = (int)m_tasks.size();
+	for (unsigned int i = 0; i < m_tasks.size(); i++)
+		m_tasks[i].iWaiting = (int)m_tasks[i].dependencies.size();
+	for (unsigned int i = 0; i < m_tasks.size(); i++)
+		if (m_tasks[i].iWaiting == 0)
+			Dispatch(i);
+
+	// Run main thread tasks as they become ready, and sleep while only the workers have anything to do
+	while (m_iRemaining > 0) {
+		if (m_mainReady.empty()) {
+			m_taskFinished.wait(lock);
+			continue;
+		}
+		std::vector<int>::iterator next = std::min_element(m_mainReady.begin(), m_mainReady.end());
+		int iTask = *next;
+		m_mainReady.erase(next);
+
+		lock.unlock();
+		Execute(iTask);
+		lock.lock();
+	}
+	m_fWallTime = GetTime();
+}
+
+void CAssetGraph::Execute(int iTask)
+{
+	Task& task = m_tasks[iTask];
+	task.threadId = std::this_thread::get_id();
+	task.fStart = GetTime();
+	task.task();
+	task.fEnd = GetTime();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (unsigned int i = 0; i < task.dependents.size(); i++) {
+		int iDependent = task.dependents[i];
+		if (--m_tasks[iDependent].iWaiting == 0)
+			Dispatch(iDependent);
+	}
+	m_iRemaining--;
+	m_taskFinished.notify_all();
+}
+
+void CAssetGraph::Dispatch(int iTask)
+{
+	if (m_tasks[iTask].thread == MAIN_THREAD || m_pThreadPool == NULL)
+		m_mainReady.push_back(iTask);
+	else
+		m_pThreadPool->Submit([this, iTask]() { Execute(iTask); });
+}
+
+double CAssetGraph::GetTime()
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_startTime).count();
+}
+
+double CAssetGraph::GetWallTime()
+{
+	return m_fWallTime;
+}
+
+// Ids only ever depend on lower ids, so one pass in id order finds the longest chain ending at each task
+void CAssetGraph::FindCriticalPath(std::vector<int>& path)
+{
+	path.clear();
+	if (m_tasks.empty())
+		return;
+
+	std::vector<double> chainTime(m_tasks.size());
+	std::vector<int> previous(m_tasks.size(), -1);
+	int iLast = 0;
+	for (unsigned int i = 0; i < m_tasks.size(); i++) {
+		const Task& task = m_tasks[i];
+		double fLongest = 0.0;
+		for (unsigned int j = 0; j < task.dependencies.size(); j++) {
+			int iDependency = task.dependencies[j];
+			if (chainTime[iDependency] > fLongest) {
+				fLongest = chainTime[iDependency];
+				previous[i] = iDependency;
+			}
+		}
+		chainTime[i] = fLongest + task.fEnd - task.fStart;
+		if (chainTime[i] > chainTime[iLast])
+			iLast = i;
+	}
+
+	for (int i = iLast; i >= 0; i = previous[i])
+		path.push_back(i);
+	std::reverse(path.begin(), path.end());
+}
+
+double CAssetGraph::GetCriticalPathTime()
+{
+	std::vector<int> path;
+	FindCriticalPath(path);
+	double fTime = 0.0;
+	for (unsigned int i = 0; i < path.size(); i++)
+		fTime += m_tasks[path[i]].fEnd - m_tasks[path[i]].fStart;
+	return fTime;
+}
+
+bool CAssetGraph::DumpTimeline(const std::string& path)
+{
+	FILE* pFile = NULL;
+	if (fopen_s(&pFile, path.c_str(), "w") != 0 || pFile == NULL)
+		return false;
+
+	double fTaskTime = 0.0;
+	for (unsigned int i = 0; i < m_tasks.size(); i++)
+		fTaskTime += m_tasks[i].fEnd - m_tasks[i].fStart;
+	fprintf(pFile, "Tasks: %d, %.1f ms wall clock, %.1f ms of work, %.1f ms on the longest chain\n", (int)m_tasks.size(),
+		GetWallTime(), fTaskTime, GetCriticalPathTime());
+
+	// Workers are numbered in the order they first picked up a task
+	std::vector<int> order(m_tasks.size());
+	for (unsigned int i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return m_tasks[a].fStart < m_tasks[b].fStart; });
+	std::vector<std::thread::id> workers;
+	fprintf(pFile, "%10s %10s %10s %10s  %s\n", "Start", "End", "Length", "Thread", "Task");
+	for (unsigned int i = 0; i < order.size(); i++) {
+		const Task& task = m_tasks[order[i]];
+		char thread[32];
+		if (task.threadId == m_mainThreadId)
+			sprintf_s(thread, "main");
+		else {
+			std::vector<std::thread::id>::iterator it = std::find(workers.begin(), workers.end(), task.threadId);
+			if (it == workers.end())
+				it = workers.insert(workers.end(), task.threadId);
+			sprintf_s(thread, "worker %d", (int)(it - workers.begin()));
+		}
+		fprintf(pFile, "%10.1f %10.1f %10.1f %10s  %s\n", task.fStart, task.fEnd, task.fEnd - task.fStart, thread, task.name.c_str());
+	}
+
+	std::vector<int> criticalPath;
+	FindCriticalPath(criticalPath);
+	fprintf(pFile, "\nLongest chain:");
+	for (unsigned int i = 0; i < criticalPath.size(); i++)
+		fprintf(pFile, "%s %s", i == 0 ? "" : " ->", m_tasks[criticalPath[i]].name.c_str());
+	fprintf(pFile, "\n");
+
+	fclose(pFile);
+	return true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <initializer_list>
+#include <chrono>
+#include <thread>
+
+class CThreadPool;
+
+// Startup work as a graph of tasks, each started once every task it depends on has finished.  Worker tasks run on a
+// CThreadPool, so reading and decoding files overlap with each other and with the main thread.  Main thread tasks, the
+// ones that make OpenGL calls, run one at a time on the thread that calls Run, lowest id first among those ready.
+//
+// A task is dispatched, and Run returns, only after m_mutex has seen the tasks before it finish, so whatever a task
+// wrote is visible to the tasks that depend on it and to the code after Run, on whichever thread they run.  Objects
+// set up on a worker can be handed to the main thread that way, provided they may be used from another thread at all.
+//
+// Each task's start and end are recorded.  The longest chain of dependent tasks is the least the startup could take
+// with any number of workers, so comparing it with the wall clock time shows how much is left to gain.
+class CAssetGraph
+{
+public:
+	enum TaskThread { WORKER_THREAD, MAIN_THREAD };
+
+	CAssetGraph();
+
+	// Returns the task's id, for the tasks that depend on it.  Dependencies are ids already returned, so the graph
+	// cannot have cycles.
+	int AddTask(const std::string& name, TaskThread thread, std::function<void()> task, std::initializer_list<int> dependencies = {});
+
+	// Runs every task and returns once they have all finished.  Without workers, everything runs on this thread.
+	void Run(CThreadPool* pThreadPool);
+
+	double GetWallTime();							// From Run starting to the last task finishing, in ms
+	double GetCriticalPathTime();					// Of the longest chain of dependent tasks, in ms
+
+	// Writes each task's thread, start and end, and the longest chain
+	bool DumpTimeline(const std::string& path);
+
+private:
+	struct Task {
+		std::string name;
+		TaskThread thread;
+		std::function<void()> task;
+		std::vector<int> dependencies, dependents;
+		int iWaiting;								// Dependencies not finished yet
+		double fStart, fEnd;						// In ms from Run starting
+		std::thread::id threadId;
+	};
+
+	void Execute(int iTask);
+	void Dispatch(int iTask);						// Called with m_mutex held
+	double GetTime();
+	void FindCriticalPath(std::vector<int>& path);
+
+	std::vector<Task> m_tasks;
+	CThreadPool* m_pThreadPool;
+	std::vector<int> m_mainReady;					// Main thread tasks ready to run.  Protected by m_mutex, as are the counts.
+	int m_iRemaining;
+	std::mutex m_mutex;
+	std::condition_variable m_taskFinished;
+	std::chrono::steady_clock::time_point m_startTime;
+	std::thread::id m_mainThreadId;
+	double m_fWallTime;
+};
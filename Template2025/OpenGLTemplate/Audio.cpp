@@ -16,7 +16,8 @@ bool CAudio::Initialise()
 	if (result != FMOD_OK) 
 		return false;
 
-	// Initialise the system
+	// Initialise the system.  Keep it thread safe (no FMOD_INIT_THREAD_UNSAFE): Game initialises it on a worker and
+	// uses it on the main thread.
 	result = m_FmodSystem->init(32, FMOD_INIT_NORMAL, 0);
 	FmodErrorCheck(result);
 	if (result != FMOD_OK) 
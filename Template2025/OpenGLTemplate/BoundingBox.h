@@ -0,0 +1,49 @@
+#pragma once
+
+#include "./include/glm/glm.hpp"
+
+#include <cfloat>
+#include <cmath>
+
+// Axis-aligned bounding box, with the bounding sphere around it.  A default-constructed box is empty, and grows to fit
+// whatever is added with Extend.
+struct BoundingBox
+{
+	glm::vec3 min;
+	glm::vec3 max;
+
+	BoundingBox() : min(FLT_MAX), max(-FLT_MAX) {}
+	BoundingBox(const glm::vec3& minIn, const glm::vec3& maxIn) : min(minIn), max(maxIn) {}
+
+	bool IsEmpty() const { return min.x > max.x; }
+
+	void Extend(const glm::vec3& p)
+	{
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+
+	void Extend(const BoundingBox& box)
+	{
+		min = glm::min(min, box.min);
+		max = glm::max(max, box.max);
+	}
+
+	glm::vec3 GetCentre() const { return (min + max) * 0.5f; }
+	glm::vec3 GetExtent() const { return (max - min) * 0.5f; }
+
+	// Radius of the bounding sphere centred on GetCentre()
+	float GetRadius() const { return glm::length(GetExtent()); }
+
+	// Box around this box after transforming it by m.  The new extent along each axis is the sum of the absolute
+	// values of the old extents projected onto that axis (Arvo's method), so no corners need transforming.
+	BoundingBox Transform(const glm::mat4& m) const
+	{
+		glm::vec3 centre = glm::vec3(m * glm::vec4(GetCentre(), 1.0f));
+		glm::vec3 extent = GetExtent();
+		glm::vec3 newExtent;
+		for (int i = 0; i < 3; i++)
+			newExtent[i] = fabs(m[0][i]) * extent.x + fabs(m[1][i]) * extent.y + fabs(m[2][i]) * extent.z;
+		return BoundingBox(centre - newExtent, centre + newExtent);
+	}
+};
@@ -331,4 +331,16 @@ int CCatmullRom::CurrentLap(float d)
 
 }
 
-glm::vec3 CCatmullRom::_dummy_vector(0.0f, 0.0f, 0.0f);
\ No newline at end of file
+glm::vec3 CCatmullRom::_dummy_vector(0.0f, 0.0f, 0.0f);
+
+BoundingBox CCatmullRom::GetBounds()
+{
+	BoundingBox bounds;
+	for (size_t i = 0; i < m_centrelinePoints.size(); i++)
+		bounds.Extend(m_centrelinePoints[i]);
+	for (size_t i = 0; i < m_leftOffsetPoints.size(); i++)
+		bounds.Extend(m_leftOffsetPoints[i]);
+	for (size_t i = 0; i < m_rightOffsetPoints.size(); i++)
+		bounds.Extend(m_rightOffsetPoints[i]);
+	return bounds;
+}
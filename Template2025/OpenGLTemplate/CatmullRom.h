@@ -3,6 +3,7 @@
 #include "vertexBufferObject.h"
 #include "vertexBufferObjectIndexed.h"
 #include "Texture.h"
+#include "BoundingBox.h"
 
 
 class CCatmullRom
@@ -26,6 +27,8 @@ public:
 
     float GetTotalLength() const {return m_distances.back();}
 
+    BoundingBox GetBounds(); // Bounding box of the centreline, offset curves and track in world coordinates
+
 private:
     void SetControlPoints();
     void ComputeLengthsAlongControlPoints();
@@ -0,0 +1,336 @@
+#include "ClusteredLighting.h"
+#include "Shaders.h"
+#include "HighResolutionTimer.h"
+#include "StreamingBuffer.h"
+
+CClusteredLighting::CClusteredLighting()
+{
+	m_iScreenWidth = m_iScreenHeight = 0;
+	m_fNear = m_fFar = 0.0f;
+	m_fTanHalfFovX = m_fTanHalfFovY = 0.0f;
+	m_fDepthScale = m_fDepthBias = 0.0f;
+	m_uiBuffers[0] = m_uiBuffers[1] = m_uiBuffers[2] = 0;
+	m_bCreated = false;
+	m_pStream = NULL;
+	m_iStreamAlignment = 0;
+	for (int i = 0; i < 3; i++) {
+		m_uiBoundBuffers[i] = 0;
+		m_iBoundOffsets[i] = 0;
+		m_iBoundSizes[i] = 0;
+	}
+}
+
+CClusteredLighting::~CClusteredLighting()
+{
+	Release();
+}
+
+// Creates the storage buffers and works out the eye space bounds of every cluster
+void CClusteredLighting::Create(int iScreenWidth, int iScreenHeight, const glm::mat4& projectionMatrix, float fNear, float fFar)
+{
+	m_iScreenWidth = iScreenWidth;
+	m_iScreenHeight = iScreenHeight;
+	m_fNear = fNear;
+	m_fFar = fFar;
+
+	// For a symmetric frustum, eye space x / depth = ndc x * tan(half fov x), and likewise for y
+	m_fTanHalfFovX = 1.0f / projectionMatrix[0][0];
+	m_fTanHalfFovY = 1.0f / projectionMatrix[1][1];
+
+	// Depth slices are spaced exponentially, so clusters stay roughly cubic along the view direction
+	float fLogRatio = log(fFar / fNear);
+	m_fDepthScale = CLUSTERS_Z / fLogRatio;
+	m_fDepthBias = -CLUSTERS_Z * log(fNear) / fLogRatio;
+
+	const int iNumClusters = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+	m_vClusterCounts.resize(iNumClusters);
+	m_vClusterLights.resize(iNumClusters * MAX_LIGHTS_PER_CLUSTER);
+	m_vClusterTable.resize(iNumClusters);
+	BuildClusterBounds();
+
+	if (!m_bCreated)
+		glGenBuffers(3, m_uiBuffers);
+	m_bCreated = true;
+
+	Upload();
+}
+
+void CClusteredLighting::Resize(int iScreenWidth, int iScreenHeight, const glm::mat4& projectionMatrix)
+{
+	if (m_bCreated)
+		Create(iScreenWidth, iScreenHeight, projectionMatrix, m_fNear, m_fFar);
+}
+
+// Each cluster is bounded by its screen tile and the near and far depths of its slice
+void CClusteredLighting::BuildClusterBounds()
+{
+	const int iNumClusters = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+	m_vClusterMin.resize(iNumClusters);
+	m_vClusterMax.resize(iNumClusters);
+
+	for (int z = 0; z < CLUSTERS_Z; z++) {
+		float fDepthNear = m_fNear * pow(m_fFar / m_fNear, (float)z / CLUSTERS_Z);
+		float fDepthFar = m_fNear * pow(m_fFar / m_fNear, (float)(z + 1) / CLUSTERS_Z);
+
+		for (int y = 0; y < CLUSTERS_Y; y++) {
+			float fNdcY0 = -1.0f + 2.0f * y / CLUSTERS_Y;
+			float fNdcY1 = -1.0f + 2.0f * (y + 1) / CLUSTERS_Y;
+
+			for (int x = 0; x < CLUSTERS_X; x++) {
+				float fNdcX0 = -1.0f + 2.0f * x / CLUSTERS_X;
+				float fNdcX1 = -1.0f + 2.0f * (x + 1) / CLUSTERS_X;
+
+				int iCluster = x + CLUSTERS_X * (y + CLUSTERS_Y * z);
+				m_vClusterMin[iCluster] = glm::vec3(
+					glm::min(fNdcX0 * fDepthNear, fNdcX0 * fDepthFar) * m_fTanHalfFovX,
+					glm::min(fNdcY0 * fDepthNear, fNdcY0 * fDepthFar) * m_fTanHalfFovY,
+					-fDepthFar);
+				m_vClusterMax[iCluster] = glm::vec3(
+					glm::max(fNdcX1 * fDepthNear, fNdcX1 * fDepthFar) * m_fTanHalfFovX,
+					glm::max(fNdcY1 * fDepthNear, fNdcY1 * fDepthFar) * m_fTanHalfFovY,
+					-fDepthNear);
+			}
+		}
+	}
+}
+
+void CClusteredLighting::ClearLights()
+{
+	m_vLights.clear();
+}
+
+// Lights beyond 65535 are ignored, since cluster slots store 16-bit light indices
+void CClusteredLighting::AddLight(const PointLight& light)
+{
+	if (m_vLights.size() < 65535)
+		m_vLights.push_back(light);
+}
+
+// Converts an eye space depth (a positive distance) into a slice index
+int CClusteredLighting::SliceFromDepth(float fDepth)
+{
+	int iSlice = (int)floor(log(fDepth) * m_fDepthScale + m_fDepthBias);
+	return glm::clamp(iSlice, 0, CLUSTERS_Z - 1);
+}
+
+void CClusteredLighting::Update(const glm::mat4& viewMatrix)
+{
+	m_vEyeLights.resize(m_vLights.size());
+	for (unsigned int i = 0; i < m_vLights.size(); i++) {
+		const PointLight& light = m_vLights[i];
+		glm::vec4 eyePosition = viewMatrix * glm::vec4(light.position, 1.0f);
+		m_vEyeLights[i].positionRadius = glm::vec4(glm::vec3(eyePosition), light.radius);
+		m_vEyeLights[i].colourIntensity = glm::vec4(light.colour, light.intensity);
+	}
+
+	AssignLights();
+	Upload();
+}
+
+// Assigns each light to the clusters its sphere overlaps.  Only the block of tiles and slices covered by the sphere's
+// projected bounds is visited, and each candidate cluster is tested against the sphere exactly.
+void CClusteredLighting::AssignLights()
+{
+	fill(m_vClusterCounts.begin(), m_vClusterCounts.end(), 0);
+
+	for (unsigned int i = 0; i < m_vEyeLights.size(); i++) {
+		glm::vec3 centre = glm::vec3(m_vEyeLights[i].positionRadius);
+		float fRadius = m_vEyeLights[i].positionRadius.w;
+		float fDepth = -centre.z;
+
+		// Skip lights entirely in front of the near plane or beyond the far plane
+		float fMinDepth = glm::max(fDepth - fRadius, m_fNear);
+		float fMaxDepth = glm::min(fDepth + fRadius, m_fFar);
+		if (fMinDepth > fMaxDepth)
+			continue;
+
+		int z0 = SliceFromDepth(fMinDepth);
+		int z1 = SliceFromDepth(fMaxDepth);
+
+		// Project the sphere's bounding box over its depth range into tile coordinates
+		float fXMin = glm::min((centre.x - fRadius) / fMinDepth, (centre.x - fRadius) / fMaxDepth) / m_fTanHalfFovX;
+		float fXMax = glm::max((centre.x + fRadius) / fMinDepth, (centre.x + fRadius) / fMaxDepth) / m_fTanHalfFovX;
+		float fYMin = glm::min((centre.y - fRadius) / fMinDepth, (centre.y - fRadius) / fMaxDepth) / m_fTanHalfFovY;
+		float fYMax = glm::max((centre.y + fRadius) / fMinDepth, (centre.y + fRadius) / fMaxDepth) / m_fTanHalfFovY;
+		if (fXMin > 1.0f || fXMax < -1.0f || fYMin > 1.0f || fYMax < -1.0f)
+			continue;
+
+		int x0 = glm::clamp((int)floor((fXMin * 0.5f + 0.5f) * CLUSTERS_X), 0, CLUSTERS_X - 1);
+		int x1 = glm::clamp((int)floor((fXMax * 0.5f + 0.5f) * CLUSTERS_X), 0, CLUSTERS_X - 1);
+		int y0 = glm::clamp((int)floor((fYMin * 0.5f + 0.5f) * CLUSTERS_Y), 0, CLUSTERS_Y - 1);
+		int y1 = glm::clamp((int)floor((fYMax * 0.5f + 0.5f) * CLUSTERS_Y), 0, CLUSTERS_Y - 1);
+
+		float fRadiusSquared = fRadius * fRadius;
+		for (int z = z0; z <= z1; z++) {
+			for (int y = y0; y <= y1; y++) {
+				for (int x = x0; x <= x1; x++) {
+					int iCluster = x + CLUSTERS_X * (y + CLUSTERS_Y * z);
+
+					// Sphere against box: distance from the centre to the closest point of the box
+					glm::vec3 closest = glm::clamp(centre, m_vClusterMin[iCluster], m_vClusterMax[iCluster]);
+					glm::vec3 d = closest - centre;
+					if (glm::dot(d, d) > fRadiusSquared)
+						continue;
+
+					unsigned int& uiCount = m_vClusterCounts[iCluster];
+					if (uiCount < MAX_LIGHTS_PER_CLUSTER)
+						m_vClusterLights[iCluster * MAX_LIGHTS_PER_CLUSTER + uiCount++] = (unsigned short)i;
+				}
+			}
+		}
+	}
+
+	// Pack the per-cluster lists into one index list
+	m_vLightIndices.clear();
+	for (unsigned int c = 0; c < m_vClusterCounts.size(); c++) {
+		m_vClusterTable[c] = glm::uvec2((unsigned int)m_vLightIndices.size(), m_vClusterCounts[c]);
+		const unsigned short* pLights = &m_vClusterLights[c * MAX_LIGHTS_PER_CLUSTER];
+		m_vLightIndices.insert(m_vLightIndices.end(), pLights, pLights + m_vClusterCounts[c]);
+	}
+}
+
+// Empty lists are padded to one element, since a zero-sized buffer cannot be bound
+void CClusteredLighting::Upload()
+{
+	GPULight emptyLight = { glm::vec4(0.0f), glm::vec4(0.0f) };
+	unsigned int uiEmptyIndex = 0;
+
+	if (m_vEyeLights.empty())
+		UploadBuffer(0, &emptyLight, sizeof(GPULight));
+	else
+		UploadBuffer(0, &m_vEyeLights[0], m_vEyeLights.size() * sizeof(GPULight));
+
+	UploadBuffer(1, &m_vClusterTable[0], m_vClusterTable.size() * sizeof(glm::uvec2));
+
+	if (m_vLightIndices.empty())
+		UploadBuffer(2, &uiEmptyIndex, sizeof(unsigned int));
+	else
+		UploadBuffer(2, &m_vLightIndices[0], m_vLightIndices.size() * sizeof(unsigned int));
+}
+
+// Copies a list into the streaming buffer if there is room.  Otherwise re-specifies the list's own storage buffer,
+// so the driver can orphan the old storage instead of waiting on the GPU.
+void CClusteredLighting::UploadBuffer(int iBuffer, const void* pData, GLsizeiptr iSize)
+{
+	m_iBoundSizes[iBuffer] = iSize;
+	if (m_pStream != NULL) {
+		void* pDest = m_pStream->Allocate(iSize, m_iStreamAlignment, m_iBoundOffsets[iBuffer]);
+		if (pDest != NULL) {
+			memcpy(pDest, pData, iSize);
+			m_uiBoundBuffers[iBuffer] = m_pStream->GetBuffer();
+			return;
+		}
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_uiBuffers[iBuffer]);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, iSize, pData, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	m_uiBoundBuffers[iBuffer] = m_uiBuffers[iBuffer];
+	m_iBoundOffsets[iBuffer] = 0;
+}
+
+void CClusteredLighting::SetStreamingBuffer(CStreamingBuffer* pStream)
+{
+	m_pStream = (pStream != NULL && pStream->IsCreated()) ? pStream : NULL;
+	if (m_pStream != NULL)
+		m_iStreamAlignment = CStreamingBuffer::GetStorageBufferAlignment();
+}
+
+void CClusteredLighting::Bind()
+{
+	const int bindings[3] = { LIGHT_BUFFER_BINDING, CLUSTER_BUFFER_BINDING, INDEX_BUFFER_BINDING };
+	for (int i = 0; i < 3; i++)
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, bindings[i], m_uiBoundBuffers[i], m_iBoundOffsets[i], m_iBoundSizes[i]);
+}
+
+// The fragment shader finds its cluster from gl_FragCoord and its eye space depth
+void CClusteredLighting::SetUniforms(CShaderProgram* pProgram)
+{
+	pProgram->SetUniform("clusterInfo.tileSize", glm::vec2((float)m_iScreenWidth / CLUSTERS_X, (float)m_iScreenHeight / CLUSTERS_Y));
+	pProgram->SetUniform("clusterInfo.countX", CLUSTERS_X);
+	pProgram->SetUniform("clusterInfo.countY", CLUSTERS_Y);
+	pProgram->SetUniform("clusterInfo.countZ", CLUSTERS_Z);
+	pProgram->SetUniform("clusterInfo.depthScale", m_fDepthScale);
+	pProgram->SetUniform("clusterInfo.depthBias", m_fDepthBias);
+}
+
+int CClusteredLighting::GetLightCount()
+{
+	return (int)m_vLights.size();
+}
+
+int CClusteredLighting::GetIndexCount()
+{
+	return (int)m_vLightIndices.size();
+}
+
+// Fills the view frustum (up to 500 units deep) with random lights and times the assignment and upload for each
+// light count.  The lights are generated directly in eye space, so the result does not depend on the camera.
+void CClusteredLighting::Benchmark(string sFileName)
+{
+	const int iLightCounts[] = { 16, 64, 256, 1024, 4096, 16384 };
+	const int iIterations = 50;
+
+	FILE* pFile = NULL;
+	if (fopen_s(&pFile, sFileName.c_str(), "w") != 0 || pFile == NULL)
+		return;
+
+	fprintf(pFile, "Clustered lighting benchmark: %d x %d x %d clusters, %d iterations per row\n\n", CLUSTERS_X, CLUSTERS_Y, CLUSTERS_Z, iIterations);
+	fprintf(pFile, "%8s %12s %12s %14s %16s %14s %10s\n", "lights", "assign (ms)", "upload (ms)", "light/cluster", "max per cluster", "index count", "overflows");
+
+	vector<GPULight> vSavedLights = m_vEyeLights;
+	CHighResolutionTimer timer;
+	srand(1);
+
+	for (unsigned int n = 0; n < sizeof(iLightCounts) / sizeof(iLightCounts[0]); n++) {
+		m_vEyeLights.resize(iLightCounts[n]);
+		for (int i = 0; i < iLightCounts[n]; i++) {
+			float fDepth = m_fNear + ((float)rand() / RAND_MAX) * glm::min(500.0f, m_fFar - m_fNear);
+			float fX = ((float)rand() / RAND_MAX * 2.0f - 1.0f) * fDepth * m_fTanHalfFovX;
+			float fY = ((float)rand() / RAND_MAX * 2.0f - 1.0f) * fDepth * m_fTanHalfFovY;
+			float fRadius = 5.0f + ((float)rand() / RAND_MAX) * 25.0f;
+			m_vEyeLights[i].positionRadius = glm::vec4(fX, fY, -fDepth, fRadius);
+			m_vEyeLights[i].colourIntensity = glm::vec4(1.0f);
+		}
+
+		double dAssignTime = 0.0, dUploadTime = 0.0;
+		for (int k = 0; k < iIterations; k++) {
+			timer.Start();
+			AssignLights();
+			dAssignTime += timer.Elapsed();
+
+			timer.Start();
+			Upload();
+			glFinish();
+			dUploadTime += timer.Elapsed();
+		}
+
+		unsigned int uiMaxCount = 0, uiNonEmpty = 0, uiOverflows = 0;
+		for (unsigned int c = 0; c < m_vClusterCounts.size(); c++) {
+			uiMaxCount = glm::max(uiMaxCount, m_vClusterCounts[c]);
+			if (m_vClusterCounts[c] > 0) uiNonEmpty++;
+			if (m_vClusterCounts[c] == MAX_LIGHTS_PER_CLUSTER) uiOverflows++;
+		}
+
+		fprintf(pFile, "%8d %12.3f %12.3f %14.2f %16u %14d %10u\n", iLightCounts[n], dAssignTime / iIterations, dUploadTime / iIterations,
+			uiNonEmpty > 0 ? (float)m_vLightIndices.size() / uiNonEmpty : 0.0f, uiMaxCount, (int)m_vLightIndices.size(), uiOverflows);
+	}
+
+	fprintf(pFile, "\nlight/cluster is the mean over non-empty clusters, which bounds the per-fragment lighting loop.\n");
+	fprintf(pFile, "overflows counts clusters that hit MAX_LIGHTS_PER_CLUSTER (%d) and dropped lights.\n", MAX_LIGHTS_PER_CLUSTER);
+	fclose(pFile);
+
+	// Put the frame's lights back
+	m_vEyeLights = vSavedLights;
+	AssignLights();
+	Upload();
+}
+
+void CClusteredLighting::Release()
+{
+	if (m_bCreated) {
+		glDeleteBuffers(3, m_uiBuffers);
+		m_uiBuffers[0] = m_uiBuffers[1] = m_uiBuffers[2] = 0;
+		m_bCreated = false;
+	}
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "Common.h"
+
+class CShaderProgram;
+class CStreamingBuffer;
+
+// A point light used by the clustered lighting pass.  Positions are in world coordinates.
+struct PointLight
+{
+	glm::vec3 position;
+	float radius;					// Distance at which the light's contribution reaches zero
+	glm::vec3 colour;
+	float intensity;
+
+	PointLight(glm::vec3 positionIn = glm::vec3(0.0f), float radiusIn = 10.0f, glm::vec3 colourIn = glm::vec3(1.0f), float intensityIn = 1.0f)
+		: position(positionIn), radius(radiusIn), colour(colourIn), intensity(intensityIn)
+	{}
+};
+
+// Clustered forward lighting.  The view frustum is divided into a grid of clusters (screen tiles x exponential depth
+// slices).  Each frame the lights are transformed into eye coordinates and assigned on the CPU to every cluster their
+// sphere of influence touches.  The lights, the per-cluster (offset, count) table and the light index list are
+// uploaded to shader storage buffers, and mainShader.frag only loops over the lights in its own cluster.
+class CClusteredLighting
+{
+public:
+	CClusteredLighting();
+	~CClusteredLighting();
+
+	// Creates the buffers and sizes the grid for a symmetric perspective projection with the given clip distances
+	void Create(int iScreenWidth, int iScreenHeight, const glm::mat4& projectionMatrix, float fNear, float fFar);
+
+	// Resizes the grid for a new screen size and projection, keeping the clip distances.  Does nothing before Create.
+	void Resize(int iScreenWidth, int iScreenHeight, const glm::mat4& projectionMatrix);
+
+	// Lights are collected again every frame
+	void ClearLights();
+	void AddLight(const PointLight& light);
+
+	// Transforms the lights into eye coordinates, assigns them to clusters and uploads the result
+	void Update(const glm::mat4& viewMatrix);
+
+	// Writes the per-frame lists into the streaming buffer instead of re-specifying the storage buffers
+	void SetStreamingBuffer(CStreamingBuffer* pStream);
+
+	// Binds the storage buffers and sets the cluster uniforms used by mainShader.frag
+	void Bind();
+	void SetUniforms(CShaderProgram* pProgram);
+
+	int GetLightCount();
+	int GetIndexCount();					// Total number of (light, cluster) pairs from the last Update
+
+	// Times the assignment pass for increasing numbers of random lights and writes the results to a text file
+	void Benchmark(string sFileName);
+
+	void Release();
+
+	static const int CLUSTERS_X = 16;
+	static const int CLUSTERS_Y = 9;
+	static const int CLUSTERS_Z = 24;
+	static const int MAX_LIGHTS_PER_CLUSTER = 128;
+
+	// Storage buffer binding points shared with mainShader.frag
+	static const int LIGHT_BUFFER_BINDING = 0;
+	static const int CLUSTER_BUFFER_BINDING = 1;
+	static const int INDEX_BUFFER_BINDING = 2;
+
+private:
+	// Light data as laid out in the std430 storage buffer
+	struct GPULight {
+		glm::vec4 positionRadius;			// Eye space position and radius
+		glm::vec4 colourIntensity;
+	};
+
+	void BuildClusterBounds();
+	void AssignLights();
+	void Upload();
+	void UploadBuffer(int iBuffer, const void* pData, GLsizeiptr iSize);
+	int SliceFromDepth(float fDepth);
+
+	int m_iScreenWidth, m_iScreenHeight;
+	float m_fNear, m_fFar;
+	float m_fTanHalfFovX, m_fTanHalfFovY;
+	float m_fDepthScale, m_fDepthBias;		// slice = log(depth) * scale + bias
+
+	vector<PointLight> m_vLights;
+	vector<GPULight> m_vEyeLights;
+	vector<glm::vec3> m_vClusterMin;			// Eye space bounding box of each cluster
+	vector<glm::vec3> m_vClusterMax;
+	vector<unsigned int> m_vClusterCounts;		// Lights found per cluster during assignment
+	vector<unsigned short> m_vClusterLights;	// MAX_LIGHTS_PER_CLUSTER light slots per cluster
+	vector<glm::uvec2> m_vClusterTable;			// (offset, count) into m_vLightIndices
+	vector<unsigned int> m_vLightIndices;
+
+	UINT m_uiBuffers[3];
+	bool m_bCreated;
+
+	CStreamingBuffer* m_pStream;
+	GLsizeiptr m_iStreamAlignment;
+	UINT m_uiBoundBuffers[3];					// Where each list was uploaded this frame
+	GLintptr m_iBoundOffsets[3];
+	GLsizeiptr m_iBoundSizes[3];
+};
@@ -0,0 +1,430 @@
+#include "CompressedImage.h"
+#include "MappedFile.h"
+
+// What each format is called by OpenGL, by the DDS (DXGI) and KTX2 (Vulkan) containers, and by the KTX2 data format
+// descriptor
+struct FormatInfo {
+	GLenum glFormat;
+	unsigned int dxgiFormat, dxgiSrgbFormat;
+	unsigned int vkFormat, vkSrgbFormat;
+	int blockBytes;
+	BYTE colourModel;
+};
+static const FormatInfo FORMATS[] = {
+	{ GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 71, 72, 131, 132, 8, 128 },		// BC1
+	{ GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 77, 78, 137, 138, 16, 130 },	// BC3
+	{ GL_COMPRESSED_RG_RGTC2, 83, 83, 141, 141, 16, 132 },				// BC5, never sRGB
+	{ GL_COMPRESSED_RGBA_BPTC_UNORM, 98, 99, 145, 146, 16, 134 },		// BC7
+};
+static const int FORMAT_COUNT = sizeof(FORMATS) / sizeof(FORMATS[0]);
+
+// Larger than any texture GL will create, and small enough that an image's size cannot overflow a size_t
+static const unsigned int MAX_SIZE = 16384;
+
+// Levels in a full mip chain down to 1x1.  A file claiming more is rejected, as level sizes past 1x1 mean nothing and
+// shifting by 32 or more is undefined.
+static unsigned int GetMaxLevelCount(unsigned int width, unsigned int height)
+{
+	unsigned int levels = 1;
+	while ((max(width, height) >> levels) > 0)
+		levels++;
+	return levels;
+}
+
+static unsigned int MakeFourCC(char a, char b, char c, char d)
+{
+	return (unsigned int)(BYTE)a | ((unsigned int)(BYTE)b << 8) | ((unsigned int)(BYTE)c << 16) | ((unsigned int)(BYTE)d << 24);
+}
+
+// DDS layout: "DDS ", the header, and, when the pixel format's FourCC is "DX10", the extended header
+struct DdsPixelFormat {
+	unsigned int size, flags, fourCC, rgbBitCount, rMask, gMask, bMask, aMask;
+};
+struct DdsHeader {
+	unsigned int size, flags, height, width, pitchOrLinearSize, depth, mipMapCount, reserved1[11];
+	DdsPixelFormat pixelFormat;
+	unsigned int caps, caps2, caps3, caps4, reserved2;
+};
+struct DdsHeaderDx10 {
+	unsigned int dxgiFormat, resourceDimension, miscFlag, arraySize, miscFlags2;
+};
+static const unsigned int DDS_MAGIC = 0x20534444;			// "DDS "
+static const unsigned int DDSD_REQUIRED = 0x1 | 0x2 | 0x4 | 0x1000;	// Caps, height, width, pixel format
+static const unsigned int DDSD_MIPMAPCOUNT = 0x20000;
+static const unsigned int DDSD_LINEARSIZE = 0x80000;
+static const unsigned int DDPF_FOURCC = 0x4;
+static const unsigned int DDSCAPS_COMPLEX = 0x8, DDSCAPS_TEXTURE = 0x1000, DDSCAPS_MIPMAP = 0x400000;
+static const unsigned int DDSCAPS2_CUBEMAP = 0x200;
+static const unsigned int DDS_DIMENSION_TEXTURE2D = 3;
+
+// KTX2 layout: the identifier, the header, the index, one level index entry per level, the data format descriptor,
+// then the levels, smallest first
+static const BYTE KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+#pragma pack(push, 4)							// The 64 bit offsets are only 4 byte aligned in the file
+struct Ktx2Header {
+	unsigned int vkFormat, typeSize, pixelWidth, pixelHeight, pixelDepth, layerCount, faceCount, levelCount, supercompressionScheme;
+	unsigned int dfdByteOffset, dfdByteLength, kvdByteOffset, kvdByteLength;
+	unsigned long long sgdByteOffset, sgdByteLength;
+};
+#pragma pack(pop)
+struct Ktx2Level {
+	unsigned long long byteOffset, byteLength, uncompressedByteLength;
+};
+static const int KTX2_LEVEL_ALIGNMENT = 16;
+
+CCompressedImage::CCompressedImage()
+{
+	m_format = FORMAT_BC1;
+	m_width = m_height = 0;
+	m_bSrgb = false;
+	m_pView = NULL;
+}
+
+void CCompressedImage::Create(Format format, int iWidth, int iHeight, bool bSrgb)
+{
+	m_format = format;
+	m_width = iWidth;
+	m_height = iHeight;
+	m_bSrgb = bSrgb && format != FORMAT_BC5;
+	m_data.clear();
+	m_pView = NULL;
+	m_levelOffsets.clear();
+}
+
+void CCompressedImage::AddLevel(const vector<BYTE>& blocks)
+{
+	m_levelOffsets.push_back(m_data.size());
+	m_data.insert(m_data.end(), blocks.begin(), blocks.end());
+}
+
+bool CCompressedImage::Load(const string& path)
+{
+	CMappedFile file;
+	if (!file.Open(path))
+		return false;
+	const BYTE* pData = file.GetData();
+	size_t size = file.GetSize();
+	if (size >= sizeof(KTX2_IDENTIFIER) && memcmp(pData, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) == 0)
+		return LoadKtx2(pData, size, true);
+	if (size >= sizeof(unsigned int) && *(const unsigned int*)pData == DDS_MAGIC)
+		return LoadDds(pData, size, true);
+	return false;
+}
+
+bool CCompressedImage::LoadView(const BYTE* pData, size_t size)
+{
+	bool bLoaded = false;
+	if (size >= sizeof(KTX2_IDENTIFIER) && memcmp(pData, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) == 0)
+		bLoaded = LoadKtx2(pData, size, false);
+	else if (size >= sizeof(unsigned int) && *(const unsigned int*)pData == DDS_MAGIC)
+		bLoaded = LoadDds(pData, size, false);
+	if (bLoaded)
+		m_pView = pData;
+	return bLoaded;
+}
+
+bool CCompressedImage::LoadConverted(const string& sourcePath)
+{
+	string::size_type dot = sourcePath.find_last_of('.');
+	string base = sourcePath.substr(0, dot);
+	return Load(base + ".ktx2") || Load(base + ".dds");
+}
+
+bool CCompressedImage::LoadDds(const BYTE* pData, size_t size, bool bCopy)
+{
+	size_t offset = sizeof(unsigned int);
+	if (size < offset + sizeof(DdsHeader))
+		return false;
+	const DdsHeader* pHeader = (const DdsHeader*)(pData + offset);
+	offset += sizeof(DdsHeader);
+	if (pHeader->size != sizeof(DdsHeader) || !(pHeader->pixelFormat.flags & DDPF_FOURCC) || (pHeader->caps2 & DDSCAPS2_CUBEMAP))
+		return false;
+
+	int iFormat = -1;
+	bool bSrgb = true;
+	unsigned int fourCC = pHeader->pixelFormat.fourCC;
+	if (fourCC == MakeFourCC('D', 'X', '1', '0')) {
+		if (size < offset + sizeof(DdsHeaderDx10))
+			return false;
+		const DdsHeaderDx10* pDx10 = (const DdsHeaderDx10*)(pData + offset);
+		offset += sizeof(DdsHeaderDx10);
+		if (pDx10->resourceDimension != DDS_DIMENSION_TEXTURE2D || pDx10->arraySize > 1)
+			return false;
+		for (int i = 0; i < FORMAT_COUNT && iFormat < 0; i++) {
+			if (pDx10->dxgiFormat == FORMATS[i].dxgiFormat || pDx10->dxgiFormat == FORMATS[i].dxgiSrgbFormat) {
+				iFormat = i;
+				bSrgb = pDx10->dxgiFormat == FORMATS[i].dxgiSrgbFormat;
+			}
+		}
+	}
+	else if (fourCC == MakeFourCC('D', 'X', 'T', '1'))
+		iFormat = FORMAT_BC1;
+	else if (fourCC == MakeFourCC('D', 'X', 'T', '5'))
+		iFormat = FORMAT_BC3;
+	else if (fourCC == MakeFourCC('A', 'T', 'I', '2') || fourCC == MakeFourCC('B', 'C', '5', 'U'))
+		iFormat = FORMAT_BC5;
+	if (iFormat < 0 || pHeader->width == 0 || pHeader->height == 0 || pHeader->width > MAX_SIZE || pHeader->height > MAX_SIZE)
+		return false;
+	unsigned int levels = (pHeader->flags & DDSD_MIPMAPCOUNT) ? max(pHeader->mipMapCount, 1u) : 1;
+	if (levels > GetMaxLevelCount(pHeader->width, pHeader->height))
+		return false;
+
+	Create((Format)iFormat, pHeader->width, pHeader->height, bSrgb);
+	int iLevels = (int)levels;
+	size_t dataSize = 0;
+	for (int i = 0; i < iLevels; i++)
+		dataSize += GetLevelSize(m_format, max(m_width >> i, 1), max(m_height >> i, 1));
+	if (size < offset + dataSize)
+		return false;
+
+	// DDS stores the levels largest first, one after another, as they are kept here
+	if (bCopy)
+		m_data.assign(pData + offset, pData + offset + dataSize);
+	size_t levelOffset = bCopy ? 0 : offset;
+	for (int i = 0; i < iLevels; i++) {
+		m_levelOffsets.push_back(levelOffset);
+		levelOffset += GetLevelSize(m_format, max(m_width >> i, 1), max(m_height >> i, 1));
+	}
+	return true;
+}
+
+bool CCompressedImage::LoadKtx2(const BYTE* pData, size_t size, bool bCopy)
+{
+	size_t offset = sizeof(KTX2_IDENTIFIER);
+	if (size < offset + sizeof(Ktx2Header))
+		return false;
+	const Ktx2Header* pHeader = (const Ktx2Header*)(pData + offset);
+	offset += sizeof(Ktx2Header);
+	if (pHeader->pixelDepth > 1 || pHeader->layerCount > 1 || pHeader->faceCount != 1 || pHeader->supercompressionScheme != 0 ||
+		pHeader->pixelWidth == 0 || pHeader->pixelHeight == 0 || pHeader->pixelWidth > MAX_SIZE || pHeader->pixelHeight > MAX_SIZE ||
+		pHeader->levelCount > GetMaxLevelCount(pHeader->pixelWidth, pHeader->pixelHeight))
+		return false;
+
+	int iFormat = -1;
+	bool bSrgb = false;
+	for (int i = 0; i < FORMAT_COUNT && iFormat < 0; i++) {
+		if (pHeader->vkFormat == FORMATS[i].vkFormat || pHeader->vkFormat == FORMATS[i].vkSrgbFormat) {
+			iFormat = i;
+			bSrgb = pHeader->vkFormat == FORMATS[i].vkSrgbFormat && i != FORMAT_BC5;
+		}
+	}
+	if (iFormat < 0)
+		return false;
+
+	int iLevels = max((int)pHeader->levelCount, 1);
+	if (size < offset + iLevels * sizeof(Ktx2Level))
+		return false;
+	const Ktx2Level* pLevels = (const Ktx2Level*)(pData + offset);
+
+	// Check every level before keeping any of them
+	Create((Format)iFormat, pHeader->pixelWidth, pHeader->pixelHeight, bSrgb);
+	for (int i = 0; i < iLevels; i++) {
+		size_t expected = GetLevelSize(m_format, max(m_width >> i, 1), max(m_height >> i, 1));
+		if (pLevels[i].byteLength != expected || pLevels[i].byteOffset > size || size - pLevels[i].byteOffset < expected)
+			return false;
+	}
+	for (int i = 0; i < iLevels; i++) {
+		if (!bCopy) {
+			m_levelOffsets.push_back((size_t)pLevels[i].byteOffset);
+			continue;
+		}
+		const BYTE* pLevel = pData + pLevels[i].byteOffset;
+		m_levelOffsets.push_back(m_data.size());
+		m_data.insert(m_data.end(), pLevel, pLevel + (size_t)pLevels[i].byteLength);
+	}
+	return true;
+}
+
+bool CCompressedImage::SaveDds(const string& path)
+{
+	FILE* pFile = NULL;
+	if (fopen_s(&pFile, path.c_str(), "wb") != 0 || pFile == NULL)
+		return false;
+
+	// Always written with the DX10 header, which is the only way to name BC7 and sRGB formats
+	DdsHeader header;
+	memset(&header, 0, sizeof(header));
+	header.size = sizeof(DdsHeader);
+	header.flags = DDSD_REQUIRED | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+	header.width = m_width;
+	header.height = m_height;
+	header.pitchOrLinearSize = (unsigned int)GetLevelSize(0);
+	header.mipMapCount = GetLevelCount();
+	header.pixelFormat.size = sizeof(DdsPixelFormat);
+	header.pixelFormat.flags = DDPF_FOURCC;
+	header.pixelFormat.fourCC = MakeFourCC('D', 'X', '1', '0');
+	header.caps = DDSCAPS_TEXTURE | (GetLevelCount() > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0);
+
+	DdsHeaderDx10 dx10;
+	memset(&dx10, 0, sizeof(dx10));
+	dx10.dxgiFormat = m_bSrgb ? FORMATS[m_format].dxgiSrgbFormat : FORMATS[m_format].dxgiFormat;
+	dx10.resourceDimension = DDS_DIMENSION_TEXTURE2D;
+	dx10.arraySize = 1;
+
+	fwrite(&DDS_MAGIC, sizeof(DDS_MAGIC), 1, pFile);
+	fwrite(&header, sizeof(header), 1, pFile);
+	fwrite(&dx10, sizeof(dx10), 1, pFile);
+	for (int i = 0; i < GetLevelCount(); i++)
+		fwrite(GetData() + m_levelOffsets[i], 1, GetLevelSize(i), pFile);
+	bool bWritten = ferror(pFile) == 0;
+	fclose(pFile);
+	return bWritten;
+}
+
+bool CCompressedImage::SaveKtx2(const string& path)
+{
+	FILE* pFile = NULL;
+	if (fopen_s(&pFile, path.c_str(), "wb") != 0 || pFile == NULL)
+		return false;
+
+	// The data format descriptor: one basic block with a sample per channel group of the block format
+	struct Sample {
+		unsigned short bitOffset;
+		BYTE bitLength, channel;
+		BYTE position[4];
+		unsigned int lower, upper;
+	};
+	vector<Sample> samples;
+	Sample sample = { 0, 63, 0, { 0, 0, 0, 0 }, 0, 0xFFFFFFFF };
+	const BYTE CHANNEL_ALPHA = 15, CHANNEL_GREEN = 1, SAMPLE_LINEAR = 0x10;
+	if (m_format == FORMAT_BC3) {
+		sample.channel = CHANNEL_ALPHA | (m_bSrgb ? SAMPLE_LINEAR : 0);	// Alpha is never sRGB encoded
+		samples.push_back(sample);
+		sample.bitOffset = 64;
+		sample.channel = 0;
+	} else if (m_format == FORMAT_BC5) {
+		samples.push_back(sample);
+		sample.bitOffset = 64;
+		sample.channel = CHANNEL_GREEN;
+	} else if (m_format == FORMAT_BC7)
+		sample.bitLength = 127;
+	samples.push_back(sample);
+
+	unsigned int blockSize = 24 + (unsigned int)(samples.size() * sizeof(Sample));
+	unsigned int dfdWords[2] = { 0, 2 | (blockSize << 16) };		// Khronos basic descriptor, version 2
+	BYTE dfdModel[16] = { FORMATS[m_format].colourModel, 1, (BYTE)(m_bSrgb ? 2 : 1), 0,	// BT.709 primaries, sRGB or linear
+		3, 3, 0, 0, (BYTE)FORMATS[m_format].blockBytes, 0, 0, 0, 0, 0, 0, 0 };			// 4x4 blocks, one plane
+	unsigned int dfdTotal = 4 + blockSize;
+
+	int iLevels = GetLevelCount();
+	Ktx2Header header;
+	memset(&header, 0, sizeof(header));
+	header.vkFormat = m_bSrgb ? FORMATS[m_format].vkSrgbFormat : FORMATS[m_format].vkFormat;
+	header.typeSize = 1;
+	header.pixelWidth = m_width;
+	header.pixelHeight = m_height;
+	header.faceCount = 1;
+	header.levelCount = iLevels;
+	header.dfdByteOffset = (unsigned int)(sizeof(KTX2_IDENTIFIER) + sizeof(Ktx2Header) + iLevels * sizeof(Ktx2Level));
+	header.dfdByteLength = dfdTotal;
+
+	// Levels go smallest first, each aligned for its blocks
+	vector<Ktx2Level> levels(iLevels);
+	size_t offset = header.dfdByteOffset + dfdTotal;
+	for (int i = iLevels - 1; i >= 0; i--) {
+		offset = (offset + KTX2_LEVEL_ALIGNMENT - 1) / KTX2_LEVEL_ALIGNMENT * KTX2_LEVEL_ALIGNMENT;
+		levels[i].byteOffset = offset;
+		levels[i].byteLength = levels[i].uncompressedByteLength = GetLevelSize(i);
+		offset += GetLevelSize(i);
+	}
+
+	fwrite(KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER), 1, pFile);
+	fwrite(&header, sizeof(header), 1, pFile);
+	fwrite(&levels[0], sizeof(Ktx2Level), iLevels, pFile);
+	fwrite(&dfdTotal, sizeof(dfdTotal), 1, pFile);
+	fwrite(dfdWords, sizeof(dfdWords), 1, pFile);
+	fwrite(dfdModel, sizeof(dfdModel), 1, pFile);
+	fwrite(&samples[0], sizeof(Sample), samples.size(), pFile);
+	size_t written = header.dfdByteOffset + dfdTotal;
+	const BYTE padding[KTX2_LEVEL_ALIGNMENT] = { 0 };
+	for (int i = iLevels - 1; i >= 0; i--) {
+		fwrite(padding, 1, (size_t)levels[i].byteOffset - written, pFile);
+		fwrite(GetData() + m_levelOffsets[i], 1, GetLevelSize(i), pFile);
+		written = (size_t)(levels[i].byteOffset + levels[i].byteLength);
+	}
+	bool bWritten = ferror(pFile) == 0;
+	fclose(pFile);
+	return bWritten;
+}
+
+CCompressedImage::Format CCompressedImage::GetFormat()
+{
+	return m_format;
+}
+
+// The renderer samples textures as they are stored, so sRGB images still map to the plain formats, as the
+// uncompressed images do
+GLenum CCompressedImage::GetInternalFormat()
+{
+	return FORMATS[m_format].glFormat;
+}
+
+bool CCompressedImage::IsSrgb()
+{
+	return m_bSrgb;
+}
+
+int CCompressedImage::GetWidth()
+{
+	return m_width;
+}
+
+int CCompressedImage::GetHeight()
+{
+	return m_height;
+}
+
+int CCompressedImage::GetBitsPerPixel()
+{
+	return FORMATS[m_format].blockBytes * 8 / 16;
+}
+
+int CCompressedImage::GetLevelCount()
+{
+	return (int)m_levelOffsets.size();
+}
+
+int CCompressedImage::GetLevelWidth(int iLevel)
+{
+	return max(m_width >> iLevel, 1);
+}
+
+int CCompressedImage::GetLevelHeight(int iLevel)
+{
+	return max(m_height >> iLevel, 1);
+}
+
+size_t CCompressedImage::GetLevelOffset(int iLevel)
+{
+	return m_levelOffsets[iLevel];
+}
+
+size_t CCompressedImage::GetLevelSize(int iLevel)
+{
+	return GetLevelSize(m_format, GetLevelWidth(iLevel), GetLevelHeight(iLevel));
+}
+
+const BYTE* CCompressedImage::GetData()
+{
+	if (m_pView != NULL)
+		return m_pView;
+	return m_data.empty() ? NULL : &m_data[0];
+}
+
+size_t CCompressedImage::GetDataSize()
+{
+	size_t size = 0;
+	for (int i = 0; i < GetLevelCount(); i++)
+		size += GetLevelSize(i);
+	return size;
+}
+
+int CCompressedImage::GetBlockBytes(Format format)
+{
+	return FORMATS[format].blockBytes;
+}
+
+size_t CCompressedImage::GetLevelSize(Format format, int iWidth, int iHeight)
+{
+	return (size_t)((iWidth + 3) / 4) * ((iHeight + 3) / 4) * FORMATS[format].blockBytes;
+}
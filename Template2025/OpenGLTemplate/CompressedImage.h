@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Common.h"
+
+// A block compressed image and its mip chain, as read from or written to a DDS or KTX2 file.  The files are made
+// offline by TextureConverter; the loading code only needs the blocks, so this holds no GL state and uploading is left
+// to CTexture.
+//
+// Rows are kept in the order FreeImage gives them, bottom row first, so the texture coordinates used for the source
+// images still apply.
+class CCompressedImage
+{
+public:
+	enum Format { FORMAT_BC1, FORMAT_BC3, FORMAT_BC5, FORMAT_BC7 };
+
+	CCompressedImage();
+
+	// Starts an image; the levels are then added largest first
+	void Create(Format format, int iWidth, int iHeight, bool bSrgb);
+	void AddLevel(const vector<BYTE>& blocks);
+
+	bool Load(const string& path);				// DDS or KTX2, told apart by their signatures
+	bool LoadConverted(const string& sourcePath);	// Looks for a .ktx2, then a .dds, beside a source image
+
+	// Reads a DDS or KTX2 file already in memory, such as a CMappedFile, and refers to the levels where they lie
+	// instead of copying them, so only the levels that are used get read.  pData must outlive the image.
+	bool LoadView(const BYTE* pData, size_t size);
+	bool SaveDds(const string& path);
+	bool SaveKtx2(const string& path);
+
+	Format GetFormat();
+	GLenum GetInternalFormat();
+	bool IsSrgb();								// Colour data; false for data such as normals
+	int GetWidth();
+	int GetHeight();
+	int GetBitsPerPixel();
+	int GetLevelCount();
+	int GetLevelWidth(int iLevel);
+	int GetLevelHeight(int iLevel);
+	size_t GetLevelOffset(int iLevel);			// Into GetData()
+	size_t GetLevelSize(int iLevel);
+	const BYTE* GetData();
+	size_t GetDataSize();						// Of every level
+
+	static int GetBlockBytes(Format format);
+	static size_t GetLevelSize(Format format, int iWidth, int iHeight);
+
+private:
+	bool LoadDds(const BYTE* pData, size_t size, bool bCopy);
+	bool LoadKtx2(const BYTE* pData, size_t size, bool bCopy);
+
+	Format m_format;
+	int m_width, m_height;
+	bool m_bSrgb;
+	vector<BYTE> m_data;						// Every level, largest first
+	const BYTE* m_pView;						// Or the file the levels are in, from LoadView
+	vector<size_t> m_levelOffsets;
+};
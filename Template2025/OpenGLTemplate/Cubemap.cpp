@@ -1,60 +1,222 @@
 #include "Common.h"
 
 #include "Cubemap.h"
+#include "TextureLoader.h"
+#include "CompressedImage.h"
+#include "ThreadPool.h"
+#include "MappedFile.h"
 
 
 #include "include\freeimage\FreeImage.h"
 #pragma comment(lib, "lib/FreeImage.lib")
 
+const char* CCubemap::CACHE_DIRECTORY = "resources\\cache\\";
 
-bool CCubemap::LoadTexture(string filename, BYTE **bmpBytes, int &iWidth, int &iHeight)
+// Layout of a mip cache file.  After the header come the levels, largest first, each holding the six faces in order
+// with rows padded to four bytes, as glGetTexImage returns them.  Bump CUBEMAP_CACHE_VERSION when any of it changes.
+static const unsigned int CUBEMAP_CACHE_MAGIC = 0x43425543;	// "CUBC"
+static const unsigned int CUBEMAP_CACHE_VERSION = 1;
+
+struct CubemapCacheHeader
 {
-	FREE_IMAGE_FORMAT fif = FIF_UNKNOWN;
-	FIBITMAP* dib(0);
+	unsigned int magic;
+	unsigned int version;
+	unsigned long long facesHash;				// Of all six face files
+	int width, height;
+	int levels;
+	float decodeTime;							// Milliseconds decoding and mip generation took, to report what the cache saves
+};
 
-	fif = FreeImage_GetFileType(filename.c_str(), 0); // Check the file signature and deduce its format
+CCubemap::CCubemap()
+{
+	m_uiTexture = 0;
+	m_uiSampler = 0;
+	m_facesHash = 0;
+	m_bLoadedFromCache = false;
+	m_loadTime = 0.0;
+	m_decodeTime = 0.0;
+	m_pLoader = NULL;
+	m_uiLoadingTexture = 0;
+	for (int i = 0; i < 6; i++)
+		m_loadRequests[i] = -1;
+	m_iFacesArrived = 0;
+	m_iFacesCompressed = 0;
+	m_bFaceFailed = false;
+	m_prepared = PREPARED_NONE;
+	m_iWidth = m_iHeight = 0;
+	m_prepareTime = 0.0;
+}
 
-	if(fif == FIF_UNKNOWN) // If still unknown, try to guess the file format from the file extension
-		fif = FreeImage_GetFIFFromFilename(filename.c_str());
-	
-	if(fif == FIF_UNKNOWN) // If still unknown, return failure
-		return false;
+CCubemap::~CCubemap()
+{
+	// The loader must not call back into a deleted cube map
+	for (int i = 0; i < 6; i++)
+		if (m_loadRequests[i] >= 0)
+			m_pLoader->Cancel(m_loadRequests[i]);
+}
 
-	if(FreeImage_FIFSupportsReading(fif)) // Check if the plugin has reading capabilities and load the file
-		dib = FreeImage_Load(fif, filename.c_str());
+size_t CCubemap::GetFaceSize(int iWidth, int iHeight)
+{
+	return (size_t)((iWidth * 3 + 3) & ~3) * iHeight;
+}
 
-	if(!dib) {
-		char message[1024];
-		sprintf_s(message, "Cannot load image\n%s\n", filename.c_str());
-		MessageBox(NULL, message, "Error", MB_ICONERROR);
-		return false;
+int CCubemap::GetLevelCount(int iWidth, int iHeight)
+{
+	int iLevels = 1;
+	while (max(iWidth, iHeight) >> iLevels > 0)
+		iLevels++;
+	return iLevels;
+}
+
+bool CCubemap::DecodeFaces(string sFaces[6], CThreadPool* pThreadPool, vector<BYTE>& staging, int& iWidth, int& iHeight)
+{
+	// The first face's header gives the size of the block, so every face can be decoded straight into its place
+	FREE_IMAGE_FORMAT fifs[6];
+	for (int i = 0; i < 6; i++) {
+		fifs[i] = FreeImage_GetFileType(sFaces[i].c_str(), 0);
+		if (fifs[i] == FIF_UNKNOWN)
+			fifs[i] = FreeImage_GetFIFFromFilename(sFaces[i].c_str());
 	}
+	FIBITMAP* header = NULL;
+	if (fifs[0] != FIF_UNKNOWN && FreeImage_FIFSupportsReading(fifs[0]))
+		header = FreeImage_Load(fifs[0], sFaces[0].c_str(), FIF_LOAD_NOPIXELS);
+	iWidth = header != NULL ? FreeImage_GetWidth(header) : 0;
+	iHeight = header != NULL ? FreeImage_GetHeight(header) : 0;
+	if (header != NULL)
+		FreeImage_Unload(header);
 
-	iWidth = FreeImage_GetWidth(dib);
-	iHeight = FreeImage_GetWidth(dib);
-	int bpp = FreeImage_GetBPP(dib);
+	size_t faceSize = GetFaceSize(iWidth, iHeight);
+	staging.resize(faceSize * 6);
+	bool bFailed[6] = { false, false, false, false, false, false };
+	auto decode = [&](int i) {
+		FIBITMAP* dib = NULL;
+		if (faceSize > 0 && fifs[i] != FIF_UNKNOWN && FreeImage_FIFSupportsReading(fifs[i]))
+			dib = FreeImage_Load(fifs[i], sFaces[i].c_str());
+		bFailed[i] = dib == NULL || (int)FreeImage_GetWidth(dib) != iWidth || (int)FreeImage_GetHeight(dib) != iHeight;
+		if (!bFailed[i])
+			FreeImage_ConvertToRawBits(&staging[faceSize * i], dib, (iWidth * 3 + 3) & ~3, 24, FI_RGBA_RED_MASK,
+				FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, FALSE);
+		if (dib != NULL)
+			FreeImage_Unload(dib);
+	};
+	if (pThreadPool != NULL)
+		pThreadPool->ParallelFor(6, decode);
+	else
+		for (int i = 0; i < 6; i++)
+			decode(i);
 
+	for (int i = 0; i < 6; i++) {
+		if (bFailed[i]) {
+			char message[1024];
+			sprintf_s(message, "Cannot load image\n%s\n", sFaces[i].c_str());
+			MessageBox(NULL, message, "Error", MB_ICONERROR);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Uploads the six faces of a level, which follow each other in pFaces.  With direct state access, a cube map can be
+// written as six layers in one call.
+void CCubemap::UploadLevel(UINT uiTexture, int iLevel, int iWidth, int iHeight, const BYTE* pFaces)
+{
+	if (GLEW_VERSION_4_5 || GLEW_ARB_direct_state_access)
+		glTextureSubImage3D(uiTexture, iLevel, 0, 0, 0, iWidth, iHeight, 6, GL_BGR, GL_UNSIGNED_BYTE, pFaces);
+	else
+		for (int i = 0; i < 6; i++)
+			glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, iLevel, 0, 0, iWidth, iHeight, GL_BGR, GL_UNSIGNED_BYTE,
+				pFaces + GetFaceSize(iWidth, iHeight) * i);
+}
 
-	BYTE* bDataPointer = FreeImage_GetBits(dib); // Retrieve the image data
+unsigned long long CCubemap::HashFaces(string sFaces[6])
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	for (int i = 0; i < 6; i++) {
+		CMappedFile file;
+		if (!file.Open(sFaces[i]))
+			return 0;
+		hash = (hash ^ file.GetHash()) * 1099511628211ULL;
+	}
+	return hash;
+}
 
+// Maps the mip chain SaveCache wrote for these faces, leaving it open for UploadCache.  The cache is keyed on the
+// contents of all six faces, so it goes stale by itself if any of them change.  Returns false, with m_cachePath set
+// to where the mips should be saved, if the file is missing, truncated or for other faces.
+bool CCubemap::OpenCache(string sFaces[6], bool bMipCache)
+{
+	m_facesHash = bMipCache ? HashFaces(sFaces) : 0;
+	if (m_facesHash == 0)
+		return false;
+	char cachePath[MAX_PATH];
+	sprintf_s(cachePath, "%s%016llx.cubemips", CACHE_DIRECTORY, m_facesHash);
+	m_cachePath = cachePath;
 
-	// If somehow one of these failed (they shouldn't), return failure
-	if(bDataPointer == NULL || FreeImage_GetWidth(dib) == 0 || FreeImage_GetHeight(dib) == 0) 
+	if (!m_cacheFile.Open(m_cachePath) || m_cacheFile.GetSize() < sizeof(CubemapCacheHeader)) {
+		m_cacheFile.Close();
 		return false;
-	int test = FreeImage_GetDIBSize(dib);
-	*bmpBytes = new BYTE [iWidth*iHeight*bpp/8];
-	memcpy(*bmpBytes, bDataPointer, iWidth*iHeight*bpp/8);
-	
-	/*
-	GLenum format;
-	FreeImage_GetBPP(dib);
-	if(FreeImage_GetBPP(dib) == 32)format = GL_RGBA;
-	if(FreeImage_GetBPP(dib) == 24)format = GL_BGR;
-	if(FreeImage_GetBPP(dib) == 8)format = GL_LUMINANCE;
-	*/
-	
-	FreeImage_Unload(dib);
-	return true; // Success
+	}
+	const CubemapCacheHeader* pHeader = (const CubemapCacheHeader*)m_cacheFile.GetData();
+	size_t size = sizeof(CubemapCacheHeader);
+	bool bValid = pHeader->magic == CUBEMAP_CACHE_MAGIC && pHeader->version == CUBEMAP_CACHE_VERSION &&
+		pHeader->facesHash == m_facesHash && pHeader->width > 0 && pHeader->height > 0 &&
+		pHeader->levels == GetLevelCount(pHeader->width, pHeader->height);
+	for (int i = 0; bValid && i < pHeader->levels; i++)
+		size += GetFaceSize(max(pHeader->width >> i, 1), max(pHeader->height >> i, 1)) * 6;
+	if (!bValid || m_cacheFile.GetSize() < size) {
+		m_cacheFile.Close();
+		return false;
+	}
+
+	m_decodeTime = pHeader->decodeTime;
+	m_bLoadedFromCache = true;
+	m_cachePath.clear();
+	return true;
+}
+
+// Uploads the mip chain OpenCache mapped, and closes it
+void CCubemap::UploadCache()
+{
+	const CubemapCacheHeader* pHeader = (const CubemapCacheHeader*)m_cacheFile.GetData();
+	glGenTextures(1, &m_uiTexture);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiTexture);
+	glTexStorage2D(GL_TEXTURE_CUBE_MAP, pHeader->levels, GL_RGB8, pHeader->width, pHeader->height);
+	const BYTE* pLevel = m_cacheFile.GetData() + sizeof(CubemapCacheHeader);
+	for (int i = 0; i < pHeader->levels; i++) {
+		int iWidth = max(pHeader->width >> i, 1), iHeight = max(pHeader->height >> i, 1);
+		UploadLevel(m_uiTexture, i, iWidth, iHeight, pLevel);
+		pLevel += GetFaceSize(iWidth, iHeight) * 6;
+	}
+	m_cacheFile.Close();
+}
+
+// Reads every level back from the GPU, which stalls, but only on the load that has no cache to read.  A failure to
+// write only costs the next start its speed up.
+void CCubemap::SaveCache(const string& path, unsigned long long facesHash, int iWidth, int iHeight)
+{
+	CubemapCacheHeader header;
+	header.magic = CUBEMAP_CACHE_MAGIC;
+	header.version = CUBEMAP_CACHE_VERSION;
+	header.facesHash = facesHash;
+	header.width = iWidth;
+	header.height = iHeight;
+	header.levels = GetLevelCount(iWidth, iHeight);
+	header.decodeTime = (float)m_decodeTime;
+
+	CreateDirectoryA(CACHE_DIRECTORY, NULL);
+	FILE* pFile = NULL;
+	if (fopen_s(&pFile, path.c_str(), "wb") != 0 || pFile == NULL)
+		return;
+	fwrite(&header, sizeof(header), 1, pFile);
+	vector<BYTE> face(GetFaceSize(iWidth, iHeight));
+	for (int i = 0; i < header.levels; i++) {
+		int iLevelWidth = max(iWidth >> i, 1), iLevelHeight = max(iHeight >> i, 1);
+		for (int j = 0; j < 6; j++) {
+			glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + j, i, GL_BGR, GL_UNSIGNED_BYTE, &face[0]);
+			fwrite(&face[0], 1, GetFaceSize(iLevelWidth, iLevelHeight), pFile);
+		}
+	}
+	fclose(pFile);
 }
 
 // Binds a texture for rendering
@@ -66,39 +228,107 @@ void CCubemap::Bind(int iTextureUnit)
 }
 
 
-// Create the plane, including its geometry, texture mapping, normal, and colour
-void CCubemap::Create(string sPositiveX, string sNegativeX, string sPositiveY, string sNegativeY, string sPositiveZ, string sNegativeZ)
+// Without a loader, this is Prepare and Upload one after the other.  With one, the faces only come from the mip cache
+// here; otherwise the loader decodes them, or uses their converted files, in the background.
+void CCubemap::Create(string sPositiveX, string sNegativeX, string sPositiveY, string sNegativeY, string sPositiveZ, string sNegativeZ,
+	CTextureLoader* pLoader, CThreadPool* pThreadPool, bool bMipCache)
 {
-	int iWidth, iHeight;
+	if (pLoader == NULL) {
+		Prepare(sPositiveX, sNegativeX, sPositiveY, sNegativeY, sPositiveZ, sNegativeZ, pThreadPool, bMipCache);
+		Upload();
+		return;
+	}
 
-	// Generate an OpenGL texture ID for this texture
-	glGenTextures(1, &m_uiTexture);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiTexture);
+	m_timer.Start();
+	m_bLoadedFromCache = false;
+	m_decodeTime = 0.0;
+	m_cachePath.clear();
+	string sFaces[6] = { sPositiveX, sNegativeX, sPositiveY, sNegativeY, sPositiveZ, sNegativeZ };
+	if (OpenCache(sFaces, bMipCache)) {
+		UploadCache();
+		CreateSampler();
+		m_loadTime = m_timer.Elapsed();
+		return;
+	}
+	CreateAsync(sFaces, pLoader);
+}
+
+void CCubemap::Prepare(string sPositiveX, string sNegativeX, string sPositiveY, string sNegativeY, string sPositiveZ, string sNegativeZ,
+	CThreadPool* pThreadPool, bool bMipCache)
+{
+	m_timer.Start();
+	m_bLoadedFromCache = false;
+	m_decodeTime = 0.0;
+	m_cachePath.clear();
+	m_prepared = PREPARED_NONE;
+	string sFaces[6] = { sPositiveX, sNegativeX, sPositiveY, sNegativeY, sPositiveZ, sNegativeZ };
+
+	// Converted faces are only used if all six have been converted, as a cube map's faces must match
+	bool bCompressed = true;
+	for (int i = 0; i < 6 && bCompressed; i++)
+		bCompressed = m_compressedFaces[i].LoadConverted(sFaces[i]);
+	if (bCompressed)
+		m_prepared = PREPARED_CONVERTED;
+	else if (OpenCache(sFaces, bMipCache))
+		m_prepared = PREPARED_CACHE;
+	else if (DecodeFaces(sFaces, pThreadPool, m_staging, m_iWidth, m_iHeight))
+		m_prepared = PREPARED_FACES;
+	m_prepareTime = m_timer.Elapsed();
+}
+
+// Falls back to a grey placeholder if Prepare found nothing it could use
+void CCubemap::Upload()
+{
+	m_timer.Start();
+	switch (m_prepared) {
+	case PREPARED_CONVERTED:
+		glGenTextures(1, &m_uiTexture);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiTexture);
+		for (int i = 0; i < 6; i++) {
+			CTexture::UploadCompressed(m_compressedFaces[i], GL_TEXTURE_CUBE_MAP, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, m_compressedFaces[i].GetData());
+			m_compressedFaces[i] = CCompressedImage();
+		}
+		break;
+	case PREPARED_CACHE:
+		UploadCache();
+		break;
+	case PREPARED_FACES:
+		glGenTextures(1, &m_uiTexture);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiTexture);
+		glTexStorage2D(GL_TEXTURE_CUBE_MAP, GetLevelCount(m_iWidth, m_iHeight), GL_RGB8, m_iWidth, m_iHeight);
+		UploadLevel(m_uiTexture, 0, m_iWidth, m_iHeight, &m_staging[0]);
+		glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+		vector<BYTE>().swap(m_staging);
+		m_decodeTime = m_prepareTime + m_timer.Elapsed();
+		if (!m_cachePath.empty())
+			SaveCache(m_cachePath, m_facesHash, m_iWidth, m_iHeight);
+		break;
+	default:
+		CreatePlaceholder();
+		break;
+	}
+	CreateSampler();
+	m_prepared = PREPARED_NONE;
+	m_loadTime = m_prepareTime + m_timer.Elapsed();
+}
+
+bool CCubemap::WasLoadedFromCache()
+{
+	return m_bLoadedFromCache;
+}
 
-	// Load the six sides
-	BYTE *pbImagePosX, *pbImageNegX, *pbImagePosY, *pbImageNegY, *pbImagePosZ, *pbImageNegZ;
-
-	LoadTexture(sPositiveX, &pbImagePosX, iWidth, iHeight);
-	LoadTexture(sNegativeX, &pbImageNegX, iWidth, iHeight);
-	LoadTexture(sPositiveY, &pbImagePosY, iWidth, iHeight);
-	LoadTexture(sNegativeY, &pbImageNegY, iWidth, iHeight);
-	LoadTexture(sPositiveZ, &pbImagePosZ, iWidth, iHeight);
-	LoadTexture(sNegativeZ, &pbImageNegZ, iWidth, iHeight);
-
-	glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_RGB, iWidth, iHeight, 0, GL_BGR, GL_UNSIGNED_BYTE, pbImagePosX);
-	glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_X, 0, GL_RGB, iWidth, iHeight, 0, GL_BGR, GL_UNSIGNED_BYTE, pbImageNegX);
-	glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Y, 0, GL_RGB, iWidth, iHeight, 0, GL_BGR, GL_UNSIGNED_BYTE, pbImagePosY);
-	glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y, 0, GL_RGB, iWidth, iHeight, 0, GL_BGR, GL_UNSIGNED_BYTE, pbImageNegY);
-	glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_Z, 0, GL_RGB, iWidth, iHeight, 0, GL_BGR, GL_UNSIGNED_BYTE, pbImagePosZ);
-	glTexImage2D(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z, 0, GL_RGB, iWidth, iHeight, 0, GL_BGR, GL_UNSIGNED_BYTE, pbImageNegZ);
-
-	delete[] pbImagePosX;
-	delete[] pbImageNegX;
-	delete[] pbImagePosY;
-	delete[] pbImageNegY;
-	delete[] pbImagePosZ;
-	delete[] pbImageNegZ;
+double CCubemap::GetLoadTime()
+{
+	return m_loadTime;
+}
+
+double CCubemap::GetDecodeTime()
+{
+	return m_decodeTime;
+}
 
+void CCubemap::CreateSampler()
+{
 	glGenSamplers(1, &m_uiSampler);
 	glSamplerParameteri(m_uiSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glSamplerParameteri(m_uiSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
@@ -106,16 +336,74 @@ void CCubemap::Create(string sPositiveX, string sNegativeX, string sPositiveY, s
 	glSamplerParameteri(m_uiSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glSamplerParameteri(m_uiSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glSamplerParameteri(m_uiSampler, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+}
 
+// A 1x1 grey cube, complete as it stands, so it can be sampled with the mipmapped sampler
+void CCubemap::CreatePlaceholder()
+{
+	BYTE grey[3] = { 128, 128, 128 };
+	glGenTextures(1, &m_uiTexture);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, m_uiTexture);
+	for (int i = 0; i < 6; i++)
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, 1, 1, 0, GL_BGR, GL_UNSIGNED_BYTE, grey);
 	glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+}
 
+void CCubemap::CreateAsync(string sFaces[6], CTextureLoader* pLoader)
+{
+	CreatePlaceholder();
+	CreateSampler();
+
+	// A cube map with only some faces at full size is incomplete, so the faces collect in a texture of their own
+	m_pLoader = pLoader;
+	m_iFacesArrived = 0;
+	m_iFacesCompressed = 0;
+	m_bFaceFailed = false;
+	glGenTextures(1, &m_uiLoadingTexture);
+	for (int i = 0; i < 6; i++)
+		m_loadRequests[i] = pLoader->Load(sFaces[i], m_uiLoadingTexture, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
+			[this, i](const CTextureLoader::Result& result) { OnFaceLoaded(i, result); });
 }
 
+void CCubemap::OnFaceLoaded(int iFace, const CTextureLoader::Result& result)
+{
+	m_loadRequests[iFace] = -1;
+	m_bFaceFailed = m_bFaceFailed || !result.bLoaded;
+	if (result.bCompressed)
+		m_iFacesCompressed++;
+	if (++m_iFacesArrived < 6)
+		return;
 
+	// Keep the placeholder if any face is missing, or if only some were converted, as the faces would not match
+	if (m_bFaceFailed || (m_iFacesCompressed > 0 && m_iFacesCompressed < 6)) {
+		glDeleteTextures(1, &m_uiLoadingTexture);
+	} else {
+		if (m_iFacesCompressed == 0) {
+			glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+			m_decodeTime = m_timer.Elapsed();
+			if (!m_cachePath.empty())
+				SaveCache(m_cachePath, m_facesHash, result.iWidth, result.iHeight);
+		}
+		glDeleteTextures(1, &m_uiTexture);
+		m_uiTexture = m_uiLoadingTexture;
+	}
+	m_uiLoadingTexture = 0;
+	m_loadTime = m_timer.Elapsed();
+}
 
 // Release resources
 void CCubemap::Release()
 {
+	for (int i = 0; i < 6; i++) {
+		if (m_loadRequests[i] >= 0) {
+			m_pLoader->Cancel(m_loadRequests[i]);
+			m_loadRequests[i] = -1;
+		}
+	}
+	if (m_uiLoadingTexture != 0) {
+		glDeleteTextures(1, &m_uiLoadingTexture);
+		m_uiLoadingTexture = 0;
+	}
 	glDeleteSamplers(1, &m_uiSampler);
 	glDeleteTextures(1, &m_uiTexture);
 }
\ No newline at end of file
@@ -2,16 +2,41 @@
 
 #include "Texture.h"
 #include "vertexBufferObject.h"
+#include "TextureLoader.h"
+#include "CompressedImage.h"
+#include "MappedFile.h"
 #include "./include/glm/gtc/type_ptr.hpp"
 
+class CThreadPool;
+
 class CCubemap
 {
 public:
-	void Create(string sPositiveX, string sNegativeX, string sPositiveY, string sNegativeY, string sPositiveZ, string sNegativeZ);
+	CCubemap();
+	~CCubemap();
+
+	// Converted .ktx2 or .dds files beside all six faces are used in their place.  Otherwise the faces are decoded at
+	// once on the pool's workers, into one block, and uploaded together.  With a loader, they are decoded in the
+	// background instead, and a grey placeholder is bound until all six have arrived.
+	//
+	// With bMipCache, the mip chain built from the faces is kept in CACHE_DIRECTORY, and later loads of the same
+	// faces upload it from there without decoding anything.
+	void Create(string sPositiveX, string sNegativeX, string sPositiveY, string sNegativeY, string sPositiveZ, string sNegativeZ,
+		CTextureLoader* pLoader = NULL, CThreadPool* pThreadPool = NULL, bool bMipCache = true);
+
+	// Create without a loader, in two halves.  Prepare reads the converted faces or the mip cache, or decodes the faces,
+	// without touching OpenGL, so it can run on a worker thread.  Upload then creates the texture on the GL thread.
+	void Prepare(string sPositiveX, string sNegativeX, string sPositiveY, string sNegativeY, string sPositiveZ, string sNegativeZ,
+		CThreadPool* pThreadPool = NULL, bool bMipCache = true);
+	void Upload();
 	void Release();
-	bool LoadTexture(string filename, BYTE **bmpBytes, int &iWidth, int &iHeight);
 	void Bind(int iTextureUnit = 0);
 
+	bool WasLoadedFromCache();
+	double GetLoadTime();						// Of Create, or Prepare and Upload, in ms
+	double GetDecodeTime();						// What decoding the faces and building the mips took, even from the cache
+
+	static const char* CACHE_DIRECTORY;
 
 private:
 	UINT m_uiVAO;
@@ -19,4 +44,43 @@ private:
 	GLuint m_uiTexture;
 	GLuint m_uiSampler; // Sampler name
 
-};
\ No newline at end of file
+	void CreateSampler();
+	void CreatePlaceholder();
+
+	// Decodes every face into staging, one after another in the block, each with rows from the bottom padded to four
+	// bytes.  Returns false, after saying which, if a face cannot be loaded or does not match the first.
+	static bool DecodeFaces(string sFaces[6], CThreadPool* pThreadPool, vector<BYTE>& staging, int& iWidth, int& iHeight);
+	static size_t GetFaceSize(int iWidth, int iHeight);
+	static int GetLevelCount(int iWidth, int iHeight);
+	void UploadLevel(UINT uiTexture, int iLevel, int iWidth, int iHeight, const BYTE* pFaces);
+
+	static unsigned long long HashFaces(string sFaces[6]);	// 0 if a face cannot be read
+	bool OpenCache(string sFaces[6], bool bMipCache);
+	void UploadCache();
+	void SaveCache(const string& path, unsigned long long facesHash, int iWidth, int iHeight);	// Of the bound cube map
+	string m_cachePath;							// Where the mips are saved once built, or empty
+	CMappedFile m_cacheFile;					// Open from OpenCache until UploadCache
+	unsigned long long m_facesHash;
+	bool m_bLoadedFromCache;
+	double m_loadTime, m_decodeTime;
+	CHighResolutionTimer m_timer;
+
+	// What Prepare leaves for Upload
+	enum PreparedSource { PREPARED_NONE, PREPARED_CONVERTED, PREPARED_CACHE, PREPARED_FACES };
+	PreparedSource m_prepared;
+	CCompressedImage m_compressedFaces[6];
+	vector<BYTE> m_staging;
+	int m_iWidth, m_iHeight;
+	double m_prepareTime;
+
+	// Faces are uploaded into a second texture, which replaces the placeholder once it is complete
+	void CreateAsync(string sFaces[6], CTextureLoader* pLoader);
+	void OnFaceLoaded(int iFace, const CTextureLoader::Result& result);
+	CTextureLoader* m_pLoader;
+	GLuint m_uiLoadingTexture;
+	int m_loadRequests[6];
+	int m_iFacesArrived;
+	int m_iFacesCompressed;						// Converted faces bring their own mips; the others need generating
+	bool m_bFaceFailed;
+
+};
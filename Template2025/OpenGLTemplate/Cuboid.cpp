@@ -2,7 +2,9 @@
 #include "Cuboid.h"
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
-CCuboid::CCuboid()
+CCuboid::CCuboid() :
+    m_vao(0),
+    m_instanceBuffer(0)
 {
 }
 
@@ -129,9 +131,11 @@ void CCuboid::Create(float width, float height, float depth)
     };
 
     // Add data to VBO
+    m_vertices.clear();
     for (int i = 0; i < 36; i++) {
         m_vbo.AddData(&vertices[i], sizeof(glm::vec3));
         m_vbo.AddData(&normals[i], sizeof(glm::vec3));
+        m_vertices.push_back(MeshVertex(vertices[i], glm::vec2(0.0f), normals[i]));
     }
 
     m_vbo.UploadDataToGPU(GL_STATIC_DRAW);
@@ -154,6 +158,33 @@ void CCuboid::Render()
     glDrawArrays(GL_TRIANGLES, 0, 36);
 }
 
+void CCuboid::RenderInstanced(CInstanceBuffer& instances)
+{
+    if (instances.GetCount() == 0)
+        return;
+
+    glBindVertexArray(m_vao);
+    instances.AttachToVertexArray(m_instanceBuffer);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 36, instances.GetCount());
+}
+
+// The cuboid is not indexed, so each vertex gets its own index
+int CCuboid::AddToArena(CMeshArena& arena)
+{
+    vector<unsigned int> indices(m_vertices.size());
+    for (unsigned int i = 0; i < indices.size(); i++)
+        indices[i] = i;
+    return arena.AddMesh(m_vertices, indices);
+}
+
+BoundingBox CCuboid::GetBounds()
+{
+    BoundingBox bounds;
+    for (unsigned int i = 0; i < m_vertices.size(); i++)
+        bounds.Extend(m_vertices[i].position);
+    return bounds;
+}
+
 void CCuboid::Release()
 {
     glDeleteVertexArrays(1, &m_vao);
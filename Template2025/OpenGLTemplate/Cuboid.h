@@ -1,6 +1,9 @@
 #pragma once
 
 #include "VertexBufferObject.h"
+#include "InstanceBuffer.h"
+#include "MeshArena.h"
+#include "BoundingBox.h"
 
 // Class for generating a cuboid
 class CCuboid
@@ -10,10 +13,15 @@ public:
     ~CCuboid();
     void Create(float width, float height, float depth);
     void Render();
+    void RenderInstanced(CInstanceBuffer& instances);   // Draws one cuboid per instance
+    int AddToArena(CMeshArena& arena);                  // Copies the cuboid into a shared mesh arena and returns its mesh id
+    BoundingBox GetBounds();                           // Bounding box in object coordinates
     void Release();
 private:
     UINT m_vao;
+    UINT m_instanceBuffer;  // Instance buffer the VAO's instance attributes point at
     CVertexBufferObject m_vbo;
+    vector<MeshVertex> m_vertices;  // CPU copy of the geometry, kept for AddToArena
     float m_width;
     float m_height;
     float m_depth;
@@ -1,165 +1,755 @@
 #include "FreeTypeFont.h"
+#include "StreamingBuffer.h"
+#include "TextObject.h"
+#include "ThreadPool.h"
+#include "MappedFile.h"
+#include "HighResolutionTimer.h"
+#include <algorithm>
 #include <minmax.h>
 
 #pragma comment(lib, "lib/freetype.lib")
 
+const char* CFreeTypeFont::CACHE_DIRECTORY = "resources\\cache\\";
+
+// Layout of a prebaked atlas file.  After the header come the glyph records, the kerning pairs, and then for each page
+// its skyline node count, used area, skyline nodes and image.  Bump FONT_CACHE_VERSION when any of it changes.
+static const unsigned int FONT_CACHE_MAGIC = 0x43544E46;	// "FNTC"
+static const unsigned int FONT_CACHE_VERSION = 1;
+
+struct FontCacheHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned long long fontHash;				// FNV-1a of the font file
+	int pixelSize;
+	int distanceField;
+	int pageSize;
+	int pageCount;
+	int glyphCount;
+	int kerningCount;
+	int newLine;
+	float bakeTime;								// Milliseconds FreeType took, to report what the cache saves
+};
+
+struct FontCacheGlyph
+{
+	unsigned int codePoint;
+	short advX, bearingX, advY;
+	short width, height;
+	short page, x, y;							// page is -1 for glyphs with no bitmap
+};
+
+struct FontCacheKerning
+{
+	unsigned int left, right;
+	int amount;
+};
+
 CFreeTypeFont::CFreeTypeFont()
 {
 	m_isLoaded = false;
+	m_colour = glm::vec4(1.0f);
+	m_vao = 0;
+	m_vertexBuffer = 0;
+	m_retainedBuffer = 0;
+	m_retainedCapacity = 0;
+	m_iDirtyFirst = INT_MAX;
+	m_iDirtyEnd = 0;
+	m_iRetainedBytesUploaded = 0;
+	m_pStream = NULL;
+	m_shaderProgram = NULL;
+	m_isDistanceField = false;
+	m_padding = 0;
+	m_outlineWidth = 0.0f;
+	m_outlineColour = glm::vec4(0.0f);
+	m_shadowOffset = glm::vec2(0.0f);
+	m_shadowColour = glm::vec4(0.0f);
+	m_atlasBudget = DEFAULT_ATLAS_BUDGET;
+	m_frame = 1;
+	m_cacheHits = m_cacheMisses = 0;
+	m_glyphArrivals = 0;
+	m_pThreadPool = NULL;
+	m_pendingJobs = 0;
+	m_ftLib = NULL;
+	m_ftFace = NULL;
+	m_ftFaceFailed = false;
+	m_loadedFromCache = false;
+	m_loadTime = m_bakeTime = 0.0;
 }
 CFreeTypeFont::~CFreeTypeFont()
-{}
+{
+	// Workers may still be rasterising with the face
+	WaitForWorkers();
+	if (m_ftFace != NULL)
+		FT_Done_Face(m_ftFace);
+	if (m_ftLib != NULL)
+		FT_Done_FreeType(m_ftLib);
+}
+
+// One dimensional squared distance transform (Felzenszwalb and Huttenlocher): d[q] = min over p of (q - p)^2 + f[p].
+// v and z are scratch space for the lower envelope of the parabolas, of n and n + 1 elements.
+static void DistanceTransform1D(const float* f, float* d, int n, int* v, float* z)
+{
+	int k = 0;
+	v[0] = 0;
+	z[0] = -FLT_MAX;
+	z[1] = FLT_MAX;
+	for (int q = 1; q < n; q++) {
+		// Drop parabolas hidden by the new one.  z[0] is -FLT_MAX, so the first is never dropped by this test.
+		float s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2.0f * (q - v[k]));
+		while (s <= z[k]) {
+			k--;
+			s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2.0f * (q - v[k]));
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k + 1] = FLT_MAX;
+	}
+	k = 0;
+	for (int q = 0; q < n; q++) {
+		while (z[k + 1] < q)
+			k++;
+		int p = v[k];
+		d[q] = (q - p) * (q - p) + f[p];
+	}
+}
+
+// Squared distance from every pixel to the nearest zero pixel, by columns and then rows.  Every other pixel must hold
+// a value larger than any squared distance in the grid.
+static void DistanceTransform2D(vector<float>& grid, int w, int h)
+{
+	int n = max(w, h);
+	vector<float> f(n), d(n), z(n + 1);
+	vector<int> v(n);
+	for (int x = 0; x < w; x++) {
+		for (int y = 0; y < h; y++)
+			f[y] = grid[y*w + x];
+		DistanceTransform1D(&f[0], &d[0], h, &v[0], &z[0]);
+		for (int y = 0; y < h; y++)
+			grid[y*w + x] = d[y];
+	}
+	for (int y = 0; y < h; y++) {
+		DistanceTransform1D(&grid[y*w], &d[0], w, &v[0], &z[0]);
+		memcpy(&grid[y*w], &d[0], w * sizeof(float));
+	}
+}
+
+// Replaces a coverage bitmap with a signed distance field iSpread pixels wider on every side.  128 is the outline,
+// larger values are inside, and the field reaches 0 and 255 iSpread pixels out and in.
+static void MakeDistanceField(vector<BYTE>& bitmap, int& iW, int& iH, int iSpread)
+{
+	int w = iW + 2 * iSpread, h = iH + 2 * iSpread;
+	// Large enough to stand for "no seed", small enough that float sums of it stay exact
+	const float fFar = 2.0f * (w * w + h * h);
+	vector<float> outside(w * h), inside(w * h);
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			int bx = x - iSpread, by = y - iSpread;
+			bool bInside = bx >= 0 && bx < iW && by >= 0 && by < iH && bitmap[by*iW + bx] >= 128;
+			outside[y*w + x] = bInside ? 0.0f : fFar;
+			inside[y*w + x] = bInside ? fFar : 0.0f;
+		}
+	}
+	DistanceTransform2D(outside, w, h);
+	DistanceTransform2D(inside, w, h);
+
+	bitmap.resize(w * h);
+	for (int i = 0; i < w * h; i++) {
+		// Distances are between pixel centres, and the outline runs half a pixel from the centres either side of it
+		float fDistance = outside[i] > 0.0f ? sqrtf(outside[i]) - 0.5f : 0.5f - sqrtf(inside[i]);
+		float fValue = 0.5f - fDistance / (2.0f * iSpread);
+		bitmap[i] = (BYTE)(min(max(fValue, 0.0f), 1.0f) * 255.0f + 0.5f);
+	}
+	iW = w;
+	iH = h;
+}
+
 
 /*-----------------------------------------------
 
 Name:	createChar
 
-Params:	iIndex - character index in Unicode.
+Params:	codePoint - character index in Unicode.
+		glyph - receives the glyph's coverage
+		and metrics.
 
-Result:	Creates one single character (its
-		texture).
+Result:	Rasterises one single character.  Must
+		be called with m_ftMutex held.
 
 /*---------------------------------------------*/
 
-inline int next_p2(int n){int res = 1; while(res < n)res <<= 1; return res;}
-
-void CFreeTypeFont::CreateChar(int index)
+void CFreeTypeFont::CreateChar(unsigned int codePoint, Glyph& glyph)
 {
-	FT_Load_Glyph(m_ftFace, FT_Get_Char_Index(m_ftFace, index), FT_LOAD_DEFAULT);
+	FT_Load_Glyph(m_ftFace, FT_Get_Char_Index(m_ftFace, codePoint), FT_LOAD_DEFAULT);
 
 	FT_Render_Glyph(m_ftFace->glyph, FT_RENDER_MODE_NORMAL);
 	FT_Bitmap* pBitmap = &m_ftFace->glyph->bitmap;
 
 	int iW = pBitmap->width, iH = pBitmap->rows;
-	int iTW = next_p2(iW), iTH = next_p2(iH);
-
-	GLubyte* bData = new GLubyte[iTW*iTH];
-	// Copy glyph data and add dark pixels elsewhere
-	for (int ch = 0; ch < iTH; ch++) 
-		for (int cw = 0; cw < iTW; cw++)
-			bData[ch*iTW+cw] = (ch >= iH || cw >= iW) ? 0 : pBitmap->buffer[(iH-ch-1)*iW+cw];
- 
-	// And create a texture from it
-
-	m_charTextures[index].CreateFromData(bData, iTW, iTH, 8, GL_DEPTH_COMPONENT, false);
-	m_charTextures[index].SetSamplerObjectParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	m_charTextures[index].SetSamplerObjectParameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	m_charTextures[index].SetSamplerObjectParameter(GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	m_charTextures[index].SetSamplerObjectParameter(GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	// FreeType rows can be padded, the atlas wants them tightly packed
+	glyph.bitmap.resize(iW*iH);
+	for (int ch = 0; ch < iH; ch++)
+		memcpy(&glyph.bitmap[ch*iW], pBitmap->buffer + ch*pBitmap->pitch, iW);
+	glyph.width = iW;
+	glyph.height = iH;
 
 	// Calculate glyph data
-	m_advX[index] = m_ftFace->glyph->advance.x>>6;
-	m_bearingX[index] = m_ftFace->glyph->metrics.horiBearingX>>6;
-	m_charWidth[index] = m_ftFace->glyph->metrics.width>>6;
+	glyph.advX = m_ftFace->glyph->advance.x>>6;
+	glyph.bearingX = m_ftFace->glyph->metrics.horiBearingX>>6;
+	glyph.advY = (m_ftFace->glyph->metrics.height - m_ftFace->glyph->metrics.horiBearingY)>>6;
+	glyph.bReady = true;
+	glyph.page = -1;
+	glyph.texRect = glm::vec4(0.0f);
+}
 
-	m_advY[index] = (m_ftFace->glyph->metrics.height - m_ftFace->glyph->metrics.horiBearingY)>>6;
-	m_bearingY[index] = m_ftFace->glyph->metrics.horiBearingY>>6;
-	m_charHeight[index] = m_ftFace->glyph->metrics.height>>6;
+// Packs a glyph's bitmap into the atlas, evicting the least recently used page if every page is full.  Rows go in top
+// first, so the top of the quad takes the smaller v.  Returns false if there was no room even so; the glyph is then
+// skipped this frame and tried again the next.
+bool CFreeTypeFont::PackChar(Glyph& glyph)
+{
+	int iPage = 0, iX = 0, iY = 0;
+	if (!m_atlas.AddBitmap(&glyph.bitmap[0], glyph.width, glyph.height, iPage, iX, iY)) {
+		int iEvicted = m_atlas.EvictLeastRecentlyUsed(m_frame);
+		if (iEvicted < 0)
+			return false;
+
+		// Every glyph on the evicted page has to be packed again when it is next used
+		for (auto it = m_glyphs.begin(); it != m_glyphs.end(); ++it)
+			if (it->second.page == iEvicted)
+				it->second.page = -1;
+		if (!m_atlas.AddBitmap(&glyph.bitmap[0], glyph.width, glyph.height, iPage, iX, iY))
+			return false;
+	}
+	float fPageSize = float(m_atlas.GetPageSize());
+	glyph.page = iPage;
+	glyph.texRect = glm::vec4(iX, iY, iX + glyph.width, iY + glyph.height) / fPageSize;
+	return true;
+}
 
-	m_newLine = max(m_newLine, int(m_ftFace->glyph->metrics.height >> 6));
+// Returns a glyph that is ready to draw, or NULL.  Glyphs with no bitmap (spaces) are returned without being packed.
+CFreeTypeFont::Glyph* CFreeTypeFont::FindGlyph(unsigned int codePoint)
+{
+	auto it = m_glyphs.find(codePoint);
+	if (it == m_glyphs.end()) {
+		m_cacheMisses++;
+		RequestGlyph(codePoint);
+		return NULL;
+	}
 
-	// Rendering data, texture coordinates are always the same, so now we waste a little memory
-	glm::vec2 vQuad[] =
-	{
-		glm::vec2(0.0f, float(-m_advY[index]+iTH)),
-		glm::vec2(0.0f, float(-m_advY[index])),
-		glm::vec2(float(iTW), float(-m_advY[index]+iTH)),
-		glm::vec2(float(iTW), float(-m_advY[index]))
+	Glyph& glyph = it->second;
+	if (!glyph.bReady) {
+		m_cacheMisses++;
+		return NULL;
+	}
+	if (glyph.width > 0 && glyph.height > 0) {
+		if (glyph.page < 0) {
+			m_cacheMisses++;
+			if (!PackChar(glyph))
+				return NULL;
+		} else
+			m_cacheHits++;
+		m_atlas.TouchPage(glyph.page, m_frame);
+	} else
+		m_cacheHits++;
+	return &glyph;
+}
+
+// Adds a placeholder for the glyph and rasterises it on a worker, or straight away without a thread pool.  Glyphs
+// outside the cache get no kerning.
+void CFreeTypeFont::RequestGlyph(unsigned int codePoint)
+{
+	Glyph& placeholder = m_glyphs[codePoint];
+	placeholder.bReady = false;
+	placeholder.page = -1;
+	placeholder.width = placeholder.height = 0;
+
+	// After a cache hit, FreeType is first loaded here.  If it cannot be, the glyph is left blank.
+	if (!OpenFace()) {
+		placeholder.advX = placeholder.bearingX = placeholder.advY = 0;
+		placeholder.bReady = true;
+		return;
+	}
+
+	auto rasterise = [this, codePoint]() {
+		Glyph glyph;
+		{
+			lock_guard<mutex> lock(m_ftMutex);
+			CreateChar(codePoint, glyph);
+		}
+		if (m_isDistanceField && glyph.width > 0 && glyph.height > 0)
+			MakeDistanceField(glyph.bitmap, glyph.width, glyph.height, DISTANCE_FIELD_SPREAD);
+
+		lock_guard<mutex> lock(m_resultMutex);
+		m_vFinished.push_back(make_pair(codePoint, glyph));
+		m_pendingJobs--;
+		m_workersDone.notify_all();
 	};
-	glm::vec2 vTexQuad[] = {glm::vec2(0.0f, 1.0f), glm::vec2(0.0f, 0.0f), glm::vec2(1.0f, 1.0f), glm::vec2(1.0f, 0.0f)};
 
-	// Add this char to VBO
-	for (int i = 0; i < 4; i++) {
-		m_vbo.AddData(&vQuad[i], sizeof(glm::vec2));
-		m_vbo.AddData(&vTexQuad[i], sizeof(glm::vec2));
+	{
+		lock_guard<mutex> lock(m_resultMutex);
+		m_pendingJobs++;
+	}
+	if (m_pThreadPool != NULL)
+		m_pThreadPool->Submit(rasterise);
+	else
+		rasterise();
+}
+
+void CFreeTypeFont::CollectGlyphs()
+{
+	vector<pair<unsigned int, Glyph>> vFinished;
+	{
+		lock_guard<mutex> lock(m_resultMutex);
+		vFinished.swap(m_vFinished);
+	}
+	for (unsigned int i = 0; i < vFinished.size(); i++) {
+		Glyph& glyph = m_glyphs[vFinished[i].first];
+		glyph = vFinished[i].second;
+		m_newLine = max(m_newLine, glyph.height - (m_isDistanceField ? 2 * DISTANCE_FIELD_SPREAD : 0));
+		m_glyphArrivals++;
 	}
-	delete[] bData;
 }
 
+void CFreeTypeFont::WaitForWorkers()
+{
+	unique_lock<mutex> lock(m_resultMutex);
+	m_workersDone.wait(lock, [this]() { return m_pendingJobs == 0; });
+}
 
-// Loads an entire font with the given path sFile and pixel size iPXSize
-bool CFreeTypeFont::LoadFont(string file, int ipixelSize)
+// Decodes one UTF-8 sequence.  Malformed bytes decode to U+FFFD one at a time, so bad text still lays out.
+unsigned int CFreeTypeFont::DecodeUtf8(const string& text, int& i)
 {
-	BOOL bError = FT_Init_FreeType(&m_ftLib);
-	
-	bError = FT_New_Face(m_ftLib, file.c_str(), 0, &m_ftFace);
-	if(bError) {
+	unsigned char c = (unsigned char)text[i++];
+	if (c < 0x80)
+		return c;
+
+	int iFollowing;
+	unsigned int codePoint;
+	if ((c & 0xE0) == 0xC0) { iFollowing = 1; codePoint = c & 0x1F; }
+	else if ((c & 0xF0) == 0xE0) { iFollowing = 2; codePoint = c & 0x0F; }
+	else if ((c & 0xF8) == 0xF0) { iFollowing = 3; codePoint = c & 0x07; }
+	else return 0xFFFD;
+
+	if (i + iFollowing > (int)text.size())
+		return 0xFFFD;
+	for (int j = 0; j < iFollowing; j++) {
+		unsigned char next = (unsigned char)text[i + j];
+		if ((next & 0xC0) != 0x80)
+			return 0xFFFD;
+		codePoint = (codePoint << 6) | (next & 0x3F);
+	}
+	i += iFollowing;
+	return codePoint;
+}
+
+// Loads an entire font with the given path sFile and pixel size iPXSize.  With bDistanceField, the glyphs are baked as
+// signed distance fields, on pThreadPool's workers if one is given.  The ASCII atlas is read from CACHE_DIRECTORY if
+// it was baked before for the same font file, size and mode, and written there if not.
+bool CFreeTypeFont::LoadFont(string file, int ipixelSize, bool bDistanceField, CThreadPool* pThreadPool)
+{
+	CHighResolutionTimer timer;
+	timer.Start();
+
+	// The cache is keyed on the font file's contents, so it goes stale by itself if the font changes
+	CMappedFile fontFile;
+	if (!fontFile.Open(file)) {
 		char message[1024];
 		sprintf_s(message, "Cannot load font\n%s\n", file.c_str());
 		MessageBox(NULL, message, "Error", MB_ICONERROR);
 		return false;
 	}
-	FT_Set_Pixel_Sizes(m_ftFace, ipixelSize, ipixelSize);
+	unsigned long long fontHash = fontFile.GetHash();
+	fontFile.Close();
+
+	m_fontPath = file;
+	m_ftFaceFailed = false;
 	m_loadedPixelSize = ipixelSize;
+	m_newLine = 0;
+	m_isDistanceField = bDistanceField;
+	m_padding = bDistanceField ? DISTANCE_FIELD_SPREAD : 0;
+	m_pThreadPool = pThreadPool;
+	m_atlas.Create(ATLAS_SIZE, m_atlasBudget);
+
+	char cachePath[MAX_PATH];
+	sprintf_s(cachePath, "%s%016llx_%d%s.fontcache", CACHE_DIRECTORY, fontHash, ipixelSize, bDistanceField ? "_sdf" : "");
+	m_loadedFromCache = LoadCache(cachePath, fontHash);
+	if (!m_loadedFromCache) {
+		if (!OpenFace())
+			return false;
+		BakeAscii();
+		m_bakeTime = timer.Elapsed();
+		SaveCache(cachePath, fontHash);
+	}
+
+	m_digitAdvance = 0;
+	for (int i = '0'; i <= '9'; i++)
+		m_digitAdvance = max(m_digitAdvance, m_glyphs[i].advX);
+	m_isLoaded = true;
 
+	// The vertices are re-uploaded every frame, so the buffer is attached at draw time, wherever they went
+	glGenBuffers(1, &m_vertexBuffer);
+	glGenBuffers(1, &m_retainedBuffer);
 	glGenVertexArrays(1, &m_vao);
 	glBindVertexArray(m_vao);
-	m_vbo.Create();
-	m_vbo.Bind();
+	glEnableVertexAttribArray(0);
+	glVertexAttribFormat(0, 2, GL_FLOAT, GL_FALSE, offsetof(TextVertex, position));
+	glVertexAttribBinding(0, 0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribFormat(1, 3, GL_FLOAT, GL_FALSE, offsetof(TextVertex, texCoord));
+	glVertexAttribBinding(1, 0);
+	glEnableVertexAttribArray(2);
+	glVertexAttribFormat(2, 4, GL_FLOAT, GL_FALSE, offsetof(TextVertex, colour));
+	glVertexAttribBinding(2, 0);
+	glBindVertexArray(0);
+
+	m_loadTime = timer.Elapsed();
+	return true;
+}
+
+bool CFreeTypeFont::OpenFace()
+{
+	if (m_ftFace != NULL)
+		return true;
+	if (m_ftFaceFailed)
+		return false;
 
+	// A font that went missing after its cache was made fails once, with one message, and its glyphs stay blank
+	if (m_ftLib == NULL)
+		FT_Init_FreeType(&m_ftLib);
+	BOOL bError = FT_New_Face(m_ftLib, m_fontPath.c_str(), 0, &m_ftFace);
+	if(bError) {
+		char message[1024];
+		sprintf_s(message, "Cannot load font\n%s\n", m_fontPath.c_str());
+		MessageBox(NULL, message, "Error", MB_ICONERROR);
+		m_ftFace = NULL;
+		m_ftFaceFailed = true;
+		return false;
+	}
+	FT_Set_Pixel_Sizes(m_ftFace, m_loadedPixelSize, m_loadedPixelSize);
+	return true;
+}
+
+// Rasterises ASCII and its kerning with FreeType.  FreeType is only called from this thread here, and the distance
+// fields, which are independent per glyph, are shared out between the workers.
+void CFreeTypeFont::BakeAscii()
+{
+	vector<Glyph> ascii(128);
 	for (int i = 0; i < 128; i++)
-		CreateChar(i);
-	m_isLoaded = true;
+		CreateChar(i, ascii[i]);
+	if (m_isDistanceField) {
+		auto bake = [&](int i) {
+			if (ascii[i].width > 0 && ascii[i].height > 0)
+				MakeDistanceField(ascii[i].bitmap, ascii[i].width, ascii[i].height, DISTANCE_FIELD_SPREAD);
+		};
+		if (m_pThreadPool != NULL)
+			m_pThreadPool->ParallelFor(128, bake);
+		else
+			for (int i = 0; i < 128; i++)
+				bake(i);
+	}
 
-	FT_Done_Face(m_ftFace);
-	FT_Done_FreeType(m_ftLib);
-	
-	m_vbo.UploadDataToGPU(GL_STATIC_DRAW);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2)*2, 0);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2)*2, (void*)(sizeof(glm::vec2)));
+	for (int i = 0; i < 128; i++) {
+		Glyph& glyph = m_glyphs[i];
+		glyph = ascii[i];
+		if (glyph.width > 0 && glyph.height > 0)
+			PackChar(glyph);
+		m_newLine = max(m_newLine, glyph.height - 2 * m_padding);
+	}
+
+	m_kerning.clear();
+	if (FT_HAS_KERNING(m_ftFace)) {
+		for (unsigned int left = 32; left < 127; left++) {
+			FT_UInt leftIndex = FT_Get_Char_Index(m_ftFace, left);
+			for (unsigned int right = 32; right < 127; right++) {
+				FT_Vector delta;
+				FT_Get_Kerning(m_ftFace, leftIndex, FT_Get_Char_Index(m_ftFace, right), FT_KERNING_DEFAULT, &delta);
+				if ((delta.x >> 6) != 0)
+					m_kerning[((unsigned long long)left << 32) | right] = delta.x >> 6;
+			}
+		}
+	}
+}
+
+// Reads a prebaked ASCII atlas through a file mapping.  The page images are uploaded straight from the mapping.
+// Returns false, leaving the font untouched, if the file is missing, truncated or for a different font or settings.
+bool CFreeTypeFont::LoadCache(const string& path, unsigned long long fontHash)
+{
+	CMappedFile cacheFile;
+	if (!cacheFile.Open(path))
+		return false;
+
+	const BYTE* pData = cacheFile.GetData();
+	size_t size = cacheFile.GetSize(), offset = 0;
+	auto take = [&](size_t bytes) -> const BYTE* {
+		if (offset + bytes > size)
+			return NULL;
+		const BYTE* p = pData + offset;
+		offset += bytes;
+		return p;
+	};
+
+	const FontCacheHeader* pHeader = (const FontCacheHeader*)take(sizeof(FontCacheHeader));
+	if (pHeader == NULL || pHeader->magic != FONT_CACHE_MAGIC || pHeader->version != FONT_CACHE_VERSION ||
+		pHeader->fontHash != fontHash || pHeader->pixelSize != m_loadedPixelSize ||
+		pHeader->distanceField != (m_isDistanceField ? 1 : 0) || pHeader->pageSize != ATLAS_SIZE ||
+		pHeader->pageCount < 0 || pHeader->pageCount > m_atlas.GetMaxPages() || pHeader->glyphCount < 0 || pHeader->glyphCount > 128 ||
+		pHeader->kerningCount < 0 || pHeader->kerningCount > 128 * 128)
+		return false;
+
+	const FontCacheGlyph* pGlyphs = (const FontCacheGlyph*)take(pHeader->glyphCount * sizeof(FontCacheGlyph));
+	const FontCacheKerning* pKerning = (const FontCacheKerning*)take(pHeader->kerningCount * sizeof(FontCacheKerning));
+	if (pGlyphs == NULL || pKerning == NULL)
+		return false;
+
+	// Check every page is complete before touching the atlas
+	vector<const BYTE*> pages(pHeader->pageCount);
+	vector<vector<CGlyphAtlas::SkylineNode>> skylines(pHeader->pageCount);
+	vector<int> usedAreas(pHeader->pageCount);
+	size_t imageSize = ATLAS_SIZE * ATLAS_SIZE;
+	for (int i = 0; i < pHeader->pageCount; i++) {
+		const int* pCounts = (const int*)take(2 * sizeof(int));
+		if (pCounts == NULL || pCounts[0] <= 0 || pCounts[0] > ATLAS_SIZE)
+			return false;
+		const CGlyphAtlas::SkylineNode* pNodes = (const CGlyphAtlas::SkylineNode*)take(pCounts[0] * sizeof(CGlyphAtlas::SkylineNode));
+		pages[i] = take(imageSize);
+		if (pNodes == NULL || pages[i] == NULL)
+			return false;
+		skylines[i].assign(pNodes, pNodes + pCounts[0]);
+		usedAreas[i] = pCounts[1];
+		if (!m_atlas.IsValidLayout(skylines[i], usedAreas[i]))
+			return false;
+	}
+
+	// Glyphs with no bitmap are on page -1 with no size; the rest lie within their page
+	for (int i = 0; i < pHeader->glyphCount; i++) {
+		const FontCacheGlyph& record = pGlyphs[i];
+		if (record.codePoint >= 128 || record.page < -1 || record.page >= pHeader->pageCount || record.width < 0 || record.height < 0)
+			return false;
+		if (record.page < 0 ? (record.width != 0 || record.height != 0) :
+			(record.x < 0 || record.y < 0 || record.x + record.width > ATLAS_SIZE || record.y + record.height > ATLAS_SIZE))
+			return false;
+	}
+
+	for (int i = 0; i < pHeader->pageCount; i++)
+		m_atlas.RestorePage(i, pages[i], skylines[i], usedAreas[i]);
+
+	// The glyphs keep a copy of their bitmap, cut from the page, for repacking after an eviction
+	for (int i = 0; i < pHeader->glyphCount; i++) {
+		const FontCacheGlyph& record = pGlyphs[i];
+		Glyph& glyph = m_glyphs[record.codePoint];
+		glyph.advX = record.advX;
+		glyph.bearingX = record.bearingX;
+		glyph.advY = record.advY;
+		glyph.width = record.width;
+		glyph.height = record.height;
+		glyph.bReady = true;
+		glyph.page = record.page;
+		glyph.bitmap.resize(record.width * record.height);
+		if (record.page >= 0) {
+			for (int row = 0; row < record.height; row++)
+				memcpy(&glyph.bitmap[row * record.width], pages[record.page] + (record.y + row) * ATLAS_SIZE + record.x, record.width);
+			glyph.texRect = glm::vec4(record.x, record.y, record.x + record.width, record.y + record.height) / float(ATLAS_SIZE);
+		} else
+			glyph.texRect = glm::vec4(0.0f);
+	}
+
+	m_kerning.clear();
+	for (int i = 0; i < pHeader->kerningCount; i++)
+		m_kerning[((unsigned long long)pKerning[i].left << 32) | pKerning[i].right] = pKerning[i].amount;
+	m_newLine = pHeader->newLine;
+	m_bakeTime = pHeader->bakeTime;
 	return true;
 }
 
+// Writes the ASCII glyphs, their kerning and the pages they were packed into.  The page images are rebuilt from the
+// glyph bitmaps rather than read back from the GPU.  A failure to write only costs the next start its speed up.
+void CFreeTypeFont::SaveCache(const string& path, unsigned long long fontHash)
+{
+	CreateDirectoryA(CACHE_DIRECTORY, NULL);
+	FILE* pFile = NULL;
+	if (fopen_s(&pFile, path.c_str(), "wb") != 0 || pFile == NULL)
+		return;
+
+	vector<FontCacheGlyph> records;
+	int iPageCount = 0;
+	for (unsigned int i = 0; i < 128; i++) {
+		const Glyph& glyph = m_glyphs[i];
+		FontCacheGlyph record;
+		record.codePoint = i;
+		record.advX = (short)glyph.advX;
+		record.bearingX = (short)glyph.bearingX;
+		record.advY = (short)glyph.advY;
+		record.width = (short)(glyph.page >= 0 ? glyph.width : 0);
+		record.height = (short)(glyph.page >= 0 ? glyph.height : 0);
+		record.page = (short)glyph.page;
+		record.x = (short)(glyph.texRect.x * ATLAS_SIZE + 0.5f);
+		record.y = (short)(glyph.texRect.y * ATLAS_SIZE + 0.5f);
+		records.push_back(record);
+		iPageCount = max(iPageCount, glyph.page + 1);
+	}
+
+	vector<FontCacheKerning> kerning;
+	for (auto it = m_kerning.begin(); it != m_kerning.end(); ++it) {
+		FontCacheKerning pair = { (unsigned int)(it->first >> 32), (unsigned int)(it->first & 0xFFFFFFFF), it->second };
+		kerning.push_back(pair);
+	}
+
+	FontCacheHeader header;
+	header.magic = FONT_CACHE_MAGIC;
+	header.version = FONT_CACHE_VERSION;
+	header.fontHash = fontHash;
+	header.pixelSize = m_loadedPixelSize;
+	header.distanceField = m_isDistanceField ? 1 : 0;
+	header.pageSize = ATLAS_SIZE;
+	header.pageCount = iPageCount;
+	header.glyphCount = (int)records.size();
+	header.kerningCount = (int)kerning.size();
+	header.newLine = m_newLine;
+	header.bakeTime = (float)m_bakeTime;
+	fwrite(&header, sizeof(header), 1, pFile);
+	fwrite(&records[0], sizeof(FontCacheGlyph), records.size(), pFile);
+	if (!kerning.empty())
+		fwrite(&kerning[0], sizeof(FontCacheKerning), kerning.size(), pFile);
+
+	for (int page = 0; page < iPageCount; page++) {
+		vector<CGlyphAtlas::SkylineNode> nodes;
+		int counts[2];
+		m_atlas.GetPageLayout(page, nodes, counts[1]);
+		counts[0] = (int)nodes.size();
+		fwrite(counts, sizeof(int), 2, pFile);
+		fwrite(&nodes[0], sizeof(CGlyphAtlas::SkylineNode), nodes.size(), pFile);
+
+		vector<BYTE> image(ATLAS_SIZE * ATLAS_SIZE, 0);
+		for (unsigned int i = 0; i < records.size(); i++) {
+			const FontCacheGlyph& record = records[i];
+			if (record.page != page)
+				continue;
+			const Glyph& glyph = m_glyphs[record.codePoint];
+			for (int row = 0; row < record.height; row++)
+				memcpy(&image[(record.y + row) * ATLAS_SIZE + record.x], &glyph.bitmap[row * record.width], record.width);
+		}
+		fwrite(&image[0], 1, image.size(), pFile);
+	}
+	fclose(pFile);
+}
+
+int CFreeTypeFont::GetKerning(unsigned int left, unsigned int right)
+{
+	if (m_kerning.empty())
+		return 0;
+	auto it = m_kerning.find(((unsigned long long)left << 32) | right);
+	return it != m_kerning.end() ? it->second : 0;
+}
+
 // Loads a system font with given name (sName) and pixel size (iPXSize)
-bool CFreeTypeFont::LoadSystemFont(string name, int ipixelSize)
+bool CFreeTypeFont::LoadSystemFont(string name, int ipixelSize, bool bDistanceField, CThreadPool* pThreadPool)
 {
 	char buf[512]; GetWindowsDirectory(buf, 512);
 	string sPath = buf;
 	sPath += "\\Fonts\\";
 	sPath += name;
 
-	return LoadFont(sPath, ipixelSize);
+	return LoadFont(sPath, ipixelSize, bDistanceField, pThreadPool);
 }
 
 
-// Prints text at the specified location (x, y) with the given pixel size (iPXSize)
+// Queues text at the specified location (x, y) with the given pixel size (iPXSize), as two triangles per character
 void CFreeTypeFont::Print(string text, int x, int y, int pixelSize)
 {
 	if(!m_isLoaded)
 		return;
 
-	glBindVertexArray(m_vao);
-	m_shaderProgram->SetUniform("sampler0", 0);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	unsigned int uiPageMask = 0;
+	Layout(text, x, y, pixelSize, m_colour, false, false, m_vVertices, uiPageMask);
+}
+
+// Appends six vertices per character of text.  With bKeepEmpty, characters with nothing to draw get a degenerate quad
+// rather than none, so character i is always at vertex i*6.  With bFixedDigits, every digit advances by the width of
+// the widest, so changing a number does not move the characters after it.  Characters still being rasterised are
+// left out, with no advance.
+bool CFreeTypeFont::Layout(const string& text, int x, int y, int pixelSize, const glm::vec4& colour, bool bKeepEmpty,
+	bool bFixedDigits, vector<TextVertex>& vertices, unsigned int& uiPageMask)
+{
 	int iCurX = x, iCurY = y;
 	if (pixelSize == -1)
 		pixelSize = m_loadedPixelSize;
 	float fScale = float(pixelSize) / float(m_loadedPixelSize);
-	for (int i = 0; i < (int) text.size(); i++) {
-		if (text[i] == '\n')
+	bool bComplete = true;
+	unsigned int previous = 0;
+	uiPageMask = 0;
+	vertices.reserve(vertices.size() + text.size() * 6);
+	for (int i = 0; i < (int) text.size(); ) {
+		unsigned int codePoint = DecodeUtf8(text, i);
+		if (codePoint == '\n')
 		{
 			iCurX = x;
 			iCurY -= m_newLine*pixelSize / m_loadedPixelSize;
+			previous = 0;
+			if (bKeepEmpty)
+				vertices.resize(vertices.size() + 6, EmptyVertex());
 			continue;
 		}
-		int iIndex = int(text[i]);
-		iCurX += m_bearingX[iIndex] * pixelSize / m_loadedPixelSize;
-		if(text[i] != ' ')
+
+		Glyph* pGlyph = FindGlyph(codePoint);
+		if (pGlyph == NULL) {
+			bComplete = false;
+			if (bKeepEmpty)
+				vertices.resize(vertices.size() + 6, EmptyVertex());
+			continue;
+		}
+
+		// Digits in fixed width slots are not kerned, or a changing number would move its neighbours
+		bool bSlot = bFixedDigits && ((codePoint >= '0' && codePoint <= '9') || (previous >= '0' && previous <= '9'));
+		if (previous != 0 && !bSlot)
+			iCurX += GetKerning(previous, codePoint) * pixelSize / m_loadedPixelSize;
+		previous = codePoint;
+
+		int iSlotPad = 0;
+		if (bFixedDigits && codePoint >= '0' && codePoint <= '9') {
+			iSlotPad = m_digitAdvance - pGlyph->advX;
+			iCurX += (iSlotPad / 2) * pixelSize / m_loadedPixelSize;
+		}
+		iCurX += pGlyph->bearingX * pixelSize / m_loadedPixelSize;
+
+		if (codePoint != ' ' && pGlyph->page >= 0)
 		{
-			m_charTextures[iIndex].Bind();
-			glm::mat4 mModelView = glm::translate(glm::mat4(1.0f), glm::vec3(float(iCurX), float(iCurY), 0.0f));
-			mModelView = glm::scale(mModelView, glm::vec3(fScale));
-			m_shaderProgram->SetUniform("matrices.modelViewMatrix", mModelView);
-			// Draw character
-			glDrawArrays(GL_TRIANGLE_STRIP, iIndex*4, 4);
+			// A distance field extends m_padding texels beyond the glyph on every side
+			float fLeft = float(iCurX) - m_padding * fScale, fRight = fLeft + pGlyph->width * fScale;
+			float fBottom = float(iCurY) - (pGlyph->advY + m_padding) * fScale, fTop = fBottom + pGlyph->height * fScale;
+			const glm::vec4& rect = pGlyph->texRect;
+			float fPage = float(pGlyph->page);
+			TextVertex corners[4] = {
+				{ glm::vec2(fLeft, fTop), glm::vec3(rect.x, rect.y, fPage), colour },
+				{ glm::vec2(fLeft, fBottom), glm::vec3(rect.x, rect.w, fPage), colour },
+				{ glm::vec2(fRight, fTop), glm::vec3(rect.z, rect.y, fPage), colour },
+				{ glm::vec2(fRight, fBottom), glm::vec3(rect.z, rect.w, fPage), colour }
+			};
+			const int order[6] = { 0, 1, 2, 2, 1, 3 };
+			for (int j = 0; j < 6; j++)
+				vertices.push_back(corners[order[j]]);
+			uiPageMask |= 1u << pGlyph->page;
 		}
+		else if (bKeepEmpty)
+			vertices.resize(vertices.size() + 6, EmptyVertex());
 
-		iCurX += (m_advX[iIndex] - m_bearingX[iIndex])*pixelSize / m_loadedPixelSize;
+		iCurX += (pGlyph->advX - pGlyph->bearingX + iSlotPad - iSlotPad / 2)*pixelSize / m_loadedPixelSize;
 	}
-	glDisable(GL_BLEND);
+	return bComplete;
+}
+
+void CFreeTypeFont::TouchPages(unsigned int uiPageMask)
+{
+	for (int i = 0; uiPageMask != 0; i++, uiPageMask >>= 1)
+		if (uiPageMask & 1)
+			m_atlas.TouchPage(i, m_frame);
+}
+
+TextVertex CFreeTypeFont::EmptyVertex()
+{
+	TextVertex vertex = { glm::vec2(0.0f), glm::vec3(0.0f), glm::vec4(0.0f) };
+	return vertex;
 }
 
 
@@ -174,26 +764,248 @@ void CFreeTypeFont::Render(int x, int y, int pixelSize, const char* text, ...)
 	Print(buf, x, y, pixelSize);
 }
 
-// Deletes all font textures
+void CFreeTypeFont::SetColour(const glm::vec4& colour)
+{
+	m_colour = colour;
+}
+
+// Widths and offsets are in texels of the baked glyphs, so they scale with the text.  They are converted here to the
+// distance field's units and to atlas texture coordinates.
+void CFreeTypeFont::SetOutline(float fWidth, const glm::vec4& colour)
+{
+	m_outlineWidth = min(fWidth, (float)DISTANCE_FIELD_SPREAD) / (2.0f * DISTANCE_FIELD_SPREAD);
+	m_outlineColour = colour;
+}
+
+void CFreeTypeFont::SetShadow(const glm::vec2& offset, const glm::vec4& colour)
+{
+	glm::vec2 clamped = glm::clamp(offset, glm::vec2(-(float)DISTANCE_FIELD_SPREAD), glm::vec2((float)DISTANCE_FIELD_SPREAD));
+	m_shadowOffset = clamped / (float)ATLAS_SIZE;
+	m_shadowColour = colour;
+}
+
+// Draws the text objects, then all the queued text in one call.  The queued vertices go into the streaming buffer if
+// there is one with room, and otherwise re-specify the font's own buffer so the driver can orphan last frame's.
+void CFreeTypeFont::Flush()
+{
+	if (!m_isLoaded)
+		return;
+
+	// Glyphs finished by the workers since the last frame can be packed and drawn from now on
+	CollectGlyphs();
+
+	glBindVertexArray(m_vao);
+	m_atlas.Bind(0);
+	m_shaderProgram->SetUniform("sampler0", 0);
+	m_shaderProgram->SetUniform("bDistanceField", m_isDistanceField ? 1 : 0);
+	if (m_isDistanceField) {
+		m_shaderProgram->SetUniform("fOutlineWidth", m_outlineWidth);
+		m_shaderProgram->SetUniform("vOutlineColour", m_outlineColour);
+		m_shaderProgram->SetUniform("vShadowOffset", m_shadowOffset);
+		m_shaderProgram->SetUniform("vShadowColour", m_shadowColour);
+	}
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	// Text objects only re-lay out when something about them changed, and only the vertices that changed are uploaded
+	m_iRetainedBytesUploaded = 0;
+	for (unsigned int i = 0; i < m_vTextObjects.size(); i++)
+		m_vTextObjects[i]->Refresh();
+	if (!m_vRetained.empty()) {
+		GLsizeiptr iStride = sizeof(TextVertex);
+		glBindBuffer(GL_ARRAY_BUFFER, m_retainedBuffer);
+		if (m_retainedCapacity < (int)m_vRetained.size()) {
+			m_retainedCapacity = (int)m_vRetained.size();
+			glBufferData(GL_ARRAY_BUFFER, m_retainedCapacity * iStride, &m_vRetained[0], GL_DYNAMIC_DRAW);
+			m_iRetainedBytesUploaded = m_retainedCapacity * iStride;
+		} else if (m_iDirtyFirst < m_iDirtyEnd) {
+			glBufferSubData(GL_ARRAY_BUFFER, m_iDirtyFirst * iStride, (m_iDirtyEnd - m_iDirtyFirst) * iStride, &m_vRetained[m_iDirtyFirst]);
+			m_iRetainedBytesUploaded = (m_iDirtyEnd - m_iDirtyFirst) * iStride;
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		m_iDirtyFirst = INT_MAX;
+		m_iDirtyEnd = 0;
+
+		glBindVertexBuffer(0, m_retainedBuffer, 0, sizeof(TextVertex));
+		glDrawArrays(GL_TRIANGLES, 0, (GLsizei)m_vRetained.size());
+	}
+
+	if (!m_vVertices.empty()) {
+		GLsizeiptr iSize = m_vVertices.size() * sizeof(TextVertex);
+		UINT uiBuffer = m_vertexBuffer;
+		GLintptr iOffset = 0;
+		void* pDest = m_pStream != NULL ? m_pStream->Allocate(iSize, sizeof(glm::vec4), iOffset) : NULL;
+		if (pDest != NULL) {
+			memcpy(pDest, &m_vVertices[0], iSize);
+			uiBuffer = m_pStream->GetBuffer();
+		} else {
+			iOffset = 0;
+			glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+			glBufferData(GL_ARRAY_BUFFER, iSize, &m_vVertices[0], GL_STREAM_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+
+		glBindVertexBuffer(0, uiBuffer, iOffset, sizeof(TextVertex));
+		glDrawArrays(GL_TRIANGLES, 0, (GLsizei)m_vVertices.size());
+		m_vVertices.clear();
+	}
+
+	glDisable(GL_BLEND);
+	m_frame++;
+}
+
+// Reserves iChars character quads in the retained vertex buffer, initially empty, and returns the first vertex.  Text
+// objects are registered so Flush can bring them up to date.  Slots are never given back; the HUD's text objects live
+// as long as the font.
+int CFreeTypeFont::AddTextObject(CTextObject* pTextObject, int iChars)
+{
+	int iFirstVertex = (int)m_vRetained.size();
+	m_vRetained.resize(m_vRetained.size() + iChars * 6, EmptyVertex());
+	m_vTextObjects.push_back(pTextObject);
+	return iFirstVertex;
+}
+
+void CFreeTypeFont::RemoveTextObject(CTextObject* pTextObject)
+{
+	for (unsigned int i = 0; i < m_vTextObjects.size(); i++) {
+		if (m_vTextObjects[i] == pTextObject) {
+			m_vTextObjects.erase(m_vTextObjects.begin() + i);
+			break;
+		}
+	}
+}
+
+// Copies vertices into the retained buffer's CPU copy.  Flush uploads the range covering everything written since
+// the last Flush with one call.
+void CFreeTypeFont::UpdateRetained(int iFirstVertex, const TextVertex* pVertices, int iCount)
+{
+	if (iCount <= 0)
+		return;
+	std::copy(pVertices, pVertices + iCount, m_vRetained.begin() + iFirstVertex);
+	m_iDirtyFirst = min(m_iDirtyFirst, iFirstVertex);
+	m_iDirtyEnd = max(m_iDirtyEnd, iFirstVertex + iCount);
+}
+
+GLsizeiptr CFreeTypeFont::GetRetainedBytesUploaded()
+{
+	return m_iRetainedBytesUploaded;
+}
+
+// Deletes the atlas, glyphs and vertex buffers
 void CFreeTypeFont::ReleaseFont()
 {
-	for (int i = 0; i < 128; i++) 
-		m_charTextures[i].Release();
-	m_vbo.Release();
-	glDeleteVertexArrays(1, &m_vao);
+	WaitForWorkers();
+	m_vFinished.clear();
+	m_glyphs.clear();
+	m_kerning.clear();
+	if (m_ftFace != NULL) {
+		FT_Done_Face(m_ftFace);
+		m_ftFace = NULL;
+	}
+	if (m_ftLib != NULL) {
+		FT_Done_FreeType(m_ftLib);
+		m_ftLib = NULL;
+	}
+	m_isLoaded = false;
+	m_atlas.Release();
+	m_vVertices.clear();
+	m_vRetained.clear();
+	m_retainedCapacity = 0;
+	if (m_vertexBuffer != 0) {
+		glDeleteBuffers(1, &m_vertexBuffer);
+		m_vertexBuffer = 0;
+	}
+	if (m_retainedBuffer != 0) {
+		glDeleteBuffers(1, &m_retainedBuffer);
+		m_retainedBuffer = 0;
+	}
+	if (m_vao != 0) {
+		glDeleteVertexArrays(1, &m_vao);
+		m_vao = 0;
+	}
 }
 
-// Gets the width of text
+// Gets the width of text.  Characters still being rasterised count as zero width.
 int CFreeTypeFont::GetTextWidth(string sText, int iPixelSize)
 {
 	int iResult = 0;
-	for (int i = 0; i < (int)sText.size(); i++)
-		iResult += m_advX[sText[i]];
+	unsigned int previous = 0;
+	for (int i = 0; i < (int)sText.size(); ) {
+		unsigned int codePoint = DecodeUtf8(sText, i);
+		auto it = m_glyphs.find(codePoint);
+		if (it == m_glyphs.end())
+			RequestGlyph(codePoint);
+		else if (it->second.bReady)
+			iResult += it->second.advX + (previous != 0 ? GetKerning(previous, codePoint) : 0);
+		previous = codePoint;
+	}
 	return iResult*iPixelSize / m_loadedPixelSize;
 }
 
+void CFreeTypeFont::SetAtlasBudget(int iBytes)
+{
+	m_atlasBudget = iBytes;
+}
+
+bool CFreeTypeFont::WasLoadedFromCache()
+{
+	return m_loadedFromCache;
+}
+
+double CFreeTypeFont::GetLoadTime()
+{
+	return m_loadTime;
+}
+
+double CFreeTypeFont::GetBakeTime()
+{
+	return m_bakeTime;
+}
+
+float CFreeTypeFont::GetCacheHitRate()
+{
+	int iLookups = m_cacheHits + m_cacheMisses;
+	return iLookups > 0 ? (float)m_cacheHits / iLookups : 1.0f;
+}
+
+int CFreeTypeFont::GetAtlasPageCount()
+{
+	return m_atlas.GetPageCount();
+}
+
+int CFreeTypeFont::GetAtlasMaxPages()
+{
+	return m_atlas.GetMaxPages();
+}
+
+float CFreeTypeFont::GetAtlasOccupancy()
+{
+	return m_atlas.GetOccupancy();
+}
+
+int CFreeTypeFont::GetAtlasEvictions()
+{
+	return m_atlas.GetEvictionCount();
+}
+
+void CFreeTypeFont::ResetStatistics()
+{
+	m_cacheHits = m_cacheMisses = 0;
+}
+
+int CFreeTypeFont::GetGlyphArrivals()
+{
+	return m_glyphArrivals;
+}
+
 // Sets shader programme that font uses
 void CFreeTypeFont::SetShaderProgram(CShaderProgram* shaderProgram)
 {
 	m_shaderProgram = shaderProgram;
+}
+
+// Vertices are written to the streaming buffer if it was created, saving a glBufferData call a frame
+void CFreeTypeFont::SetStreamingBuffer(CStreamingBuffer* pStream)
+{
+	m_pStream = (pStream != NULL && pStream->IsCreated()) ? pStream : NULL;
 }
\ No newline at end of file
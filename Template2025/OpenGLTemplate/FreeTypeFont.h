@@ -4,46 +4,169 @@
 #include FT_FREETYPE_H
 
 #include "Common.h"
-#include "Texture.h"
+#include "GlyphAtlas.h"
 #include "Shaders.h"
-#include "VertexBufferObject.h"
 
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
 
-// This class is a wrapper for FreeType fonts and their usage with OpenGL
+class CStreamingBuffer;
+class CTextObject;
+class CThreadPool;
+
+// One corner of a glyph quad.  Text carries its colour per vertex, so differently coloured strings share a draw.
+struct TextVertex
+{
+	glm::vec2 position;
+	glm::vec3 texCoord;							// z is the atlas page
+	glm::vec4 colour;
+};
+
+// This class is a wrapper for FreeType fonts and their usage with OpenGL.  Text is UTF-8.  ASCII is rasterised when
+// the font loads; any other character is rasterised on a worker thread the first time it is drawn, and appears a
+// frame or two later.  The glyphs are packed into the pages of one atlas texture, held to a memory budget by evicting
+// the least recently used page.  Print and Render only append quads to a batch, and Flush draws everything queued since the last Flush
+// with a single draw call, so call it once a frame after all the text has been queued.  Text that persists from frame
+// to frame is better held in a CTextObject, whose quads stay in a retained buffer and are only rebuilt on change.
+//
+// A font can instead be baked as signed distance fields: each atlas texel holds the distance to the glyph's outline,
+// so the shader finds a sharp edge at any scale from one atlas, and can draw an outline and drop shadow as well.
 class CFreeTypeFont
 {
 public:
 	CFreeTypeFont();
 	~CFreeTypeFont();
 
-	bool LoadFont(string file, int pixelSize);
-	bool LoadSystemFont(string name, int pixelSize);
+	bool LoadFont(string file, int pixelSize, bool bDistanceField = false, CThreadPool* pThreadPool = NULL);
+	bool LoadSystemFont(string name, int pixelSize, bool bDistanceField = false, CThreadPool* pThreadPool = NULL);
 
 	int GetTextWidth(string text, int pixelSize);
 
+	// Memory for the atlas pages.  Takes effect at the next load.
+	void SetAtlasBudget(int iBytes);
+
+	// Startup: whether the ASCII atlas came from the prebaked cache, how long the load took, and how long baking
+	// it with FreeType took (measured now, or when the cache was written)
+	bool WasLoadedFromCache();
+	double GetLoadTime();
+	double GetBakeTime();
+
+	// Glyph cache statistics: lookups found ready in the atlas (since the last ResetStatistics), and atlas use
+	float GetCacheHitRate();
+	int GetAtlasPageCount();
+	int GetAtlasMaxPages();
+	float GetAtlasOccupancy();
+	int GetAtlasEvictions();
+	void ResetStatistics();
+
 	void Print(string text, int x, int y, int pixelSize = -1);
 	void Render(int x, int y, int pixelSize, const char* text, ...);
+	void SetColour(const glm::vec4& colour);		// Applies to text queued from now on
+
+	// Effects for distance field fonts, applied to all the font's text.  Sizes are in texels of the baked glyphs, at
+	// most DISTANCE_FIELD_SPREAD; the shadow offset is x right and y down.  A zero alpha turns an effect off.
+	void SetOutline(float fWidth, const glm::vec4& colour);
+	void SetShadow(const glm::vec2& offset, const glm::vec4& colour);
+
+	// Draws the text objects and the queued text with the font's shader program, which must be in use with its
+	// projection set
+	void Flush();
+	GLsizeiptr GetRetainedBytesUploaded();		// By the last Flush, for text objects
+
+	// Used by CTextObject
+	// Returns false if some glyphs were not ready yet.  uiPageMask gets a bit for each atlas page the quads use.
+	bool Layout(const string& text, int x, int y, int pixelSize, const glm::vec4& colour, bool bKeepEmpty, bool bFixedDigits,
+		vector<TextVertex>& vertices, unsigned int& uiPageMask);
+	void TouchPages(unsigned int uiPageMask);	// Keeps the pages from eviction this frame
+	int GetGlyphArrivals();						// Counts glyphs added to the cache by workers
+	static unsigned int DecodeUtf8(const string& text, int& i);	// Returns the code point at i and moves past it
+	int AddTextObject(CTextObject* pTextObject, int iChars);
+	void RemoveTextObject(CTextObject* pTextObject);
+	void UpdateRetained(int iFirstVertex, const TextVertex* pVertices, int iCount);
+	static TextVertex EmptyVertex();			// Degenerate, draws nothing
 
-	
 	void ReleaseFont();
 
 	void SetShaderProgram(CShaderProgram* shaderProgram);
+	void SetStreamingBuffer(CStreamingBuffer* pStream);
+
+	static const int ATLAS_SIZE = 512;			// Of each page
+	static const int DEFAULT_ATLAS_BUDGET = 1024 * 1024;
+	static const int DISTANCE_FIELD_SPREAD = 6;	// Texels the distance field reaches either side of an outline
+	static const char* CACHE_DIRECTORY;			// Where prebaked atlases are kept
 
 private:
-	void CreateChar(int index);
+	struct Glyph {
+		int advX, bearingX;
+		int advY;								// Below the baseline
+		int width, height;						// Of the bitmap, padding included
+		vector<BYTE> bitmap;					// Kept so the glyph can be packed again after its page is evicted
+		bool bReady;							// False while a worker is rasterising it
+		int page;								// -1 when it is not in the atlas
+		glm::vec4 texRect;						// Atlas texture coordinates: left, top, right, bottom
+	};
+
+	bool OpenFace();							// Loads the face if it is not loaded yet
+	void BakeAscii();
+	bool LoadCache(const string& path, unsigned long long fontHash);
+	void SaveCache(const string& path, unsigned long long fontHash);
+	int GetKerning(unsigned int left, unsigned int right);
+
+	void CreateChar(unsigned int codePoint, Glyph& glyph);
+	bool PackChar(Glyph& glyph);
+	Glyph* FindGlyph(unsigned int codePoint);	// Returns NULL if it is not ready, and requests it if it is new
+	void RequestGlyph(unsigned int codePoint);
+	void CollectGlyphs();						// Takes glyphs the workers have finished
+	void WaitForWorkers();
+
+	CGlyphAtlas m_atlas;
+	unordered_map<unsigned int, Glyph> m_glyphs;
+	unordered_map<unsigned long long, int> m_kerning;	// Between ASCII pairs, keyed on (left << 32) | right
+	int m_atlasBudget;
+	unsigned int m_frame;
+	int m_cacheHits, m_cacheMisses;
+	int m_glyphArrivals;
+
+	// Shared with the workers.  FreeType calls are serialised by m_ftMutex, as a face is not thread safe.
+	CThreadPool* m_pThreadPool;
+	mutex m_ftMutex;
+	mutex m_resultMutex;
+	condition_variable m_workersDone;
+	vector<pair<unsigned int, Glyph>> m_vFinished;	// Protected by m_resultMutex
+	int m_pendingJobs;							// Protected by m_resultMutex
 
-	CTexture m_charTextures[256];
-	int m_advX[256], m_advY[256];
-	int m_bearingX[256], m_bearingY[256];
-	int m_charWidth[256], m_charHeight[256];
 	int m_loadedPixelSize, m_newLine;
+	int m_digitAdvance;							// Of the widest digit
+	bool m_isDistanceField;
+	int m_padding;								// Texels around each glyph bitmap
+	float m_outlineWidth;						// In distance field units
+	glm::vec4 m_outlineColour;
+	glm::vec2 m_shadowOffset;					// In atlas texture coordinates
+	glm::vec4 m_shadowColour;
 
 	bool m_isLoaded;
 
+	vector<TextVertex> m_vVertices;				// Queued since the last Flush
+	glm::vec4 m_colour;
+
+	vector<CTextObject*> m_vTextObjects;
+	vector<TextVertex> m_vRetained;				// Every text object's quads, in the order they were added
+	UINT m_retainedBuffer;
+	int m_retainedCapacity;						// Vertices
+	int m_iDirtyFirst, m_iDirtyEnd;				// Range of m_vRetained changed since the last Flush
+	GLsizeiptr m_iRetainedBytesUploaded;
+
 	UINT m_vao;
-	CVertexBufferObject m_vbo;
+	UINT m_vertexBuffer;						// Used when there is no streaming buffer, or it is full
+	CStreamingBuffer* m_pStream;
+
+	string m_fontPath;
+	bool m_loadedFromCache;
+	double m_loadTime, m_bakeTime;				// Milliseconds
 
 	FT_Library m_ftLib;
-	FT_Face m_ftFace;
+	FT_Face m_ftFace;							// Only loaded if the cache missed or a glyph outside it is needed
+	bool m_ftFaceFailed;						// The face could not be loaded; OpenFace has said so and does not try again
 	CShaderProgram* m_shaderProgram;
 };
@@ -0,0 +1,55 @@
+#include "Frustum.h"
+
+CFrustum::CFrustum()
+{
+	for (int i = 0; i < NUM_PLANES; i++)
+		m_planes[i] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+// Each plane is the sum or difference of the fourth row of the clip matrix and one of the other rows
+void CFrustum::Set(const glm::mat4& projectionMatrix, const glm::mat4& viewMatrix)
+{
+	glm::mat4 m = projectionMatrix * viewMatrix;
+	glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+	glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+	glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+	glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+	m_planes[0] = row3 + row0;
+	m_planes[1] = row3 - row0;
+	m_planes[2] = row3 + row1;
+	m_planes[3] = row3 - row1;
+	m_planes[4] = row3 + row2;
+	m_planes[5] = row3 - row2;
+
+	// Normalise so that sphere tests can compare distances with radii
+	for (int i = 0; i < NUM_PLANES; i++)
+		m_planes[i] /= glm::length(glm::vec3(m_planes[i]));
+}
+
+// Tests the corner furthest along each plane's normal (the positive vertex) to reject the box, and the opposite corner
+// to find boxes that lie entirely inside
+CFrustum::Result CFrustum::TestBox(const BoundingBox& box) const
+{
+	Result result = INSIDE;
+	for (int i = 0; i < NUM_PLANES; i++) {
+		const glm::vec4& plane = m_planes[i];
+		glm::vec3 positive(plane.x >= 0.0f ? box.max.x : box.min.x, plane.y >= 0.0f ? box.max.y : box.min.y, plane.z >= 0.0f ? box.max.z : box.min.z);
+		glm::vec3 negative(plane.x >= 0.0f ? box.min.x : box.max.x, plane.y >= 0.0f ? box.min.y : box.max.y, plane.z >= 0.0f ? box.min.z : box.max.z);
+
+		if (glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f)
+			return OUTSIDE;
+		if (glm::dot(glm::vec3(plane), negative) + plane.w < 0.0f)
+			result = INTERSECTING;
+	}
+	return result;
+}
+
+bool CFrustum::TestSphere(const glm::vec3& centre, float radius) const
+{
+	for (int i = 0; i < NUM_PLANES; i++) {
+		if (glm::dot(glm::vec3(m_planes[i]), centre) + m_planes[i].w < -radius)
+			return false;
+	}
+	return true;
+}
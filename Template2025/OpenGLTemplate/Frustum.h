@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Common.h"
+#include "BoundingBox.h"
+
+// The six planes of a view frustum, taken from a combined projection * view matrix.  Each plane is stored as
+// (normal, distance) with the normal pointing into the frustum, so a point p is inside when dot(normal, p) + distance >= 0.
+class CFrustum
+{
+public:
+	CFrustum();
+
+	// Extracts the planes from projectionMatrix * viewMatrix (Gribb and Hartmann's method)
+	void Set(const glm::mat4& projectionMatrix, const glm::mat4& viewMatrix);
+
+	enum Result { OUTSIDE, INTERSECTING, INSIDE };
+
+	Result TestBox(const BoundingBox& box) const;
+	bool TestSphere(const glm::vec3& centre, float radius) const;
+
+	const glm::vec4& GetPlane(int i) const { return m_planes[i]; }
+
+	static const int NUM_PLANES = 6;
+
+private:
+	glm::vec4 m_planes[NUM_PLANES];		// Left, right, bottom, top, near, far
+};
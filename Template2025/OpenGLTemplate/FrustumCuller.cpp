@@ -0,0 +1,329 @@
+#include "FrustumCuller.h"
+#include "HighResolutionTimer.h"
+
+#include <algorithm>
+
+// The AVX path is compiled with MSVC (which allows AVX intrinsics without /arch:AVX) or when the compiler targets AVX,
+// and is only used if the CPU and operating system support it
+#if defined(__AVX__) || (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
+#define FRUSTUM_CULLER_AVX
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static const int SIMD_PADDING = 7;
+
+CFrustumCuller::CFrustumCuller()
+{
+	m_bUseSIMD = IsAVXSupported();
+}
+
+CFrustumCuller::~CFrustumCuller()
+{
+}
+
+void CFrustumCuller::BoxList::Add(const BoundingBox& box, int iId)
+{
+	// Drop any padding before appending
+	size_t n = ids.size();
+	minX.resize(n); minY.resize(n); minZ.resize(n);
+	maxX.resize(n); maxY.resize(n); maxZ.resize(n);
+
+	minX.push_back(box.min.x); minY.push_back(box.min.y); minZ.push_back(box.min.z);
+	maxX.push_back(box.max.x); maxY.push_back(box.max.y); maxZ.push_back(box.max.z);
+	ids.push_back(iId);
+}
+
+void CFrustumCuller::BoxList::Clear()
+{
+	minX.clear(); minY.clear(); minZ.clear();
+	maxX.clear(); maxY.clear(); maxZ.clear();
+	ids.clear();
+}
+
+// The padding lanes are masked out of the results, so their contents do not matter
+void CFrustumCuller::BoxList::PadForSIMD()
+{
+	size_t n = ids.size() + SIMD_PADDING;
+	minX.resize(n, 0.0f); minY.resize(n, 0.0f); minZ.resize(n, 0.0f);
+	maxX.resize(n, 0.0f); maxY.resize(n, 0.0f); maxZ.resize(n, 0.0f);
+}
+
+void CFrustumCuller::AddStatic(const BoundingBox& box, int iId)
+{
+	BuildEntry entry;
+	entry.box = box;
+	entry.centre = box.GetCentre();
+	entry.iId = iId;
+	m_vStaticEntries.push_back(entry);
+}
+
+// Builds the hierarchy top down, splitting each node at the median centre along the longest axis of its centres.
+// The build reorders the entries so that every subtree covers a contiguous range of them.
+void CFrustumCuller::BuildHierarchy()
+{
+	m_vNodes.clear();
+	m_staticBoxes.Clear();
+	if (m_vStaticEntries.empty())
+		return;
+
+	m_vNodes.reserve(2 * m_vStaticEntries.size() / LEAF_SIZE + 1);
+	Build(m_vStaticEntries, 0, (int)m_vStaticEntries.size());
+
+	for (unsigned int i = 0; i < m_vStaticEntries.size(); i++)
+		m_staticBoxes.Add(m_vStaticEntries[i].box, m_vStaticEntries[i].iId);
+	m_staticBoxes.PadForSIMD();
+}
+
+int CFrustumCuller::Build(vector<BuildEntry>& vEntries, int iBegin, int iEnd)
+{
+	int iNode = (int)m_vNodes.size();
+	m_vNodes.push_back(Node());
+
+	BoundingBox bounds, centres;
+	for (int i = iBegin; i < iEnd; i++) {
+		bounds.Extend(vEntries[i].box);
+		centres.Extend(vEntries[i].centre);
+	}
+
+	m_vNodes[iNode].bounds = bounds;
+	m_vNodes[iNode].iFirst = iBegin;
+	m_vNodes[iNode].iCount = iEnd - iBegin;
+	m_vNodes[iNode].iRight = -1;
+
+	if (iEnd - iBegin <= LEAF_SIZE)
+		return iNode;
+
+	glm::vec3 size = centres.max - centres.min;
+	int iAxis = 0;
+	if (size.y > size.x) iAxis = 1;
+	if (size.z > size[iAxis]) iAxis = 2;
+
+	int iMid = (iBegin + iEnd) / 2;
+	nth_element(vEntries.begin() + iBegin, vEntries.begin() + iMid, vEntries.begin() + iEnd,
+		[iAxis](const BuildEntry& a, const BuildEntry& b) { return a.centre[iAxis] < b.centre[iAxis]; });
+
+	Build(vEntries, iBegin, iMid);
+	int iRight = Build(vEntries, iMid, iEnd);
+	m_vNodes[iNode].iRight = iRight;
+	return iNode;
+}
+
+void CFrustumCuller::ClearStatic()
+{
+	m_vStaticEntries.clear();
+	m_staticBoxes.Clear();
+	m_vNodes.clear();
+}
+
+void CFrustumCuller::AddDynamic(const BoundingBox& box, int iId)
+{
+	m_dynamicBoxes.Add(box, iId);
+}
+
+void CFrustumCuller::ClearDynamic()
+{
+	m_dynamicBoxes.Clear();
+}
+
+// Tests up to eight boxes from iFirst against every plane.  Bit i of the result is set if box iFirst + i is visible.
+unsigned int CFrustumCuller::TestBatchScalar(const BoxList& list, int iFirst, const CFrustum& frustum)
+{
+	unsigned int uiVisible = 0xFF;
+	for (int p = 0; p < CFrustum::NUM_PLANES; p++) {
+		const glm::vec4& plane = frustum.GetPlane(p);
+		const float* pX = plane.x >= 0.0f ? &list.maxX[iFirst] : &list.minX[iFirst];
+		const float* pY = plane.y >= 0.0f ? &list.maxY[iFirst] : &list.minY[iFirst];
+		const float* pZ = plane.z >= 0.0f ? &list.maxZ[iFirst] : &list.minZ[iFirst];
+		for (int i = 0; i < 8; i++) {
+			if (plane.x * pX[i] + plane.y * pY[i] + plane.z * pZ[i] + plane.w < 0.0f)
+				uiVisible &= ~(1u << i);
+		}
+	}
+	return uiVisible;
+}
+
+// The AVX version of TestBatchScalar.  For each plane, only the corner furthest along the normal (the positive vertex)
+// needs testing, and since the sign of each normal component is the same for all eight boxes, choosing between the
+// min and max arrays is done once per plane rather than with per-lane blends.
+unsigned int CFrustumCuller::TestBatchAVX(const BoxList& list, int iFirst, const CFrustum& frustum)
+{
+#ifdef FRUSTUM_CULLER_AVX
+	__m256 visible = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+	for (int p = 0; p < CFrustum::NUM_PLANES; p++) {
+		const glm::vec4& plane = frustum.GetPlane(p);
+		const float* pX = plane.x >= 0.0f ? &list.maxX[iFirst] : &list.minX[iFirst];
+		const float* pY = plane.y >= 0.0f ? &list.maxY[iFirst] : &list.minY[iFirst];
+		const float* pZ = plane.z >= 0.0f ? &list.maxZ[iFirst] : &list.minZ[iFirst];
+
+		__m256 d = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.x), _mm256_loadu_ps(pX)), _mm256_set1_ps(plane.w));
+		d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(plane.y), _mm256_loadu_ps(pY)));
+		d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(plane.z), _mm256_loadu_ps(pZ)));
+		visible = _mm256_and_ps(visible, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_GE_OQ));
+	}
+	return (unsigned int)_mm256_movemask_ps(visible);
+#else
+	return TestBatchScalar(list, iFirst, frustum);
+#endif
+}
+
+// Tests a contiguous range of boxes in batches of eight, masking off the lanes past the end of the range
+void CFrustumCuller::TestRange(const BoxList& list, int iFirst, int iCount, const CFrustum& frustum, vector<int>& vVisible)
+{
+	for (int i = 0; i < iCount; i += 8) {
+		unsigned int uiMask = m_bUseSIMD ? TestBatchAVX(list, iFirst + i, frustum) : TestBatchScalar(list, iFirst + i, frustum);
+		int iLanes = glm::min(8, iCount - i);
+		uiMask &= (1u << iLanes) - 1;
+
+		while (uiMask != 0) {
+			int iLane = 0;
+			while (!(uiMask & (1u << iLane)))
+				iLane++;
+			vVisible.push_back(list.ids[iFirst + i + iLane]);
+			uiMask &= uiMask - 1;
+		}
+	}
+}
+
+void CFrustumCuller::Cull(const CFrustum& frustum, vector<int>& vVisible)
+{
+	// Static objects:  walk the hierarchy with an explicit stack
+	if (!m_vNodes.empty()) {
+		int stack[64];
+		int iStackSize = 0;
+		stack[iStackSize++] = 0;
+
+		while (iStackSize > 0) {
+			const Node& node = m_vNodes[stack[--iStackSize]];
+			CFrustum::Result result = frustum.TestBox(node.bounds);
+			if (result == CFrustum::OUTSIDE)
+				continue;
+
+			if (result == CFrustum::INSIDE) {
+				vVisible.insert(vVisible.end(), m_staticBoxes.ids.begin() + node.iFirst, m_staticBoxes.ids.begin() + node.iFirst + node.iCount);
+			}
+			else if (node.iRight < 0) {
+				TestRange(m_staticBoxes, node.iFirst, node.iCount, frustum, vVisible);
+			}
+			else {
+				int iLeft = (int)(&node - &m_vNodes[0]) + 1;
+				stack[iStackSize++] = node.iRight;
+				stack[iStackSize++] = iLeft;
+			}
+		}
+	}
+
+	// Dynamic objects:  one flat pass
+	m_dynamicBoxes.PadForSIMD();
+	TestRange(m_dynamicBoxes, 0, m_dynamicBoxes.Size(), frustum, vVisible);
+}
+
+int CFrustumCuller::GetStaticCount()
+{
+	return m_staticBoxes.Size();
+}
+
+int CFrustumCuller::GetDynamicCount()
+{
+	return m_dynamicBoxes.Size();
+}
+
+int CFrustumCuller::GetNodeCount()
+{
+	return (int)m_vNodes.size();
+}
+
+void CFrustumCuller::SetUseSIMD(bool bUseSIMD)
+{
+	m_bUseSIMD = bUseSIMD && IsAVXSupported();
+}
+
+// AVX needs support from both the CPU and the operating system (which must save the YMM registers)
+bool CFrustumCuller::IsAVXSupported()
+{
+#if !defined(FRUSTUM_CULLER_AVX)
+	return false;
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	bool bOSXSave = (info[2] & (1 << 27)) != 0;
+	bool bAVX = (info[2] & (1 << 28)) != 0;
+	if (!bOSXSave || !bAVX)
+		return false;
+	return (_xgetbv(0) & 6) == 6;
+#else
+	return true;
+#endif
+}
+
+// Compares a scalar and an AVX pass over a flat list with the hierarchy, for the same 100,000 boxes and frusta.
+// The visible counts should match between methods.
+void CFrustumCuller::Benchmark(string sFileName)
+{
+	const int iNumObjects = 100000;
+	const int iNumViews = 8;
+	const int iIterations = 20;
+
+	FILE* pFile = NULL;
+	if (fopen_s(&pFile, sFileName.c_str(), "w") != 0 || pFile == NULL)
+		return;
+
+	// Random boxes from 1 to 20 units across, spread through a 4000 unit cube around the origin
+	srand(1);
+	CFrustumCuller flat, hierarchy;
+	for (int i = 0; i < iNumObjects; i++) {
+		glm::vec3 centre((float)rand() / RAND_MAX * 4000.0f - 2000.0f, (float)rand() / RAND_MAX * 4000.0f - 2000.0f, (float)rand() / RAND_MAX * 4000.0f - 2000.0f);
+		glm::vec3 extent(0.5f + (float)rand() / RAND_MAX * 9.5f);
+		BoundingBox box(centre - extent, centre + extent);
+		flat.AddDynamic(box, i);
+		hierarchy.AddStatic(box, i);
+	}
+
+	CHighResolutionTimer timer;
+	timer.Start();
+	hierarchy.BuildHierarchy();
+	double dBuildTime = timer.Elapsed();
+
+	fprintf(pFile, "Frustum culling benchmark: %d objects, %d views, %d iterations per view\n", iNumObjects, iNumViews, iIterations);
+	fprintf(pFile, "AVX supported: %s\n", IsAVXSupported() ? "yes" : "no");
+	fprintf(pFile, "Hierarchy build: %.3f ms, %d nodes\n\n", dBuildTime, hierarchy.GetNodeCount());
+	fprintf(pFile, "%6s %10s %14s %14s %14s %14s\n", "view", "visible", "flat scalar", "flat AVX", "BVH scalar", "BVH AVX");
+
+	glm::mat4 projectionMatrix = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.5f, 5000.0f);
+	double dTotals[4] = { 0.0, 0.0, 0.0, 0.0 };
+	vector<int> vVisible;
+	vVisible.reserve(iNumObjects);
+
+	for (int v = 0; v < iNumViews; v++) {
+		float fAngle = v * 6.2831853f / iNumViews;
+		glm::mat4 viewMatrix = glm::lookAt(glm::vec3(0.0f), glm::vec3(cos(fAngle), 0.2f, sin(fAngle)), glm::vec3(0.0f, 1.0f, 0.0f));
+		CFrustum frustum;
+		frustum.Set(projectionMatrix, viewMatrix);
+
+		double dTimes[4];
+		int iVisible[4];
+		for (int m = 0; m < 4; m++) {
+			CFrustumCuller& culler = (m < 2) ? flat : hierarchy;
+			culler.SetUseSIMD(m % 2 == 1);
+			timer.Start();
+			for (int k = 0; k < iIterations; k++) {
+				vVisible.clear();
+				culler.Cull(frustum, vVisible);
+			}
+			dTimes[m] = timer.Elapsed() / iIterations;
+			iVisible[m] = (int)vVisible.size();
+			dTotals[m] += dTimes[m];
+		}
+
+		bool bMatch = iVisible[1] == iVisible[0] && iVisible[2] == iVisible[0] && iVisible[3] == iVisible[0];
+		fprintf(pFile, "%6d %10d %11.3f ms %11.3f ms %11.3f ms %11.3f ms%s\n", v, iVisible[0], dTimes[0], dTimes[1], dTimes[2], dTimes[3],
+			bMatch ? "" : "  (visible counts differ)");
+	}
+
+	fprintf(pFile, "%6s %10s %11.3f ms %11.3f ms %11.3f ms %11.3f ms\n", "mean", "",
+		dTotals[0] / iNumViews, dTotals[1] / iNumViews, dTotals[2] / iNumViews, dTotals[3] / iNumViews);
+	fclose(pFile);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Common.h"
+#include "BoundingBox.h"
+#include "Frustum.h"
+
+// Frustum culling for the scene's objects.  Objects are identified by an integer id chosen by the caller.
+//  - Static objects are added once and kept in a bounding volume hierarchy, so whole groups of objects are accepted
+//    or rejected by testing one node.  Nodes that are entirely inside the frustum accept their objects without tests.
+//  - Dynamic objects are re-added every frame to a flat structure-of-arrays list.
+// Boxes are tested eight at a time with AVX when the CPU supports it (one box per lane, one plane per iteration),
+// with a scalar loop otherwise.
+class CFrustumCuller
+{
+public:
+	CFrustumCuller();
+	~CFrustumCuller();
+
+	void AddStatic(const BoundingBox& box, int iId);
+	void BuildHierarchy();						// Call after adding static objects, before culling
+	void ClearStatic();
+
+	void AddDynamic(const BoundingBox& box, int iId);
+	void ClearDynamic();
+
+	// Appends the ids of every static and dynamic object whose box touches the frustum
+	void Cull(const CFrustum& frustum, vector<int>& vVisible);
+
+	int GetStaticCount();
+	int GetDynamicCount();
+	int GetNodeCount();
+
+	// Lets the benchmark compare the scalar and AVX paths.  SIMD is used by default when available.
+	void SetUseSIMD(bool bUseSIMD);
+	static bool IsAVXSupported();
+
+	// Culls 100,000 random boxes from several view directions with each method and writes the timings to a text file
+	static void Benchmark(string sFileName);
+
+	static const int LEAF_SIZE = 8;				// Maximum objects per leaf, one AVX batch
+
+private:
+	// Box bounds by component, so that eight boxes can be loaded into one register per component.  The float arrays
+	// are padded by SIMD_PADDING entries after PadForSIMD() so a batch never reads past the end.
+	struct BoxList {
+		vector<float> minX, minY, minZ, maxX, maxY, maxZ;
+		vector<int> ids;
+
+		void Add(const BoundingBox& box, int iId);
+		void Clear();
+		void PadForSIMD();
+		int Size() const { return (int)ids.size(); }
+	};
+
+	// BVH node.  Objects under a node are contiguous in m_staticBoxes, starting at iFirst.
+	struct Node {
+		BoundingBox bounds;
+		int iFirst;
+		int iCount;
+		int iRight;								// Index of the right child (the left child follows the node), or -1 for a leaf
+	};
+
+	struct BuildEntry {
+		BoundingBox box;
+		glm::vec3 centre;
+		int iId;
+	};
+
+	int Build(vector<BuildEntry>& vEntries, int iBegin, int iEnd);
+	void TestRange(const BoxList& list, int iFirst, int iCount, const CFrustum& frustum, vector<int>& vVisible);
+
+	static unsigned int TestBatchScalar(const BoxList& list, int iFirst, const CFrustum& frustum);
+	static unsigned int TestBatchAVX(const BoxList& list, int iFirst, const CFrustum& frustum);
+
+	vector<BuildEntry> m_vStaticEntries;		// Static objects added since the last build
+	BoxList m_staticBoxes;
+	vector<Node> m_vNodes;
+	BoxList m_dynamicBoxes;
+	bool m_bUseSIMD;
+};
@@ -36,14 +36,33 @@ Source code drawn from a number of sources and examples, including contributions
 #include "Skybox.h"
 #include "Plane.h"
 #include "Shaders.h"
+#include "ShaderCompileQueue.h"
+#include "ShaderPermutations.h"
+#include "Material.h"
 #include "FreeTypeFont.h"
+#include "TextObject.h"
 #include "Sphere.h"
+#include "LodSelector.h"
 #include "MatrixStack.h"
 #include "OpenAssetImportMesh.h"
 #include "Audio.h"
 #include "CatmullRom.h"
 #include "Pyramid.h"
 #include "Cuboid.h"
+#include "ClusteredLighting.h"
+#include "InstanceBuffer.h"
+#include "MeshArena.h"
+#include "RenderQueue.h"
+#include "Frustum.h"
+#include "FrustumCuller.h"
+#include "ThreadPool.h"
+#include "AssetGraph.h"
+#include "OcclusionCuller.h"
+#include "GpuCuller.h"
+#include "StreamingBuffer.h"
+#include "TextureLoader.h"
+#include "TextureCache.h"
+#include "TextureStreamer.h"
 
 // Constructor
 Game::Game()
@@ -51,11 +70,42 @@ Game::Game()
 	m_pSkybox = NULL;
 	m_pCamera = NULL;
 	m_pShaderPrograms = NULL;
+	m_pShaderCompileQueue = NULL;
+	m_pMainShaderPermutations = NULL;
+	m_pCurrentProgram = NULL;
 	m_pPlanarTerrain = NULL;
 	m_pFtFont = NULL;
+	for (int i = 0; i < HUD_TEXT_COUNT; i++)
+		m_pHudText[i] = NULL;
 	m_pSphere = NULL;
 	m_pPyramid = NULL;
 	m_pCuboid = NULL;
+	m_pClusteredLighting = NULL;
+	m_pPickupInstances = NULL;
+	m_pStartLightInstances = NULL;
+	m_pMeshArena = NULL;
+	m_pRenderQueue = NULL;
+	m_pFrustum = NULL;
+	m_pFrustumCuller = NULL;
+	m_pThreadPool = NULL;
+	m_pOcclusionCuller = NULL;
+	m_occlusionCullingEnabled = true;
+	m_occludedCount = 0;
+	m_occlusionTime = 0.0;
+	m_pGpuCuller = NULL;
+	m_pStreamingBuffer = NULL;
+	m_pTextureLoader = NULL;
+	m_pTextureStreamer = NULL;
+	m_gpuCullingEnabled = false;
+	m_gpuCullingActive = false;
+	m_pickupMaterial = Material(glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(1.0f), 50.0f);	// Red
+	m_pBarrelMesh = NULL;
+	m_pHorseMesh = NULL;
+	m_pPropInstances = NULL;
+	m_pPropLods = NULL;
+	m_pStartLightLods = NULL;
+	memset(m_lodInstanceCounts, 0, sizeof(m_lodInstanceCounts));
+	m_lodTriangles = m_fullDetailTriangles = 0;
 	m_pHighResolutionTimer = NULL;
 	m_pAudio = NULL;
 
@@ -89,6 +139,10 @@ Game::Game()
 	m_startLightPositions[2] = glm::vec4(10.0f, 5.0f, 5.0f, 1.0f);
 
 	m_fogEnabled = false;
+	m_lightTime = 0.0f;
+	m_pickupCount = NUM_PICKUPS;
+	m_pyramidMesh = m_cuboidMesh = m_sphereMesh = -1;
+	m_stressSceneEnabled = false;
 }
 
 // Destructor
@@ -98,12 +152,36 @@ Game::~Game()
 	delete m_pCamera;
 	delete m_pSkybox;
 	delete m_pPlanarTerrain;
+	for (int i = 0; i < HUD_TEXT_COUNT; i++)
+		delete m_pHudText[i];					// Before the font they live in
 	delete m_pFtFont;
 	delete m_pSphere;
 	delete m_pAudio;
 	delete m_pCatmullRom;
 	delete m_pPyramid;
 	delete m_pCuboid;
+	delete m_pClusteredLighting;
+	delete m_pPickupInstances;
+	delete m_pStartLightInstances;
+	delete m_pRenderQueue;
+	delete m_pMeshArena;
+	delete m_pFrustum;
+	delete m_pFrustumCuller;
+	delete m_pOcclusionCuller;
+	delete m_pGpuCuller;
+	delete m_pStreamingBuffer;
+	delete m_pThreadPool;
+	delete m_pBarrelMesh;
+	delete m_pHorseMesh;
+	delete m_pPropInstances;
+	delete m_pPropLods;
+	delete m_pStartLightLods;
+	delete m_pTextureLoader;					// After the objects whose textures it may still be loading
+	CTextureCache::GetInstance().SetStreamer(NULL);
+	delete m_pTextureStreamer;					// Textures still alive keep the levels they have
+
+	delete m_pMainShaderPermutations;
+	delete m_pShaderCompileQueue;
 
 	if (m_pShaderPrograms != NULL) {
 		for (unsigned int i = 0; i < m_pShaderPrograms->size(); i++)
@@ -126,11 +204,31 @@ void Game::Initialise()
 	m_pCamera = new CCamera;
 	m_pSkybox = new CSkybox;
 	m_pShaderPrograms = new vector <CShaderProgram*>;
+	m_pShaderCompileQueue = new CShaderCompileQueue;
+	m_pMainShaderPermutations = new CShaderPermutations;
 	m_pPlanarTerrain = new CPlane;
 	m_pFtFont = new CFreeTypeFont;
 	m_pSphere = new CSphere;
 	m_pPyramid = new CPyramid;
 	m_pCuboid = new CCuboid;
+	m_pClusteredLighting = new CClusteredLighting;
+	m_pPickupInstances = new CInstanceBuffer;
+	m_pStartLightInstances = new CInstanceBuffer;
+	m_pMeshArena = new CMeshArena;
+	m_pRenderQueue = new CRenderQueue;
+	m_pFrustum = new CFrustum;
+	m_pFrustumCuller = new CFrustumCuller;
+	m_pThreadPool = new CThreadPool;
+	m_pOcclusionCuller = new COcclusionCuller;
+	m_pGpuCuller = new CGpuCuller;
+	m_pStreamingBuffer = new CStreamingBuffer;
+	m_pTextureLoader = new CTextureLoader;
+	m_pTextureStreamer = new CTextureStreamer;
+	m_pBarrelMesh = new COpenAssetImportMesh;
+	m_pHorseMesh = new COpenAssetImportMesh;
+	m_pPropInstances = new CInstanceBuffer;
+	m_pPropLods = new CLodSelector;
+	m_pStartLightLods = new CLodSelector;
 	m_pAudio = new CAudio;
 
 	RECT dimensions = m_gameWindow.GetDimensions();
@@ -142,78 +240,539 @@ void Game::Initialise()
 	m_pCamera->SetOrthographicProjectionMatrix(width, height);
 	m_pCamera->SetPerspectiveProjectionMatrix(45.0f, (float)width / (float)height, 0.5f, 5000.0f);
 
-	// Load shaders
-	vector<CShader> shShaders;
-	vector<string> sShaderFileNames;
-	sShaderFileNames.push_back("mainShader.vert");
-	sShaderFileNames.push_back("mainShader.frag");
-	sShaderFileNames.push_back("textShader.vert");
-	sShaderFileNames.push_back("textShader.frag");
-
-	for (int i = 0; i < (int)sShaderFileNames.size(); i++) {
-		string sExt = sShaderFileNames[i].substr((int)sShaderFileNames[i].size() - 4, 4);
-		int iShaderType;
-		if (sExt == "vert") iShaderType = GL_VERTEX_SHADER;
-		else if (sExt == "frag") iShaderType = GL_FRAGMENT_SHADER;
-		else if (sExt == "geom") iShaderType = GL_GEOMETRY_SHADER;
-		else if (sExt == "tcnl") iShaderType = GL_TESS_CONTROL_SHADER;
-		else iShaderType = GL_TESS_EVALUATION_SHADER;
-		CShader shader;
-		shader.LoadShader("resources\\shaders\\" + sShaderFileNames[i], iShaderType);
-		shShaders.push_back(shader);
-	}
-
-	// Create the main shader program
-	CShaderProgram* pMainProgram = new CShaderProgram;
-	pMainProgram->CreateProgram();
-	pMainProgram->AddShaderToProgram(&shShaders[0]);
-	pMainProgram->AddShaderToProgram(&shShaders[1]);
-	pMainProgram->LinkProgram();
-	m_pShaderPrograms->push_back(pMainProgram);
-
-	// Create a shader program for fonts
-	CShaderProgram* pFontProgram = new CShaderProgram;
-	pFontProgram->CreateProgram();
-	pFontProgram->AddShaderToProgram(&shShaders[2]);
-	pFontProgram->AddShaderToProgram(&shShaders[3]);
-	pFontProgram->LinkProgram();
-	m_pShaderPrograms->push_back(pFontProgram);
-
-	// You can follow this pattern to load additional shaders
+	// Worker threads, used by loading as well as by the occlusion culler
+	m_pThreadPool->Create();
+
+	// Startup runs as a graph of tasks.  Reading and decoding files runs on the workers, while everything that makes GL
+	// calls runs here, one task at a time, as soon as what it needs is ready.  The tasks' times are written to
+	// startup_timeline.txt with the longest dependency chain, which is as short as startup can get.
+	CAssetGraph startup;
+	CShaderProgram* pFontProgram = NULL;
+
+	int gl = startup.AddTask("Buffers and shaders", CAssetGraph::MAIN_THREAD, [&]() {
+		// Per-frame data (instances, draw commands, light lists) is streamed through one persistently mapped buffer.
+		// If the driver cannot create it, each user falls back to re-specifying its own buffers.
+		m_pStreamingBuffer->Create(STREAMING_REGION_SIZE);
+
+		// Images are decoded on the workers and uploaded a few per frame from Render, with placeholders bound until then
+		m_pTextureLoader->Create(m_pThreadPool);
+
+		// Textures with a converted file stream their mip levels against a memory budget; the rest load whole
+		m_pTextureStreamer->Create(m_pThreadPool);
+		CTextureCache::GetInstance().SetStreamer(m_pTextureStreamer);
+
+		// Divide the view frustum into light clusters
+		m_pClusteredLighting->Create(width, height, *m_pCamera->GetPerspectiveProjectionMatrix(), 0.5f, 5000.0f);
+		m_pClusteredLighting->SetStreamingBuffer(m_pStreamingBuffer);
+
+		// Load shaders.  Programs are compiled in the background by the compile queue and use a placeholder
+		// program until they are ready, so startup does not wait on the shader compiler.
+		m_pShaderCompileQueue->Initialise("resources\\shaders\\");
+
+		// Create the main shader.  Its variants are compiled on first use from the SHADER_KEY_* bits in Material.h,
+		// so the key names here must stay in the same order as those bits.
+		m_pMainShaderPermutations->Create(m_pShaderCompileQueue, { "mainShader.vert", "mainShader.frag" }, { "SKYBOX", "TEXTURED", "FOG", "INSTANCED", "DRAW_DATA", "GPU_CULLED", "COMPACT_VERTEX" });
+
+		// Request the variants used every frame up front, so they compile in parallel with the rest of the loading
+		m_pMainShaderPermutations->GetProgram(SHADER_KEY_SKYBOX);
+		m_pMainShaderPermutations->GetProgram(SHADER_KEY_TEXTURED);
+		m_pMainShaderPermutations->GetProgram(0);
+		m_pMainShaderPermutations->GetProgram(SHADER_KEY_INSTANCED);
+		m_pMainShaderPermutations->GetProgram(SHADER_KEY_DRAW_DATA);
+		m_pMainShaderPermutations->GetProgram(SHADER_KEY_TEXTURED | SHADER_KEY_INSTANCED);
+		m_pMainShaderPermutations->GetProgram(SHADER_KEY_TEXTURED | SHADER_KEY_INSTANCED | SHADER_KEY_COMPACT_VERTEX);
+		m_pMainShaderPermutations->GetProgram(SHADER_KEY_DRAW_DATA | SHADER_KEY_GPU_CULLED);
+
+		// Create a shader program for fonts
+		pFontProgram = new CShaderProgram;
+		m_pShaderCompileQueue->Submit(pFontProgram, { "textShader.vert", "textShader.frag" });
+		m_pShaderPrograms->push_back(pFontProgram);
+
+		// You can follow this pattern to load additional shaders
+
+		glEnable(GL_CULL_FACE);
+	});
 
 	// Create the skybox
 	// Skybox downloaded from http://www.akimbo.in/forum/viewtopic.php?f=10&t=9
-	m_pSkybox->Create(2500.0f);
+	// Its six faces decode at once on the pool, or come straight from the mip cache, in less time than a placeholder
+	// would be up for, so it is loaded here rather than through the texture loader.  Only the upload waits for the
+	// main thread.
+	int skyboxPrepare = startup.AddTask("Skybox faces", CAssetGraph::WORKER_THREAD, [&]() {
+		m_pSkybox->Prepare(m_pThreadPool);
+	});
+	startup.AddTask("Skybox", CAssetGraph::MAIN_THREAD, [&]() {
+		m_pSkybox->Upload(2500.0f);
+	}, { skyboxPrepare });
 
 	// Create the planar terrain
-	m_pPlanarTerrain->Create("resources\\textures\\", "grassfloor01.jpg", 2000.0f, 2000.0f, 50.0f); // Texture downloaded from http://www.psionicgames.com/?page_id=26 on 24 Jan 2013
+	startup.AddTask("Terrain", CAssetGraph::MAIN_THREAD, [&]() {
+		m_pPlanarTerrain->Create("resources\\textures\\", "grassfloor01.jpg", 2000.0f, 2000.0f, 50.0f, m_pTextureLoader); // Texture downloaded from http://www.psionicgames.com/?page_id=26 on 24 Jan 2013
+	}, { gl });
+
+	// The font is baked as distance fields, on the worker threads, so the HUD text stays sharp at any size
+	startup.AddTask("Font", CAssetGraph::MAIN_THREAD, [&]() {
+		m_pFtFont->LoadSystemFont("arial.ttf", 32, true, m_pThreadPool);
+		m_pFtFont->SetOutline(1.0f, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+		m_pFtFont->SetShadow(glm::vec2(2.0f, 2.0f), glm::vec4(0.0f, 0.0f, 0.0f, 0.5f));
+		m_pFtFont->SetShaderProgram(pFontProgram);
+		m_pFtFont->SetStreamingBuffer(m_pStreamingBuffer);
+		InitializeHudText();
+	}, { gl });
+
+	int shapes = startup.AddTask("Shapes", CAssetGraph::MAIN_THREAD, [&]() {
+		// Create a pyramid
+		m_pPyramid->Create(2.0f, 3.0f);
+
+		// Create a cuboid
+		m_pCuboid->Create(2.0f, 3.0f, 6.0f);
+
+		// Instance buffers for the pickups, start lights and props, which are each drawn with one instanced call
+		m_pPickupInstances->Create(m_pStreamingBuffer);
+		m_pStartLightInstances->Create(m_pStreamingBuffer);
+		m_pPropInstances->Create(m_pStreamingBuffer);
+
+		// Create a sphere
+		m_pSphere->Create("resources\\textures\\", "dirtpile01.jpg", 25, 25, m_pTextureLoader);  // Texture downloaded from http://www.psionicgames.com/?page_id=26 on 24 Jan 2013
+
+		// Copy the basic shapes into the mesh arena used by the render queue
+		m_pMeshArena->Create(65536, 262144);
+		m_pyramidMesh = m_pPyramid->AddToArena(*m_pMeshArena);
+		m_cuboidMesh = m_pCuboid->AddToArena(*m_pMeshArena);
+		m_sphereMesh = m_pSphere->AddToArena(*m_pMeshArena);
+
+		m_pyramidBounds = m_pPyramid->GetBounds();
+		m_cuboidBounds = m_pCuboid->GetBounds();
+		m_sphereBounds = m_pSphere->GetBounds();
+		m_pRenderQueue->Create(m_pMeshArena, m_pStreamingBuffer);
+		m_pGpuCuller->Create(m_pMeshArena, m_pShaderCompileQueue, width, height);
+	}, { gl });
+
+	// Load the scenery meshes.  Reading, importing and optimising them needs no GL, so only the upload waits for the
+	// main thread.
+	int barrelPrepare = startup.AddTask("Barrel mesh", CAssetGraph::WORKER_THREAD, [&]() {
+		m_pBarrelMesh->Prepare("resources\\models\\Barrel\\barrel02.obj", true);
+	});
+	int horsePrepare = startup.AddTask("Horse mesh", CAssetGraph::WORKER_THREAD, [&]() {
+		m_pHorseMesh->Prepare("resources\\models\\Horse\\horse2.obj", true);
+	});
+	int barrelUpload = startup.AddTask("Barrel upload", CAssetGraph::MAIN_THREAD, [&]() {
+		m_pBarrelMesh->Upload(m_pTextureLoader);
+	}, { gl, barrelPrepare });
+	int horseUpload = startup.AddTask("Horse upload", CAssetGraph::MAIN_THREAD, [&]() {
+		m_pHorseMesh->Upload(m_pTextureLoader);
+	}, { gl, horsePrepare });
 
-	m_pFtFont->LoadSystemFont("arial.ttf", 32);
-	m_pFtFont->SetShaderProgram(pFontProgram);
+	// Create the catmull rom spline
+	int track = startup.AddTask("Track", CAssetGraph::MAIN_THREAD, [&]() {
+		m_pCatmullRom = new CCatmullRom();
+		m_pCatmullRom->CreateCentreline();
+		m_pCatmullRom->CreateOffsetCurves();
+		m_pCatmullRom->CreateTrack();
+	});
+
+	// Placing the scene uses rand, so it stays on one thread to keep the same layout
+	startup.AddTask("Scene", CAssetGraph::MAIN_THREAD, [&]() {
+		InitializePickups();
+		InitializeTrackLights();
+		InitializeStressScene();
+		InitializeProps();
+		m_pPropLods->Create((int)m_props.size(), CMeshSimplifier::LOD_COUNT, 300.0f);
+		m_pStartLightLods->Create(3, CMeshSimplifier::LOD_COUNT, 100.0f);
+		m_pOcclusionCuller->Create(m_pThreadPool);
+		BuildCullingHierarchy();
+		BuildGpuCulledInstances();
+	}, { track, shapes, barrelUpload, horseUpload });
+
+	// Initialise audio and load the sounds.  CAudio keeps one FMOD result for every call, so these run one after another.
+	// They are used from the main thread once Run returns, which the graph orders after the last of them finishes, and
+	// FMOD allows that: its API is thread safe unless initialised with FMOD_INIT_THREAD_UNSAFE, which CAudio does not use.
+	int audio = startup.AddTask("Audio", CAssetGraph::WORKER_THREAD, [&]() {
+		m_pAudio->Initialise();
+	});
+	int sound = startup.AddTask("Boing.wav", CAssetGraph::WORKER_THREAD, [&]() {
+		m_pAudio->LoadEventSound("resources\\Audio\\Boing.wav");					// Royalty free sound from freesound.org
+	}, { audio });
+	startup.AddTask("Music", CAssetGraph::WORKER_THREAD, [&]() {
+		m_pAudio->LoadMusicStream("resources\\Audio\\DST-Garote.mp3");	// Royalty free music from http://www.nosoapradio.us/
+	}, { sound });
+
+	startup.Run(m_pThreadPool);
+	startup.DumpTimeline("startup_timeline.txt");
+	//m_pAudio->PlayMusicStream();
+}
 
-	// Create a pyramid
-	m_pPyramid->Create(2.0f, 3.0f);
+void Game::Resize(int width, int height)
+{
+	// A minimised window has no size, and keeps what it had
+	if (width <= 0 || height <= 0 || m_pCamera == NULL)
+		return;
 
-	// Create a cuboid
-	m_pCuboid->Create(2.0f, 3.0f, 6.0f);
+	glViewport(0, 0, width, height);
+	m_pCamera->SetOrthographicProjectionMatrix(width, height);
+	m_pCamera->SetPerspectiveProjectionMatrix(45.0f, (float)width / (float)height, 0.5f, 5000.0f);
 
-	// Create a sphere
-	m_pSphere->Create("resources\\textures\\", "dirtpile01.jpg", 25, 25);  // Texture downloaded from http://www.psionicgames.com/?page_id=26 on 24 Jan 2013
-	glEnable(GL_CULL_FACE);
+	// The light clusters are screen tiles, and the Hi-Z pyramid is built from the depth buffer, so both follow the window
+	m_pClusteredLighting->Resize(width, height, *m_pCamera->GetPerspectiveProjectionMatrix());
+	m_pGpuCuller->Resize(width, height);
+}
 
-	// Create the catmull rom spline
-	m_pCatmullRom = new CCatmullRom();
-	m_pCatmullRom->CreateCentreline();
-	m_pCatmullRom->CreateOffsetCurves();
-	m_pCatmullRom->CreateTrack();
+// Selects the main shader permutation for a material, binds it, and sets the material uniforms.  Per-frame uniforms
+// are uploaded whenever the bound variant changes, since each variant is a separate program.  bInstanced selects the
+// variant that takes its model matrices from an instance buffer, and bCompactVertex the one that decodes CompactVertex
+// positions (the mesh then sets the decode uniforms).
+CShaderProgram* Game::UseMaterial(const Material& material, bool bInstanced, bool bCompactVertex)
+{
+	CShaderProgram* pProgram = m_pMainShaderPermutations->GetProgram(material.GetShaderKeys(m_fogEnabled, bInstanced, bCompactVertex));
+	if (pProgram != m_pCurrentProgram) {
+		pProgram->UseProgram();
+		SetFrameUniforms(pProgram);
+		m_pCurrentProgram = pProgram;
+	}
+
+	pProgram->SetUniform("material1.Ma", material.Ma);	// Ambient material reflectance
+	pProgram->SetUniform("material1.Md", material.Md);	// Diffuse material reflectance
+	pProgram->SetUniform("material1.Ms", material.Ms);	// Specular material reflectance
+	pProgram->SetUniform("material1.Me", material.Me);	// Emitted colour
+	pProgram->SetUniform("material1.shininess", material.shininess);	// Shininess material property
+	return pProgram;
+}
+
+// Sets the uniforms that are the same for every draw in the frame
+void Game::SetFrameUniforms(CShaderProgram* pProgram)
+{
+	pProgram->SetUniform("sampler0", 0);
+	pProgram->SetUniform("CubeMapTex", CUBE_MAP_TEXTURE_UNIT);
 
-	InitializePickups();
+	pProgram->SetUniform("fogDensity", 0.015f);  // Fog thickness value
+	pProgram->SetUniform("fogColor", glm::vec3(0.5f, 0.5f, 0.5f));
 
-	// Initialise audio and play background music
-	m_pAudio->Initialise();
-	m_pAudio->LoadEventSound("resources\\Audio\\Boing.wav");					// Royalty free sound from freesound.org
-	m_pAudio->LoadMusicStream("resources\\Audio\\DST-Garote.mp3");	// Royalty free music from http://www.nosoapradio.us/
-	//m_pAudio->PlayMusicStream();
+	// Set the projection and view matrices
+	pProgram->SetUniform("matrices.projMatrix", m_pCamera->GetPerspectiveProjectionMatrix());
+	pProgram->SetUniform("matrices.viewMatrix", m_viewMatrix);
+
+	// Set light in main shader program
+	glm::vec4 lightPosition1 = glm::vec4(-100, 100, -100, 1); // Position of light source *in world coordinates*
+	pProgram->SetUniform("light1.position", m_viewMatrix * lightPosition1); // Position of light source *in eye coordinates*
+	pProgram->SetUniform("light1.La", glm::vec3(1.0f));		// Ambient colour of light
+	pProgram->SetUniform("light1.Ld", glm::vec3(1.0f));		// Diffuse colour of light
+	pProgram->SetUniform("light1.Ls", glm::vec3(1.0f));		// Specular colour of light
+
+	// Point lights are looked up by cluster
+	m_pClusteredLighting->SetUniforms(pProgram);
+}
+
+// Queues a draw of a mesh in the arena with the DRAW_DATA variant of the main shader
+void Game::SubmitToQueue(int mesh, const Material& material, const glm::mat4& model, CTexture* pTexture)
+{
+	CShaderProgram* pProgram = m_pMainShaderPermutations->GetProgram(material.GetShaderKeys(m_fogEnabled) | SHADER_KEY_DRAW_DATA);
+	m_pRenderQueue->Submit(mesh, pProgram, pTexture, material, model);
+}
+
+// Lays out a grid of pyramids, cuboids and spheres in a range of colours, to measure how well the render queue batches
+void Game::InitializeStressScene()
+{
+	m_stressMaterials.clear();
+	const glm::vec3 colours[] = {
+		glm::vec3(0.8f, 0.1f, 0.1f), glm::vec3(0.1f, 0.8f, 0.1f), glm::vec3(0.1f, 0.1f, 0.8f),
+		glm::vec3(0.8f, 0.8f, 0.1f), glm::vec3(0.8f, 0.1f, 0.8f), glm::vec3(0.1f, 0.8f, 0.8f)
+	};
+	for (int i = 0; i < 6; i++)
+		m_stressMaterials.push_back(Material(colours[i] * 0.3f, colours[i], glm::vec3(0.5f), 20.0f + 10.0f * i));
+
+	m_stressObjects.clear();
+	const int meshes[] = { m_pyramidMesh, m_cuboidMesh, m_sphereMesh };
+	const glm::vec3 centre(65.0f, 0.0f, 230.0f);
+	const float spacing = 10.0f;
+	for (int z = 0; z < STRESS_GRID_SIZE; z++) {
+		for (int x = 0; x < STRESS_GRID_SIZE; x++) {
+			StressObject object;
+			object.mesh = meshes[rand() % 3];
+			object.material = rand() % (int)m_stressMaterials.size();
+
+			glm::vec3 position = centre + glm::vec3((x - STRESS_GRID_SIZE / 2) * spacing, 2.0f, (z - STRESS_GRID_SIZE / 2) * spacing);
+			object.model = glm::translate(glm::mat4(1.0f), position);
+			object.model = glm::rotate(object.model, (float)rand() / RAND_MAX * 6.283f, glm::vec3(0.0f, 1.0f, 0.0f));
+			if (object.mesh == m_sphereMesh)
+				object.model = glm::scale(object.model, glm::vec3(1.5f));
+			m_stressObjects.push_back(object);
+		}
+	}
+}
+
+// Stands barrels and horses a little way outside the track, alternating sides
+void Game::InitializeProps()
+{
+	m_props.clear();
+	float trackLength = m_pCatmullRom->GetTotalLength();
+	float spacing = trackLength / NUM_PROPS;
+
+	for (int i = 0; i < NUM_PROPS; i++) {
+		glm::vec3 centrePos, nextPos, up;
+		m_pCatmullRom->Sample(i * spacing + spacing * 0.5f, centrePos, up);
+		m_pCatmullRom->Sample(i * spacing + spacing * 0.5f + 0.1f, nextPos);
+		glm::vec3 forward = glm::normalize(nextPos - centrePos);
+		glm::vec3 right = glm::normalize(glm::cross(forward, up));
+		float side = (i % 2 == 0) ? 1.0f : -1.0f;
+
+		Prop prop;
+		prop.horse = (i % 4 < 2);
+		prop.model = glm::translate(glm::mat4(1.0f), centrePos + right * side * (float)(TRACK_WIDTH / 2 + 8));
+		prop.model = glm::rotate(prop.model, atan2(forward.x, forward.z), glm::vec3(0.0f, 1.0f, 0.0f));
+		if (!prop.horse)
+			prop.model = glm::scale(prop.model, glm::vec3(3.0f));
+		m_props.push_back(prop);
+	}
+}
+
+glm::mat4 Game::GetCarModelMatrix()
+{
+	// Get car's current position and next position
+	glm::vec3 carPos, up;
+	glm::vec3 nextPos;
+	m_pCatmullRom->Sample(m_currentDistance, carPos, up);
+	m_pCatmullRom->Sample(m_currentDistance + 0.1f, nextPos, up);
+
+	// Calculate forward direction and angle
+	glm::vec3 forward = glm::normalize(nextPos - carPos);
+	float angle = atan2(forward.x, forward.z);
+
+	// Apply lateral offset if needed
+	glm::vec3 right = glm::normalize(glm::cross(forward, up));
+	carPos += right * m_carCentrelineOffset;
+
+	// Set position and rotation
+	glm::mat4 carModel = glm::translate(glm::mat4(1.0f), carPos);
+	return glm::rotate(carModel, angle, glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+glm::mat4 Game::GetPickupModelMatrix(const glm::vec3& position)
+{
+	return glm::scale(glm::translate(glm::mat4(1.0f), position), glm::vec3(3.0f));
+}
+
+glm::mat4 Game::GetStartLightModelMatrix(int i)
+{
+	return glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(m_startLightPositions[i])), glm::vec3(0.8f));
+}
+
+// Static objects go into the culler's hierarchy.  The stress scene is only included while it is switched on.
+void Game::BuildCullingHierarchy()
+{
+	m_cullBounds[CULL_TERRAIN].assign(1, m_pPlanarTerrain->GetBounds());
+	m_cullBounds[CULL_TRACK].assign(1, m_pCatmullRom->GetBounds());
+
+	m_cullBounds[CULL_PROP].resize(m_props.size());
+	for (unsigned int i = 0; i < m_props.size(); i++) {
+		BoundingBox bounds = m_props[i].horse ? m_pHorseMesh->GetBounds() : m_pBarrelMesh->GetBounds();
+		m_cullBounds[CULL_PROP][i] = bounds.Transform(m_props[i].model);
+	}
+
+	m_cullBounds[CULL_STRESS].resize(m_stressObjects.size());
+	for (unsigned int i = 0; i < m_stressObjects.size(); i++) {
+		const StressObject& object = m_stressObjects[i];
+		const BoundingBox& bounds = (object.mesh == m_pyramidMesh) ? m_pyramidBounds : (object.mesh == m_cuboidMesh) ? m_cuboidBounds : m_sphereBounds;
+		m_cullBounds[CULL_STRESS][i] = bounds.Transform(object.model);
+	}
+
+	m_pFrustumCuller->ClearStatic();
+	const int staticCategories[] = { CULL_TERRAIN, CULL_TRACK, CULL_PROP, CULL_STRESS };
+	for (int c : staticCategories) {
+		if (c == CULL_STRESS && (!m_stressSceneEnabled || m_gpuCullingActive))
+			continue;
+		for (unsigned int i = 0; i < m_cullBounds[c].size(); i++)
+			m_pFrustumCuller->AddStatic(m_cullBounds[c][i], CullId(c, i));
+	}
+	m_pFrustumCuller->BuildHierarchy();
+
+	BuildOccluders();
+}
+
+// The terrain, the horses and the stress scene's cuboids hide what is behind them.  Barrels, pyramids and spheres are
+// too small, or too far from their bounding boxes, to be worth rasterising.
+void Game::BuildOccluders()
+{
+	m_pOcclusionCuller->ClearOccluders();
+
+	BoundingBox terrain = m_pPlanarTerrain->GetBounds();
+	vector<glm::vec3> terrainCorners = {
+		glm::vec3(terrain.min.x, 0.0f, terrain.min.z), glm::vec3(terrain.min.x, 0.0f, terrain.max.z),
+		glm::vec3(terrain.max.x, 0.0f, terrain.min.z), glm::vec3(terrain.max.x, 0.0f, terrain.max.z)
+	};
+	m_pOcclusionCuller->AddOccluder(terrainCorners, { 0, 1, 2, 2, 1, 3 }, glm::mat4(1.0f));
+
+	vector<glm::vec3> horsePositions;
+	vector<unsigned int> horseIndices;
+	m_pHorseMesh->GetTriangles(horsePositions, horseIndices);
+	for (unsigned int i = 0; i < m_props.size(); i++) {
+		if (m_props[i].horse)
+			m_pOcclusionCuller->AddOccluder(horsePositions, horseIndices, m_props[i].model);
+	}
+
+	if (m_stressSceneEnabled) {
+		for (unsigned int i = 0; i < m_stressObjects.size(); i++) {
+			if (m_stressObjects[i].mesh == m_cuboidMesh)
+				m_pOcclusionCuller->AddOccluderBox(m_cuboidBounds, m_stressObjects[i].model);
+		}
+	}
+}
+
+// The pickups and the stress scene are uploaded to the GPU culler whenever either is switched between its normal and
+// stress versions.  The pickups come first, so UpdatePickups can move one by its index when it is respawned.
+void Game::BuildGpuCulledInstances()
+{
+	m_pGpuCuller->ClearInstances();
+	for (unsigned int i = 0; i < m_pickups.size(); i++) {
+		glm::mat4 model = GetPickupModelMatrix(m_pickups[i].position);
+		m_pGpuCuller->AddInstance(m_pyramidMesh, m_pickupMaterial, model, m_pyramidBounds.Transform(model));
+	}
+
+	if (m_stressSceneEnabled) {
+		for (unsigned int i = 0; i < m_stressObjects.size(); i++) {
+			const StressObject& object = m_stressObjects[i];
+			m_pGpuCuller->AddInstance(object.mesh, m_stressMaterials[object.material], object.model, m_cullBounds[CULL_STRESS][i]);
+		}
+	}
+	m_pGpuCuller->Upload();
+}
+
+// Adds this frame's dynamic objects, culls everything against the camera's frustum and records what is visible.
+// Objects that pass are then tested against the occluders.  The skybox is not culled, since it always surrounds the
+// camera, and neither the terrain nor the track are occlusion tested, since they are too large to ever be hidden.
+void Game::CullScene()
+{
+	// The pickups and stress objects move between the CPU and GPU paths once the GPU culler can take them
+	bool gpuCullingActive = m_gpuCullingEnabled && m_pGpuCuller->IsReady();
+	if (gpuCullingActive != m_gpuCullingActive) {
+		m_gpuCullingActive = gpuCullingActive;
+		BuildCullingHierarchy();
+	}
+
+	m_pFrustum->Set(*m_pCamera->GetPerspectiveProjectionMatrix(), m_viewMatrix);
+
+	m_cullBounds[CULL_CAR].assign(1, m_cuboidBounds.Transform(GetCarModelMatrix()));
+	m_cullBounds[CULL_PICKUP].resize(m_gpuCullingActive ? 0 : m_pickups.size());
+	for (unsigned int i = 0; i < m_cullBounds[CULL_PICKUP].size(); i++)
+		m_cullBounds[CULL_PICKUP][i] = m_pyramidBounds.Transform(GetPickupModelMatrix(m_pickups[i].position));
+	m_cullBounds[CULL_START_LIGHT].clear();
+	if (m_startSequenceActive || m_goLightActive) {
+		for (int i = 0; i < 3; i++)
+			m_cullBounds[CULL_START_LIGHT].push_back(m_sphereBounds.Transform(GetStartLightModelMatrix(i)));
+	}
+
+	m_pFrustumCuller->ClearDynamic();
+	const int dynamicCategories[] = { CULL_CAR, CULL_PICKUP, CULL_START_LIGHT };
+	for (int c : dynamicCategories) {
+		for (unsigned int i = 0; i < m_cullBounds[c].size(); i++)
+			m_pFrustumCuller->AddDynamic(m_cullBounds[c][i], CullId(c, i));
+	}
+
+	for (int c = 0; c < CULL_CATEGORY_COUNT; c++)
+		m_visible[c].assign(m_cullBounds[c].size(), 0);
+
+	m_visibleIds.clear();
+	m_pFrustumCuller->Cull(*m_pFrustum, m_visibleIds);
+	for (unsigned int i = 0; i < m_visibleIds.size(); i++)
+		m_visible[m_visibleIds[i] >> 24][m_visibleIds[i] & 0xFFFFFF] = 1;
+
+	// Occlusion test what survived the frustum
+	m_occludedCount = 0;
+	if (m_occlusionCullingEnabled) {
+		CHighResolutionTimer timer;
+		timer.Start();
+		m_pOcclusionCuller->Render(*m_pCamera->GetPerspectiveProjectionMatrix() * m_viewMatrix);
+
+		m_occlusionIds.clear();
+		m_occlusionBoxes.clear();
+		for (unsigned int i = 0; i < m_visibleIds.size(); i++) {
+			int category = m_visibleIds[i] >> 24;
+			if (category == CULL_TERRAIN || category == CULL_TRACK)
+				continue;
+			m_occlusionIds.push_back(m_visibleIds[i]);
+			m_occlusionBoxes.push_back(m_cullBounds[category][m_visibleIds[i] & 0xFFFFFF]);
+		}
+
+		m_pOcclusionCuller->TestBoxes(m_occlusionBoxes, m_occlusionVisible);
+		for (unsigned int i = 0; i < m_occlusionIds.size(); i++) {
+			if (!m_occlusionVisible[i]) {
+				m_visible[m_occlusionIds[i] >> 24][m_occlusionIds[i] & 0xFFFFFF] = 0;
+				m_occludedCount++;
+			}
+		}
+		m_occlusionTime = timer.Elapsed();
+	}
+}
+
+// The diameter of the bounds' sphere in pixels, from the projection's focal length.  Inside the sphere, the near
+// plane's distance is used, which asks for full detail.
+float Game::GetProjectedSize(const BoundingBox& bounds)
+{
+	RECT dimensions = m_gameWindow.GetDimensions();
+	float height = (float)(dimensions.bottom - dimensions.top);
+	float radius = bounds.GetRadius();
+	float distance = max(glm::length(bounds.GetCentre() - m_pCamera->GetPosition()) - radius, 0.5f);
+	return 2.0f * radius * (*m_pCamera->GetPerspectiveProjectionMatrix())[1][1] / distance * height * 0.5f;
+}
+
+// Places coloured lamps along both edges of the track
+void Game::InitializeTrackLights()
+{
+	m_trackLightPositions.clear();
+	float trackLength = m_pCatmullRom->GetTotalLength();
+	float spacing = trackLength / (NUM_TRACK_LIGHTS / 2);
+
+	for (int i = 0; i < NUM_TRACK_LIGHTS / 2; i++) {
+		glm::vec3 centrePos, nextPos, up;
+		m_pCatmullRom->Sample(i * spacing, centrePos, up);
+		m_pCatmullRom->Sample(i * spacing + 0.1f, nextPos);
+		glm::vec3 right = glm::normalize(glm::cross(glm::normalize(nextPos - centrePos), up));
+
+		m_trackLightPositions.push_back(centrePos + right * (float)(TRACK_WIDTH / 2 + 2) + up * 2.0f);
+		m_trackLightPositions.push_back(centrePos - right * (float)(TRACK_WIDTH / 2 + 2) + up * 2.0f);
+	}
+}
+
+// Gathers this frame's point lights (start lights, pickup glows, car headlights and track lamps) and assigns them to clusters
+void Game::UpdateLights()
+{
+	m_pClusteredLighting->ClearLights();
+
+	// Start lights
+	if (m_startSequenceActive || m_goLightActive) {
+		for (int i = 0; i < 3; i++) {
+			if (m_goLightActive)
+				m_pClusteredLighting->AddLight(PointLight(glm::vec3(m_startLightPositions[i]), 40.0f, glm::vec3(0.0f, 1.0f, 0.0f), 150.0f));
+			else if (m_startLightStates[i])
+				m_pClusteredLighting->AddLight(PointLight(glm::vec3(m_startLightPositions[i]), 40.0f, glm::vec3(1.0f, 0.0f, 0.0f), 150.0f));
+		}
+	}
+
+	// Pickup glows
+	int pickupLights = 0;
+	for (const auto& pickup : m_pickups) {
+		if (pickup.active && pickupLights++ < MAX_PICKUP_LIGHTS)
+			m_pClusteredLighting->AddLight(PointLight(pickup.position, 12.0f, glm::vec3(1.0f, 0.2f, 0.1f), 30.0f));
+	}
+
+	// Car headlights, slightly ahead of the car on either side
+	glm::vec3 carPos, nextPos, up;
+	m_pCatmullRom->Sample(m_currentDistance, carPos, up);
+	m_pCatmullRom->Sample(m_currentDistance + 0.1f, nextPos);
+	glm::vec3 forward = glm::normalize(nextPos - carPos);
+	glm::vec3 right = glm::normalize(glm::cross(forward, up));
+	carPos += right * m_carCentrelineOffset;
+	for (int side = -1; side <= 1; side += 2)
+		m_pClusteredLighting->AddLight(PointLight(carPos + forward * 5.0f + right * (float)side + up, 30.0f, glm::vec3(1.0f, 1.0f, 0.9f), 80.0f));
+
+	// Track lamps, with a colour chase running around the track
+	for (unsigned int i = 0; i < m_trackLightPositions.size(); i++) {
+		float phase = m_lightTime * 2.0f - (float)(i / 2) * 0.3f;
+		glm::vec3 colour = 0.5f + 0.5f * glm::vec3(sin(phase), sin(phase + 2.094f), sin(phase + 4.189f));
+		m_pClusteredLighting->AddLight(PointLight(m_trackLightPositions[i], 15.0f, colour, 40.0f));
+	}
+
+	m_pClusteredLighting->Update(m_viewMatrix);
+	m_pClusteredLighting->Bind();
 }
 
 // Render method runs repeatedly in a loop
@@ -228,186 +787,198 @@ void Game::Render()
 	glutil::MatrixStack modelViewMatrixStack;
 	modelViewMatrixStack.SetIdentity();
 
-	// Use the main shader program 
-	CShaderProgram* pMainProgram = (*m_pShaderPrograms)[0];
-	pMainProgram->UseProgram();
-	pMainProgram->SetUniform("bUseTexture", true);
-	pMainProgram->SetUniform("sampler0", 0);
-	// Note: cubemap and non-cubemap textures should not be mixed in the same texture unit.  Setting unit 10 to be a cubemap texture.
-	int cubeMapTextureUnit = 10;
-	pMainProgram->SetUniform("CubeMapTex", cubeMapTextureUnit);
+	// Call LookAt to create the view matrix and put this on the modelViewMatrix stack. 
+	// Store the view matrix for later (it's useful for lighting -- since lighting is done in eye coordinates)
+	modelViewMatrixStack.LookAt(m_pCamera->GetPosition(), m_pCamera->GetView(), m_pCamera->GetUpVector());
+	m_viewMatrix = modelViewMatrixStack.Top();
 
-	pMainProgram->SetUniform("fogEnabled", m_fogEnabled);
-	pMainProgram->SetUniform("fogDensity", 0.015f);  // Fog thickness value
-	pMainProgram->SetUniform("fogColor", glm::vec3(0.5f, 0.5f, 0.5f));
+	// Force the frame uniforms to be set on the first program used this frame
+	m_pCurrentProgram = NULL;
 
-	// Set the projection matrix
-	pMainProgram->SetUniform("matrices.projMatrix", m_pCamera->GetPerspectiveProjectionMatrix());
+	// Move on to the next region of the streaming buffer, which the GPU should have finished reading by now
+	m_pStreamingBuffer->BeginFrame();
 
-	// Call LookAt to create the view matrix and put this on the modelViewMatrix stack. 
-	// Store the view matrix and the normal matrix associated with the view matrix for later (they're useful for lighting -- since lighting is done in eye coordinates)
-	modelViewMatrixStack.LookAt(m_pCamera->GetPosition(), m_pCamera->GetView(), m_pCamera->GetUpVector());
-	glm::mat4 viewMatrix = modelViewMatrixStack.Top();
-	glm::mat3 viewNormalMatrix = m_pCamera->ComputeNormalMatrix(viewMatrix);
+	// Upload textures the workers have finished decoding, within this frame's budget
+	m_pTextureLoader->Update();
 
+	// Bring in the mip levels last frame's draws asked for, dropping unused ones if over budget
+	m_pTextureStreamer->Update();
 
-	// Set light and materials in main shader program
-	glm::vec4 lightPosition1 = glm::vec4(-100, 100, -100, 1); // Position of light source *in world coordinates*
-	pMainProgram->SetUniform("light1.position", viewMatrix * lightPosition1); // Position of light source *in eye coordinates*
-	pMainProgram->SetUniform("light1.La", glm::vec3(1.0f));		// Ambient colour of light
-	pMainProgram->SetUniform("light1.Ld", glm::vec3(1.0f));		// Diffuse colour of light
-	pMainProgram->SetUniform("light1.Ls", glm::vec3(1.0f));		// Specular colour of light
-	pMainProgram->SetUniform("material1.Ma", glm::vec3(1.0f));	// Ambient material reflectance
-	pMainProgram->SetUniform("material1.Md", glm::vec3(0.0f));	// Diffuse material reflectance
-	pMainProgram->SetUniform("material1.Ms", glm::vec3(0.0f));	// Specular material reflectance
-	pMainProgram->SetUniform("material1.shininess", 15.0f);		// Shininess material property
+	// Assign this frame's point lights to clusters
+	UpdateLights();
+
+	// Work out which objects are in view
+	CullScene();
 
+	// Objects drawn through the render queue are submitted during the frame and drawn together by Flush
+	m_pRenderQueue->Begin(m_viewMatrix);
+
+	// Materials.  Each one selects a main shader permutation, so untextured objects never sample a texture
+	// and only the skybox variant samples the cube map.
+	// Note: cubemap and non-cubemap textures should not be mixed in the same texture unit.  The cubemap uses unit CUBE_MAP_TEXTURE_UNIT.
+	const Material skyboxMaterial(glm::vec3(1.0f), glm::vec3(0.0f), glm::vec3(0.0f), 15.0f, false, true);
+	const Material terrainMaterial(glm::vec3(1.0f), glm::vec3(0.0f), glm::vec3(0.0f), 15.0f, true);
+	const Material trackMaterial(glm::vec3(0.15f), glm::vec3(0.15f), glm::vec3(0.2f), 10.0f);	// Dark grey, low shininess for matte look
+	const Material carMaterial(glm::vec3(0.0f, 0.0f, 0.8f), glm::vec3(0.0f, 0.0f, 0.8f), glm::vec3(0.8f), 50.0f);	// Blue
+	const Material startLightMaterial(glm::vec3(1.0f), glm::vec3(1.0f), glm::vec3(1.0f), 15.0f, false, false, glm::vec3(1.0f));	// White, tinted per instance
+	const Material propMaterial(glm::vec3(0.4f), glm::vec3(0.8f), glm::vec3(0.1f), 10.0f, true);	// Textured by the mesh
 
 	// Render the skybox and terrain with full ambient reflectance 
+	CShaderProgram* pProgram = UseMaterial(skyboxMaterial);
 	modelViewMatrixStack.Push();
-	pMainProgram->SetUniform("renderSkybox", true);
 	// Translate the modelview matrix to the camera eye point so skybox stays centred around camera
 	glm::vec3 vEye = m_pCamera->GetPosition();
 	modelViewMatrixStack.Translate(vEye);
-	pMainProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-	pMainProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
-	m_pSkybox->Render(cubeMapTextureUnit);
-	pMainProgram->SetUniform("renderSkybox", false);
+	pProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
+	pProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
+	m_pSkybox->Render(CUBE_MAP_TEXTURE_UNIT);
 	modelViewMatrixStack.Pop();
 
 	// Render the planar terrain
-	modelViewMatrixStack.Push();
-	pMainProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-	pMainProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
-	m_pPlanarTerrain->Render();
-	modelViewMatrixStack.Pop();
-
+	if (m_visible[CULL_TERRAIN][0]) {
+		pProgram = UseMaterial(terrainMaterial);
+		modelViewMatrixStack.Push();
+		pProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
+		pProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
+		m_pPlanarTerrain->Render();
+		m_pPlanarTerrain->RequestTextureDetail(GetProjectedSize(m_cullBounds[CULL_TERRAIN][0]));
+		modelViewMatrixStack.Pop();
+	}
 
-	// Turn on diffuse + specular materials
-	pMainProgram->SetUniform("material1.Ma", glm::vec3(0.5f));	// Ambient material reflectance
-	pMainProgram->SetUniform("material1.Md", glm::vec3(0.5f));	// Diffuse material reflectance
-	pMainProgram->SetUniform("material1.Ms", glm::vec3(1.0f));	// Specular material reflectance	
 
-	// Render the start lights
+	// Render the start lights as one instanced draw per level of detail.  The instance colour picks green for GO, red
+	// for countdown or grey for off, and its alpha switches the emission on.
+	m_lodTriangles = m_fullDetailTriangles = 0;
+	memset(m_lodInstanceCounts, 0, sizeof(m_lodInstanceCounts));
 	if (m_startSequenceActive || m_goLightActive) {
-		pMainProgram->SetUniform("bUseTexture", false);
-
-		// Render each light sphere
 		for (int i = 0; i < 3; i++) {
-			modelViewMatrixStack.Push();
-			modelViewMatrixStack.Translate(glm::vec3(m_startLightPositions[i]));
-			modelViewMatrixStack.Scale(glm::vec3(0.8f));
-
-			if (m_goLightActive) {
-				// Green for GO
-				pMainProgram->SetUniform("material1.Ma", glm::vec3(0.0f, 1.0f, 0.0f));
-				pMainProgram->SetUniform("material1.Md", glm::vec3(0.0f, 1.0f, 0.0f));
-				pMainProgram->SetUniform("material1.Me", glm::vec3(0.0f, 5.0f, 0.0f));
-			}
-			else if (m_startLightStates[i]) {
-				// Red for countdown
-				pMainProgram->SetUniform("material1.Ma", glm::vec3(1.0f, 0.0f, 0.0f));
-				pMainProgram->SetUniform("material1.Md", glm::vec3(1.0f, 0.0f, 0.0f));
-				pMainProgram->SetUniform("material1.Me", glm::vec3(5.0f, 0.0f, 0.0f));
-			}
-			else {
-				// Gray for off state
-				pMainProgram->SetUniform("material1.Ma", glm::vec3(0.2f));
-				pMainProgram->SetUniform("material1.Md", glm::vec3(0.2f));
-				pMainProgram->SetUniform("material1.Me", glm::vec3(0.0f));
+			if (m_visible[CULL_START_LIGHT][i])
+				m_pStartLightLods->Select(i, GetProjectedSize(m_cullBounds[CULL_START_LIGHT][i]));
+		}
+		for (int lod = 0; lod < CMeshSimplifier::LOD_COUNT; lod++) {
+			m_pStartLightInstances->Clear();
+			for (int i = 0; i < 3; i++) {
+				if (!m_visible[CULL_START_LIGHT][i] || m_pStartLightLods->GetLod(i) != lod)
+					continue;
+
+				glm::vec4 colour;
+				if (m_goLightActive)
+					colour = glm::vec4(0.0f, 1.0f, 0.0f, 1.0f);
+				else if (m_startLightStates[i])
+					colour = glm::vec4(1.0f, 0.0f, 0.0f, 1.0f);
+				else
+					colour = glm::vec4(0.2f, 0.2f, 0.2f, 0.0f);
+
+				m_pStartLightInstances->AddInstance(GetStartLightModelMatrix(i), colour);
 			}
-			pMainProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-			pMainProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
-			m_pSphere->Render();
-			modelViewMatrixStack.Pop();
+			if (m_pStartLightInstances->GetCount() == 0)
+				continue;
+			m_pStartLightInstances->Upload();
+
+			UseMaterial(startLightMaterial, true);
+			m_pSphere->RenderInstanced(*m_pStartLightInstances, lod);
+			m_lodTriangles += m_pStartLightInstances->GetCount() * m_pSphere->GetTriangleCount(lod);
+			m_fullDetailTriangles += m_pStartLightInstances->GetCount() * m_pSphere->GetTriangleCount(0);
 		}
-		pMainProgram->SetUniform("bUseTexture", true);
 	}
 
 
-	pMainProgram->SetUniform("bUseTexture", false);
-	pMainProgram->SetUniform("material1.Ma", glm::vec3(0.2f, 0.5f, 0.2f));  // Ambient
-	pMainProgram->SetUniform("material1.Md", glm::vec3(0.2f, 0.5f, 0.2f));  // Diffuse
-	pMainProgram->SetUniform("material1.Ms", glm::vec3(1.0f));  // Specular
-	pMainProgram->SetUniform("material1.shininess", 50.0f);     // Shininess
-
-	pMainProgram->SetUniform("bUseTexture", true);
-
-	pMainProgram->SetUniform("bUseTexture", false);
-	pMainProgram->SetUniform("material1.Ma", glm::vec3(0.15f));  // Dark grey ambient
-	pMainProgram->SetUniform("material1.Md", glm::vec3(0.15f));  // Dark grey diffuse
-	pMainProgram->SetUniform("material1.Ms", glm::vec3(0.2f));   // Low specular
-	pMainProgram->SetUniform("material1.shininess", 10.0f);      // Low shininess for matte look
-
 	// Render the track
-	m_pCatmullRom->RenderCentreline();
-	m_pCatmullRom->RenderOffsetCurves();
-	m_pCatmullRom->RenderTrack();
-
-	pMainProgram->SetUniform("bUseTexture", true);
-
-	// Render the car
-	pMainProgram->SetUniform("bUseTexture", false);
-	modelViewMatrixStack.Push();
-
-	// Get car's current position and next position
-	glm::vec3 carPos, up;
-	glm::vec3 nextPos;
-	m_pCatmullRom->Sample(m_currentDistance, carPos, up);
-	m_pCatmullRom->Sample(m_currentDistance + 0.1f, nextPos, up);
-
-	// Calculate forward direction and angle
-	glm::vec3 forward = glm::normalize(nextPos - carPos);
-	float angle = atan2(forward.x, forward.z);
-
-	// Apply lateral offset if needed
-	glm::vec3 right = glm::normalize(glm::cross(forward, up));
-	carPos += right * m_carCentrelineOffset;
-
-	// Set position and rotation
-	modelViewMatrixStack.Translate(carPos);
-	modelViewMatrixStack.Rotate(glm::vec3(0.0f, 1.0f, 0.0f), angle);
-
-	// Set blue color for the car
-	pMainProgram->SetUniform("material1.Ma", glm::vec3(0.0f, 0.0f, 0.8f));
-	pMainProgram->SetUniform("material1.Md", glm::vec3(0.0f, 0.0f, 0.8f));
-	pMainProgram->SetUniform("material1.Ms", glm::vec3(0.8f));
-	pMainProgram->SetUniform("material1.shininess", 50.0f);
-
-	// Apply the transformation and render
-	pMainProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-	pMainProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
-	m_pCuboid->Render();
-	modelViewMatrixStack.Pop();
-	pMainProgram->SetUniform("bUseTexture", true);
-
-	// Render the pickups
-	pMainProgram->SetUniform("bUseTexture", false);
-	for (const auto& pickup : m_pickups) {
-		modelViewMatrixStack.Push();
+	if (m_visible[CULL_TRACK][0]) {
+		pProgram = UseMaterial(trackMaterial);
+		pProgram->SetUniform("matrices.modelViewMatrix", m_viewMatrix);
+		pProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(m_viewMatrix));
+		m_pCatmullRom->RenderCentreline();
+		m_pCatmullRom->RenderOffsetCurves();
+		m_pCatmullRom->RenderTrack();
+	}
 
-		modelViewMatrixStack.Translate(pickup.position);
-		modelViewMatrixStack.Scale(3.0f);
+	// Render the props, one instanced draw per mesh and level of detail.  Each prop's level comes from its size on
+	// screen, and the nearest instance decides how much texture detail is needed.
+	for (int horse = 0; horse < 2; horse++) {
+		COpenAssetImportMesh* pMesh = (horse == 1) ? m_pHorseMesh : m_pBarrelMesh;
+		float largestSize = 0.0f;
+		for (unsigned int i = 0; i < m_props.size(); i++) {
+			if (m_props[i].horse == (horse == 1) && m_visible[CULL_PROP][i]) {
+				float size = GetProjectedSize(m_cullBounds[CULL_PROP][i]);
+				m_pPropLods->Select(i, size);
+				largestSize = max(largestSize, size);
+			}
+		}
+		for (int lod = 0; lod < CMeshSimplifier::LOD_COUNT; lod++) {
+			m_pPropInstances->Clear();
+			for (unsigned int i = 0; i < m_props.size(); i++) {
+				if (m_props[i].horse == (horse == 1) && m_visible[CULL_PROP][i] && m_pPropLods->GetLod(i) == lod)
+					m_pPropInstances->AddInstance(m_props[i].model);
+			}
+			if (m_pPropInstances->GetCount() == 0)
+				continue;
+			m_pPropInstances->Upload();
+			pMesh->SetDecodeUniforms(UseMaterial(propMaterial, true, pMesh->IsCompact()));
+			pMesh->RenderInstanced(*m_pPropInstances, lod);
+			m_lodInstanceCounts[lod] += m_pPropInstances->GetCount();
+			m_lodTriangles += m_pPropInstances->GetCount() * pMesh->GetTriangleCount(lod);
+			m_fullDetailTriangles += m_pPropInstances->GetCount() * pMesh->GetTriangleCount(0);
+		}
+		if (largestSize > 0.0f)
+			pMesh->RequestTextureDetail(largestSize);
+	}
 
-		// Set red color for pickups
-		pMainProgram->SetUniform("material1.Ma", glm::vec3(1.0f, 0.0f, 0.0f));
-		pMainProgram->SetUniform("material1.Md", glm::vec3(1.0f, 0.0f, 0.0f));
-		pMainProgram->SetUniform("material1.Ms", glm::vec3(1.0f));
-		pMainProgram->SetUniform("material1.shininess", 50.0f);
+	// Queue the car
+	if (m_visible[CULL_CAR][0])
+		SubmitToQueue(m_cuboidMesh, carMaterial, GetCarModelMatrix());
 
-		pMainProgram->SetUniform("matrices.modelViewMatrix", modelViewMatrixStack.Top());
-		pMainProgram->SetUniform("matrices.normalMatrix", m_pCamera->ComputeNormalMatrix(modelViewMatrixStack.Top()));
+	// Queue the visible part of the stress scene
+	if (m_stressSceneEnabled && !m_gpuCullingActive) {
+		for (unsigned int i = 0; i < m_stressObjects.size(); i++) {
+			if (m_visible[CULL_STRESS][i])
+				SubmitToQueue(m_stressObjects[i].mesh, m_stressMaterials[m_stressObjects[i].material], m_stressObjects[i].model);
+		}
+	}
 
-		m_pPyramid->Render();
+	// Draw everything queued.  The queue calls back whenever it changes program, so the frame uniforms get set.
+	m_pRenderQueue->Flush([this](CShaderProgram* pQueueProgram) {
+		pQueueProgram->UseProgram();
+		SetFrameUniforms(pQueueProgram);
+		m_pCurrentProgram = pQueueProgram;
+	});
+
+	if (m_gpuCullingActive) {
+		// Cull the pickups and stress scene on the GPU and draw whatever survives
+		if (m_pGpuCuller->Cull(*m_pCamera->GetPerspectiveProjectionMatrix(), m_viewMatrix)) {
+			pProgram = m_pMainShaderPermutations->GetProgram(Material().GetShaderKeys(m_fogEnabled) | SHADER_KEY_DRAW_DATA | SHADER_KEY_GPU_CULLED);
+			pProgram->UseProgram();
+			SetFrameUniforms(pProgram);
+			m_pCurrentProgram = pProgram;
+			m_pGpuCuller->Draw();
+		}
+		else
+			m_pCurrentProgram = NULL;
+	}
+	else {
+		// Render the pickups with one instanced draw
+		m_pPickupInstances->Clear();
+		for (unsigned int i = 0; i < m_pickups.size(); i++) {
+			if (m_visible[CULL_PICKUP][i])
+				m_pPickupInstances->AddInstance(GetPickupModelMatrix(m_pickups[i].position));
+		}
+		m_pPickupInstances->Upload();
 
-		modelViewMatrixStack.Pop();
+		UseMaterial(m_pickupMaterial, true);
+		m_pPyramid->RenderInstanced(*m_pPickupInstances);
 	}
-	pMainProgram->SetUniform("bUseTexture", true);
 
-	RenderHUD();
+	// Keep this frame's depth for the next frame's GPU occlusion test
+	if (m_gpuCullingActive)
+		m_pGpuCuller->UpdateHiZ();
 
 	// Draw the 2D graphics after the 3D graphics
+	RenderHUD();
 	DisplayFrameRate();
+	FlushText();
+
+	// Nothing else is streamed this frame
+	m_pStreamingBuffer->EndFrame();
 
 	// Swap buffers to show the rendered image
 	SwapBuffers(m_gameWindow.Hdc());
@@ -417,6 +988,11 @@ void Game::Render()
 // Update method runs repeatedly with the Render method
 void Game::Update()
 {
+	// Pick up shader programs that have finished compiling, and any shader files edited on disk
+	m_pShaderCompileQueue->Update();
+
+	m_lightTime += (float)m_dt / 1000.0f;
+
 	if (m_freeCamera) {
 		// Allow camera to be controlled freely
 		m_pCamera->Update(m_dt);
@@ -543,8 +1119,6 @@ void Game::Update()
 void Game::DisplayFrameRate()
 {
 
-	CShaderProgram* fontProgram = (*m_pShaderPrograms)[1];
-
 	RECT dimensions = m_gameWindow.GetDimensions();
 	int height = dimensions.bottom - dimensions.top;
 
@@ -563,15 +1137,22 @@ void Game::DisplayFrameRate()
 		m_frameCount = 0;
 	}
 
-	if (m_framesPerSecond > 0) {
-		// Use the font shader program and render the text
-		fontProgram->UseProgram();
-		glDisable(GL_DEPTH_TEST);
-		fontProgram->SetUniform("matrices.modelViewMatrix", glm::mat4(1));
-		fontProgram->SetUniform("matrices.projMatrix", m_pCamera->GetOrthographicProjectionMatrix());
-		fontProgram->SetUniform("vColour", glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
-		m_pFtFont->Render(20, height - 20, 20, "FPS: %d", m_framesPerSecond);
-	}
+	// The text object is drawn with the rest of the HUD, and only changes when the rate does
+	CTextObject* pText = m_pHudText[HUD_FPS];
+	pText->SetVisible(m_framesPerSecond > 0);
+	pText->SetPosition(20, height - 20);
+	if (pText->UpdateKey(m_framesPerSecond))
+		pText->Format("FPS: %d", m_framesPerSecond);
+}
+
+// Draws all the text queued this frame with one draw call
+void Game::FlushText()
+{
+	CShaderProgram* fontProgram = (*m_pShaderPrograms)[0];
+	fontProgram->UseProgram();
+	glDisable(GL_DEPTH_TEST);
+	fontProgram->SetUniform("matrices.projMatrix", m_pCamera->GetOrthographicProjectionMatrix());
+	m_pFtFont->Flush();
 }
 
 // The game loop runs repeatedly until game over
@@ -604,15 +1185,8 @@ void Game::RenderHUD()
 	int height = dimensions.bottom - dimensions.top;
 	int width = dimensions.right - dimensions.left;
 
-	// Use the font shader program
-	CShaderProgram* fontProgram = (*m_pShaderPrograms)[1];
-	fontProgram->UseProgram();
-	glDisable(GL_DEPTH_TEST);
-
-	// Set up the orthographic projection matrix
-	fontProgram->SetUniform("matrices.projMatrix", m_pCamera->GetOrthographicProjectionMatrix());
-	fontProgram->SetUniform("matrices.modelViewMatrix", glm::mat4(1));
-	fontProgram->SetUniform("vColour", glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+	// Only text whose value changed is formatted and laid out again; FlushText draws it all
+	CTextObject** pText = m_pHudText;
 
 	// Format time as minutes:seconds.milliseconds
 	int minutes = (int)m_gameTime / 60;
@@ -620,34 +1194,134 @@ void Game::RenderHUD()
 	int milliseconds = (int)((m_gameTime - (int)m_gameTime) * 100);
 
 	// Render time in top left corner
-	m_pFtFont->Render(20, height - 40, 20, "Time: %02d:%02d.%02d", minutes, seconds, milliseconds);
+	pText[HUD_TIME]->SetPosition(20, height - 40);
+	if (pText[HUD_TIME]->UpdateKey((minutes * 60 + seconds) * 100 + milliseconds))
+		pText[HUD_TIME]->Format("Time: %02d:%02d.%02d", minutes, seconds, milliseconds);
 
 	// Render current lap time
+	pText[HUD_LAP]->SetVisible(m_isGameRunning);
+	pText[HUD_BEST]->SetVisible(m_isGameRunning && m_fastestLapTime != FLT_MAX);
+	pText[HUD_SPEED]->SetVisible(m_isGameRunning);
 	if (m_isGameRunning) {
 		minutes = (int)m_currentLapTime / 60;
 		seconds = (int)m_currentLapTime % 60;
 		milliseconds = (int)((m_currentLapTime - (int)m_currentLapTime) * 100);
-		m_pFtFont->Render(20, height - 60, 20, "Lap: %02d:%02d.%02d", minutes, seconds, milliseconds);
+		pText[HUD_LAP]->SetPosition(20, height - 60);
+		if (pText[HUD_LAP]->UpdateKey((minutes * 60 + seconds) * 100 + milliseconds))
+			pText[HUD_LAP]->Format("Lap: %02d:%02d.%02d", minutes, seconds, milliseconds);
 
 		// Render fastest lap if one exists
 		if (m_fastestLapTime != FLT_MAX) {
 			minutes = (int)m_fastestLapTime / 60;
 			seconds = (int)m_fastestLapTime % 60;
 			milliseconds = (int)((m_fastestLapTime - (int)m_fastestLapTime) * 100);
-			m_pFtFont->Render(20, height - 80, 20, "Best: %02d:%02d.%02d", minutes, seconds, milliseconds);
+			pText[HUD_BEST]->SetPosition(20, height - 80);
+			if (pText[HUD_BEST]->UpdateKey((minutes * 60 + seconds) * 100 + milliseconds))
+				pText[HUD_BEST]->Format("Best: %02d:%02d.%02d", minutes, seconds, milliseconds);
 		}
 
 		// Render speed in top right corner
-		m_pFtFont->Render(width - 120, height - 20, 20, "Speed: %.1f", m_carSpeed * 100);
+		pText[HUD_SPEED]->SetPosition(width - 120, height - 20);
+		if (pText[HUD_SPEED]->UpdateKey((int)floorf(m_carSpeed * 1000 + 0.5f)))
+			pText[HUD_SPEED]->Format("Speed: %.1f", m_carSpeed * 100);
+	}
+
+	// Render queue statistics for the stress scene:  without the queue, every command would be its own draw call
+	pText[HUD_QUEUE]->SetVisible(m_stressSceneEnabled);
+	pText[HUD_CULLING]->SetVisible(m_stressSceneEnabled);
+	pText[HUD_OCCLUSION]->SetVisible(m_stressSceneEnabled && m_occlusionCullingEnabled);
+	pText[HUD_GPU_CULLING]->SetVisible(m_stressSceneEnabled && m_gpuCullingEnabled);
+	pText[HUD_STREAMED]->SetVisible(m_stressSceneEnabled && m_pStreamingBuffer->IsCreated());
+	pText[HUD_GLYPHS]->SetVisible(m_stressSceneEnabled);
+	pText[HUD_FONT_CACHE]->SetVisible(m_stressSceneEnabled);
+	pText[HUD_SKYBOX]->SetVisible(m_stressSceneEnabled);
+	pText[HUD_MESHES]->SetVisible(m_stressSceneEnabled);
+	pText[HUD_TEXTURES]->SetVisible(m_stressSceneEnabled);
+	pText[HUD_TEXTURE_STREAMING]->SetVisible(m_stressSceneEnabled);
+	pText[HUD_LOD]->SetVisible(m_stressSceneEnabled);
+	if (m_stressSceneEnabled) {
+		pText[HUD_QUEUE]->Format("Queue: %d commands in %d draws (%.2f ms)",
+			m_pRenderQueue->GetCommandCount(), m_pRenderQueue->GetBatchCount(), m_pRenderQueue->GetFlushTime());
+		pText[HUD_CULLING]->Format("Culling: %d of %d objects visible",
+			(int)m_visibleIds.size(), m_pFrustumCuller->GetStaticCount() + m_pFrustumCuller->GetDynamicCount());
+		if (m_occlusionCullingEnabled)
+			pText[HUD_OCCLUSION]->Format("Occlusion: %d hidden by %d triangles (%.2f ms)",
+				m_occludedCount, m_pOcclusionCuller->GetRasterisedTriangleCount(), m_occlusionTime);
+		if (m_gpuCullingEnabled)
+			pText[HUD_GPU_CULLING]->Format("GPU culling: %d instances%s", m_pGpuCuller->GetInstanceCount(),
+				m_pGpuCuller->IsIndirectCountSupported() ? "" : " (no indirect count)");
+		if (m_pStreamingBuffer->IsCreated())
+			pText[HUD_STREAMED]->Format("Streamed: %.1f KB, %d fence waits, %d overflows", m_pStreamingBuffer->GetBytesStreamed() / 1024.0f,
+				m_pStreamingBuffer->GetFenceWaits(), m_pStreamingBuffer->GetFailedAllocations());
+		pText[HUD_GLYPHS]->Format("Glyphs: %.1f%% hits, %d/%d pages, %.0f%% full, %d evicted",
+			m_pFtFont->GetCacheHitRate() * 100.0f, m_pFtFont->GetAtlasPageCount(), m_pFtFont->GetAtlasMaxPages(),
+			m_pFtFont->GetAtlasOccupancy() * 100.0f, m_pFtFont->GetAtlasEvictions());
+
+		// Startup cost of the font, which does not change after loading
+		if (pText[HUD_FONT_CACHE]->UpdateKey(0)) {
+			if (m_pFtFont->WasLoadedFromCache())
+				pText[HUD_FONT_CACHE]->Format("Font: cached, %.1f ms (%.1f ms saved)", m_pFtFont->GetLoadTime(),
+					m_pFtFont->GetBakeTime() - m_pFtFont->GetLoadTime());
+			else
+				pText[HUD_FONT_CACHE]->Format("Font: baked in %.1f ms, cached for next start", m_pFtFont->GetLoadTime());
+		}
+		if (pText[HUD_SKYBOX]->UpdateKey(0)) {
+			CCubemap* pCubemap = m_pSkybox->GetCubemap();
+			if (pCubemap->WasLoadedFromCache())
+				pText[HUD_SKYBOX]->Format("Skybox: mip cache, %.1f ms (%.1f ms saved)", pCubemap->GetLoadTime(),
+					pCubemap->GetDecodeTime() - pCubemap->GetLoadTime());
+			else
+				pText[HUD_SKYBOX]->Format("Skybox: decoded in %.1f ms, %.1f ms with caching", pCubemap->GetDecodeTime(),
+					pCubemap->GetLoadTime());
+		}
+		if (pText[HUD_MESHES]->UpdateKey(0)) {
+			COpenAssetImportMesh* pMeshes[] = { m_pBarrelMesh, m_pHorseMesh };
+			int iCached = 0, iCompact = 0;
+			double loadTime = 0.0, importTime = 0.0;
+			for (int i = 0; i < 2; i++) {
+				iCached += pMeshes[i]->WasLoadedFromCache() ? 1 : 0;
+				iCompact += pMeshes[i]->IsCompact() ? 1 : 0;
+				loadTime += pMeshes[i]->GetLoadTime();
+				importTime += pMeshes[i]->GetImportTime();
+			}
+			pText[HUD_MESHES]->Format("Meshes: %d/2 from .mesh files, %d/2 compact, %.1f ms (Assimp import %.1f ms)", iCached, iCompact,
+				loadTime, importTime);
+		}
+		if (m_pTextureLoader->GetPendingCount() > 0)
+			pText[HUD_TEXTURES]->Format("Textures: %d loading, %.1f KB uploaded this frame", m_pTextureLoader->GetPendingCount(),
+				m_pTextureLoader->GetBytesUploaded() / 1024.0f);
+		else if (pText[HUD_TEXTURES]->UpdateKey(0))
+			pText[HUD_TEXTURES]->Format("Textures: %d loaded (%d compressed, %.1f MB) %.1f ms after the first request",
+				m_pTextureLoader->GetLoadedCount(), m_pTextureLoader->GetCompressedCount(),
+				m_pTextureLoader->GetTextureBytes() / (1024.0f * 1024.0f), m_pTextureLoader->GetLoadTime());
+		pText[HUD_TEXTURE_STREAMING]->Format("Streaming: %.1f/%.0f MB resident, %.1f MB requested",
+			m_pTextureStreamer->GetResidentBytes() / (1024.0f * 1024.0f), m_pTextureStreamer->GetBudget() / (1024.0f * 1024.0f),
+			m_pTextureStreamer->GetRequestedBytes() / (1024.0f * 1024.0f));
+		pText[HUD_LOD]->Format("LOD: %d/%d/%d/%d props, %.1fk of %.1fk triangles (%.0f%% fewer)", m_lodInstanceCounts[0],
+			m_lodInstanceCounts[1], m_lodInstanceCounts[2], m_lodInstanceCounts[3], m_lodTriangles / 1000.0f,
+			m_fullDetailTriangles / 1000.0f, m_fullDetailTriangles > 0 ? 100.0f * (1.0f - (float)m_lodTriangles / m_fullDetailTriangles) : 0.0f);
 	}
 }
 
+// The stress scene lines sit in the bottom left corner; the rest are placed every frame, as they follow the window size
+void Game::InitializeHudText()
+{
+	for (int i = 0; i < HUD_TEXT_COUNT; i++) {
+		m_pHudText[i] = new CTextObject;
+		m_pHudText[i]->Create(m_pFtFont, HUD_TEXT_CHARS);
+		m_pHudText[i]->SetPixelSize(20);
+		m_pHudText[i]->SetColour(glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+	}
+	for (int i = HUD_QUEUE; i <= HUD_LOD; i++)
+		m_pHudText[i]->SetPosition(20, 20 * (i - HUD_QUEUE + 1));
+}
+
 void Game::InitializePickups() {
 	m_pickups.clear();
 	float trackLength = m_pCatmullRom->GetTotalLength();
-	float spacing = trackLength / NUM_PICKUPS;
+	float spacing = trackLength / m_pickupCount;
 
-	for (int i = 0; i < NUM_PICKUPS; i++) {
+	for (int i = 0; i < m_pickupCount; i++) {
 
 		if (i * spacing < 10.0f) { 
 			continue;
@@ -673,7 +1347,8 @@ void Game::InitializePickups() {
 }
 
 void Game::UpdatePickups() {
-	for (auto& pickup : m_pickups) {
+	for (unsigned int i = 0; i < m_pickups.size(); i++) {
+		Pickup& pickup = m_pickups[i];
 		// Update inactive timer if pickup is inactive
 		if (!pickup.active) {
 			pickup.inactiveTimer += m_dt;
@@ -698,6 +1373,12 @@ void Game::UpdatePickups() {
 			pickup.position = centerPos;
 			pickup.position.x += pickup.lateralOffset;
 			pickup.position.y += PICKUP_HOVER_HEIGHT;
+
+			// The GPU culler keeps its own copy, uploaded by BuildGpuCulledInstances
+			if (m_pyramidMesh >= 0) {
+				glm::mat4 model = GetPickupModelMatrix(pickup.position);
+				m_pGpuCuller->UpdateInstance(i, model, m_pyramidBounds.Transform(model));
+			}
 		}
 	}
 	m_lastCarDistance = m_currentDistance;
@@ -769,6 +1450,7 @@ LRESULT Game::ProcessEvents(HWND window, UINT message, WPARAM w_param, LPARAM l_
 		RECT dimensions;
 		GetClientRect(window, &dimensions);
 		m_gameWindow.SetDimensions(dimensions);
+		Resize(dimensions.right - dimensions.left, dimensions.bottom - dimensions.top);
 		break;
 
 	case WM_PAINT:
@@ -829,6 +1511,33 @@ LRESULT Game::ProcessEvents(HWND window, UINT message, WPARAM w_param, LPARAM l_
 		case 'C':
 			m_fogEnabled = !m_fogEnabled;
 			break;
+		case VK_F2:
+			m_pClusteredLighting->Benchmark("clustered_lighting_benchmark.txt");
+			break;
+		case 'G':
+			m_stressSceneEnabled = !m_stressSceneEnabled;
+			BuildCullingHierarchy();
+			BuildGpuCulledInstances();
+			break;
+		case 'U':
+			m_gpuCullingEnabled = !m_gpuCullingEnabled;
+			BuildCullingHierarchy();
+			break;
+		case 'O':
+			m_occlusionCullingEnabled = !m_occlusionCullingEnabled;
+			break;
+		case VK_F3:
+			CFrustumCuller::Benchmark("frustum_culling_benchmark.txt");
+			break;
+		case VK_F4:
+			CTextureCache::GetInstance().DumpInventory("texture_inventory.txt");
+			break;
+		case 'P':
+			// Switch between the normal pickups and the instancing stress test
+			m_pickupCount = (m_pickupCount == NUM_PICKUPS) ? STRESS_PICKUPS : NUM_PICKUPS;
+			InitializePickups();
+			BuildGpuCulledInstances();
+			break;
 		}
 		break;
 
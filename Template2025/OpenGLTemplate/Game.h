@@ -2,6 +2,9 @@
 
 #include "Common.h"
 #include "GameWindow.h"
+#include "BoundingBox.h"
+#include "Material.h"
+#include "MeshSimplifier.h"
 
 // Classes used in game.  For a new class, declare it here and provide a pointer to an object of this class below.  Then, in Game.cpp, 
 // include the header.  In the Game constructor, set the pointer to NULL and in Game::Initialise, create a new object.  Don't forget to 
@@ -10,15 +13,32 @@ class CCamera;
 class CSkybox;
 class CShader;
 class CShaderProgram;
+class CShaderCompileQueue;
+class CShaderPermutations;
 class CPlane;
 class CFreeTypeFont;
 class CHighResolutionTimer;
 class CSphere;
+class CLodSelector;
 class COpenAssetImportMesh;
 class CAudio;
 class CCatmullRom;
 class CPyramid;
 class CCuboid;
+class CClusteredLighting;
+class CInstanceBuffer;
+class CMeshArena;
+class CRenderQueue;
+class CTexture;
+class CFrustum;
+class CFrustumCuller;
+class CThreadPool;
+class COcclusionCuller;
+class CGpuCuller;
+class CStreamingBuffer;
+class CTextObject;
+class CTextureLoader;
+class CTextureStreamer;
 
 class Game {
 private:
@@ -27,15 +47,114 @@ private:
 	void Update();
 	void Render();
 
+	// Called from WM_SIZE.  Rebuilds everything sized from the window, once Initialise has created it.
+	void Resize(int width, int height);
+
+	// Main shader helpers used by Render
+	CShaderProgram* UseMaterial(const Material& material, bool bInstanced = false, bool bCompactVertex = false);
+	void SetFrameUniforms(CShaderProgram* pProgram);
+	CShaderProgram* m_pCurrentProgram;		// Main shader variant currently bound
+	glm::mat4 m_viewMatrix;					// View matrix for the frame being rendered
+	static const int CUBE_MAP_TEXTURE_UNIT = 10;
+
+	// Point lights for the clustered lighting pass, gathered every frame
+	void UpdateLights();
+	void InitializeTrackLights();
+	static const int NUM_TRACK_LIGHTS = 200;
+	vector<glm::vec3> m_trackLightPositions;
+	float m_lightTime;						// Seconds since startup, used to animate the track lights
+
+	// Deferred render queue.  Meshes are copied into a shared arena so that queued draws can be merged.
+	void SubmitToQueue(int mesh, const Material& material, const glm::mat4& model, CTexture* pTexture = NULL);
+	int m_pyramidMesh, m_cuboidMesh, m_sphereMesh;		// Mesh ids in m_pMeshArena
+
+	// Stress scene of many small objects drawn through the render queue, toggled with 'G'
+	void InitializeStressScene();
+	static const int STRESS_GRID_SIZE = 64;
+	struct StressObject {
+		int mesh;
+		int material;
+		glm::mat4 model;
+	};
+	vector<StressObject> m_stressObjects;
+	vector<Material> m_stressMaterials;
+	bool m_stressSceneEnabled;
+
+	// Model matrices shared by rendering and culling
+	glm::mat4 GetCarModelMatrix();
+	glm::mat4 GetPickupModelMatrix(const glm::vec3& position);
+	glm::mat4 GetStartLightModelMatrix(int i);
+
+	// Scenery props (barrels and horses) placed beside the track
+	void InitializeProps();
+	static const int NUM_PROPS = 40;
+	struct Prop {
+		bool horse;
+		glm::mat4 model;
+	};
+	vector<Prop> m_props;
+
+	// Levels of detail of the props and start lights, picked from their size on screen
+	CLodSelector* m_pPropLods;
+	CLodSelector* m_pStartLightLods;
+	int m_lodInstanceCounts[CMeshSimplifier::LOD_COUNT];	// Props drawn at each level this frame
+	int m_lodTriangles, m_fullDetailTriangles;				// Prop and start light triangles drawn this frame, and at full detail
+
+	// Frustum culling.  Culling ids combine a category with the object's index within that category.
+	enum CullCategory { CULL_TERRAIN, CULL_TRACK, CULL_PROP, CULL_STRESS, CULL_CAR, CULL_PICKUP, CULL_START_LIGHT, CULL_CATEGORY_COUNT };
+	static int CullId(int category, int index) { return (category << 24) | index; }
+	void BuildCullingHierarchy();			// Adds the static objects to the culler's hierarchy
+	void BuildOccluders();					// Adds the occluder meshes to the occlusion culler
+	void CullScene();						// Fills m_visible for the current camera
+	float GetProjectedSize(const BoundingBox& bounds);	// Pixels the bounds span on screen, for texture streaming
+	vector<BoundingBox> m_cullBounds[CULL_CATEGORY_COUNT];	// World space bounds of every object, by category
+	vector<char> m_visible[CULL_CATEGORY_COUNT];
+	vector<int> m_visibleIds;
+
+	// Occlusion culling, toggled with 'O'
+	bool m_occlusionCullingEnabled;
+	int m_occludedCount;
+	double m_occlusionTime;
+	vector<int> m_occlusionIds;
+	vector<BoundingBox> m_occlusionBoxes;
+	vector<char> m_occlusionVisible;
+
+	// GPU-driven culling of the pickups and the stress scene, toggled with 'U'.  While it is on, and once its programs
+	// have linked, those objects are left out of the CPU culling above.
+	void BuildGpuCulledInstances();
+	bool m_gpuCullingEnabled;
+	bool m_gpuCullingActive;					// Enabled and ready; until then the CPU path keeps drawing them
+	Material m_pickupMaterial;
+	BoundingBox m_pyramidBounds, m_cuboidBounds, m_sphereBounds;		// Object space bounds of the shared shapes
+
 	// Pointers to game objects.  They will get allocated in Game::Initialise()
 	CSkybox *m_pSkybox;
 	CCamera *m_pCamera;
 	vector <CShaderProgram *> *m_pShaderPrograms;
+	CShaderCompileQueue *m_pShaderCompileQueue;
+	CShaderPermutations *m_pMainShaderPermutations;
 	CPlane *m_pPlanarTerrain;
 	CFreeTypeFont *m_pFtFont;
 	CSphere *m_pSphere;
 	CPyramid *m_pPyramid;
 	CCuboid* m_pCuboid;
+	CClusteredLighting* m_pClusteredLighting;
+	CInstanceBuffer* m_pPickupInstances;
+	CInstanceBuffer* m_pStartLightInstances;
+	CMeshArena* m_pMeshArena;
+	CRenderQueue* m_pRenderQueue;
+	CFrustum* m_pFrustum;
+	CFrustumCuller* m_pFrustumCuller;
+	CThreadPool* m_pThreadPool;
+	COcclusionCuller* m_pOcclusionCuller;
+	CGpuCuller* m_pGpuCuller;
+	CStreamingBuffer* m_pStreamingBuffer;
+	static const int STREAMING_REGION_SIZE = 8 * 1024 * 1024;	// Bytes per frame
+	CTextureLoader* m_pTextureLoader;
+	CTextureStreamer* m_pTextureStreamer;
+	COpenAssetImportMesh* m_pBarrelMesh;
+	COpenAssetImportMesh* m_pHorseMesh;
+	CInstanceBuffer* m_pPropInstances;
 	CHighResolutionTimer *m_pHighResolutionTimer;
 	CAudio *m_pAudio;
 
@@ -78,12 +197,23 @@ private:
 	float m_gameTime;
 	bool m_isGameRunning;
 	void RenderHUD();
+	void FlushText();
+
+	// HUD text is held in text objects, which are only laid out again when what they show changes
+	enum HudText { HUD_FPS, HUD_TIME, HUD_LAP, HUD_BEST, HUD_SPEED, HUD_QUEUE, HUD_CULLING, HUD_OCCLUSION, HUD_GPU_CULLING,
+		HUD_STREAMED, HUD_GLYPHS, HUD_FONT_CACHE, HUD_SKYBOX, HUD_MESHES, HUD_TEXTURES, HUD_TEXTURE_STREAMING, HUD_LOD, HUD_TEXT_COUNT };
+	static const int HUD_TEXT_CHARS = 64;
+	void InitializeHudText();
+	CTextObject* m_pHudText[HUD_TEXT_COUNT];
 
 	// Pickup system
 	void InitializePickups();
 	void UpdatePickups();
 
 	static const int NUM_PICKUPS = 20;
+	static const int STRESS_PICKUPS = 10000;	// Pickup count used by the instancing stress test ('P')
+	static const int MAX_PICKUP_LIGHTS = 256;	// Only this many pickups get a glow light
+	int m_pickupCount;
 	static const int PICKUP_HOVER_HEIGHT = 1;
 	static const int TRACK_WIDTH = 20;
 	const float PICKUP_INACTIVE_TIME = 1.0f;
@@ -199,7 +199,7 @@ void GameWindow::InitOpenGL()
 	PIXELFORMATDESCRIPTOR pfd;
 
 	int iMajorVersion = 4;
-	int iMinorVersion = 0;
+	int iMinorVersion = 3;
 
 	if(iMajorVersion <= 2)
 	{
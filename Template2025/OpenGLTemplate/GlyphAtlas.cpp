@@ -0,0 +1,265 @@
+#include "GlyphAtlas.h"
+
+CGlyphAtlas::CGlyphAtlas()
+{
+	m_iPageSize = 0;
+	m_iEvictions = 0;
+	m_uiTexture = 0;
+	m_uiSampler = 0;
+}
+
+CGlyphAtlas::~CGlyphAtlas()
+{
+	Release();
+}
+
+void CGlyphAtlas::Create(int iPageSize, int iBudgetBytes)
+{
+	m_iPageSize = iPageSize;
+	m_iEvictions = 0;
+	int iPages = min(max(iBudgetBytes / (iPageSize * iPageSize), 1), (int)MAX_PAGES);
+	m_vPages.resize(iPages);
+
+	glGenTextures(1, &m_uiTexture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_uiTexture);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_R8, iPageSize, iPageSize, iPages);
+	for (int i = 0; i < iPages; i++) {
+		ResetPage(i);
+		m_vPages[i].bInUse = false;
+	}
+
+	glGenSamplers(1, &m_uiSampler);
+	glSamplerParameteri(m_uiSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glSamplerParameteri(m_uiSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glSamplerParameteri(m_uiSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glSamplerParameteri(m_uiSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+// Empties a page's skyline and clears its texels, so padding around glyphs is empty
+void CGlyphAtlas::ResetPage(int iPage)
+{
+	Page& page = m_vPages[iPage];
+	page.skyline.clear();
+	SkylineNode node = { 0, 0, m_iPageSize };
+	page.skyline.push_back(node);
+	page.iUsedArea = 0;
+	page.uiLastUsed = 0;
+
+	vector<BYTE> vEmpty(m_iPageSize * m_iPageSize, 0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_uiTexture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, iPage, m_iPageSize, m_iPageSize, 1, GL_RED, GL_UNSIGNED_BYTE, &vEmpty[0]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+bool CGlyphAtlas::AddBitmap(const BYTE* pData, int iWidth, int iHeight, int& iPage, int& iX, int& iY)
+{
+	// Try the pages in use first, then start a new one
+	iPage = -1;
+	for (int i = 0; i < (int)m_vPages.size() && iPage < 0; i++) {
+		if (m_vPages[i].bInUse && Pack(m_vPages[i], iWidth + 2, iHeight + 2, iX, iY))
+			iPage = i;
+	}
+	for (int i = 0; i < (int)m_vPages.size() && iPage < 0; i++) {
+		if (!m_vPages[i].bInUse && Pack(m_vPages[i], iWidth + 2, iHeight + 2, iX, iY)) {
+			m_vPages[i].bInUse = true;
+			iPage = i;
+		}
+	}
+	if (iPage < 0)
+		return false;
+
+	m_vPages[iPage].iUsedArea += (iWidth + 2) * (iHeight + 2);
+	iX++;
+	iY++;
+
+	if (iWidth > 0 && iHeight > 0) {
+		glBindTexture(GL_TEXTURE_2D_ARRAY, m_uiTexture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, iX, iY, iPage, iWidth, iHeight, 1, GL_RED, GL_UNSIGNED_BYTE, pData);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+	return true;
+}
+
+int CGlyphAtlas::EvictLeastRecentlyUsed(unsigned int uiFrame)
+{
+	int iOldest = -1;
+	for (int i = 0; i < (int)m_vPages.size(); i++) {
+		const Page& page = m_vPages[i];
+		if (!page.bInUse || page.uiLastUsed == uiFrame)
+			continue;
+		if (iOldest < 0 || page.uiLastUsed < m_vPages[iOldest].uiLastUsed)
+			iOldest = i;
+	}
+	if (iOldest < 0)
+		return -1;
+
+	ResetPage(iOldest);
+	m_vPages[iOldest].bInUse = false;
+	m_iEvictions++;
+	return iOldest;
+}
+
+void CGlyphAtlas::TouchPage(int iPage, unsigned int uiFrame)
+{
+	m_vPages[iPage].uiLastUsed = uiFrame;
+}
+
+int CGlyphAtlas::FitAt(const Page& page, int iNode, int iWidth, int iHeight)
+{
+	const vector<SkylineNode>& skyline = page.skyline;
+	int x = skyline[iNode].x;
+	if (x + iWidth > m_iPageSize)
+		return -1;
+
+	// The rectangle rests on the highest segment under it
+	int y = 0;
+	int iWidthLeft = iWidth;
+	for (int i = iNode; iWidthLeft > 0; i++) {
+		y = max(y, skyline[i].y);
+		if (y + iHeight > m_iPageSize)
+			return -1;
+		iWidthLeft -= skyline[i].width;
+	}
+	return y;
+}
+
+bool CGlyphAtlas::Pack(Page& page, int iWidth, int iHeight, int& iX, int& iY)
+{
+	vector<SkylineNode>& skyline = page.skyline;
+	int iBestNode = -1;
+	int iBestBottom = INT_MAX;
+	int iBestWidth = INT_MAX;
+	for (int i = 0; i < (int)skyline.size(); i++) {
+		int y = FitAt(page, i, iWidth, iHeight);
+		if (y < 0)
+			continue;
+		if (y + iHeight < iBestBottom || (y + iHeight == iBestBottom && skyline[i].width < iBestWidth)) {
+			iBestNode = i;
+			iBestBottom = y + iHeight;
+			iBestWidth = skyline[i].width;
+		}
+	}
+	if (iBestNode < 0)
+		return false;
+
+	iX = skyline[iBestNode].x;
+	iY = iBestBottom - iHeight;
+
+	// Raise the skyline over the new rectangle, and trim or remove the segments it now covers
+	SkylineNode node = { iX, iBestBottom, iWidth };
+	skyline.insert(skyline.begin() + iBestNode, node);
+	for (int i = iBestNode + 1; i < (int)skyline.size(); ) {
+		SkylineNode& previous = skyline[i - 1];
+		int iOverlap = previous.x + previous.width - skyline[i].x;
+		if (iOverlap <= 0)
+			break;
+		skyline[i].x += iOverlap;
+		skyline[i].width -= iOverlap;
+		if (skyline[i].width > 0)
+			break;
+		skyline.erase(skyline.begin() + i);
+	}
+
+	// Merge neighbouring segments at the same height
+	for (int i = 0; i + 1 < (int)skyline.size(); ) {
+		if (skyline[i].y == skyline[i + 1].y) {
+			skyline[i].width += skyline[i + 1].width;
+			skyline.erase(skyline.begin() + i + 1);
+		} else
+			i++;
+	}
+	return true;
+}
+
+void CGlyphAtlas::GetPageLayout(int iPage, vector<SkylineNode>& nodes, int& iUsedArea)
+{
+	nodes = m_vPages[iPage].skyline;
+	iUsedArea = m_vPages[iPage].iUsedArea;
+}
+
+// Uploads a whole page image, such as one read from a file mapping, and takes over its packing state
+void CGlyphAtlas::RestorePage(int iPage, const BYTE* pImage, const vector<SkylineNode>& nodes, int iUsedArea)
+{
+	Page& page = m_vPages[iPage];
+	page.skyline = nodes;
+	page.iUsedArea = iUsedArea;
+	page.bInUse = true;
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_uiTexture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, iPage, m_iPageSize, m_iPageSize, 1, GL_RED, GL_UNSIGNED_BYTE, pImage);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+bool CGlyphAtlas::IsValidLayout(const vector<SkylineNode>& nodes, int iUsedArea)
+{
+	if (nodes.empty() || iUsedArea < 0 || iUsedArea > m_iPageSize * m_iPageSize)
+		return false;
+	int x = 0;
+	for (unsigned int i = 0; i < nodes.size(); i++) {
+		if (nodes[i].x != x || nodes[i].width <= 0 || nodes[i].width > m_iPageSize - x || nodes[i].y < 0 || nodes[i].y > m_iPageSize)
+			return false;
+		x += nodes[i].width;
+	}
+	return x == m_iPageSize;
+}
+
+void CGlyphAtlas::Bind(int iTextureUnit)
+{
+	glActiveTexture(GL_TEXTURE0 + iTextureUnit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, m_uiTexture);
+	glBindSampler(iTextureUnit, m_uiSampler);
+}
+
+int CGlyphAtlas::GetPageSize()
+{
+	return m_iPageSize;
+}
+
+int CGlyphAtlas::GetPageCount()
+{
+	int iCount = 0;
+	for (unsigned int i = 0; i < m_vPages.size(); i++)
+		if (m_vPages[i].bInUse)
+			iCount++;
+	return iCount;
+}
+
+int CGlyphAtlas::GetMaxPages()
+{
+	return (int)m_vPages.size();
+}
+
+float CGlyphAtlas::GetOccupancy()
+{
+	int iUsed = 0, iPages = 0;
+	for (unsigned int i = 0; i < m_vPages.size(); i++) {
+		if (m_vPages[i].bInUse) {
+			iUsed += m_vPages[i].iUsedArea;
+			iPages++;
+		}
+	}
+	if (iPages == 0)
+		return 0.0f;
+	return (float)iUsed / ((float)iPages * m_iPageSize * m_iPageSize);
+}
+
+int CGlyphAtlas::GetEvictionCount()
+{
+	return m_iEvictions;
+}
+
+void CGlyphAtlas::Release()
+{
+	if (m_uiTexture != 0) {
+		glDeleteTextures(1, &m_uiTexture);
+		m_uiTexture = 0;
+	}
+	if (m_uiSampler != 0) {
+		glDeleteSamplers(1, &m_uiSampler);
+		m_uiSampler = 0;
+	}
+	m_vPages.clear();
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "Common.h"
+
+// Single channel texture pages that glyph bitmaps are packed into, so a whole frame of text can be drawn with one
+// texture bound.  The pages are layers of one array texture, allocated up to a memory budget when the atlas is
+// created; pages are handed out as they are needed.  Within a page, rectangles are placed with a skyline packer: the
+// top edge of everything packed so far is kept as a list of horizontal segments, and each new rectangle goes where it
+// ends up lowest, ties broken by the narrower segment.  This wastes little space for glyphs, which are all of similar
+// height.
+//
+// A skyline cannot give back single rectangles, so when every page is full the least recently used page is cleared
+// as a whole.  The owner marks pages used each frame with TouchPage, and pages used in the current frame are never
+// evicted, so vertices already queued this frame stay valid.
+class CGlyphAtlas
+{
+public:
+	CGlyphAtlas();
+	~CGlyphAtlas();
+
+	// Allocates as many iPageSize square pages as fit in iBudgetBytes, at least one and at most MAX_PAGES
+	void Create(int iPageSize, int iBudgetBytes);
+
+	// Packs a tightly packed 8 bit bitmap (rows from the top) into the first page with room, and uploads it.  Returns
+	// false if no page has room.  The position is in texels; a texel of padding is left around each bitmap so linear
+	// filtering does not bleed.
+	bool AddBitmap(const BYTE* pData, int iWidth, int iHeight, int& iPage, int& iX, int& iY);
+
+	// Clears the least recently used page that was not touched in uiFrame and returns it, or -1 if there is none
+	int EvictLeastRecentlyUsed(unsigned int uiFrame);
+	void TouchPage(int iPage, unsigned int uiFrame);
+
+	// A page's packing state, so a prebaked page can be restored along with its image and packed into further
+	struct SkylineNode {
+		int x, y, width;
+	};
+	void GetPageLayout(int iPage, vector<SkylineNode>& nodes, int& iUsedArea);
+	void RestorePage(int iPage, const BYTE* pImage, const vector<SkylineNode>& nodes, int iUsedArea);
+
+	// Whether a layout read from a file can be restored: segments of positive width lying side by side across the
+	// whole page, in order, each no higher than the page, and a used area that fits in it
+	bool IsValidLayout(const vector<SkylineNode>& nodes, int iUsedArea);
+
+	void Bind(int iTextureUnit = 0);
+	int GetPageSize();
+	int GetPageCount();							// Pages in use
+	int GetMaxPages();
+	float GetOccupancy();						// Fraction of the in-use pages' texels covered by packed rectangles
+	int GetEvictionCount();
+	void Release();
+
+	static const int MAX_PAGES = 32;			// Pages are tracked in 32 bit masks
+
+private:
+	struct Page {
+		vector<SkylineNode> skyline;
+		int iUsedArea;
+		unsigned int uiLastUsed;
+		bool bInUse;
+	};
+
+	void ResetPage(int iPage);
+	bool Pack(Page& page, int iWidth, int iHeight, int& iX, int& iY);
+	int FitAt(const Page& page, int iNode, int iWidth, int iHeight);	// Returns the y the rectangle would sit at, or -1
+
+	vector<Page> m_vPages;
+	int m_iPageSize;
+	int m_iEvictions;
+	UINT m_uiTexture;
+	UINT m_uiSampler;
+};
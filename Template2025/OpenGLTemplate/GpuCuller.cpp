@@ -0,0 +1,325 @@
+#include "GpuCuller.h"
+#include "MeshArena.h"
+#include "Frustum.h"
+#include "ShaderCompileQueue.h"
+
+#include <map>
+
+#define BUFFER_OFFSET(i) ((char *)NULL + (i))
+
+// Storage buffer bindings used by the compute passes only
+static const int CULL_INSTANCE_BUFFER_BINDING = 5;
+static const int COMMAND_BUFFER_BINDING = 6;
+static const int DRAW_COMMAND_BUFFER_BINDING = 7;
+static const int DRAW_COUNT_BUFFER_BINDING = 8;
+
+// Work group sizes, matching local_size_x and local_size_x/y in the compute shaders
+static const int CULL_GROUP_SIZE = 64;
+static const int HIZ_GROUP_SIZE = 8;
+
+CGpuCuller::CGpuCuller()
+{
+	m_pArena = NULL;
+	m_iCommandCount = 0;
+	m_uiDrawDataBuffer = m_uiCullInstanceBuffer = m_uiInstanceIndexBuffer = 0;
+	m_uiCommandTemplateBuffer = m_uiCommandBuffer = m_uiDrawCommandBuffer = m_uiDrawCountBuffer = 0;
+	m_iScreenWidth = m_iScreenHeight = 0;
+	m_iHiZLevels = 0;
+	m_uiDepthTexture = m_uiHiZTexture = 0;
+	m_bHiZValid = false;
+	m_bHiZEnabled = true;
+	m_bCulled = false;
+}
+
+CGpuCuller::~CGpuCuller()
+{
+	Release();
+}
+
+void CGpuCuller::Create(CMeshArena* pArena, CShaderCompileQueue* pCompileQueue, int iScreenWidth, int iScreenHeight)
+{
+	m_pArena = pArena;
+
+	pCompileQueue->Submit(&m_cullProgram, { "gpuCull.comp" });
+	pCompileQueue->Submit(&m_compactProgram, { "gpuCompact.comp" });
+	pCompileQueue->Submit(&m_hiZProgram, { "hiZ.comp" });
+
+	glGenBuffers(1, &m_uiDrawDataBuffer);
+	glGenBuffers(1, &m_uiCullInstanceBuffer);
+	glGenBuffers(1, &m_uiInstanceIndexBuffer);
+	glGenBuffers(1, &m_uiCommandTemplateBuffer);
+	glGenBuffers(1, &m_uiCommandBuffer);
+	glGenBuffers(1, &m_uiDrawCommandBuffer);
+	glGenBuffers(1, &m_uiDrawCountBuffer);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_uiDrawCountBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	CreateHiZ(iScreenWidth, iScreenHeight);
+}
+
+void CGpuCuller::Resize(int iScreenWidth, int iScreenHeight)
+{
+	if (m_uiHiZTexture == 0 || (iScreenWidth == m_iScreenWidth && iScreenHeight == m_iScreenHeight))
+		return;
+	ReleaseHiZ();
+	CreateHiZ(iScreenWidth, iScreenHeight);
+}
+
+// Depth copy, and a Hi-Z pyramid with every level down to 1x1
+void CGpuCuller::CreateHiZ(int iScreenWidth, int iScreenHeight)
+{
+	m_iScreenWidth = iScreenWidth;
+	m_iScreenHeight = iScreenHeight;
+
+	glGenTextures(1, &m_uiDepthTexture);
+	glBindTexture(GL_TEXTURE_2D, m_uiDepthTexture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, iScreenWidth, iScreenHeight);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	m_iHiZLevels = 1;
+	while ((max(iScreenWidth, iScreenHeight) >> m_iHiZLevels) > 0)
+		m_iHiZLevels++;
+
+	glGenTextures(1, &m_uiHiZTexture);
+	glBindTexture(GL_TEXTURE_2D, m_uiHiZTexture);
+	glTexStorage2D(GL_TEXTURE_2D, m_iHiZLevels, GL_R32F, iScreenWidth, iScreenHeight);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void CGpuCuller::ReleaseHiZ()
+{
+	if (m_uiHiZTexture != 0) {
+		glDeleteTextures(1, &m_uiDepthTexture);
+		glDeleteTextures(1, &m_uiHiZTexture);
+		m_uiDepthTexture = m_uiHiZTexture = 0;
+	}
+	m_bHiZValid = false;
+}
+
+void CGpuCuller::ClearInstances()
+{
+	m_vInstanceMeshes.clear();
+	m_vDrawData.clear();
+	m_vCullInstances.clear();
+}
+
+void CGpuCuller::AddInstance(int iMesh, const Material& material, const glm::mat4& modelMatrix, const BoundingBox& worldBounds)
+{
+	if (iMesh < 0)
+		return;
+
+	m_vInstanceMeshes.push_back(iMesh);
+	m_vDrawData.push_back(DrawData(material, modelMatrix));
+
+	CullInstance cullInstance;
+	cullInstance.boundsMin = glm::vec4(worldBounds.min, 1.0f);
+	cullInstance.boundsMax = glm::vec4(worldBounds.max, 1.0f);
+	cullInstance.info = glm::ivec4(0);
+	m_vCullInstances.push_back(cullInstance);
+}
+
+// Makes one command per mesh, and gives each command a slice of the instance index buffer big enough for all of its
+// instances, starting at its baseInstance
+void CGpuCuller::Upload()
+{
+	std::map<int, int> commandOfMesh;
+	vector<DrawElementsIndirectCommand> vCommands;
+	for (unsigned int i = 0; i < m_vInstanceMeshes.size(); i++) {
+		int iMesh = m_vInstanceMeshes[i];
+		if (commandOfMesh.find(iMesh) == commandOfMesh.end()) {
+			const MeshRange& range = m_pArena->GetMesh(iMesh);
+			DrawElementsIndirectCommand command = { range.indexCount, 0, range.firstIndex, range.baseVertex, 0 };
+			commandOfMesh[iMesh] = (int)vCommands.size();
+			vCommands.push_back(command);
+		}
+		int iCommand = commandOfMesh[iMesh];
+		m_vCullInstances[i].info.x = iCommand;
+		vCommands[iCommand].baseInstance++;
+	}
+
+	unsigned int uiOffset = 0;
+	for (unsigned int i = 0; i < vCommands.size(); i++) {
+		unsigned int uiCount = vCommands[i].baseInstance;
+		vCommands[i].baseInstance = uiOffset;
+		uiOffset += uiCount;
+	}
+	m_iCommandCount = (int)vCommands.size();
+	if (m_vDrawData.empty())
+		return;
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_uiDrawDataBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, m_vDrawData.size() * sizeof(DrawData), &m_vDrawData[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_uiCullInstanceBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, m_vCullInstances.size() * sizeof(CullInstance), &m_vCullInstances[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_uiInstanceIndexBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, m_vDrawData.size() * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_uiCommandTemplateBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, vCommands.size() * sizeof(DrawElementsIndirectCommand), &vCommands[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_uiCommandBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, vCommands.size() * sizeof(DrawElementsIndirectCommand), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_uiDrawCommandBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, vCommands.size() * sizeof(DrawElementsIndirectCommand), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// Only the instance's own entries are rewritten, so its command and slice of the instance index buffer stay the same
+void CGpuCuller::UpdateInstance(int iInstance, const glm::mat4& modelMatrix, const BoundingBox& worldBounds)
+{
+	if (iInstance < 0 || iInstance >= (int)m_vDrawData.size())
+		return;
+
+	m_vDrawData[iInstance].modelMatrix = modelMatrix;
+	CullInstance& cullInstance = m_vCullInstances[iInstance];
+	cullInstance.boundsMin = glm::vec4(worldBounds.min, 1.0f);
+	cullInstance.boundsMax = glm::vec4(worldBounds.max, 1.0f);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_uiDrawDataBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, iInstance * sizeof(DrawData), sizeof(DrawData), &m_vDrawData[iInstance]);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_uiCullInstanceBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, iInstance * sizeof(CullInstance), sizeof(CullInstance), &cullInstance);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+bool CGpuCuller::IsReady()
+{
+	return m_cullProgram.IsLinked() && m_compactProgram.IsLinked();
+}
+
+bool CGpuCuller::Cull(const glm::mat4& projectionMatrix, const glm::mat4& viewMatrix)
+{
+	m_viewProjection = projectionMatrix * viewMatrix;
+	m_bCulled = false;
+	if (m_vDrawData.empty() || !IsReady())
+		return false;
+
+	// Reset the commands' instance counts and the draw count
+	glBindBuffer(GL_COPY_READ_BUFFER, m_uiCommandTemplateBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, m_uiCommandBuffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, m_iCommandCount * sizeof(DrawElementsIndirectCommand));
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_uiDrawCountBuffer);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCE_INDEX_BUFFER_BINDING, m_uiInstanceIndexBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_INSTANCE_BUFFER_BINDING, m_uiCullInstanceBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMMAND_BUFFER_BINDING, m_uiCommandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_COMMAND_BUFFER_BINDING, m_uiDrawCommandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_COUNT_BUFFER_BINDING, m_uiDrawCountBuffer);
+
+	// Cull the instances
+	CFrustum frustum;
+	frustum.Set(projectionMatrix, viewMatrix);
+	glm::vec4 planes[CFrustum::NUM_PLANES];
+	for (int i = 0; i < CFrustum::NUM_PLANES; i++)
+		planes[i] = frustum.GetPlane(i);
+
+	m_cullProgram.UseProgram();
+	m_cullProgram.SetUniform("frustumPlanes", planes, CFrustum::NUM_PLANES);
+	m_cullProgram.SetUniform("instanceCount", (int)m_vDrawData.size());
+	m_cullProgram.SetUniform("hiZEnabled", (m_bHiZValid && m_bHiZEnabled) ? 1 : 0);
+	m_cullProgram.SetUniform("hiZViewProjection", m_hiZViewProjection);
+	m_cullProgram.SetUniform("hiZSize", glm::vec2((float)m_iScreenWidth, (float)m_iScreenHeight));
+	m_cullProgram.SetUniform("hiZLevels", m_iHiZLevels);
+	m_cullProgram.SetUniform("hiZ", 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, m_uiHiZTexture);
+	glBindSampler(0, 0);
+	glDispatchCompute((m_vDrawData.size() + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	// Move the commands that have instances to the front
+	m_compactProgram.UseProgram();
+	m_compactProgram.SetUniform("commandCount", m_iCommandCount);
+	glDispatchCompute((m_iCommandCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+	m_bCulled = true;
+	return true;
+}
+
+void CGpuCuller::Draw()
+{
+	if (!m_bCulled)
+		return;
+
+	m_pArena->Bind();
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CRenderQueue::DRAW_DATA_BUFFER_BINDING, m_uiDrawDataBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCE_INDEX_BUFFER_BINDING, m_uiInstanceIndexBuffer);
+
+	if (IsIndirectCountSupported()) {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_uiDrawCommandBuffer);
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, m_uiDrawCountBuffer);
+		glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, BUFFER_OFFSET(0), 0, m_iCommandCount, 0);
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+	}
+	else {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_uiCommandBuffer);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, BUFFER_OFFSET(0), m_iCommandCount, 0);
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+// Level 0 is the depth buffer itself.  Each further level holds the farthest depth of the texels below it.
+void CGpuCuller::UpdateHiZ()
+{
+	if (m_uiHiZTexture == 0 || !m_hiZProgram.IsLinked())
+		return;
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, m_uiDepthTexture);
+	glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, m_iScreenWidth, m_iScreenHeight);
+	glBindSampler(0, 0);
+
+	m_hiZProgram.UseProgram();
+	m_hiZProgram.SetUniform("depthTexture", 0);
+	for (int iLevel = 0; iLevel < m_iHiZLevels; iLevel++) {
+		int iWidth = max(m_iScreenWidth >> iLevel, 1);
+		int iHeight = max(m_iScreenHeight >> iLevel, 1);
+
+		m_hiZProgram.SetUniform("level", iLevel);
+		if (iLevel > 0)
+			glBindImageTexture(0, m_uiHiZTexture, iLevel - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glBindImageTexture(1, m_uiHiZTexture, iLevel, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glDispatchCompute((iWidth + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, (iHeight + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	m_hiZViewProjection = m_viewProjection;
+	m_bHiZValid = true;
+}
+
+void CGpuCuller::SetHiZEnabled(bool bEnabled)
+{
+	m_bHiZEnabled = bEnabled;
+}
+
+int CGpuCuller::GetInstanceCount()
+{
+	return (int)m_vDrawData.size();
+}
+
+bool CGpuCuller::IsIndirectCountSupported()
+{
+	return GLEW_ARB_indirect_parameters != 0;
+}
+
+void CGpuCuller::Release()
+{
+	if (m_uiDrawDataBuffer != 0) {
+		UINT buffers[] = { m_uiDrawDataBuffer, m_uiCullInstanceBuffer, m_uiInstanceIndexBuffer, m_uiCommandTemplateBuffer,
+			m_uiCommandBuffer, m_uiDrawCommandBuffer, m_uiDrawCountBuffer };
+		glDeleteBuffers(7, buffers);
+		m_uiDrawDataBuffer = m_uiCullInstanceBuffer = m_uiInstanceIndexBuffer = 0;
+		m_uiCommandTemplateBuffer = m_uiCommandBuffer = m_uiDrawCommandBuffer = m_uiDrawCountBuffer = 0;
+	}
+	ReleaseHiZ();
+	m_cullProgram.DeleteProgram();
+	m_compactProgram.DeleteProgram();
+	m_hiZProgram.DeleteProgram();
+	ClearInstances();
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "Common.h"
+#include "Material.h"
+#include "BoundingBox.h"
+#include "RenderQueue.h"
+#include "Shaders.h"
+
+class CMeshArena;
+class CShaderCompileQueue;
+
+// GPU-driven culling of many static instances of meshes in a CMeshArena.  The instances are uploaded once.  Each frame
+//  1. gpuCull.comp tests every instance's bounds against the frustum and against a Hi-Z pyramid (the farthest depth
+//     of each region of the previous frame's depth buffer), and appends the survivors to their mesh's slice of the
+//     instance index buffer, counting them in that mesh's DrawElementsIndirectCommand
+//  2. gpuCompact.comp copies the commands with at least one instance to the front of the draw command buffer and
+//     counts them
+//  3. Draw() issues glMultiDrawElementsIndirectCountARB, so the number of draws is read from the GPU too
+// The CPU cost per frame does not depend on the number of instances.  Without GL_ARB_indirect_parameters, every
+// command is drawn with glMultiDrawElementsIndirect, and those with no visible instances draw nothing.
+//
+// Instances are drawn with the DRAW_DATA and GPU_CULLED variant of mainShader, which finds its DrawData through
+// the instance index buffer instead of the draw id.
+class CGpuCuller
+{
+public:
+	CGpuCuller();
+	~CGpuCuller();
+
+	// Submits the compute programs to the compile queue and creates a Hi-Z pyramid for a screen of the given size
+	void Create(CMeshArena* pArena, CShaderCompileQueue* pCompileQueue, int iScreenWidth, int iScreenHeight);
+
+	// Recreates the Hi-Z pyramid for a new screen size.  Culling ignores it until UpdateHiZ has filled it again.
+	void Resize(int iScreenWidth, int iScreenHeight);
+
+	void ClearInstances();
+	void AddInstance(int iMesh, const Material& material, const glm::mat4& modelMatrix, const BoundingBox& worldBounds);
+	void Upload();								// Call after adding instances
+
+	// Moves an instance already uploaded, given in the order it was added
+	void UpdateInstance(int iInstance, const glm::mat4& modelMatrix, const BoundingBox& worldBounds);
+
+	bool IsReady();								// Whether the culling programs have linked, so Cull can run
+
+	// Runs the culling passes.  Returns false (and Draw does nothing) if the programs are still compiling or there
+	// are no instances.
+	bool Cull(const glm::mat4& projectionMatrix, const glm::mat4& viewMatrix);
+
+	// Draws the visible instances with whatever program is bound
+	void Draw();
+
+	// Copies the current depth buffer and builds the Hi-Z pyramid used by the next Cull.  Call after the opaque scene
+	// has been drawn.
+	void UpdateHiZ();
+
+	void SetHiZEnabled(bool bEnabled);
+	int GetInstanceCount();
+	bool IsIndirectCountSupported();
+	void Release();
+
+	static const int INSTANCE_INDEX_BUFFER_BINDING = 4;		// Read by mainShader.vert; DrawData uses RenderQueue's binding
+
+private:
+	// Bounds read by gpuCull.comp.  Laid out for std430.
+	struct CullInstance {
+		glm::vec4 boundsMin;
+		glm::vec4 boundsMax;
+		glm::ivec4 info;						// x: index of the instance's command
+	};
+
+	struct DrawElementsIndirectCommand {
+		unsigned int count;
+		unsigned int instanceCount;
+		unsigned int firstIndex;
+		int baseVertex;
+		unsigned int baseInstance;
+	};
+
+	void CreateHiZ(int iScreenWidth, int iScreenHeight);
+	void ReleaseHiZ();
+
+	CMeshArena* m_pArena;
+	CShaderProgram m_cullProgram;
+	CShaderProgram m_compactProgram;
+	CShaderProgram m_hiZProgram;
+
+	vector<int> m_vInstanceMeshes;
+	vector<DrawData> m_vDrawData;
+	vector<CullInstance> m_vCullInstances;
+	int m_iCommandCount;
+
+	UINT m_uiDrawDataBuffer;
+	UINT m_uiCullInstanceBuffer;
+	UINT m_uiInstanceIndexBuffer;
+	UINT m_uiCommandTemplateBuffer;			// Commands with no instances, copied over m_uiCommandBuffer each frame
+	UINT m_uiCommandBuffer;
+	UINT m_uiDrawCommandBuffer;
+	UINT m_uiDrawCountBuffer;
+
+	int m_iScreenWidth, m_iScreenHeight;
+	int m_iHiZLevels;
+	UINT m_uiDepthTexture;					// Copy of the default framebuffer's depth
+	UINT m_uiHiZTexture;					// R32F, full mip chain
+	bool m_bHiZValid;
+	bool m_bHiZEnabled;
+	bool m_bCulled;							// Whether Cull ran this frame
+	glm::mat4 m_viewProjection;				// This frame's, stored with the pyramid by UpdateHiZ
+	glm::mat4 m_hiZViewProjection;			// The one the pyramid was rendered with
+};
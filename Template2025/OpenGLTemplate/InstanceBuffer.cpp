@@ -0,0 +1,91 @@
+#include "InstanceBuffer.h"
+#include "StreamingBuffer.h"
+
+
+CInstanceBuffer::CInstanceBuffer()
+{
+	m_uiBuffer = 0;
+	m_pStream = NULL;
+	m_uiSourceBuffer = 0;
+	m_iSourceOffset = 0;
+}
+
+CInstanceBuffer::~CInstanceBuffer()
+{
+	Release();
+}
+
+void CInstanceBuffer::Create(CStreamingBuffer* pStream)
+{
+	m_pStream = pStream;
+	glGenBuffers(1, &m_uiBuffer);
+}
+
+void CInstanceBuffer::Clear()
+{
+	m_vInstances.clear();
+}
+
+void CInstanceBuffer::AddInstance(const glm::mat4& modelMatrix, const glm::vec4& colour)
+{
+	InstanceData instance;
+	instance.modelMatrix = modelMatrix;
+	instance.colour = colour;
+	m_vInstances.push_back(instance);
+}
+
+// Writes the instances into this frame's part of the streaming buffer.  Without one (or if it is full), re-specifies
+// the whole buffer, so the driver can hand back fresh storage rather than wait for last frame's draws.
+void CInstanceBuffer::Upload()
+{
+	if (m_vInstances.empty())
+		return;
+
+	GLsizeiptr iSize = m_vInstances.size() * sizeof(InstanceData);
+	if (m_pStream != NULL) {
+		void* pData = m_pStream->Allocate(iSize, sizeof(glm::vec4), m_iSourceOffset);
+		if (pData != NULL) {
+			memcpy(pData, &m_vInstances[0], iSize);
+			m_uiSourceBuffer = m_pStream->GetBuffer();
+			return;
+		}
+	}
+
+	m_uiSourceBuffer = m_uiBuffer;
+	m_iSourceOffset = 0;
+	glBindBuffer(GL_ARRAY_BUFFER, m_uiBuffer);
+	glBufferData(GL_ARRAY_BUFFER, m_vInstances.size() * sizeof(InstanceData), &m_vInstances[0], GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// The attribute formats are the same for every instance buffer, so a vertex array only needs them set once.  The
+// buffer and offset change with every upload, and rebinding them is a single call.
+void CInstanceBuffer::AttachToVertexArray(UINT& uiAttachedBuffer)
+{
+	if (uiAttachedBuffer == 0) {
+		// Model matrix (one column per attribute), then colour
+		for (int i = 0; i < 5; i++) {
+			glEnableVertexAttribArray(FIRST_ATTRIBUTE + i);
+			glVertexAttribFormat(FIRST_ATTRIBUTE + i, 4, GL_FLOAT, GL_FALSE, i * sizeof(glm::vec4));
+			glVertexAttribBinding(FIRST_ATTRIBUTE + i, FIRST_ATTRIBUTE);
+		}
+		glVertexBindingDivisor(FIRST_ATTRIBUTE, 1);
+		uiAttachedBuffer = m_uiBuffer;
+	}
+
+	glBindVertexBuffer(FIRST_ATTRIBUTE, m_uiSourceBuffer, m_iSourceOffset, sizeof(InstanceData));
+}
+
+int CInstanceBuffer::GetCount()
+{
+	return (int)m_vInstances.size();
+}
+
+void CInstanceBuffer::Release()
+{
+	if (m_uiBuffer != 0) {
+		glDeleteBuffers(1, &m_uiBuffer);
+		m_uiBuffer = 0;
+	}
+	m_vInstances.clear();
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "Common.h"
+
+class CStreamingBuffer;
+
+// Per-instance data read by the INSTANCED variant of mainShader.  The colour's rgb tints the material's ambient,
+// diffuse and emissive colours, and its alpha scales the emission.
+struct InstanceData
+{
+	glm::mat4 modelMatrix;
+	glm::vec4 colour;
+};
+
+// A buffer of per-instance transforms and colours, used to draw many copies of a mesh with one instanced draw call.
+// The instances are gathered on the CPU each frame and uploaded in one go, into a streaming buffer if one is given.
+// Meshes attach the buffer to their vertex array as attributes FIRST_ATTRIBUTE (a mat4, which takes four locations)
+// and FIRST_ATTRIBUTE + 4 (the colour), read through vertex buffer binding FIRST_ATTRIBUTE with a divisor of 1.
+class CInstanceBuffer
+{
+public:
+	CInstanceBuffer();
+	~CInstanceBuffer();
+
+	void Create(CStreamingBuffer* pStream = NULL);
+	void Clear();
+	void AddInstance(const glm::mat4& modelMatrix, const glm::vec4& colour = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f));
+	void Upload();
+
+	// Points the instance attributes of the currently bound vertex array at the last upload.  uiAttachedBuffer is
+	// non-zero once the vertex array's instance attribute formats have been set up, so that is only done once.
+	void AttachToVertexArray(UINT& uiAttachedBuffer);
+
+	int GetCount();
+	void Release();
+
+	static const int FIRST_ATTRIBUTE = 3;
+
+private:
+	UINT m_uiBuffer;
+	CStreamingBuffer* m_pStream;
+	UINT m_uiSourceBuffer;						// Where the last upload went: m_uiBuffer or the streaming buffer
+	GLintptr m_iSourceOffset;
+	vector<InstanceData> m_vInstances;
+};
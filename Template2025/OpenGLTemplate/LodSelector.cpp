@@ -0,0 +1,39 @@
+#include "LodSelector.h"
+
+#include <cfloat>
+
+const float CLodSelector::HYSTERESIS = 0.2f;
+
+CLodSelector::CLodSelector()
+{
+	m_iLodCount = 1;
+	m_fFullDetailPixels = 0.0f;
+}
+
+void CLodSelector::Create(int iObjectCount, int iLodCount, float fFullDetailPixels)
+{
+	m_lods.assign(iObjectCount, 0);
+	m_iLodCount = max(iLodCount, 1);
+	m_fFullDetailPixels = fFullDetailPixels;
+}
+
+float CLodSelector::GetThreshold(int iLod)
+{
+	return iLod <= 0 ? FLT_MAX : m_fFullDetailPixels / (float)(1 << (iLod - 1));
+}
+
+int CLodSelector::Select(int iObject, float fPixels)
+{
+	int iLod = m_lods[iObject];
+	while (iLod < m_iLodCount - 1 && fPixels < GetThreshold(iLod + 1))
+		iLod++;
+	while (iLod > 0 && fPixels > GetThreshold(iLod) * (1.0f + HYSTERESIS))
+		iLod--;
+	m_lods[iObject] = iLod;
+	return iLod;
+}
+
+int CLodSelector::GetLod(int iObject)
+{
+	return m_lods[iObject];
+}
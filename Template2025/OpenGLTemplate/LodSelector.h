@@ -0,0 +1,26 @@
+#pragma once
+
+#include "Common.h"
+
+// Picks each object's level of detail from its size on screen.  Level i is used below GetThreshold(i) pixels; each
+// level halves the triangles, so each threshold is half the one before.  An object moves to a coarser level as soon as
+// it shrinks below the threshold, but only moves back once it is HYSTERESIS larger than that, so an object hovering
+// around a threshold does not pop between levels every frame.
+class CLodSelector
+{
+public:
+	CLodSelector();
+
+	// Every object starts at full detail
+	void Create(int iObjectCount, int iLodCount, float fFullDetailPixels);
+	int Select(int iObject, float fPixels);		// Updates and returns the object's level
+	int GetLod(int iObject);
+	float GetThreshold(int iLod);
+
+	static const float HYSTERESIS;
+
+private:
+	vector<int> m_lods;
+	int m_iLodCount;
+	float m_fFullDetailPixels;
+};
@@ -0,0 +1,79 @@
+#include "MappedFile.h"
+
+CMappedFile::CMappedFile()
+{
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_hMapping = NULL;
+	m_pData = NULL;
+	m_size = 0;
+}
+
+CMappedFile::~CMappedFile()
+{
+	Close();
+}
+
+bool CMappedFile::Open(const string& path)
+{
+	Close();
+
+	m_hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (m_hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_hFile, &size) || size.QuadPart == 0) {
+		Close();
+		return false;
+	}
+
+	m_hMapping = CreateFileMappingA(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_hMapping == NULL) {
+		Close();
+		return false;
+	}
+	m_pData = (const BYTE*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+	if (m_pData == NULL) {
+		Close();
+		return false;
+	}
+	m_size = (size_t)size.QuadPart;
+	return true;
+}
+
+const BYTE* CMappedFile::GetData()
+{
+	return m_pData;
+}
+
+size_t CMappedFile::GetSize()
+{
+	return m_size;
+}
+
+unsigned long long CMappedFile::GetHash()
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < m_size; i++) {
+		hash ^= m_pData[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+void CMappedFile::Close()
+{
+	if (m_pData != NULL) {
+		UnmapViewOfFile(m_pData);
+		m_pData = NULL;
+	}
+	if (m_hMapping != NULL) {
+		CloseHandle(m_hMapping);
+		m_hMapping = NULL;
+	}
+	if (m_hFile != INVALID_HANDLE_VALUE) {
+		CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+	m_size = 0;
+}
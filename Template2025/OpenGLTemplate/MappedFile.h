@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Common.h"
+
+// A read-only view of a whole file through a memory mapping.  Pages are read in by the OS as they are touched, so
+// nothing is copied until it is used, and data can be handed straight to OpenGL from the mapping.
+class CMappedFile
+{
+public:
+	CMappedFile();
+	~CMappedFile();
+
+	bool Open(const string& path);				// Returns false if the file is missing or empty
+	const BYTE* GetData();
+	size_t GetSize();
+	unsigned long long GetHash();				// FNV-1a of the contents, to recognise a file that has not changed
+	void Close();
+
+private:
+	HANDLE m_hFile;
+	HANDLE m_hMapping;
+	const BYTE* m_pData;
+	size_t m_size;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Common.h"
+
+// Compile-time feature keys of mainShader.  The bit order matches the key names passed to CShaderPermutations in
+// Game::Initialise, so add new keys at the end of both.
+enum MainShaderKey
+{
+	SHADER_KEY_SKYBOX = 1 << 0,		// Sample the cube map instead of lighting the surface
+	SHADER_KEY_TEXTURED = 1 << 1,	// Modulate the lit colour with sampler0
+	SHADER_KEY_FOG = 1 << 2,		// Apply exponential-squared fog
+	SHADER_KEY_INSTANCED = 1 << 3,	// Read model matrices and colour tints from a CInstanceBuffer
+	SHADER_KEY_DRAW_DATA = 1 << 4,	// Read model matrices and materials from CRenderQueue's draw data
+	SHADER_KEY_GPU_CULLED = 1 << 5,	// With DRAW_DATA, find each instance's draw data through CGpuCuller's visible list
+	SHADER_KEY_COMPACT_VERTEX = 1 << 6,	// Positions are 16 bit within the mesh's bounds; see CompactVertex
+};
+
+// Surface properties used to draw an object with the main shader.  The material also decides which shader
+// permutation is used, so per-fragment branches on these flags are not needed.
+struct Material
+{
+	glm::vec3 Ma;					// Ambient reflectance
+	glm::vec3 Md;					// Diffuse reflectance
+	glm::vec3 Ms;					// Specular reflectance
+	glm::vec3 Me;					// Emitted colour, added after lighting
+	float shininess;
+	bool textured;
+	bool skybox;
+
+	Material(glm::vec3 ambient = glm::vec3(1.0f), glm::vec3 diffuse = glm::vec3(0.0f), glm::vec3 specular = glm::vec3(0.0f),
+		float shininessIn = 15.0f, bool texturedIn = false, bool skyboxIn = false, glm::vec3 emissive = glm::vec3(0.0f))
+		: Ma(ambient), Md(diffuse), Ms(specular), Me(emissive), shininess(shininessIn), textured(texturedIn), skybox(skyboxIn)
+	{}
+
+	// Returns the permutation keys needed to draw this material
+	unsigned int GetShaderKeys(bool bFogEnabled, bool bInstanced = false, bool bCompactVertex = false) const
+	{
+		unsigned int uiKeys = 0;
+		if (skybox) uiKeys |= SHADER_KEY_SKYBOX;
+		else if (textured) uiKeys |= SHADER_KEY_TEXTURED;
+		if (bFogEnabled) uiKeys |= SHADER_KEY_FOG;
+		if (bInstanced) uiKeys |= SHADER_KEY_INSTANCED;
+		if (bCompactVertex) uiKeys |= SHADER_KEY_COMPACT_VERTEX;
+		return uiKeys;
+	}
+};
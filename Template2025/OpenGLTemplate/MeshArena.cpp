@@ -0,0 +1,98 @@
+#include "MeshArena.h"
+
+#define BUFFER_OFFSET(i) ((char *)NULL + (i))
+
+CMeshArena::CMeshArena()
+{
+	m_vao = m_vbo = m_ibo = 0;
+	m_uiMaxVertices = m_uiMaxIndices = 0;
+	m_uiVertexCount = m_uiIndexCount = 0;
+}
+
+CMeshArena::~CMeshArena()
+{
+	Release();
+}
+
+// Creates the buffers at their full size up front, so adding meshes never reallocates them
+void CMeshArena::Create(unsigned int uiMaxVertices, unsigned int uiMaxIndices)
+{
+	m_uiMaxVertices = uiMaxVertices;
+	m_uiMaxIndices = uiMaxIndices;
+
+	glGenVertexArrays(1, &m_vao);
+	glBindVertexArray(m_vao);
+
+	glGenBuffers(1, &m_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+	glBufferData(GL_ARRAY_BUFFER, uiMaxVertices * sizeof(MeshVertex), NULL, GL_STATIC_DRAW);
+
+	glGenBuffers(1, &m_ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, uiMaxIndices * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+
+	GLsizei stride = sizeof(MeshVertex);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, BUFFER_OFFSET(0));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, BUFFER_OFFSET(sizeof(glm::vec3)));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, BUFFER_OFFSET(sizeof(glm::vec3) + sizeof(glm::vec2)));
+
+	glBindVertexArray(0);
+}
+
+// Appends the vertices and indices.  Indices stay relative to the mesh's first vertex; the base vertex is applied at draw time.
+int CMeshArena::AddMesh(const vector<MeshVertex>& vVertices, const vector<unsigned int>& vIndices)
+{
+	if (vVertices.empty() || vIndices.empty())
+		return -1;
+	if (m_uiVertexCount + vVertices.size() > m_uiMaxVertices || m_uiIndexCount + vIndices.size() > m_uiMaxIndices)
+		return -1;
+
+	MeshRange range;
+	range.firstIndex = m_uiIndexCount;
+	range.indexCount = (unsigned int)vIndices.size();
+	range.baseVertex = (int)m_uiVertexCount;
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+	glBufferSubData(GL_ARRAY_BUFFER, m_uiVertexCount * sizeof(MeshVertex), vVertices.size() * sizeof(MeshVertex), &vVertices[0]);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// The element buffer binding is part of the VAO state
+	glBindVertexArray(m_vao);
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, m_uiIndexCount * sizeof(unsigned int), vIndices.size() * sizeof(unsigned int), &vIndices[0]);
+	glBindVertexArray(0);
+
+	m_uiVertexCount += (unsigned int)vVertices.size();
+	m_uiIndexCount += (unsigned int)vIndices.size();
+	m_vMeshes.push_back(range);
+	return (int)m_vMeshes.size() - 1;
+}
+
+const MeshRange& CMeshArena::GetMesh(int iMesh)
+{
+	return m_vMeshes[iMesh];
+}
+
+int CMeshArena::GetMeshCount()
+{
+	return (int)m_vMeshes.size();
+}
+
+void CMeshArena::Bind()
+{
+	glBindVertexArray(m_vao);
+}
+
+void CMeshArena::Release()
+{
+	if (m_vao != 0) {
+		glDeleteVertexArrays(1, &m_vao);
+		glDeleteBuffers(1, &m_vbo);
+		glDeleteBuffers(1, &m_ibo);
+		m_vao = m_vbo = m_ibo = 0;
+	}
+	m_vMeshes.clear();
+	m_uiVertexCount = m_uiIndexCount = 0;
+}
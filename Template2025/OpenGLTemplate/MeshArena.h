@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Common.h"
+
+// Vertex layout shared by every mesh in a CMeshArena.  Attribute locations match mainShader (0 position,
+// 1 texture coordinate, 2 normal).
+struct MeshVertex
+{
+	glm::vec3 position;
+	glm::vec2 texCoord;
+	glm::vec3 normal;
+
+	MeshVertex() {}
+	MeshVertex(const glm::vec3& positionIn, const glm::vec2& texCoordIn, const glm::vec3& normalIn)
+		: position(positionIn), texCoord(texCoordIn), normal(normalIn)
+	{}
+};
+
+// Where a mesh lives inside the arena, in the form glDrawElementsBaseVertex and indirect draw commands expect
+struct MeshRange
+{
+	unsigned int firstIndex;
+	unsigned int indexCount;
+	int baseVertex;
+};
+
+// One vertex buffer, one index buffer and one vertex array shared by many meshes.  Because every mesh uses the same
+// buffers and vertex format, draws of different meshes can be merged into a single multi-draw call.
+class CMeshArena
+{
+public:
+	CMeshArena();
+	~CMeshArena();
+
+	// Allocates storage for the given number of vertices and indices
+	void Create(unsigned int uiMaxVertices, unsigned int uiMaxIndices);
+
+	// Copies a mesh into the arena and returns its id, or -1 if the arena is full
+	int AddMesh(const vector<MeshVertex>& vVertices, const vector<unsigned int>& vIndices);
+
+	const MeshRange& GetMesh(int iMesh);
+	int GetMeshCount();
+
+	void Bind();
+	void Release();
+
+private:
+	UINT m_vao;
+	UINT m_vbo;
+	UINT m_ibo;
+	unsigned int m_uiMaxVertices, m_uiMaxIndices;
+	unsigned int m_uiVertexCount, m_uiIndexCount;
+	vector<MeshRange> m_vMeshes;
+};
@@ -0,0 +1,229 @@
+#include "MeshOptimiser.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// Forsyth's scoring: the three most recent vertices score a flat 0.75 (so the triangle just drawn does not always
+// win), older cache entries less the further back they are, and a vertex with few triangles left gets a boost so it
+// is finished off and leaves the cache for good
+float CMeshOptimiser::GetVertexScore(int iCachePosition, int iRemainingTriangles)
+{
+	if (iRemainingTriangles == 0)
+		return -1.0f;
+
+	float fScore = 0.0f;
+	if (iCachePosition >= 0) {
+		if (iCachePosition < 3)
+			fScore = 0.75f;
+		else
+			fScore = powf(1.0f - (iCachePosition - 3) / (float)(CACHE_SIZE - 3), 1.5f);
+	}
+	return fScore + 2.0f / sqrtf((float)iRemainingTriangles);
+}
+
+void CMeshOptimiser::OptimiseVertexCache(unsigned int* pIndices, unsigned int iIndexCount, unsigned int iVertexCount)
+{
+	unsigned int iTriangleCount = iIndexCount / 3;
+	if (iTriangleCount == 0)
+		return;
+
+	// The triangles using each vertex.  Those not yet emitted are kept at the front of each vertex's list, and
+	// remaining[v] counts them.
+	std::vector<unsigned int> firstTriangle(iVertexCount + 1, 0), vertexTriangles(iTriangleCount * 3);
+	for (unsigned int i = 0; i < iTriangleCount * 3; i++)
+		firstTriangle[pIndices[i] + 1]++;
+	for (unsigned int v = 0; v < iVertexCount; v++)
+		firstTriangle[v + 1] += firstTriangle[v];
+	std::vector<int> remaining(iVertexCount, 0);
+	for (unsigned int i = 0; i < iTriangleCount * 3; i++) {
+		unsigned int v = pIndices[i];
+		vertexTriangles[firstTriangle[v] + remaining[v]++] = i / 3;
+	}
+
+	std::vector<int> cachePosition(iVertexCount, -1);
+	std::vector<float> vertexScore(iVertexCount);
+	for (unsigned int v = 0; v < iVertexCount; v++)
+		vertexScore[v] = GetVertexScore(-1, remaining[v]);
+	std::vector<float> triangleScore(iTriangleCount);
+	std::vector<bool> emitted(iTriangleCount, false);
+	int iBest = 0;
+	for (unsigned int t = 0; t < iTriangleCount; t++) {
+		triangleScore[t] = vertexScore[pIndices[t * 3]] + vertexScore[pIndices[t * 3 + 1]] + vertexScore[pIndices[t * 3 + 2]];
+		if (triangleScore[t] > triangleScore[iBest])
+			iBest = t;
+	}
+
+	std::vector<unsigned int> output;
+	output.reserve(iTriangleCount * 3);
+	std::vector<unsigned int> cache, newCache;		// Most recent first
+	unsigned int iNextUnemitted = 0;
+	while (iBest >= 0) {
+		emitted[iBest] = true;
+		const unsigned int* pTriangle = pIndices + iBest * 3;
+		newCache.clear();
+		for (int k = 0; k < 3; k++) {
+			unsigned int v = pTriangle[k];
+			output.push_back(v);
+			newCache.push_back(v);
+
+			// Take the triangle out of the vertex's remaining list
+			unsigned int* pList = &vertexTriangles[firstTriangle[v]];
+			int iLast = --remaining[v];
+			for (int j = 0; j <= iLast; j++) {
+				if (pList[j] == (unsigned int)iBest) {
+					std::swap(pList[j], pList[iLast]);
+					break;
+				}
+			}
+		}
+		for (unsigned int i = 0; i < cache.size(); i++)
+			if (cache[i] != pTriangle[0] && cache[i] != pTriangle[1] && cache[i] != pTriangle[2])
+				newCache.push_back(cache[i]);
+
+		// Vertices pushed out of the cache lose their cache score
+		for (unsigned int i = CACHE_SIZE; i < newCache.size(); i++)
+			cachePosition[newCache[i]] = -1;
+		cache.assign(newCache.begin(), newCache.begin() + std::min((int)newCache.size(), (int)CACHE_SIZE));
+
+		// Rescore everything whose position changed, and the triangles they belong to
+		for (unsigned int i = 0; i < newCache.size(); i++) {
+			unsigned int v = newCache[i];
+			if (i < cache.size())
+				cachePosition[v] = i;
+			float fScore = GetVertexScore(cachePosition[v], remaining[v]);
+			float fDelta = fScore - vertexScore[v];
+			vertexScore[v] = fScore;
+			for (int j = 0; j < remaining[v]; j++)
+				triangleScore[vertexTriangles[firstTriangle[v] + j]] += fDelta;
+		}
+
+		// The next triangle is the best one touching the cache, or failing that the first one left
+		iBest = -1;
+		float fBestScore = -FLT_MAX;
+		for (unsigned int i = 0; i < cache.size(); i++) {
+			unsigned int v = cache[i];
+			for (int j = 0; j < remaining[v]; j++) {
+				unsigned int t = vertexTriangles[firstTriangle[v] + j];
+				if (triangleScore[t] > fBestScore) {
+					fBestScore = triangleScore[t];
+					iBest = t;
+				}
+			}
+		}
+		if (iBest < 0) {
+			while (iNextUnemitted < iTriangleCount && emitted[iNextUnemitted])
+				iNextUnemitted++;
+			if (iNextUnemitted < iTriangleCount)
+				iBest = iNextUnemitted;
+		}
+	}
+
+	std::copy(output.begin(), output.end(), pIndices);
+}
+
+void CMeshOptimiser::OptimiseOverdraw(unsigned int* pIndices, unsigned int iIndexCount, const unsigned char* pPositions, size_t iStride,
+	unsigned int iVertexCount)
+{
+	unsigned int iTriangleCount = iIndexCount / 3;
+	if (iTriangleCount == 0)
+		return;
+	auto position = [&](unsigned int v) { return *(const glm::vec3*)(pPositions + v * iStride); };
+
+	// A cluster starts wherever all three of a triangle's vertices miss the cache
+	std::vector<unsigned int> clusterStarts;
+	std::vector<unsigned int> timestamps(iVertexCount, 0);
+	unsigned int uiTime = SIMULATED_CACHE_SIZE + 1;
+	for (unsigned int t = 0; t < iTriangleCount; t++) {
+		int iMisses = 0;
+		for (int k = 0; k < 3; k++) {
+			unsigned int v = pIndices[t * 3 + k];
+			if (uiTime - timestamps[v] > (unsigned int)SIMULATED_CACHE_SIZE) {
+				timestamps[v] = uiTime++;
+				iMisses++;
+			}
+		}
+		if (t == 0 || iMisses == 3)
+			clusterStarts.push_back(t);
+	}
+	clusterStarts.push_back(iTriangleCount);
+
+	// Area weighted centres and normals
+	glm::vec3 meshCentre(0.0f);
+	float fMeshArea = 0.0f;
+	unsigned int iClusterCount = (unsigned int)clusterStarts.size() - 1;
+	std::vector<glm::vec3> clusterCentres(iClusterCount, glm::vec3(0.0f)), clusterNormals(iClusterCount, glm::vec3(0.0f));
+	std::vector<float> clusterAreas(iClusterCount, 0.0f);
+	for (unsigned int c = 0; c < iClusterCount; c++) {
+		for (unsigned int t = clusterStarts[c]; t < clusterStarts[c + 1]; t++) {
+			glm::vec3 a = position(pIndices[t * 3]), b = position(pIndices[t * 3 + 1]), d = position(pIndices[t * 3 + 2]);
+			glm::vec3 normal = glm::cross(b - a, d - a);
+			float fArea = glm::length(normal);
+			clusterCentres[c] += (a + b + d) * (fArea / 3.0f);
+			clusterNormals[c] += normal;
+			clusterAreas[c] += fArea;
+		}
+		meshCentre += clusterCentres[c];
+		fMeshArea += clusterAreas[c];
+	}
+	if (fMeshArea > 0.0f)
+		meshCentre /= fMeshArea;
+
+	std::vector<float> sortKeys(iClusterCount, 0.0f);
+	for (unsigned int c = 0; c < iClusterCount; c++) {
+		float fLength = glm::length(clusterNormals[c]);
+		if (clusterAreas[c] > 0.0f && fLength > 0.0f)
+			sortKeys[c] = glm::dot(clusterCentres[c] / clusterAreas[c] - meshCentre, clusterNormals[c] / fLength);
+	}
+
+	std::vector<unsigned int> order(iClusterCount);
+	for (unsigned int c = 0; c < iClusterCount; c++)
+		order[c] = c;
+	std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return sortKeys[a] > sortKeys[b]; });
+
+	std::vector<unsigned int> output;
+	output.reserve(iTriangleCount * 3);
+	for (unsigned int i = 0; i < iClusterCount; i++) {
+		unsigned int c = order[i];
+		output.insert(output.end(), pIndices + clusterStarts[c] * 3, pIndices + clusterStarts[c + 1] * 3);
+	}
+	std::copy(output.begin(), output.end(), pIndices);
+}
+
+void CMeshOptimiser::OptimiseVertexFetch(unsigned char* pVertices, size_t iVertexSize, unsigned int* pIndices, unsigned int iIndexCount,
+	unsigned int iVertexCount)
+{
+	const unsigned int UNUSED = 0xFFFFFFFF;
+	std::vector<unsigned int> remap(iVertexCount, UNUSED);
+	unsigned int iNext = 0;
+	for (unsigned int i = 0; i < iIndexCount; i++) {
+		if (remap[pIndices[i]] == UNUSED)
+			remap[pIndices[i]] = iNext++;
+		pIndices[i] = remap[pIndices[i]];
+	}
+	for (unsigned int v = 0; v < iVertexCount; v++)
+		if (remap[v] == UNUSED)
+			remap[v] = iNext++;
+
+	std::vector<unsigned char> original(pVertices, pVertices + iVertexSize * iVertexCount);
+	for (unsigned int v = 0; v < iVertexCount; v++)
+		memcpy(pVertices + remap[v] * iVertexSize, &original[v * iVertexSize], iVertexSize);
+}
+
+unsigned int CMeshOptimiser::CountCacheMisses(const unsigned int* pIndices, unsigned int iIndexCount, unsigned int iVertexCount,
+	unsigned int iCacheSize)
+{
+	// A vertex is still cached if fewer than iCacheSize misses have happened since it went in
+	std::vector<unsigned int> timestamps(iVertexCount, 0);
+	unsigned int uiTime = iCacheSize + 1, iMisses = 0;
+	for (unsigned int i = 0; i < iIndexCount; i++) {
+		unsigned int v = pIndices[i];
+		if (uiTime - timestamps[v] > iCacheSize) {
+			timestamps[v] = uiTime++;
+			iMisses++;
+		}
+	}
+	return iMisses;
+}
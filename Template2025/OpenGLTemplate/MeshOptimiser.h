@@ -0,0 +1,44 @@
+#pragma once
+
+#include "./include/glm/glm.hpp"
+
+#include <cstddef>
+
+// Reorders indexed triangle lists so the GPU does less work drawing them.  Meant to run once, when a mesh is imported,
+// before it is baked into its .mesh file.  Only depends on the standard library and glm, so the results can be checked
+// without a GL context.
+//
+//  - OptimiseVertexCache orders triangles for the post-transform vertex cache, with Tom Forsyth's linear-speed
+//    algorithm: each step emits the triangle whose vertices score highest, favouring vertices still in a simulated
+//    LRU cache and vertices with few triangles left.
+//  - OptimiseOverdraw then splits that order into clusters wherever the cache starts afresh, and sorts the clusters so
+//    those facing outwards from the mesh's centre come first, as they are more likely to occlude the rest.  Breaking
+//    only where the cache was cold anyway leaves the cache efficiency almost untouched.
+//  - OptimiseVertexFetch renumbers the vertices in the order the triangles first use them, so vertex fetches walk the
+//    vertex buffer forwards.
+class CMeshOptimiser
+{
+public:
+	static void OptimiseVertexCache(unsigned int* pIndices, unsigned int iIndexCount, unsigned int iVertexCount);
+
+	// pPositions points at the first vertex's position, with iStride bytes from one vertex to the next
+	static void OptimiseOverdraw(unsigned int* pIndices, unsigned int iIndexCount, const unsigned char* pPositions, size_t iStride,
+		unsigned int iVertexCount);
+
+	// Reorders the iVertexSize byte vertices in place and renumbers the indices to match.  Vertices no triangle uses
+	// are moved to the end.
+	static void OptimiseVertexFetch(unsigned char* pVertices, size_t iVertexSize, unsigned int* pIndices, unsigned int iIndexCount,
+		unsigned int iVertexCount);
+
+	// Vertices transformed by a FIFO post-transform cache of iCacheSize entries drawing the triangles in order.  Divided
+	// by the triangles this is the ACMR (average cache miss ratio, 0.5 at best for a large regular mesh, 3 at worst);
+	// divided by the vertices it is the ATVR (average transform to vertex ratio, 1 at best).
+	static unsigned int CountCacheMisses(const unsigned int* pIndices, unsigned int iIndexCount, unsigned int iVertexCount,
+		unsigned int iCacheSize = SIMULATED_CACHE_SIZE);
+
+	static const int CACHE_SIZE = 32;				// Of the LRU cache OptimiseVertexCache models
+	static const int SIMULATED_CACHE_SIZE = 16;		// Of the FIFO cache the statistics are measured with
+
+private:
+	static float GetVertexScore(int iCachePosition, int iRemainingTriangles);
+};
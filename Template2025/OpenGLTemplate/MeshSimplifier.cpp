@@ -0,0 +1,266 @@
+#include "MeshSimplifier.h"
+#include "MeshOptimiser.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+const float CMeshSimplifier::LOD_ERRORS[LOD_COUNT] = { 0.0f, 0.01f, 0.02f, 0.04f };
+
+CMeshSimplifier::Quadric CMeshSimplifier::PlaneQuadric(const glm::vec3& normal, float d, float fWeight)
+{
+	Quadric q;
+	q.a2 = normal.x * normal.x * fWeight;
+	q.b2 = normal.y * normal.y * fWeight;
+	q.c2 = normal.z * normal.z * fWeight;
+	q.ab = normal.x * normal.y * fWeight;
+	q.ac = normal.x * normal.z * fWeight;
+	q.bc = normal.y * normal.z * fWeight;
+	q.ad = normal.x * d * fWeight;
+	q.bd = normal.y * d * fWeight;
+	q.cd = normal.z * d * fWeight;
+	q.d2 = d * d * fWeight;
+	q.w = fWeight;
+	return q;
+}
+
+void CMeshSimplifier::AddQuadric(Quadric& q, const Quadric& other)
+{
+	q.a2 += other.a2;
+	q.b2 += other.b2;
+	q.c2 += other.c2;
+	q.ab += other.ab;
+	q.ac += other.ac;
+	q.bc += other.bc;
+	q.ad += other.ad;
+	q.bd += other.bd;
+	q.cd += other.cd;
+	q.d2 += other.d2;
+	q.w += other.w;
+}
+
+float CMeshSimplifier::EvaluateQuadric(const Quadric& q, const glm::vec3& p)
+{
+	float rx = q.a2 * p.x + q.ab * p.y + q.ac * p.z;
+	float ry = q.ab * p.x + q.b2 * p.y + q.bc * p.z;
+	float rz = q.ac * p.x + q.bc * p.y + q.c2 * p.z;
+	float r = rx * p.x + ry * p.y + rz * p.z + 2.0f * (q.ad * p.x + q.bd * p.y + q.cd * p.z) + q.d2;
+	return q.w > 0.0f ? fabsf(r) / q.w : 0.0f;
+}
+
+unsigned int CMeshSimplifier::Simplify(unsigned int* pDestination, const unsigned int* pIndices, unsigned int iIndexCount,
+	const BYTE* pPositions, size_t iStride, unsigned int iVertexCount, unsigned int iTargetIndexCount, float fTargetError,
+	float* pResultError)
+{
+	vector<unsigned int> result(pIndices, pIndices + iIndexCount - iIndexCount % 3);
+	if (pResultError != NULL)
+		*pResultError = 0.0f;
+	if (iVertexCount == 0 || result.empty()) {
+		std::copy(result.begin(), result.end(), pDestination);
+		return (unsigned int)result.size();
+	}
+
+	// Positions scaled so the largest dimension is 1, which makes the errors relative
+	vector<glm::vec3> positions(iVertexCount);
+	glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+	for (unsigned int v = 0; v < iVertexCount; v++) {
+		positions[v] = *(const glm::vec3*)(pPositions + v * iStride);
+		minimum = glm::min(minimum, positions[v]);
+		maximum = glm::max(maximum, positions[v]);
+	}
+	glm::vec3 extent = maximum - minimum;
+	float fScale = max(extent.x, max(extent.y, extent.z));
+	fScale = fScale > 0.0f ? 1.0f / fScale : 0.0f;
+	for (unsigned int v = 0; v < iVertexCount; v++)
+		positions[v] = (positions[v] - minimum) * fScale;
+
+	// Vertices split along a seam share a position with another vertex.  wedge[v] is the first vertex with v's position.
+	vector<unsigned int> order(iVertexCount), wedge(iVertexCount);
+	for (unsigned int v = 0; v < iVertexCount; v++)
+		order[v] = v;
+	std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+		const glm::vec3& pa = positions[a];
+		const glm::vec3& pb = positions[b];
+		if (pa.x != pb.x) return pa.x < pb.x;
+		if (pa.y != pb.y) return pa.y < pb.y;
+		if (pa.z != pb.z) return pa.z < pb.z;
+		return a < b;
+	});
+	vector<bool> locked(iVertexCount, false), lockedWedge(iVertexCount, false);
+	for (unsigned int i = 0; i < iVertexCount;) {
+		unsigned int j = i + 1;
+		while (j < iVertexCount && positions[order[j]] == positions[order[i]])
+			j++;
+		for (unsigned int k = i; k < j; k++) {
+			wedge[order[k]] = order[i];
+			locked[order[k]] = j - i > 1;
+		}
+		i = j;
+	}
+
+	// Edges between positions used by other than two triangles are borders, or non-manifold
+	vector<unsigned long long> edges;
+	edges.reserve(result.size());
+	for (unsigned int i = 0; i < result.size(); i++) {
+		unsigned int a = wedge[result[i]], b = wedge[result[i - i % 3 + (i + 1) % 3]];
+		if (a != b)
+			edges.push_back(((unsigned long long)min(a, b) << 32) | max(a, b));
+	}
+	std::sort(edges.begin(), edges.end());
+	for (unsigned int i = 0; i < edges.size();) {
+		unsigned int j = i + 1;
+		while (j < edges.size() && edges[j] == edges[i])
+			j++;
+		if (j - i != 2) {
+			lockedWedge[(unsigned int)(edges[i] >> 32)] = true;
+			lockedWedge[(unsigned int)(edges[i] & 0xFFFFFFFF)] = true;
+		}
+		i = j;
+	}
+	for (unsigned int v = 0; v < iVertexCount; v++)
+		if (lockedWedge[wedge[v]])
+			locked[v] = true;
+
+	// Each vertex starts with the planes of its triangles, weighted by their areas
+	Quadric zero;
+	memset(&zero, 0, sizeof(zero));
+	vector<Quadric> quadrics(iVertexCount, zero);
+	for (unsigned int t = 0; t < result.size() / 3; t++) {
+		const unsigned int* pTriangle = &result[t * 3];
+		glm::vec3 normal = glm::cross(positions[pTriangle[1]] - positions[pTriangle[0]], positions[pTriangle[2]] - positions[pTriangle[0]]);
+		float fArea = glm::length(normal);
+		if (fArea == 0.0f)
+			continue;
+		normal /= fArea;
+		Quadric q = PlaneQuadric(normal, -glm::dot(normal, positions[pTriangle[0]]), fArea * 0.5f);
+		for (int k = 0; k < 3; k++)
+			AddQuadric(quadrics[pTriangle[k]], q);
+	}
+
+	// Each pass collapses the cheapest edges it can without two collapses touching the same triangles, then drops the
+	// triangles that became degenerate
+	struct Collapse {
+		unsigned int v0, v1;		// v0 moves onto v1
+		float fCost;
+	};
+	float fMaxCost = fTargetError * fTargetError, fResultCost = 0.0f;
+	vector<unsigned int> firstTriangle, vertexTriangles;
+	vector<Collapse> collapses;
+	vector<bool> touched;
+	while (result.size() > iTargetIndexCount) {
+		unsigned int iTriangleCount = (unsigned int)result.size() / 3;
+		firstTriangle.assign(iVertexCount + 1, 0);
+		for (unsigned int i = 0; i < result.size(); i++)
+			firstTriangle[result[i] + 1]++;
+		for (unsigned int v = 0; v < iVertexCount; v++)
+			firstTriangle[v + 1] += firstTriangle[v];
+		vertexTriangles.resize(result.size());
+		vector<unsigned int> filled(firstTriangle.begin(), firstTriangle.end() - 1);
+		for (unsigned int i = 0; i < result.size(); i++)
+			vertexTriangles[filled[result[i]]++] = i / 3;
+
+		collapses.clear();
+		for (unsigned int i = 0; i < result.size(); i++) {
+			unsigned int a = result[i], b = result[i - i % 3 + (i + 1) % 3];
+			Quadric q = quadrics[a];
+			AddQuadric(q, quadrics[b]);
+			Collapse collapse;
+			if (!locked[a]) {
+				collapse.v0 = a;
+				collapse.v1 = b;
+				collapse.fCost = EvaluateQuadric(q, positions[b]);
+				collapses.push_back(collapse);
+			}
+			if (!locked[b]) {
+				collapse.v0 = b;
+				collapse.v1 = a;
+				collapse.fCost = EvaluateQuadric(q, positions[a]);
+				collapses.push_back(collapse);
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.fCost < b.fCost; });
+
+		touched.assign(iVertexCount, false);
+		unsigned int iRemoved = 0, iCollapsed = 0;
+		for (unsigned int c = 0; c < collapses.size(); c++) {
+			const Collapse& collapse = collapses[c];
+			if (collapse.fCost > fMaxCost || (iTriangleCount - iRemoved) * 3 <= iTargetIndexCount)
+				break;
+			if (touched[collapse.v0] || touched[collapse.v1])
+				continue;
+
+			// Refuse if a triangle that survives would flip, or collapse to nothing
+			bool bFlips = false;
+			unsigned int iDegenerate = 0;
+			for (unsigned int j = firstTriangle[collapse.v0]; j < firstTriangle[collapse.v0 + 1] && !bFlips; j++) {
+				const unsigned int* pTriangle = &result[vertexTriangles[j] * 3];
+				if (pTriangle[0] == collapse.v1 || pTriangle[1] == collapse.v1 || pTriangle[2] == collapse.v1) {
+					iDegenerate++;
+					continue;
+				}
+				glm::vec3 p[3];
+				for (int k = 0; k < 3; k++)
+					p[k] = positions[pTriangle[k]];
+				glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				for (int k = 0; k < 3; k++)
+					if (pTriangle[k] == collapse.v0)
+						p[k] = positions[collapse.v1];
+				glm::vec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+				bFlips = glm::dot(before, after) <= 0.0f && glm::dot(before, before) > 0.0f;
+			}
+			if (bFlips)
+				continue;
+
+			// The triangles around v0 are only touched by this collapse for the rest of the pass
+			for (unsigned int j = firstTriangle[collapse.v0]; j < firstTriangle[collapse.v0 + 1]; j++) {
+				unsigned int* pTriangle = &result[vertexTriangles[j] * 3];
+				for (int k = 0; k < 3; k++) {
+					touched[pTriangle[k]] = true;
+					if (pTriangle[k] == collapse.v0)
+						pTriangle[k] = collapse.v1;
+				}
+			}
+			AddQuadric(quadrics[collapse.v1], quadrics[collapse.v0]);
+			fResultCost = max(fResultCost, collapse.fCost);
+			iRemoved += iDegenerate;
+			iCollapsed++;
+		}
+		if (iCollapsed == 0)
+			break;
+
+		unsigned int iWrite = 0;
+		for (unsigned int t = 0; t < iTriangleCount; t++) {
+			unsigned int a = result[t * 3], b = result[t * 3 + 1], d = result[t * 3 + 2];
+			if (a == b || b == d || a == d)
+				continue;
+			result[iWrite++] = a;
+			result[iWrite++] = b;
+			result[iWrite++] = d;
+		}
+		result.resize(iWrite);
+	}
+
+	if (pResultError != NULL)
+		*pResultError = sqrtf(fResultCost);
+	std::copy(result.begin(), result.end(), pDestination);
+	return (unsigned int)result.size();
+}
+
+void CMeshSimplifier::BuildLods(const unsigned int* pIndices, unsigned int iIndexCount, const BYTE* pPositions, size_t iStride,
+	unsigned int iVertexCount, vector<unsigned int> lods[])
+{
+	lods[0].assign(pIndices, pIndices + iIndexCount);
+	for (int i = 1; i < LOD_COUNT; i++) {
+		const vector<unsigned int>& previous = lods[i - 1];
+		lods[i].resize(previous.size());
+		if (previous.empty())
+			continue;
+		unsigned int iTarget = (unsigned int)(previous.size() / 6) * 3;
+		lods[i].resize(Simplify(&lods[i][0], &previous[0], (unsigned int)previous.size(), pPositions, iStride, iVertexCount,
+			iTarget, LOD_ERRORS[i]));
+		if (lods[i].size() < previous.size())
+			CMeshOptimiser::OptimiseVertexCache(&lods[i][0], (unsigned int)lods[i].size(), iVertexCount);
+		else
+			lods[i] = previous;
+	}
+}
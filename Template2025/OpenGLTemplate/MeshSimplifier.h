@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Common.h"
+
+// Reduces an indexed triangle list with quadric error metrics (Garland and Heckbert), to build a mesh's levels of
+// detail.  Like CMeshOptimiser, it only depends on the standard library and glm, and is meant to run when a mesh is
+// imported.
+//
+// Each vertex carries the sum of the squared distances to the planes of the triangles around it.  Edges are collapsed
+// cheapest first, moving one end onto the other, so the simplified triangles index the original vertices and every
+// level of detail can share one vertex buffer.  Vertices on an open border, or split along a texture or normal seam,
+// are never moved, which keeps the outline and the seams intact at the cost of some reduction.  A collapse is refused
+// if it would flip any triangle around the vertex being moved.
+class CMeshSimplifier
+{
+public:
+	// Writes at most iIndexCount indices to pDestination (which may be pIndices) and returns how many.  Stops at
+	// iTargetIndexCount, or before a collapse would move the surface further than fTargetError, as a fraction of the
+	// mesh's largest dimension.  pResultError, if given, receives the largest error introduced, on the same scale.
+	static unsigned int Simplify(unsigned int* pDestination, const unsigned int* pIndices, unsigned int iIndexCount,
+		const BYTE* pPositions, size_t iStride, unsigned int iVertexCount, unsigned int iTargetIndexCount, float fTargetError,
+		float* pResultError = NULL);
+
+	// Builds LOD_COUNT levels of detail, each from the one before with half its triangles, allowing LOD_ERRORS of
+	// error.  Level 0 is a copy of pIndices.  The coarser levels are ordered for the vertex cache; a level that could
+	// not be reduced further is a copy of the one before.
+	static void BuildLods(const unsigned int* pIndices, unsigned int iIndexCount, const BYTE* pPositions, size_t iStride,
+		unsigned int iVertexCount, vector<unsigned int> lods[]);
+
+	static const int LOD_COUNT = 4;
+	static const float LOD_ERRORS[LOD_COUNT];		// Largest error allowed at each level, as in Simplify
+
+private:
+	// The plane distance quadric, symmetric so ten terms are enough, and the triangle area it was weighted by
+	struct Quadric {
+		float a2, b2, c2, ab, ac, bc, ad, bd, cd, d2;
+		float w;
+	};
+	static Quadric PlaneQuadric(const glm::vec3& normal, float d, float fWeight);
+	static void AddQuadric(Quadric& q, const Quadric& other);
+	static float EvaluateQuadric(const Quadric& q, const glm::vec3& p);	// Mean squared distance to the planes
+};
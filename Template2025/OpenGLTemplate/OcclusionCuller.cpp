@@ -0,0 +1,342 @@
+#include "OcclusionCuller.h"
+#include "ThreadPool.h"
+
+#include <emmintrin.h>
+#include <algorithm>
+#include <cmath>
+
+// Occluder triangles transformed per job, and boxes tested per job
+static const int TRIANGLES_PER_JOB = 1024;
+static const int BOXES_PER_JOB = 256;
+
+COcclusionCuller::COcclusionCuller()
+{
+	m_pPool = NULL;
+	m_iRasterisedTriangles = 0;
+}
+
+COcclusionCuller::~COcclusionCuller()
+{}
+
+void COcclusionCuller::Create(CThreadPool* pPool)
+{
+	m_pPool = pPool;
+	m_vDepth.assign(WIDTH * HEIGHT, 1.0f);
+	m_vHiZ.assign(TILES_X * TILES_Y, 1.0f);
+}
+
+void COcclusionCuller::AddOccluder(const std::vector<glm::vec3>& vPositions, const std::vector<unsigned int>& vIndices, const glm::mat4& modelMatrix)
+{
+	std::vector<glm::vec3> vWorld(vPositions.size());
+	for (unsigned int i = 0; i < vPositions.size(); i++)
+		vWorld[i] = glm::vec3(modelMatrix * glm::vec4(vPositions[i], 1.0f));
+
+	for (unsigned int i = 0; i + 2 < vIndices.size(); i += 3) {
+		m_vOccluderVertices.push_back(vWorld[vIndices[i]]);
+		m_vOccluderVertices.push_back(vWorld[vIndices[i + 1]]);
+		m_vOccluderVertices.push_back(vWorld[vIndices[i + 2]]);
+	}
+}
+
+// Adds the twelve triangles of a box.  The corners are transformed individually, so a rotated box stays exact.
+void COcclusionCuller::AddOccluderBox(const BoundingBox& box, const glm::mat4& modelMatrix)
+{
+	std::vector<glm::vec3> vCorners(8);
+	for (int i = 0; i < 8; i++)
+		vCorners[i] = glm::vec3((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+
+	static const unsigned int faces[36] = {
+		0, 2, 3, 0, 3, 1,		// -z
+		4, 5, 7, 4, 7, 6,		// +z
+		0, 4, 6, 0, 6, 2,		// -x
+		1, 3, 7, 1, 7, 5,		// +x
+		0, 1, 5, 0, 5, 4,		// -y
+		2, 6, 7, 2, 7, 3		// +y
+	};
+	AddOccluder(vCorners, std::vector<unsigned int>(faces, faces + 36), modelMatrix);
+}
+
+void COcclusionCuller::ClearOccluders()
+{
+	m_vOccluderVertices.clear();
+}
+
+glm::vec3 COcclusionCuller::ToScreen(const glm::vec4& clip) const
+{
+	glm::vec3 ndc = glm::vec3(clip) / clip.w;
+	return glm::vec3((ndc.x * 0.5f + 0.5f) * WIDTH, (ndc.y * 0.5f + 0.5f) * HEIGHT, ndc.z * 0.5f + 0.5f);
+}
+
+// Projects triangles to screen space, clipping them against the near plane (z + w >= 0 in clip space) and the guard
+// band (|x|, |y| <= GUARD_BAND * w), which keeps the fixed point coordinates small enough for 32 bit edge functions.
+// Most triangles are inside every plane and are passed through whole; the rest are clipped to a polygon and fanned.
+void COcclusionCuller::TransformTriangles(int iFirst, int iCount, std::vector<ScreenTriangle>& vOut)
+{
+	vOut.clear();
+	for (int t = iFirst; t < iFirst + iCount; t++) {
+		glm::vec4 polygon[CLIP_PLANES + 3], clipped[CLIP_PLANES + 3];
+		int iVertices = 3;
+		unsigned int uiOutside = 0;
+		for (int i = 0; i < 3; i++) {
+			polygon[i] = m_viewProjection * glm::vec4(m_vOccluderVertices[t * 3 + i], 1.0f);
+			for (int p = 0; p < CLIP_PLANES; p++)
+				if (ClipDistance(polygon[i], p) < 0.0f)
+					uiOutside |= 1 << p;
+		}
+
+		// Sutherland-Hodgman, one plane at a time, for the planes some vertex is outside
+		for (int p = 0; p < CLIP_PLANES && iVertices >= 3; p++) {
+			if ((uiOutside & (1 << p)) == 0)
+				continue;
+			int iClipped = 0;
+			for (int i = 0; i < iVertices; i++) {
+				const glm::vec4& a = polygon[i];
+				const glm::vec4& b = polygon[(i + 1) % iVertices];
+				float fA = ClipDistance(a, p), fB = ClipDistance(b, p);
+				if (fA >= 0.0f)
+					clipped[iClipped++] = a;
+				if ((fA >= 0.0f) != (fB >= 0.0f))
+					clipped[iClipped++] = a + (b - a) * (fA / (fA - fB));
+			}
+			iVertices = iClipped;
+			std::copy(clipped, clipped + iClipped, polygon);
+		}
+
+		for (int i = 1; i + 1 < iVertices; i++) {
+			ScreenTriangle triangle;
+			triangle.v[0] = ToScreen(polygon[0]);
+			triangle.v[1] = ToScreen(polygon[i]);
+			triangle.v[2] = ToScreen(polygon[i + 1]);
+			vOut.push_back(triangle);
+		}
+	}
+}
+
+// Plane 0 is the near plane, then the guard band's left, right, bottom and top
+float COcclusionCuller::ClipDistance(const glm::vec4& clip, int iPlane)
+{
+	switch (iPlane) {
+	case 0: return clip.z + clip.w;
+	case 1: return GUARD_BAND * clip.w + clip.x;
+	case 2: return GUARD_BAND * clip.w - clip.x;
+	case 3: return GUARD_BAND * clip.w + clip.y;
+	default: return GUARD_BAND * clip.w - clip.y;
+	}
+}
+
+// Rasterises every triangle that overlaps one band of TILE_SIZE rows, then reduces the band to its row of HiZ tiles.
+//
+// The vertices are snapped to 1/2^SUBPIXEL_BITS of a pixel and the edge functions are evaluated exactly in integers,
+// four pixel centres at once.  A pixel centre lying on an edge belongs to the triangle only if the edge is a top or a
+// left edge, so a pixel on an edge shared by two triangles is covered by exactly one of them and meshes have no
+// cracks.  Depth is still a float plane.
+void COcclusionCuller::RasteriseBand(int iBand)
+{
+	const int ONE = 1 << SUBPIXEL_BITS;
+	const int HALF = ONE / 2;
+	const int iBandTop = iBand * TILE_SIZE;
+	const int iBandBottom = iBandTop + TILE_SIZE;
+	const __m128 laneOffsets = _mm_setr_ps(0.0f, (float)ONE, 2.0f * ONE, 3.0f * ONE);
+
+	for (unsigned int c = 0; c < m_vChunkTriangles.size(); c++) {
+		const std::vector<ScreenTriangle>& vTriangles = m_vChunkTriangles[c];
+		for (unsigned int t = 0; t < vTriangles.size(); t++) {
+			int X[3], Y[3];
+			float Z[3];
+			for (int i = 0; i < 3; i++) {
+				X[i] = (int)floor(vTriangles[t].v[i].x * ONE + 0.5f);
+				Y[i] = (int)floor(vTriangles[t].v[i].y * ONE + 0.5f);
+				Z[i] = vTriangles[t].v[i].z;
+			}
+
+			// Make the winding counter-clockwise, so the edge functions are positive inside
+			long long area = (long long)(X[1] - X[0]) * (Y[2] - Y[0]) - (long long)(Y[1] - Y[0]) * (X[2] - X[0]);
+			if (area == 0)
+				continue;
+			if (area < 0) {
+				std::swap(X[1], X[2]);
+				std::swap(Y[1], Y[2]);
+				std::swap(Z[1], Z[2]);
+				area = -area;
+			}
+
+			// Pixels whose centres can be inside the triangle's bounding rectangle, within this band
+			int iMinX = std::max((std::min(X[0], std::min(X[1], X[2])) - HALF + ONE - 1) >> SUBPIXEL_BITS, 0) & ~3;
+			int iMaxX = std::min((std::max(X[0], std::max(X[1], X[2])) - HALF) >> SUBPIXEL_BITS, WIDTH - 1);
+			int iMinY = std::max((std::min(Y[0], std::min(Y[1], Y[2])) - HALF + ONE - 1) >> SUBPIXEL_BITS, iBandTop);
+			int iMaxY = std::min((std::max(Y[0], std::max(Y[1], Y[2])) - HALF) >> SUBPIXEL_BITS, iBandBottom - 1);
+			if (iMinX > iMaxX || iMinY > iMaxY)
+				continue;
+
+			// Edge e runs from vertex e + 1 to vertex e + 2, opposite vertex e: E(p) = A (p.x - a.x) + B (p.y - a.y),
+			// twice the area of (a, b, p).  Pixels on an edge that is neither top nor left are moved outside by one.
+			int A[3], B[3];
+			long long rowStart[3];
+			int iFirstX = (iMinX << SUBPIXEL_BITS) + HALF, iFirstY = (iMinY << SUBPIXEL_BITS) + HALF;
+			for (int e = 0; e < 3; e++) {
+				int a = (e + 1) % 3, b = (e + 2) % 3;
+				A[e] = Y[a] - Y[b];
+				B[e] = X[b] - X[a];
+				bool bTopLeft = A[e] > 0 || (A[e] == 0 && B[e] < 0);
+				rowStart[e] = (long long)A[e] * (iFirstX - X[a]) + (long long)B[e] * (iFirstY - Y[a]) - (bTopLeft ? 0 : 1);
+			}
+
+			// The edge functions divided by the area are the barycentric weights of the vertices, so depth is a plane
+			// in the same form, here per subpixel
+			float fArea = (float)area;
+			float zA = (A[0] * Z[0] + A[1] * Z[1] + A[2] * Z[2]) / fArea;
+			float zB = (B[0] * Z[0] + B[1] * Z[1] + B[2] * Z[2]) / fArea;
+			float zFirst = (rowStart[0] * Z[0] + rowStart[1] * Z[1] + rowStart[2] * Z[2]) / fArea;
+
+			// The edge functions of four neighbouring pixels, and how much they change per step of four pixels
+			__m128i laneE[3], stepE[3];
+			for (int e = 0; e < 3; e++) {
+				laneE[e] = _mm_setr_epi32(0, A[e] * ONE, A[e] * 2 * ONE, A[e] * 3 * ONE);
+				stepE[e] = _mm_set1_epi32(A[e] * 4 * ONE);
+			}
+			__m128 zLanes = _mm_mul_ps(_mm_set1_ps(zA), laneOffsets);
+			__m128 zStep = _mm_set1_ps(zA * 4 * ONE);
+
+			for (int y = iMinY; y <= iMaxY; y++) {
+				int iRow = (y - iMinY) << SUBPIXEL_BITS;
+				__m128i e0 = _mm_add_epi32(_mm_set1_epi32((int)(rowStart[0] + (long long)B[0] * iRow)), laneE[0]);
+				__m128i e1 = _mm_add_epi32(_mm_set1_epi32((int)(rowStart[1] + (long long)B[1] * iRow)), laneE[1]);
+				__m128i e2 = _mm_add_epi32(_mm_set1_epi32((int)(rowStart[2] + (long long)B[2] * iRow)), laneE[2]);
+				__m128 z = _mm_add_ps(_mm_set1_ps(zFirst + zB * iRow), zLanes);
+				float* pRow = &m_vDepth[y * WIDTH];
+
+				for (int x = iMinX; x <= iMaxX; x += 4) {
+					// Inside where no edge function is negative, which is where the sign bit of their OR is clear
+					__m128i outside = _mm_srai_epi32(_mm_or_si128(e0, _mm_or_si128(e1, e2)), 31);
+					__m128 inside = _mm_castsi128_ps(_mm_xor_si128(outside, _mm_set1_epi32(-1)));
+					if (_mm_movemask_ps(inside) != 0) {
+						__m128 old = _mm_loadu_ps(pRow + x);
+						__m128 nearer = _mm_min_ps(old, z);
+						_mm_storeu_ps(pRow + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+					}
+					e0 = _mm_add_epi32(e0, stepE[0]);
+					e1 = _mm_add_epi32(e1, stepE[1]);
+					e2 = _mm_add_epi32(e2, stepE[2]);
+					z = _mm_add_ps(z, zStep);
+				}
+			}
+		}
+	}
+
+	BuildHiZ(iBand);
+}
+
+// Each HiZ tile keeps the farthest depth of its pixels
+void COcclusionCuller::BuildHiZ(int iBand)
+{
+	for (int tx = 0; tx < TILES_X; tx++) {
+		__m128 farthest = _mm_setzero_ps();
+		for (int y = iBand * TILE_SIZE; y < (iBand + 1) * TILE_SIZE; y++) {
+			const float* pRow = &m_vDepth[y * WIDTH + tx * TILE_SIZE];
+			for (int x = 0; x < TILE_SIZE; x += 4)
+				farthest = _mm_max_ps(farthest, _mm_loadu_ps(pRow + x));
+		}
+		float values[4];
+		_mm_storeu_ps(values, farthest);
+		m_vHiZ[iBand * TILES_X + tx] = std::max(std::max(values[0], values[1]), std::max(values[2], values[3]));
+	}
+}
+
+void COcclusionCuller::Render(const glm::mat4& viewProjection)
+{
+	m_viewProjection = viewProjection;
+	std::fill(m_vDepth.begin(), m_vDepth.end(), 1.0f);
+
+	int iTriangles = (int)m_vOccluderVertices.size() / 3;
+	int iJobs = (iTriangles + TRIANGLES_PER_JOB - 1) / TRIANGLES_PER_JOB;
+	m_vChunkTriangles.resize(iJobs);
+
+	auto transform = [&](int iJob) {
+		int iFirst = iJob * TRIANGLES_PER_JOB;
+		TransformTriangles(iFirst, std::min(TRIANGLES_PER_JOB, iTriangles - iFirst), m_vChunkTriangles[iJob]);
+	};
+	auto rasterise = [&](int iBand) { RasteriseBand(iBand); };
+
+	if (m_pPool != NULL) {
+		m_pPool->ParallelFor(iJobs, transform);
+		m_pPool->ParallelFor(TILES_Y, rasterise);
+	}
+	else {
+		for (int i = 0; i < iJobs; i++)
+			transform(i);
+		for (int i = 0; i < TILES_Y; i++)
+			rasterise(i);
+	}
+
+	m_iRasterisedTriangles = 0;
+	for (int i = 0; i < iJobs; i++)
+		m_iRasterisedTriangles += (int)m_vChunkTriangles[i].size();
+}
+
+bool COcclusionCuller::TestBox(const BoundingBox& box) const
+{
+	// Screen rectangle and nearest depth of the box's corners
+	glm::vec3 screenMin(1e30f), screenMax(-1e30f);
+	for (int i = 0; i < 8; i++) {
+		glm::vec3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+		glm::vec4 clip = m_viewProjection * glm::vec4(corner, 1.0f);
+		if (clip.z + clip.w < 0.0f)
+			return true;
+
+		glm::vec3 screen = ToScreen(clip);
+		screenMin = glm::min(screenMin, screen);
+		screenMax = glm::max(screenMax, screen);
+	}
+
+	if (screenMax.x < 0.0f || screenMin.x >= (float)WIDTH || screenMax.y < 0.0f || screenMin.y >= (float)HEIGHT)
+		return false;
+
+	int iMinX = std::max((int)floor(screenMin.x), 0) / TILE_SIZE;
+	int iMaxX = std::min((int)floor(screenMax.x), WIDTH - 1) / TILE_SIZE;
+	int iMinY = std::max((int)floor(screenMin.y), 0) / TILE_SIZE;
+	int iMaxY = std::min((int)floor(screenMax.y), HEIGHT - 1) / TILE_SIZE;
+
+	// Visible if any covered tile has something behind the box's nearest point
+	for (int ty = iMinY; ty <= iMaxY; ty++) {
+		for (int tx = iMinX; tx <= iMaxX; tx++) {
+			if (screenMin.z <= m_vHiZ[ty * TILES_X + tx])
+				return true;
+		}
+	}
+	return false;
+}
+
+void COcclusionCuller::TestBoxes(const std::vector<BoundingBox>& vBoxes, std::vector<char>& vVisible)
+{
+	vVisible.resize(vBoxes.size());
+	int iCount = (int)vBoxes.size();
+	int iJobs = (iCount + BOXES_PER_JOB - 1) / BOXES_PER_JOB;
+
+	auto test = [&](int iJob) {
+		int iEnd = std::min((iJob + 1) * BOXES_PER_JOB, iCount);
+		for (int i = iJob * BOXES_PER_JOB; i < iEnd; i++)
+			vVisible[i] = TestBox(vBoxes[i]) ? 1 : 0;
+	};
+
+	if (m_pPool != NULL)
+		m_pPool->ParallelFor(iJobs, test);
+	else {
+		for (int i = 0; i < iJobs; i++)
+			test(i);
+	}
+}
+
+int COcclusionCuller::GetOccluderTriangleCount()
+{
+	return (int)m_vOccluderVertices.size() / 3;
+}
+
+int COcclusionCuller::GetRasterisedTriangleCount()
+{
+	return m_iRasterisedTriangles;
+}
+
+const float* COcclusionCuller::GetDepthBuffer()
+{
+	return &m_vDepth[0];
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "./include/glm/glm.hpp"
+#include "BoundingBox.h"
+
+#include <vector>
+
+class CThreadPool;
+
+// Software occlusion culling.  Occluder triangles are rasterised on the CPU into a small depth buffer, four pixels at
+// a time with SSE and a watertight fixed point rasteriser, and the buffer is reduced to a hierarchical depth (HiZ) grid holding the farthest depth in each
+// tile.  An object is hidden if the nearest point of its bounding box is behind every tile its screen rectangle covers.
+//
+// The buffer is split into horizontal bands that are rasterised on a thread pool.  Each pixel belongs to one band and
+// keeps the minimum of the depths written to it, so the result does not depend on thread timing.  The class makes no
+// OpenGL or Windows calls.
+class COcclusionCuller
+{
+public:
+	COcclusionCuller();
+	~COcclusionCuller();
+
+	void Create(CThreadPool* pPool);			// pPool may be NULL to run on the calling thread
+
+	// Occluders are stored in world space, so they only need adding again when they move
+	void AddOccluder(const std::vector<glm::vec3>& vPositions, const std::vector<unsigned int>& vIndices, const glm::mat4& modelMatrix);
+	void AddOccluderBox(const BoundingBox& box, const glm::mat4& modelMatrix);
+	void ClearOccluders();
+
+	// Clears the depth buffer, rasterises the occluders as seen through viewProjection and builds the HiZ grid
+	void Render(const glm::mat4& viewProjection);
+
+	// Returns false if the world space box is hidden behind the occluders or off screen.  Boxes crossing the camera's
+	// near plane are always visible.
+	bool TestBox(const BoundingBox& box) const;
+
+	// Tests many boxes on the thread pool.  vVisible is resized to match vBoxes.
+	void TestBoxes(const std::vector<BoundingBox>& vBoxes, std::vector<char>& vVisible);
+
+	int GetOccluderTriangleCount();
+	int GetRasterisedTriangleCount();			// Triangles left after near-plane clipping in the last Render
+	const float* GetDepthBuffer();				// WIDTH x HEIGHT depths in [0, 1], bottom row first
+
+	static const int WIDTH = 256;
+	static const int HEIGHT = 128;
+	static const int TILE_SIZE = 8;				// HiZ tiles are TILE_SIZE pixels square
+	static const int TILES_X = WIDTH / TILE_SIZE;
+	static const int TILES_Y = HEIGHT / TILE_SIZE;
+	static const int SUBPIXEL_BITS = 4;			// Vertices are snapped to 1/16 of a pixel
+
+	// Triangles are clipped to GUARD_BAND times the screen's extent around its centre, so snapped coordinates stay
+	// within a few thousand pixels and the edge functions cannot overflow 32 bits
+	static const int GUARD_BAND = 4;
+	static const int CLIP_PLANES = 5;			// Near plane and the four sides of the guard band
+
+private:
+	// A triangle in screen space: x and y in pixels, z is depth in [0, 1]
+	struct ScreenTriangle {
+		glm::vec3 v[3];
+	};
+
+	void TransformTriangles(int iFirst, int iCount, std::vector<ScreenTriangle>& vOut);
+	static float ClipDistance(const glm::vec4& clip, int iPlane);		// Inside where not negative
+	void RasteriseBand(int iBand);
+	void BuildHiZ(int iBand);
+	glm::vec3 ToScreen(const glm::vec4& clip) const;
+
+	CThreadPool* m_pPool;
+	std::vector<glm::vec3> m_vOccluderVertices;	// World space, three per triangle
+	glm::mat4 m_viewProjection;
+	std::vector<std::vector<ScreenTriangle>> m_vChunkTriangles;	// Transformed triangles, one list per job
+	std::vector<float> m_vDepth;
+	std::vector<float> m_vHiZ;
+	int m_iRasterisedTriangles;
+};
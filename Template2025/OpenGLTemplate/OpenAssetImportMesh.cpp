@@ -18,42 +18,31 @@
 
 #include <assert.h>
 #include "OpenAssetImportMesh.h"
+#include "MappedFile.h"
+#include "HighResolutionTimer.h"
+#include "MeshOptimiser.h"
+#include "Shaders.h"
+#include "./include/glm/gtc/packing.hpp"
 
 #pragma comment(lib, "lib/assimp.lib")
 
-COpenAssetImportMesh::MeshEntry::MeshEntry()
-{
-    vbo = INVALID_OGL_VALUE;
-    ibo = INVALID_OGL_VALUE;
-    NumIndices  = 0;
-    MaterialIndex = INVALID_MATERIAL;
-};
-
-COpenAssetImportMesh::MeshEntry::~MeshEntry()
-{
-    if (vbo != INVALID_OGL_VALUE)
-        glDeleteBuffers(1, &vbo);
-
-    if (ibo != INVALID_OGL_VALUE)
-        glDeleteBuffers(1, &ibo);
-}
-
-void COpenAssetImportMesh::MeshEntry::Init(const std::vector<Vertex>& Vertices,
-                          const std::vector<unsigned int>& Indices)
-{
-    NumIndices = int(Indices.size());
-
-	glGenBuffers(1, &vbo);
-  	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * Vertices.size(), &Vertices[0], GL_STATIC_DRAW);
-
-    glGenBuffers(1, &ibo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * NumIndices, &Indices[0], GL_STATIC_DRAW);
-}
-
 COpenAssetImportMesh::COpenAssetImportMesh()
 {
+    m_vao = 0;
+    m_vbo = 0;
+    m_ibo = 0;
+    m_instanceBuffer = 0;
+    memset(m_TriangleCounts, 0, sizeof(m_TriangleCounts));
+    m_Compact = false;
+    m_CompactError.Position = m_CompactError.Normal = m_CompactError.TexCoord = 0.0f;
+    m_LoadedFromCache = false;
+    m_IsPrepared = false;
+    m_Prepared.pVertexData = m_Prepared.pIndexData = NULL;
+    m_Prepared.pEntries = NULL;
+    m_Prepared.pMaterials = NULL;
+    m_Prepared.NumEntries = m_Prepared.NumMaterials = 0;
+    m_LoadTime = 0.0;
+    m_ImportTime = 0.0;
 }
 
 
@@ -66,83 +55,371 @@ COpenAssetImportMesh::~COpenAssetImportMesh()
 void COpenAssetImportMesh::Clear()
 {
     for (unsigned int i = 0 ; i < m_Textures.size() ; i++) {
-        SAFE_DELETE(m_Textures[i]);
+        if (m_Textures[i])
+            CTextureCache::GetInstance().Release(m_Textures[i]);
+        m_Textures[i] = NULL;
     }
 	glDeleteVertexArrays(1, &m_vao);
+    glDeleteBuffers(1, &m_vbo);
+    glDeleteBuffers(1, &m_ibo);
+    m_vao = 0;
+    m_vbo = 0;
+    m_ibo = 0;
+    for (int i = 0 ; i < CMeshSimplifier::LOD_COUNT ; i++) {
+        m_Batches[i].clear();
+        m_TriangleCounts[i] = 0;
+    }
 }
 
 
-bool COpenAssetImportMesh::Load(const std::string& Filename)
+bool COpenAssetImportMesh::Load(const std::string& Filename, CTextureLoader* pLoader, bool bCompact)
 {
-    // Release the previously loaded mesh (if it exists)
-    Clear();
-    
-    bool Ret = false;
+    return Prepare(Filename, bCompact) && Upload(pLoader);
+}
+
+bool COpenAssetImportMesh::Prepare(const std::string& Filename, bool bCompact)
+{
+    CHighResolutionTimer Timer;
+    Timer.Start();
+    m_IsPrepared = false;
+    m_Filename = Filename;
+    m_CacheFile.Close();
+
+    // The cache is keyed on the model file's contents, so it goes stale by itself if the model changes
+    unsigned long long SourceHash = 0;
+    CMappedFile SourceFile;
+    if (SourceFile.Open(Filename)) {
+        SourceHash = SourceFile.GetHash();
+        SourceFile.Close();
+    }
+    std::string CachePath = Filename.substr(0, Filename.find_last_of('.')) + ".mesh";
+    m_Compact = bCompact;
+
+    m_LoadedFromCache = SourceHash != 0 && LoadCache(CachePath, SourceHash);
+    if (m_LoadedFromCache) {
+        m_LoadTime = Timer.Elapsed();
+        printf("Loaded mesh '%s' from its cache in %.1f ms (imported in %.1f ms)\n", Filename.c_str(), m_LoadTime, m_ImportTime);
+        if (m_Compact)
+            printf("Compact vertices of '%s': position error %.5f, normal error %.2f degrees, texture coordinate error %.3f texels\n",
+                Filename.c_str(), m_CompactError.Position, m_CompactError.Normal, m_CompactError.TexCoord);
+        m_IsPrepared = true;
+        return true;
+    }
+    m_CacheFile.Close();
+
     Assimp::Importer Importer;
 
     const aiScene* pScene = Importer.ReadFile(Filename.c_str(), aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs);
     
-    if (pScene) {
-        Ret = InitFromScene(pScene, Filename);
-    }
-    else {
+    if (!pScene) {
         MessageBox(NULL, Importer.GetErrorString(), "Error loading mesh model", MB_ICONHAND);
+        return false;
     }
 
-    return Ret;
+    std::vector<Vertex> Vertices;
+    std::vector<unsigned int> Indices;
+    m_Entries.clear();
+    m_Materials.clear();
+    InitFromScene(pScene, Vertices, Indices, m_Entries, m_Materials);
+    Optimise(Vertices, Indices, m_Entries, m_IndexData, Filename);
+
+    BoundingBox Bounds;
+    for (unsigned int i = 0 ; i < Vertices.size() ; i++)
+        Bounds.Extend(Vertices[i].m_pos);
+    m_VertexData.clear();
+    m_CompactError.Position = m_CompactError.Normal = m_CompactError.TexCoord = 0.0f;
+    if (m_Compact)
+        CompactVertices(Vertices, Bounds, m_VertexData, m_CompactError);
+    else if (!Vertices.empty())
+        m_VertexData.assign((const BYTE*)&Vertices[0], (const BYTE*)&Vertices[0] + Vertices.size() * sizeof(Vertex));
+    m_Prepared.pVertexData = m_VertexData.empty() ? NULL : &m_VertexData[0];
+    m_Prepared.pIndexData = m_IndexData.empty() ? NULL : &m_IndexData[0];
+    m_Prepared.pEntries = m_Entries.empty() ? NULL : &m_Entries[0];
+    m_Prepared.NumEntries = (unsigned int)m_Entries.size();
+    m_Prepared.pMaterials = m_Materials.empty() ? NULL : &m_Materials[0];
+    m_Prepared.NumMaterials = (unsigned int)m_Materials.size();
+    m_Prepared.Bounds = Bounds;
+    m_bounds = Bounds;
+    m_ImportTime = Timer.Elapsed();
+
+    if (SourceHash != 0)
+        SaveCache(CachePath, SourceHash, m_VertexData, m_IndexData, m_Entries, m_Materials);
+    m_LoadTime = Timer.Elapsed();
+    printf("Imported mesh '%s' in %.1f ms\n", Filename.c_str(), m_ImportTime);
+    if (m_Compact)
+        printf("Compact vertices of '%s': position error %.5f, normal error %.2f degrees, texture coordinate error %.3f texels\n",
+            Filename.c_str(), m_CompactError.Position, m_CompactError.Normal, m_CompactError.TexCoord);
+    m_IsPrepared = true;
+    return true;
 }
 
-bool COpenAssetImportMesh::InitFromScene(const aiScene* pScene, const std::string& Filename)
-{  
-    m_Entries.resize(pScene->mNumMeshes);
-    m_Textures.resize(pScene->mNumMaterials);
+// Replaces the previously loaded mesh (if it exists) with the prepared one, then lets go of the prepared data
+bool COpenAssetImportMesh::Upload(CTextureLoader* pLoader)
+{
+    if (!m_IsPrepared)
+        return false;
 
-	glGenVertexArrays(1, &m_vao); 
-	glBindVertexArray(m_vao);
+    CHighResolutionTimer Timer;
+    Timer.Start();
+    Clear();
+    bool Ret = InitFromData(m_Prepared.pVertexData, m_Prepared.pIndexData, m_Prepared.pEntries, m_Prepared.NumEntries,
+        m_Prepared.pMaterials, m_Prepared.NumMaterials, m_Prepared.Bounds, m_Filename, pLoader);
+
+    m_IsPrepared = false;
+    m_CacheFile.Close();
+    std::vector<BYTE>().swap(m_VertexData);
+    std::vector<BYTE>().swap(m_IndexData);
+    std::vector<MeshFileEntry>().swap(m_Entries);
+    std::vector<MeshFileMaterial>().swap(m_Materials);
+    m_LoadTime += Timer.Elapsed();
+    return Ret;
+}
 
+// Gathers every mesh in the scene into one array of vertices and one of 32 bit indices
+void COpenAssetImportMesh::InitFromScene(const aiScene* pScene, std::vector<Vertex>& Vertices, std::vector<unsigned int>& Indices,
+    std::vector<MeshFileEntry>& Entries, std::vector<MeshFileMaterial>& Materials)
+{  
+    const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
 
-    // Initialize the meshes in the scene one by one
-    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+    Entries.resize(pScene->mNumMeshes);
+    for (unsigned int i = 0 ; i < pScene->mNumMeshes ; i++) {
         const aiMesh* paiMesh = pScene->mMeshes[i];
-        InitMesh(i, paiMesh);
+        MeshFileEntry& Entry = Entries[i];
+        Entry.BaseVertex = (unsigned int)Vertices.size();
+        Entry.NumVertices = paiMesh->mNumVertices;
+        Entry.IndexOffset = (unsigned int)(Indices.size() * sizeof(unsigned int));
+        Entry.NumIndices = paiMesh->mNumFaces * 3;
+        Entry.IndexSize = sizeof(unsigned int);
+        Entry.MaterialIndex = paiMesh->mMaterialIndex;
+        Entry.Lod = 0;
+
+        for (unsigned int j = 0 ; j < paiMesh->mNumVertices ; j++) {
+            const aiVector3D* pPos      = &(paiMesh->mVertices[j]);
+            const aiVector3D* pNormal   = &(paiMesh->mNormals[j]);
+            const aiVector3D* pTexCoord = paiMesh->HasTextureCoords(0) ? &(paiMesh->mTextureCoords[0][j]) : &Zero3D;
+
+            Vertices.push_back(Vertex(glm::vec3(pPos->x, pPos->y, pPos->z),
+                                      glm::vec2(pTexCoord->x, 1.0f-pTexCoord->y),
+                                      glm::vec3(pNormal->x, pNormal->y, pNormal->z)));
+        }
+
+        for (unsigned int j = 0 ; j < paiMesh->mNumFaces ; j++) {
+            const aiFace& Face = paiMesh->mFaces[j];
+            assert(Face.mNumIndices == 3);
+            Indices.push_back(Face.mIndices[0]);
+            Indices.push_back(Face.mIndices[1]);
+            Indices.push_back(Face.mIndices[2]);
+        }
     }
 
-    return InitMaterials(pScene, Filename);
+    Materials.resize(pScene->mNumMaterials);
+    for (unsigned int i = 0 ; i < pScene->mNumMaterials ; i++) {
+        const aiMaterial* pMaterial = pScene->mMaterials[i];
+        MeshFileMaterial& Material = Materials[i];
+        memset(&Material, 0, sizeof(Material));
+
+        aiString Path;
+        if (pMaterial->GetTextureCount(aiTextureType_DIFFUSE) > 0 &&
+            pMaterial->GetTexture(aiTextureType_DIFFUSE, 0, &Path, NULL, NULL, NULL, NULL, NULL) == AI_SUCCESS)
+            strncpy_s(Material.TexturePath, Path.data, _TRUNCATE);
+
+        aiColor3D color (0.f,0.f,0.f);
+        pMaterial->Get(AI_MATKEY_COLOR_DIFFUSE,color);
+        Material.Diffuse[0] = color[0];
+        Material.Diffuse[1] = color[1];
+        Material.Diffuse[2] = color[2];
+    }
 }
 
-void COpenAssetImportMesh::InitMesh(unsigned int Index, const aiMesh* paiMesh)
+// Quantises the vertices into CompactVertex, then decodes them again the way the GPU will to measure the error
+void COpenAssetImportMesh::CompactVertices(const std::vector<Vertex>& Vertices, const BoundingBox& Bounds, std::vector<BYTE>& VertexData,
+    CompactError& Error)
 {
-    m_Entries[Index].MaterialIndex = paiMesh->mMaterialIndex;
-    
-    std::vector<Vertex> Vertices;
-    std::vector<unsigned int> Indices;
-
-    const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
+    glm::vec3 Extent = Bounds.max - Bounds.min;
+    glm::vec3 Scale(Extent.x > 0.0f ? 1.0f / Extent.x : 0.0f, Extent.y > 0.0f ? 1.0f / Extent.y : 0.0f, Extent.z > 0.0f ? 1.0f / Extent.z : 0.0f);
+
+    VertexData.resize(Vertices.size() * sizeof(CompactVertex));
+    CompactVertex* pCompact = Vertices.empty() ? NULL : (CompactVertex*)&VertexData[0];
+    Error.Position = Error.Normal = Error.TexCoord = 0.0f;
+    for (unsigned int i = 0 ; i < Vertices.size() ; i++) {
+        const Vertex& v = Vertices[i];
+        CompactVertex& c = pCompact[i];
+        glm::vec3 Normalised = (v.m_pos - Bounds.min) * Scale;
+        for (int k = 0 ; k < 3 ; k++)
+            c.m_pos[k] = glm::packUnorm1x16(Normalised[k]);
+        c.m_pos[3] = 0;
+        c.m_tex = glm::packHalf2x16(v.m_tex);
+        glm::vec3 Normal = glm::length(v.m_normal) > 0.0f ? glm::normalize(v.m_normal) : glm::vec3(0.0f, 1.0f, 0.0f);
+        c.m_normal = glm::packSnorm3x10_1x2(glm::vec4(Normal, 0.0f));
+
+        glm::vec3 Position = Bounds.min + glm::vec3(glm::unpackUnorm1x16(c.m_pos[0]), glm::unpackUnorm1x16(c.m_pos[1]),
+            glm::unpackUnorm1x16(c.m_pos[2])) * Extent;
+        glm::vec3 DecodedNormal = glm::normalize(glm::vec3(glm::unpackSnorm3x10_1x2(c.m_normal)));
+        float Angle = glm::degrees(acosf(glm::clamp(glm::dot(Normal, DecodedNormal), -1.0f, 1.0f)));
+        glm::vec2 TexCoordError = glm::abs(glm::unpackHalf2x16(c.m_tex) - v.m_tex) * 1024.0f;
+        Error.Position = max(Error.Position, glm::length(Position - v.m_pos));
+        Error.Normal = max(Error.Normal, Angle);
+        Error.TexCoord = max(Error.TexCoord, max(TexCoordError.x, TexCoordError.y));
+    }
+}
 
-    for (unsigned int i = 0 ; i < paiMesh->mNumVertices ; i++) {
-        const aiVector3D* pPos      = &(paiMesh->mVertices[i]);
-        const aiVector3D* pNormal   = &(paiMesh->mNormals[i]);
-        const aiVector3D* pTexCoord = paiMesh->HasTextureCoords(0) ? &(paiMesh->mTextureCoords[0][i]) : &Zero3D;
+// Reorders each entry's triangles for the vertex cache and then for overdraw, and its vertices for fetching, then packs
+// the indices into IndexData, 16 bit for entries with few enough vertices.  Reports the cache efficiency before and
+// after, measured on a simulated FIFO cache.  The coarser levels of detail are built from the reordered entry, and
+// appended to Entries.
+void COpenAssetImportMesh::Optimise(std::vector<Vertex>& Vertices, std::vector<unsigned int>& Indices, std::vector<MeshFileEntry>& Entries,
+    std::vector<BYTE>& IndexData, const std::string& Filename)
+{
+    unsigned int MissesBefore = 0, MissesAfter = 0, NumTriangles = 0, NumVertices = 0, Num16Bit = 0;
+    unsigned int LodTriangles[CMeshSimplifier::LOD_COUNT] = {};
+    std::vector<MeshFileEntry> LodEntries;
+    std::vector<unsigned int> Lods[CMeshSimplifier::LOD_COUNT];
+    IndexData.clear();
+    for (unsigned int i = 0 ; i < Entries.size() ; i++) {
+        MeshFileEntry& Entry = Entries[i];
+        if (Entry.NumIndices == 0)
+            continue;
+        unsigned int* pIndices = &Indices[Entry.IndexOffset / sizeof(unsigned int)];
+        Vertex* pVertices = &Vertices[Entry.BaseVertex];
+
+        MissesBefore += CMeshOptimiser::CountCacheMisses(pIndices, Entry.NumIndices, Entry.NumVertices);
+        CMeshOptimiser::OptimiseVertexCache(pIndices, Entry.NumIndices, Entry.NumVertices);
+        CMeshOptimiser::OptimiseOverdraw(pIndices, Entry.NumIndices, (const BYTE*)&pVertices->m_pos, sizeof(Vertex), Entry.NumVertices);
+        CMeshOptimiser::OptimiseVertexFetch((BYTE*)pVertices, sizeof(Vertex), pIndices, Entry.NumIndices, Entry.NumVertices);
+        MissesAfter += CMeshOptimiser::CountCacheMisses(pIndices, Entry.NumIndices, Entry.NumVertices);
+        NumTriangles += Entry.NumIndices / 3;
+        NumVertices += Entry.NumVertices;
+
+        CMeshSimplifier::BuildLods(pIndices, Entry.NumIndices, (const BYTE*)&pVertices->m_pos, sizeof(Vertex), Entry.NumVertices, Lods);
+
+        // Each level's indices start on a four byte boundary, whatever their size.  A level that could not be reduced
+        // reuses the indices of the one before.
+        Entry.IndexSize = Entry.NumVertices <= 65536 ? sizeof(unsigned short) : sizeof(unsigned int);
+        Num16Bit += Entry.IndexSize == sizeof(unsigned short) ? 1 : 0;
+        MeshFileEntry Level = Entry;
+        for (int Lod = 0 ; Lod < CMeshSimplifier::LOD_COUNT ; Lod++) {
+            Level.Lod = Lod;
+            if (Lod == 0 || Lods[Lod].size() < Lods[Lod - 1].size()) {
+                Level.NumIndices = (unsigned int)Lods[Lod].size();
+                Level.IndexOffset = (unsigned int)((IndexData.size() + 3) & ~3);
+                IndexData.resize(Level.IndexOffset + Level.NumIndices * Level.IndexSize);
+                if (Level.IndexSize == sizeof(unsigned short)) {
+                    unsigned short* pPacked = (unsigned short*)&IndexData[Level.IndexOffset];
+                    for (unsigned int j = 0 ; j < Level.NumIndices ; j++)
+                        pPacked[j] = (unsigned short)Lods[Lod][j];
+                }
+                else
+                    memcpy(&IndexData[Level.IndexOffset], &Lods[Lod][0], Level.NumIndices * sizeof(unsigned int));
+            }
+            if (Lod == 0)
+                Entry = Level;
+            else
+                LodEntries.push_back(Level);
+            LodTriangles[Lod] += Level.NumIndices / 3;
+        }
+    }
+    Entries.insert(Entries.end(), LodEntries.begin(), LodEntries.end());
+
+    if (NumTriangles > 0)
+        printf("Optimised mesh '%s': ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, %u of %u entries with 16 bit indices\n",
+            Filename.c_str(), (float)MissesBefore / NumTriangles, (float)MissesAfter / NumTriangles,
+            (float)MissesBefore / NumVertices, (float)MissesAfter / NumVertices, Num16Bit, (unsigned int)(Entries.size() - LodEntries.size()));
+    if (NumTriangles > 0)
+        printf("Levels of detail of '%s': %u, %u, %u and %u triangles\n", Filename.c_str(), LodTriangles[0], LodTriangles[1],
+            LodTriangles[2], LodTriangles[3]);
+}
 
-        Vertex v(glm::vec3(pPos->x, pPos->y, pPos->z),
-                 glm::vec2(pTexCoord->x, 1.0f-pTexCoord->y),
-                 glm::vec3(pNormal->x, pNormal->y, pNormal->z));
+// Creates the buffers and acquires the textures.  The data can come straight from a mapped .mesh file.
+bool COpenAssetImportMesh::InitFromData(const BYTE* pVertexData, const BYTE* pIndexData, const MeshFileEntry* pEntries,
+    unsigned int NumEntries, const MeshFileMaterial* pMaterials, unsigned int NumMaterials, const BoundingBox& Bounds,
+    const std::string& Filename, CTextureLoader* pLoader)
+{
+    m_Textures.resize(NumMaterials);
+    m_instanceBuffer = 0;
+    m_bounds = Bounds;
+    m_Positions.clear();
+    m_Indices.clear();
+
+    // The entries' vertices and indices are already one after another, so each array goes up in one piece
+    unsigned int NumVertices = 0, IndexDataSize = 0;
+    for (unsigned int i = 0 ; i < NumEntries ; i++) {
+        NumVertices = max(NumVertices, pEntries[i].BaseVertex + pEntries[i].NumVertices);
+        IndexDataSize = max(IndexDataSize, pEntries[i].IndexOffset + pEntries[i].NumIndices * pEntries[i].IndexSize);
+    }
 
-        Vertices.push_back(v);
+	glGenVertexArrays(1, &m_vao); 
+	glBindVertexArray(m_vao);
+    glGenBuffers(1, &m_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+    GLsizei VertexSize = m_Compact ? sizeof(CompactVertex) : sizeof(Vertex);
+    glBufferData(GL_ARRAY_BUFFER, VertexSize * NumVertices, pVertexData, GL_STATIC_DRAW);
+    glGenBuffers(1, &m_ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, IndexDataSize, pIndexData, GL_STATIC_DRAW);
+
+    // Position, texture coordinate and normal
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+    if (m_Compact) {
+        glVertexAttribFormat(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, offsetof(CompactVertex, m_pos));
+        glVertexAttribFormat(1, 2, GL_HALF_FLOAT, GL_FALSE, offsetof(CompactVertex, m_tex));
+        glVertexAttribFormat(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, offsetof(CompactVertex, m_normal));
+    }
+    else {
+        glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, m_pos));
+        glVertexAttribFormat(1, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, m_tex));
+        glVertexAttribFormat(2, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, m_normal));
     }
+    glVertexAttribBinding(0, 0);
+    glVertexAttribBinding(1, 0);
+    glVertexAttribBinding(2, 0);
+    glBindVertexBuffer(0, m_vbo, 0, VertexSize);
+	glBindVertexArray(0);
+
+    // Gather the entries into one batch per level of detail and material, keeping a copy of the full detail triangles for
+    // occlusion culling
+    for (unsigned int i = 0 ; i < NumEntries ; i++) {
+        const MeshFileEntry& Entry = pEntries[i];
+        if (Entry.Lod == 0) {
+            unsigned int BaseVertex = (unsigned int)m_Positions.size();
+            for (unsigned int j = 0 ; j < Entry.NumVertices ; j++) {
+                if (m_Compact) {
+                    const unsigned short* pPos = ((const CompactVertex*)pVertexData)[Entry.BaseVertex + j].m_pos;
+                    m_Positions.push_back(Bounds.min + glm::vec3(glm::unpackUnorm1x16(pPos[0]), glm::unpackUnorm1x16(pPos[1]),
+                        glm::unpackUnorm1x16(pPos[2])) * (Bounds.max - Bounds.min));
+                }
+                else
+                    m_Positions.push_back(((const Vertex*)pVertexData)[Entry.BaseVertex + j].m_pos);
+            }
+            const BYTE* pIndices = pIndexData + Entry.IndexOffset;
+            for (unsigned int j = 0 ; j < Entry.NumIndices ; j++)
+                m_Indices.push_back(BaseVertex + (Entry.IndexSize == sizeof(unsigned short) ? ((const unsigned short*)pIndices)[j] : ((const unsigned int*)pIndices)[j]));
+        }
 
-    for (unsigned int i = 0 ; i < paiMesh->mNumFaces ; i++) {
-        const aiFace& Face = paiMesh->mFaces[i];
-        assert(Face.mNumIndices == 3);
-        Indices.push_back(Face.mIndices[0]);
-        Indices.push_back(Face.mIndices[1]);
-        Indices.push_back(Face.mIndices[2]);
+        if (Entry.NumIndices == 0)
+            continue;
+        std::vector<DrawBatch>& Batches = m_Batches[Entry.Lod];
+        m_TriangleCounts[Entry.Lod] += Entry.NumIndices / 3;
+        GLenum IndexType = Entry.IndexSize == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        unsigned int b = 0;
+        while (b < Batches.size() && (Batches[b].MaterialIndex != Entry.MaterialIndex || Batches[b].IndexType != IndexType))
+            b++;
+        if (b == Batches.size()) {
+            Batches.push_back(DrawBatch());
+            Batches[b].MaterialIndex = Entry.MaterialIndex;
+            Batches[b].IndexType = IndexType;
+        }
+        Batches[b].Counts.push_back((GLsizei)Entry.NumIndices);
+        Batches[b].Offsets.push_back((const GLvoid*)(size_t)Entry.IndexOffset);
+        Batches[b].BaseVertices.push_back((GLint)Entry.BaseVertex);
     }
 
-    m_Entries[Index].Init(Vertices, Indices);
+    return InitMaterials(pMaterials, NumMaterials, Filename, pLoader);
 }
 
-bool COpenAssetImportMesh::InitMaterials(const aiScene* pScene, const std::string& Filename)
+bool COpenAssetImportMesh::InitMaterials(const MeshFileMaterial* pMaterials, unsigned int NumMaterials, const std::string& Filename,
+    CTextureLoader* pLoader)
 {
     // Extract the directory part from the file name
     std::string::size_type SlashIndex = Filename.find_last_of("\\");
@@ -161,78 +438,232 @@ bool COpenAssetImportMesh::InitMaterials(const aiScene* pScene, const std::strin
     bool Ret = true;
 
     // Initialize the materials
-    for (unsigned int i = 0 ; i < pScene->mNumMaterials ; i++) {
-        const aiMaterial* pMaterial = pScene->mMaterials[i];
+    for (unsigned int i = 0 ; i < NumMaterials ; i++) {
+        const MeshFileMaterial& Material = pMaterials[i];
+        glm::vec3 Colour(Material.Diffuse[0], Material.Diffuse[1], Material.Diffuse[2]);
 
         m_Textures[i] = NULL;
 
-        if (pMaterial->GetTextureCount(aiTextureType_DIFFUSE) > 0) {
-            aiString Path;
-
-			if (pMaterial->GetTexture(aiTextureType_DIFFUSE, 0, &Path, NULL, NULL, NULL, NULL, NULL) == AI_SUCCESS) {
-                std::string FullPath = Dir + "\\" + Path.data;
-                m_Textures[i] = new CTexture();
-                if (!m_Textures[i]->Load(FullPath, true)) {
- 					MessageBox(NULL, FullPath.c_str(), "Error loading mesh texture", MB_ICONHAND);
-                    delete m_Textures[i];
-                    m_Textures[i] = NULL;
-                    Ret = false;
-                }
-                else {
-                    printf("Loaded texture '%s'\n", FullPath.c_str());
-                }
+        if (Material.TexturePath[0] != '\0') {
+            std::string FullPath = Dir + "\\" + Material.TexturePath;
+            // The diffuse colour stands in until the image arrives, and stays if it cannot be loaded
+            m_Textures[i] = CTextureCache::GetInstance().Acquire(FullPath, pLoader, Colour);
+            if (!m_Textures[i]) {
+ 				MessageBox(NULL, FullPath.c_str(), "Error loading mesh texture", MB_ICONHAND);
+                Ret = false;
+            }
+            else if (pLoader == NULL) {
+                printf("Loaded texture '%s'\n", FullPath.c_str());
             }
         }
 
         // Load a single colour texture matching the diffuse colour if no texture added
         if (!m_Textures[i]) {
-		
-			aiColor3D color (0.f,0.f,0.f);
-			pMaterial->Get(AI_MATKEY_COLOR_DIFFUSE,color);
-
-			m_Textures[i] = new CTexture();
-			BYTE data[3];
-			data[0] = (BYTE) (color[2]*255);
-			data[1] = (BYTE) (color[1]*255);
-			data[2] = (BYTE) (color[0]*255);
-			m_Textures[i]->CreateFromData(data, 1, 1, 24, GL_BGR, false);
-
+			m_Textures[i] = CTextureCache::GetInstance().AcquireColour(Colour);
         }
     }
 
     return Ret;
 }
 
-void COpenAssetImportMesh::Render()
+// Layout of a .mesh file: the header, then the entries (the full detail ones, then the coarser levels), the materials,
+// the vertices and the indices.  Bump MESH_CACHE_VERSION when any of it, or the Vertex or CompactVertex struct, changes.
+static const unsigned int MESH_CACHE_MAGIC = 0x4853454D;	// "MESH"
+static const unsigned int MESH_CACHE_VERSION = 4;
+
+struct MeshCacheHeader
 {
-	glBindVertexArray(m_vao);
+    unsigned int Magic;
+    unsigned int Version;
+    unsigned long long SourceHash;                     // FNV-1a of the model file
+    unsigned int NumEntries, NumMaterials;
+    unsigned int NumVertices, IndexDataSize;
+    unsigned int VertexSize;
+    unsigned int Compact;                              // The vertices are CompactVertex, quantised within the bounds
+    float PositionError, NormalError, TexCoordError;   // Of the compact vertices, as reported at import
+    glm::vec3 BoundsMin, BoundsMax;
+    float ImportTime;                                  // Milliseconds the import took, to report what the cache saves
+};
 
-    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
-		glEnableVertexAttribArray(0);
-		glEnableVertexAttribArray(1);
-		glEnableVertexAttribArray(2);
-        glBindBuffer(GL_ARRAY_BUFFER, m_Entries[i].vbo);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)12);
-        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)20);
+// Returns false if the file is missing, truncated or for another version of the model.  Otherwise the file stays
+// mapped, and the mesh is prepared to be uploaded straight from the mapping.
+bool COpenAssetImportMesh::LoadCache(const std::string& CachePath, unsigned long long SourceHash)
+{
+    CMappedFile& CacheFile = m_CacheFile;
+    if (!CacheFile.Open(CachePath) || CacheFile.GetSize() < sizeof(MeshCacheHeader))
+        return false;
+
+    const BYTE* pData = CacheFile.GetData();
+    const MeshCacheHeader* pHeader = (const MeshCacheHeader*)pData;
+    if (pHeader->Magic != MESH_CACHE_MAGIC || pHeader->Version != MESH_CACHE_VERSION || pHeader->SourceHash != SourceHash ||
+        pHeader->Compact != (m_Compact ? 1u : 0u) || pHeader->VertexSize != (m_Compact ? sizeof(CompactVertex) : sizeof(Vertex)))
+        return false;
+
+    size_t EntriesOffset = sizeof(MeshCacheHeader);
+    size_t MaterialsOffset = EntriesOffset + pHeader->NumEntries * sizeof(MeshFileEntry);
+    size_t VerticesOffset = MaterialsOffset + pHeader->NumMaterials * sizeof(MeshFileMaterial);
+    size_t IndicesOffset = VerticesOffset + (size_t)pHeader->NumVertices * pHeader->VertexSize;
+    if (CacheFile.GetSize() < IndicesOffset + pHeader->IndexDataSize)
+        return false;
+
+    // Check every entry lies inside the arrays before creating anything
+    const MeshFileEntry* pEntries = (const MeshFileEntry*)(pData + EntriesOffset);
+    for (unsigned int i = 0 ; i < pHeader->NumEntries ; i++) {
+        const MeshFileEntry& Entry = pEntries[i];
+        if ((unsigned long long)Entry.BaseVertex + Entry.NumVertices > pHeader->NumVertices ||
+            (Entry.IndexSize != sizeof(unsigned short) && Entry.IndexSize != sizeof(unsigned int)) || Entry.IndexOffset % Entry.IndexSize != 0 ||
+            (unsigned long long)Entry.IndexOffset + (unsigned long long)Entry.NumIndices * Entry.IndexSize > pHeader->IndexDataSize ||
+            Entry.MaterialIndex >= pHeader->NumMaterials || Entry.Lod >= CMeshSimplifier::LOD_COUNT)
+            return false;
+    }
 
+    m_ImportTime = pHeader->ImportTime;
+    m_CompactError.Position = pHeader->PositionError;
+    m_CompactError.Normal = pHeader->NormalError;
+    m_CompactError.TexCoord = pHeader->TexCoordError;
+    m_Prepared.pVertexData = pData + VerticesOffset;
+    m_Prepared.pIndexData = pData + IndicesOffset;
+    m_Prepared.pEntries = pEntries;
+    m_Prepared.NumEntries = pHeader->NumEntries;
+    m_Prepared.pMaterials = (const MeshFileMaterial*)(pData + MaterialsOffset);
+    m_Prepared.NumMaterials = pHeader->NumMaterials;
+    m_Prepared.Bounds = BoundingBox(pHeader->BoundsMin, pHeader->BoundsMax);
+    return true;
+}
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Entries[i].ibo);
+// A failure to write only costs the next load its speed up
+void COpenAssetImportMesh::SaveCache(const std::string& CachePath, unsigned long long SourceHash, const std::vector<BYTE>& VertexData,
+    const std::vector<BYTE>& IndexData, const std::vector<MeshFileEntry>& Entries, const std::vector<MeshFileMaterial>& Materials)
+{
+    FILE* pFile = NULL;
+    if (fopen_s(&pFile, CachePath.c_str(), "wb") != 0 || pFile == NULL)
+        return;
+
+    // Cleared bytewise so the padding written to the file is zero too.  The cast is because glm's vectors have
+    // constructors, which memset would otherwise warn about.
+    MeshCacheHeader Header;
+    memset((void*)&Header, 0, sizeof(Header));
+    Header.Magic = MESH_CACHE_MAGIC;
+    Header.Version = MESH_CACHE_VERSION;
+    Header.SourceHash = SourceHash;
+    Header.NumEntries = (unsigned int)Entries.size();
+    Header.NumMaterials = (unsigned int)Materials.size();
+    Header.VertexSize = m_Compact ? sizeof(CompactVertex) : sizeof(Vertex);
+    Header.NumVertices = (unsigned int)(VertexData.size() / Header.VertexSize);
+    Header.IndexDataSize = (unsigned int)IndexData.size();
+    Header.Compact = m_Compact ? 1 : 0;
+    Header.PositionError = m_CompactError.Position;
+    Header.NormalError = m_CompactError.Normal;
+    Header.TexCoordError = m_CompactError.TexCoord;
+    Header.BoundsMin = m_bounds.min;
+    Header.BoundsMax = m_bounds.max;
+    Header.ImportTime = (float)m_ImportTime;
+
+    fwrite(&Header, sizeof(Header), 1, pFile);
+    if (!Entries.empty())
+        fwrite(&Entries[0], sizeof(MeshFileEntry), Entries.size(), pFile);
+    if (!Materials.empty())
+        fwrite(&Materials[0], sizeof(MeshFileMaterial), Materials.size(), pFile);
+    if (!VertexData.empty())
+        fwrite(&VertexData[0], 1, VertexData.size(), pFile);
+    if (!IndexData.empty())
+        fwrite(&IndexData[0], 1, IndexData.size(), pFile);
+    fclose(pFile);
+}
 
+bool COpenAssetImportMesh::IsCompact()
+{
+    return m_Compact;
+}
 
-        const unsigned int MaterialIndex = m_Entries[i].MaterialIndex;
+// Compact positions arrive as 0 - 1 across the bounds
+void COpenAssetImportMesh::SetDecodeUniforms(CShaderProgram* pProgram)
+{
+    if (!m_Compact)
+        return;
+    pProgram->SetUniform("positionOffset", m_bounds.min);
+    pProgram->SetUniform("positionScale", m_bounds.max - m_bounds.min);
+}
 
-        if (MaterialIndex < m_Textures.size() && m_Textures[MaterialIndex]) {
-            m_Textures[MaterialIndex]->Bind(0);
+bool COpenAssetImportMesh::WasLoadedFromCache()
+{
+    return m_LoadedFromCache;
+}
+
+double COpenAssetImportMesh::GetLoadTime()
+{
+    return m_LoadTime;
+}
+
+double COpenAssetImportMesh::GetImportTime()
+{
+    return m_ImportTime;
+}
+
+// Lod is clamped to the levels there are
+void COpenAssetImportMesh::Render(int Lod)
+{
+	glBindVertexArray(m_vao);
+
+    const std::vector<DrawBatch>& Batches = m_Batches[glm::clamp(Lod, 0, CMeshSimplifier::LOD_COUNT - 1)];
+    for (unsigned int i = 0 ; i < Batches.size() ; i++) {
+        const DrawBatch& Batch = Batches[i];
+        if (Batch.MaterialIndex < m_Textures.size() && m_Textures[Batch.MaterialIndex]) {
+            m_Textures[Batch.MaterialIndex]->Bind(0);
         }
 
+        if (Batch.Counts.size() == 1)
+            glDrawElementsBaseVertex(GL_TRIANGLES, Batch.Counts[0], Batch.IndexType, (GLvoid*)Batch.Offsets[0], Batch.BaseVertices[0]);
+        else
+            glMultiDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei*)&Batch.Counts[0], Batch.IndexType, (GLvoid**)&Batch.Offsets[0],
+                (GLsizei)Batch.Counts.size(), (GLint*)&Batch.BaseVertices[0]);
+    }
+}
+
+unsigned int COpenAssetImportMesh::GetTriangleCount(int Lod)
+{
+    return m_TriangleCounts[glm::clamp(Lod, 0, CMeshSimplifier::LOD_COUNT - 1)];
+}
+
+BoundingBox COpenAssetImportMesh::GetBounds()
+{
+    return m_bounds;
+}
+
+void COpenAssetImportMesh::GetTriangles(std::vector<glm::vec3>& Positions, std::vector<unsigned int>& Indices)
+{
+    Positions = m_Positions;
+    Indices = m_Indices;
+}
 
-        glDrawElements(GL_TRIANGLES, m_Entries[i].NumIndices, GL_UNSIGNED_INT, 0);
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
+// The texture coordinates are assumed to span each texture once
+void COpenAssetImportMesh::RequestTextureDetail(float fPixels)
+{
+    for (unsigned int i = 0 ; i < m_Textures.size() ; i++) {
+        if (m_Textures[i])
+            m_Textures[i]->RequestDetail(fPixels);
     }
+}
 
+// Same as Render, but each mesh entry is drawn once per instance.  There is no instanced multi-draw without an indirect
+// buffer, so the entries sharing a material are drawn one after another.
+void COpenAssetImportMesh::RenderInstanced(CInstanceBuffer& instances, int Lod)
+{
+    if (instances.GetCount() == 0)
+        return;
 
+    glBindVertexArray(m_vao);
+    instances.AttachToVertexArray(m_instanceBuffer);
 
+    const std::vector<DrawBatch>& Batches = m_Batches[glm::clamp(Lod, 0, CMeshSimplifier::LOD_COUNT - 1)];
+    for (unsigned int i = 0 ; i < Batches.size() ; i++) {
+        const DrawBatch& Batch = Batches[i];
+        if (Batch.MaterialIndex < m_Textures.size() && m_Textures[Batch.MaterialIndex]) {
+            m_Textures[Batch.MaterialIndex]->Bind(0);
+        }
+
+        for (unsigned int j = 0 ; j < Batch.Counts.size() ; j++)
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, Batch.Counts[j], Batch.IndexType, (GLvoid*)Batch.Offsets[j],
+                instances.GetCount(), Batch.BaseVertices[j]);
+    }
 }
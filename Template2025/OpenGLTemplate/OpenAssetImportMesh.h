@@ -29,6 +29,10 @@
 
 #include "Common.h"
 #include "Texture.h"
+#include "InstanceBuffer.h"
+#include "BoundingBox.h"
+#include "MeshSimplifier.h"
+#include "MappedFile.h"
 
 #define INVALID_OGL_VALUE 0xFFFFFFFF
 #define SAFE_DELETE(p) if (p) { delete p; p = NULL; }
@@ -50,40 +54,131 @@ struct Vertex
     }
 };
 
+// The compact layout Load can be asked for: 16 bytes a vertex rather than 32.  The COMPACT_VERTEX variant of the main
+// shader turns the position back into object space; the rest is decoded by the vertex fetch.
+struct CompactVertex
+{
+    unsigned short m_pos[4];    // Unsigned normalised across the mesh's bounds.  The fourth is padding.
+    unsigned int m_tex;         // Two half floats, so coordinates outside 0 - 1 still tile
+    unsigned int m_normal;      // GL_INT_2_10_10_10_REV, signed normalised
+};
 
+class CShaderProgram;
+
+
+// Meshes are imported with Assimp the first time, and written to a .mesh file beside the model.  Later loads map that
+// file and upload its vertices and indices straight from the mapping, skipping the import.  Before a mesh is baked, its
+// triangles and vertices are reordered by CMeshOptimiser, and submeshes with few enough vertices get 16 bit indices.
+// CMeshSimplifier then bakes CMeshSimplifier::LOD_COUNT levels of detail into the same file, as extra index ranges over
+// the same vertices.
+//
+// With bCompact, the vertices are quantised into CompactVertex when the mesh is baked, and Load reports the largest
+// error that introduced.  They must then be drawn with the COMPACT_VERTEX shader variant, after SetDecodeUniforms.
+//
+// All the submeshes share one vertex buffer and one index buffer, with the vertex format set up once in the vertex
+// array, so drawing only binds each material's texture and issues a base vertex draw (or a multi-draw, when several
+// submeshes share the material).
 class COpenAssetImportMesh
 {
 public:
     COpenAssetImportMesh();
     ~COpenAssetImportMesh();
-    bool Load(const std::string& Filename);
-    void Render();
+    bool Load(const std::string& Filename, CTextureLoader* pLoader = NULL, bool bCompact = false);  // Textures load in the background if given a loader
+
+    // Load in two halves.  Prepare maps the .mesh file, or imports the model and writes one, without touching OpenGL,
+    // so it can run on a worker thread.  Upload then creates the buffers and acquires the textures on the thread with
+    // the GL context.
+    bool Prepare(const std::string& Filename, bool bCompact = false);
+    bool Upload(CTextureLoader* pLoader = NULL);
+    void Render(int Lod = 0);
+    void RenderInstanced(CInstanceBuffer& instances, int Lod = 0);  // Draws one copy of the mesh per instance
+    void RequestTextureDetail(float fPixels);          // For streamed textures, from the mesh's size on screen
+    unsigned int GetTriangleCount(int Lod = 0);
+    BoundingBox GetBounds();                           // Bounding box of all mesh entries in object coordinates
+    void GetTriangles(std::vector<glm::vec3>& Positions, std::vector<unsigned int>& Indices);  // All entries' triangles, for occlusion culling
+
+    bool IsCompact();
+    void SetDecodeUniforms(CShaderProgram* pProgram);  // For the COMPACT_VERTEX variant; does nothing for full vertices
+
+    bool WasLoadedFromCache();
+    double GetLoadTime();                              // Of Load, or Prepare and Upload, in ms
+    double GetImportTime();                            // What the Assimp import took, even when loaded from the cache
 
 private:
-    bool InitFromScene(const aiScene* pScene, const std::string& Filename);
-    void InitMesh(unsigned int Index, const aiMesh* paiMesh);
-    bool InitMaterials(const aiScene* pScene, const std::string& Filename);
+    // A mesh as it is laid out in a .mesh file.  Each entry's indices count from its first vertex.
+    struct MeshFileEntry {
+        unsigned int BaseVertex, NumVertices;
+        unsigned int IndexOffset, NumIndices;          // Offset in bytes into the index data
+        unsigned int IndexSize;                        // 2 or 4 bytes
+        unsigned int MaterialIndex;
+        unsigned int Lod;                              // Coarser levels share the full detail entry's vertices
+    };
+    struct MeshFileMaterial {
+        char TexturePath[MAX_PATH];                    // Diffuse texture relative to the model, or empty
+        float Diffuse[3];
+    };
+
+    void InitFromScene(const aiScene* pScene, std::vector<Vertex>& Vertices, std::vector<unsigned int>& Indices,
+        std::vector<MeshFileEntry>& Entries, std::vector<MeshFileMaterial>& Materials);
+    // Largest differences between the full and compact vertices: in object space units, in degrees, and in texels of a
+    // 1024 texel texture
+    struct CompactError {
+        float Position, Normal, TexCoord;
+    };
+    static void CompactVertices(const std::vector<Vertex>& Vertices, const BoundingBox& Bounds, std::vector<BYTE>& VertexData,
+        CompactError& Error);
+    void Optimise(std::vector<Vertex>& Vertices, std::vector<unsigned int>& Indices, std::vector<MeshFileEntry>& Entries,
+        std::vector<BYTE>& IndexData, const std::string& Filename);
+    bool InitFromData(const BYTE* pVertexData, const BYTE* pIndexData, const MeshFileEntry* pEntries, unsigned int NumEntries,
+        const MeshFileMaterial* pMaterials, unsigned int NumMaterials, const BoundingBox& Bounds, const std::string& Filename,
+        CTextureLoader* pLoader);
+    bool InitMaterials(const MeshFileMaterial* pMaterials, unsigned int NumMaterials, const std::string& Filename, CTextureLoader* pLoader);
+    bool LoadCache(const std::string& CachePath, unsigned long long SourceHash);
+    void SaveCache(const std::string& CachePath, unsigned long long SourceHash, const std::vector<BYTE>& VertexData,
+        const std::vector<BYTE>& IndexData, const std::vector<MeshFileEntry>& Entries, const std::vector<MeshFileMaterial>& Materials);
     void Clear();
 	
 
-#define INVALID_MATERIAL 0xFFFFFFFF
-
-    struct MeshEntry {
-        MeshEntry();
-
-        ~MeshEntry();
-
-        void Init(const std::vector<Vertex>& Vertices,
-                  const std::vector<unsigned int>& Indices);
-        GLuint vbo;
-        GLuint ibo;
-        unsigned int NumIndices;
+    // The submeshes that share a material and index size, drawn together.  Each one's indices count from its base vertex.
+    struct DrawBatch {
         unsigned int MaterialIndex;
+        GLenum IndexType;
+        std::vector<GLsizei> Counts;
+        std::vector<const GLvoid*> Offsets;            // Into the index buffer, in bytes
+        std::vector<GLint> BaseVertices;
     };
 
-    std::vector<MeshEntry> m_Entries;
+    std::vector<DrawBatch> m_Batches[CMeshSimplifier::LOD_COUNT];
+    unsigned int m_TriangleCounts[CMeshSimplifier::LOD_COUNT];
     std::vector<CTexture*> m_Textures;
 	GLuint m_vao;
+    GLuint m_vbo, m_ibo;        // Every submesh's vertices and indices, one after another
+	GLuint m_instanceBuffer;    // Instance buffer the VAO's instance attributes point at
+    BoundingBox m_bounds;
+    std::vector<glm::vec3> m_Positions;     // CPU copy of every entry's positions and full detail indices
+    std::vector<unsigned int> m_Indices;
+    bool m_Compact;                         // Vertices are CompactVertex
+    CompactError m_CompactError;
+    bool m_LoadedFromCache;
+
+    // What Prepare leaves for Upload: pointers into the mapped .mesh file, or into the imported data
+    struct PreparedMesh {
+        const BYTE* pVertexData;
+        const BYTE* pIndexData;
+        const MeshFileEntry* pEntries;
+        unsigned int NumEntries;
+        const MeshFileMaterial* pMaterials;
+        unsigned int NumMaterials;
+        BoundingBox Bounds;
+    };
+    PreparedMesh m_Prepared;
+    bool m_IsPrepared;
+    std::string m_Filename;
+    CMappedFile m_CacheFile;
+    std::vector<BYTE> m_VertexData, m_IndexData;
+    std::vector<MeshFileEntry> m_Entries;
+    std::vector<MeshFileMaterial> m_Materials;
+    double m_LoadTime, m_ImportTime;
 };
 
 
@@ -4,30 +4,35 @@
 
 
 CPlane::CPlane()
-{}
+{
+	m_pTexture = NULL;
+}
 
 CPlane::~CPlane()
 {}
 
 
 // Create the plane, including its geometry, texture mapping, normal, and colour
-void CPlane::Create(string directory, string filename, float width, float height, float textureRepeat)
+void CPlane::Create(string directory, string filename, float width, float height, float textureRepeat, CTextureLoader* pLoader)
 {
 	
 	m_width = width;
 	m_height = height;
+	m_textureRepeat = textureRepeat;
 
-	// Load the texture
-	m_texture.Load(directory+filename, true);
+	// Load the texture, or share it if something else already has
+	m_pTexture = CTextureCache::GetInstance().Acquire(directory+filename, pLoader);
 
 	m_directory = directory;
 	m_filename = filename;
 
 	// Set parameters for texturing using sampler object
-	m_texture.SetSamplerObjectParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	m_texture.SetSamplerObjectParameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	m_texture.SetSamplerObjectParameter(GL_TEXTURE_WRAP_S, GL_REPEAT);
-	m_texture.SetSamplerObjectParameter(GL_TEXTURE_WRAP_T, GL_REPEAT);
+	if (m_pTexture != NULL) {
+		m_pTexture->SetSamplerObjectParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		m_pTexture->SetSamplerObjectParameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		m_pTexture->SetSamplerObjectParameter(GL_TEXTURE_WRAP_S, GL_REPEAT);
+		m_pTexture->SetSamplerObjectParameter(GL_TEXTURE_WRAP_T, GL_REPEAT);
+	}
 	
 
 	// Use VAO to store state associated with vertices
@@ -92,7 +97,8 @@ void CPlane::Create(string directory, string filename, float width, float height
 void CPlane::Render()
 {
 	glBindVertexArray(m_vao);
-	m_texture.Bind();
+	if (m_pTexture != NULL)
+		m_pTexture->Bind();
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 	
 }
@@ -100,7 +106,23 @@ void CPlane::Render()
 // Release resources
 void CPlane::Release()
 {
-	m_texture.Release();
+	if (m_pTexture != NULL) {
+		CTextureCache::GetInstance().Release(m_pTexture);
+		m_pTexture = NULL;
+	}
 	glDeleteVertexArrays(1, &m_vao);
 	m_vbo.Release();
-}
\ No newline at end of file
+}
+
+// Each repeat of the texture only gets its share of the pixels
+void CPlane::RequestTextureDetail(float fPixels)
+{
+	if (m_pTexture != NULL)
+		m_pTexture->RequestDetail(fPixels / m_textureRepeat);
+}
+
+// The plane lies in y = 0, centred on the origin
+BoundingBox CPlane::GetBounds()
+{
+	return BoundingBox(glm::vec3(-m_width / 2.0f, 0.0f, -m_height / 2.0f), glm::vec3(m_width / 2.0f, 0.0f, m_height / 2.0f));
+}
@@ -2,6 +2,7 @@
 
 #include "Texture.h"
 #include "VertexBufferObject.h"
+#include "BoundingBox.h"
 
 // Class for generating a xz plane of a given size
 class CPlane
@@ -9,15 +10,18 @@ class CPlane
 public:
 	CPlane();
 	~CPlane();
-	void Create(string sDirectory, string sFilename, float fWidth, float fHeight, float fTextureRepeat);
+	void Create(string sDirectory, string sFilename, float fWidth, float fHeight, float fTextureRepeat, CTextureLoader* pLoader = NULL);	// The texture loads in the background if given a loader
 	void Render();
+	BoundingBox GetBounds();	// Bounding box in object coordinates
+	void RequestTextureDetail(float fPixels);	// The plane covers fPixels on screen; the texture repeats across it
 	void Release();
 private:
 	UINT m_vao;
 	CVertexBufferObject m_vbo;
-	CTexture m_texture;
+	CTexture* m_pTexture;	// Shared through CTextureCache
 	string m_directory;
 	string m_filename;
 	float m_width;
 	float m_height;
+	float m_textureRepeat;
 };
\ No newline at end of file
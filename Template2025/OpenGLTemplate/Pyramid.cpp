@@ -4,6 +4,7 @@
 
 CPyramid::CPyramid() :
     m_vao(0),
+    m_instanceBuffer(0),
     m_width(0),
     m_height(0),
     m_blinkTimer(0.0f),
@@ -95,9 +96,11 @@ void CPyramid::Create(float width, float height)
 
 
     // Add data to VBO
+    m_vertices.clear();
     for (int i = 0; i < 18; i++) {
         m_vbo.AddData(&vertices[i], sizeof(glm::vec3));
         m_vbo.AddData(&normals[i], sizeof(glm::vec3));
+        m_vertices.push_back(MeshVertex(vertices[i], glm::vec2(0.0f), normals[i]));
     }
 
     m_vbo.UploadDataToGPU(GL_STATIC_DRAW);
@@ -123,6 +126,33 @@ void CPyramid::Render()
     glDrawArrays(GL_TRIANGLES, 0, 18);  // 6 triangles * 3 vertices
 }
 
+void CPyramid::RenderInstanced(CInstanceBuffer& instances)
+{
+    if (!m_isVisible || instances.GetCount() == 0)
+        return;
+
+    glBindVertexArray(m_vao);
+    instances.AttachToVertexArray(m_instanceBuffer);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 18, instances.GetCount());
+}
+
+// The pyramid is not indexed, so each vertex gets its own index
+int CPyramid::AddToArena(CMeshArena& arena)
+{
+    vector<unsigned int> indices(m_vertices.size());
+    for (unsigned int i = 0; i < indices.size(); i++)
+        indices[i] = i;
+    return arena.AddMesh(m_vertices, indices);
+}
+
+BoundingBox CPyramid::GetBounds()
+{
+    BoundingBox bounds;
+    for (unsigned int i = 0; i < m_vertices.size(); i++)
+        bounds.Extend(m_vertices[i].position);
+    return bounds;
+}
+
 void CPyramid::Release()
 {
     glDeleteVertexArrays(1, &m_vao);
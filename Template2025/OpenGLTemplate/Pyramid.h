@@ -1,5 +1,8 @@
 #pragma once
 #include "VertexBufferObject.h"
+#include "InstanceBuffer.h"
+#include "MeshArena.h"
+#include "BoundingBox.h"
 #include "Common.h"
 
 // Class for generating a pyramid
@@ -10,11 +13,16 @@ public:
     ~CPyramid();
     void Create(float width, float height);
     void Render();
+    void RenderInstanced(CInstanceBuffer& instances);   // Draws one pyramid per instance
+    int AddToArena(CMeshArena& arena);                  // Copies the pyramid into a shared mesh arena and returns its mesh id
+    BoundingBox GetBounds();                           // Bounding box in object coordinates
     void Release();
     void Update(float dt);
 private:
     UINT m_vao;
+    UINT m_instanceBuffer;  // Instance buffer the VAO's instance attributes point at
     CVertexBufferObject m_vbo;
+    vector<MeshVertex> m_vertices;  // CPU copy of the geometry, kept for AddToArena
     float m_width;
     float m_height;
     float m_blinkTimer;
@@ -0,0 +1,236 @@
+#include "RenderQueue.h"
+#include "MeshArena.h"
+#include "Shaders.h"
+#include "Texture.h"
+#include "HighResolutionTimer.h"
+#include "StreamingBuffer.h"
+
+#define BUFFER_OFFSET(i) ((char *)NULL + (i))
+
+CRenderQueue::CRenderQueue()
+{
+	m_pArena = NULL;
+	m_pStream = NULL;
+	m_iStorageAlignment = 0;
+	m_uiIndirectBuffer = 0;
+	m_uiDrawDataBuffer = 0;
+	m_iBatchCount = 0;
+	m_dFlushTime = 0.0;
+}
+
+CRenderQueue::~CRenderQueue()
+{
+	Release();
+}
+
+void CRenderQueue::Create(CMeshArena* pArena, CStreamingBuffer* pStream)
+{
+	m_pArena = pArena;
+	m_pStream = (pStream != NULL && pStream->IsCreated()) ? pStream : NULL;
+	if (m_pStream != NULL)
+		m_iStorageAlignment = CStreamingBuffer::GetStorageBufferAlignment();
+	glGenBuffers(1, &m_uiIndirectBuffer);
+	glGenBuffers(1, &m_uiDrawDataBuffer);
+}
+
+void CRenderQueue::Begin(const glm::mat4& viewMatrix)
+{
+	m_viewMatrix = viewMatrix;
+	m_vCommands.clear();
+	m_vKeys.clear();
+	m_vPrograms.clear();
+	m_vTextures.clear();
+}
+
+// Numbers programs and textures in the order they are first seen this frame
+int CRenderQueue::FindOrAdd(vector<void*>& vList, void* p)
+{
+	for (unsigned int i = 0; i < vList.size(); i++) {
+		if (vList[i] == p)
+			return (int)i;
+	}
+	vList.push_back(p);
+	return (int)vList.size() - 1;
+}
+
+void CRenderQueue::Submit(int iMesh, CShaderProgram* pProgram, CTexture* pTexture, const Material& material, const glm::mat4& modelMatrix, int iPass)
+{
+	if (iMesh < 0)
+		return;
+
+	RenderCommand command;
+	command.iMesh = iMesh;
+	command.pProgram = pProgram;
+	command.pTexture = pTexture;
+	command.drawData = DrawData(material, modelMatrix);
+	m_vCommands.push_back(command);
+
+	// Positive floats keep their order when their bits are compared as integers
+	float fDepth = glm::max(-(m_viewMatrix * modelMatrix[3]).z, 0.0f);
+	unsigned int uiDepth;
+	memcpy(&uiDepth, &fDepth, sizeof(uiDepth));
+
+	unsigned long long ullKey = 0;
+	ullKey |= (unsigned long long)(iPass & 0xF) << 60;
+	ullKey |= (unsigned long long)(FindOrAdd(m_vPrograms, pProgram) & 0xFFF) << 48;
+	ullKey |= (unsigned long long)(FindOrAdd(m_vTextures, pTexture) & 0xFFFF) << 32;
+	ullKey |= uiDepth;
+	m_vKeys.push_back(ullKey);
+}
+
+// An LSD radix sort with 8-bit digits.  Digits that are the same for every key (such as the pass, usually) are skipped,
+// so a frame with few programs and textures costs little more than the depth passes.
+void CRenderQueue::RadixSort(vector<unsigned long long>& vKeys, vector<unsigned int>& vValues)
+{
+	size_t n = vKeys.size();
+	vector<unsigned long long> vKeysTemp(n);
+	vector<unsigned int> vValuesTemp(n);
+
+	for (int iShift = 0; iShift < 64; iShift += 8) {
+		size_t counts[256] = { 0 };
+		for (size_t i = 0; i < n; i++)
+			counts[(vKeys[i] >> iShift) & 0xFF]++;
+
+		if (n == 0 || counts[(vKeys[0] >> iShift) & 0xFF] == n)
+			continue;
+
+		size_t offset = 0;
+		for (int b = 0; b < 256; b++) {
+			size_t count = counts[b];
+			counts[b] = offset;
+			offset += count;
+		}
+
+		for (size_t i = 0; i < n; i++) {
+			size_t dest = counts[(vKeys[i] >> iShift) & 0xFF]++;
+			vKeysTemp[dest] = vKeys[i];
+			vValuesTemp[dest] = vValues[i];
+		}
+		vKeys.swap(vKeysTemp);
+		vValues.swap(vValuesTemp);
+	}
+}
+
+void CRenderQueue::Flush(std::function<void(CShaderProgram*)> bindProgram)
+{
+	CHighResolutionTimer timer;
+	timer.Start();
+
+	m_iBatchCount = 0;
+	if (m_vCommands.empty()) {
+		m_dFlushTime = timer.Elapsed();
+		return;
+	}
+
+	// Sort command indices by key
+	vector<unsigned long long> vSortedKeys = m_vKeys;
+	m_vOrder.resize(m_vCommands.size());
+	for (unsigned int i = 0; i < m_vOrder.size(); i++)
+		m_vOrder[i] = i;
+	RadixSort(vSortedKeys, m_vOrder);
+
+	// Build one indirect command and one draw data entry per queued command, and split them into batches wherever
+	// the pass, program or texture changes
+	struct Batch {
+		unsigned int uiFirst;
+		unsigned int uiCount;
+		CShaderProgram* pProgram;
+		CTexture* pTexture;
+	};
+	vector<Batch> vBatches;
+	m_vIndirect.resize(m_vCommands.size());
+	m_vDrawData.resize(m_vCommands.size());
+
+	for (unsigned int i = 0; i < m_vOrder.size(); i++) {
+		const RenderCommand& command = m_vCommands[m_vOrder[i]];
+		const MeshRange& range = m_pArena->GetMesh(command.iMesh);
+
+		DrawElementsIndirectCommand& indirect = m_vIndirect[i];
+		indirect.count = range.indexCount;
+		indirect.instanceCount = 1;
+		indirect.firstIndex = range.firstIndex;
+		indirect.baseVertex = range.baseVertex;
+		indirect.baseInstance = 0;
+		m_vDrawData[i] = command.drawData;
+
+		if (i == 0 || (vSortedKeys[i] >> 32) != (vSortedKeys[i - 1] >> 32)) {
+			Batch batch = { i, 0, command.pProgram, command.pTexture };
+			vBatches.push_back(batch);
+		}
+		vBatches.back().uiCount++;
+	}
+
+	// Write the commands and draw data into the streaming buffer, or upload them to the queue's own buffers if it
+	// is missing or full
+	GLsizeiptr iIndirectSize = m_vIndirect.size() * sizeof(DrawElementsIndirectCommand);
+	GLsizeiptr iDrawDataSize = m_vDrawData.size() * sizeof(DrawData);
+	GLintptr iIndirectOffset = 0, iDrawDataOffset = 0;
+	void* pIndirect = NULL;
+	void* pDrawData = NULL;
+	if (m_pStream != NULL) {
+		pIndirect = m_pStream->Allocate(iIndirectSize, sizeof(GLuint), iIndirectOffset);
+		if (pIndirect != NULL)
+			pDrawData = m_pStream->Allocate(iDrawDataSize, m_iStorageAlignment, iDrawDataOffset);
+	}
+
+	if (pDrawData != NULL) {
+		memcpy(pIndirect, &m_vIndirect[0], iIndirectSize);
+		memcpy(pDrawData, &m_vDrawData[0], iDrawDataSize);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_pStream->GetBuffer());
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BUFFER_BINDING, m_pStream->GetBuffer(), iDrawDataOffset, iDrawDataSize);
+	}
+	else {
+		iIndirectOffset = 0;
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_uiIndirectBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, iIndirectSize, &m_vIndirect[0], GL_STREAM_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_uiDrawDataBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, iDrawDataSize, &m_vDrawData[0], GL_STREAM_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_BUFFER_BINDING, m_uiDrawDataBuffer);
+	}
+
+	m_pArena->Bind();
+	CShaderProgram* pCurrentProgram = NULL;
+	for (unsigned int i = 0; i < vBatches.size(); i++) {
+		const Batch& batch = vBatches[i];
+		if (batch.pProgram != pCurrentProgram) {
+			bindProgram(batch.pProgram);
+			pCurrentProgram = batch.pProgram;
+		}
+		if (batch.pTexture != NULL)
+			batch.pTexture->Bind(0);
+
+		// gl_DrawIDARB restarts at zero for every multi-draw, so the shader adds the batch's offset into the draw data
+		batch.pProgram->SetUniform("drawDataOffset", (int)batch.uiFirst);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, BUFFER_OFFSET(iIndirectOffset + batch.uiFirst * sizeof(DrawElementsIndirectCommand)), batch.uiCount, 0);
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	m_iBatchCount = (int)vBatches.size();
+	m_dFlushTime = timer.Elapsed();
+}
+
+int CRenderQueue::GetCommandCount()
+{
+	return (int)m_vCommands.size();
+}
+
+int CRenderQueue::GetBatchCount()
+{
+	return m_iBatchCount;
+}
+
+double CRenderQueue::GetFlushTime()
+{
+	return m_dFlushTime;
+}
+
+void CRenderQueue::Release()
+{
+	if (m_uiIndirectBuffer != 0) {
+		glDeleteBuffers(1, &m_uiIndirectBuffer);
+		glDeleteBuffers(1, &m_uiDrawDataBuffer);
+		m_uiIndirectBuffer = m_uiDrawDataBuffer = 0;
+	}
+	m_vCommands.clear();
+	m_vKeys.clear();
+}
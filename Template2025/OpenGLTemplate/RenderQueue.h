@@ -0,0 +1,102 @@
+#pragma once
+
+#include "Common.h"
+#include "Material.h"
+
+#include <functional>
+
+class CShaderProgram;
+class CTexture;
+class CMeshArena;
+class CStreamingBuffer;
+
+// Per-draw data read by the DRAW_DATA variant of mainShader through gl_DrawIDARB.  Laid out for std430.
+struct DrawData
+{
+	glm::mat4 modelMatrix;
+	glm::vec4 ambientShininess;		// Ma in xyz, shininess in w
+	glm::vec4 diffuse;				// Md
+	glm::vec4 specular;				// Ms
+	glm::vec4 emissive;				// Me
+
+	DrawData() {}
+	DrawData(const Material& material, const glm::mat4& modelMatrixIn)
+		: modelMatrix(modelMatrixIn), ambientShininess(material.Ma, material.shininess), diffuse(material.Md, 0.0f),
+		specular(material.Ms, 0.0f), emissive(material.Me, 0.0f)
+	{}
+};
+
+// A deferred queue of draws of meshes in a CMeshArena.  Each command carries a 64-bit sort key
+//   bits 60-63 pass | bits 48-59 program | bits 32-47 material (texture) | bits 0-31 view depth
+// so that after a radix sort, commands that share a pass, program and texture are adjacent and drawn front to back.
+// Each run of such commands becomes one glMultiDrawElementsIndirect call, and the transforms and material colours
+// that differ between the draws in a run are passed through a storage buffer indexed by gl_DrawIDARB.
+class CRenderQueue
+{
+public:
+	CRenderQueue();
+	~CRenderQueue();
+
+	// Commands and draw data are written into pStream when one is given, and uploaded with glBufferData otherwise
+	void Create(CMeshArena* pArena, CStreamingBuffer* pStream = NULL);
+
+	// Clears the queue and sets the view matrix used to work out each command's depth
+	void Begin(const glm::mat4& viewMatrix);
+
+	// Queues one draw of a mesh.  pProgram should be a DRAW_DATA variant of the main shader, and pTexture (if any)
+	// is bound to texture unit 0.
+	void Submit(int iMesh, CShaderProgram* pProgram, CTexture* pTexture, const Material& material, const glm::mat4& modelMatrix, int iPass = 0);
+
+	// Sorts and draws everything queued.  bindProgram is called whenever the program changes, so the caller can
+	// bind it and set its per-frame uniforms.
+	void Flush(std::function<void(CShaderProgram*)> bindProgram);
+
+	// Statistics for the last Flush
+	int GetCommandCount();
+	int GetBatchCount();
+	double GetFlushTime();					// CPU time in milliseconds, including the sort
+
+	void Release();
+
+	static const int DRAW_DATA_BUFFER_BINDING = 3;
+
+	// Sorts values by their 64-bit keys (least significant byte first, skipping bytes that are equal in every key)
+	static void RadixSort(vector<unsigned long long>& vKeys, vector<unsigned int>& vValues);
+
+private:
+	struct RenderCommand {
+		int iMesh;
+		CShaderProgram* pProgram;
+		CTexture* pTexture;
+		DrawData drawData;
+	};
+
+	// Same layout as the GL DrawElementsIndirectCommand
+	struct DrawElementsIndirectCommand {
+		unsigned int count;
+		unsigned int instanceCount;
+		unsigned int firstIndex;
+		int baseVertex;
+		unsigned int baseInstance;
+	};
+
+	int FindOrAdd(vector<void*>& vList, void* p);
+
+	CMeshArena* m_pArena;
+	CStreamingBuffer* m_pStream;
+	GLsizeiptr m_iStorageAlignment;
+	glm::mat4 m_viewMatrix;
+	vector<RenderCommand> m_vCommands;
+	vector<unsigned long long> m_vKeys;
+	vector<unsigned int> m_vOrder;
+	vector<void*> m_vPrograms;				// Programs and textures seen this frame, numbered for the sort key
+	vector<void*> m_vTextures;
+	vector<DrawElementsIndirectCommand> m_vIndirect;
+	vector<DrawData> m_vDrawData;
+
+	UINT m_uiIndirectBuffer;
+	UINT m_uiDrawDataBuffer;
+
+	int m_iBatchCount;
+	double m_dFlushTime;
+};
@@ -0,0 +1,268 @@
+#include "ShaderCompileQueue.h"
+
+#include <algorithm>
+
+// Source for the placeholder program.  It only transforms positions and outputs a flat grey, so it compiles quickly
+// and accepts the matrix uniforms that every other program in the game uses.
+static const char* s_sPlaceholderVertexShader =
+	"#version 400 core\n"
+	"uniform struct Matrices { mat4 projMatrix; mat4 modelViewMatrix; } matrices;\n"
+	"layout (location = 0) in vec3 inPosition;\n"
+	"void main() { gl_Position = matrices.projMatrix * matrices.modelViewMatrix * vec4(inPosition, 1.0); }\n";
+
+static const char* s_sPlaceholderFragmentShader =
+	"#version 400 core\n"
+	"out vec4 vOutputColour;\n"
+	"void main() { vOutputColour = vec4(0.5, 0.5, 0.5, 1.0); }\n";
+
+CShaderCompileQueue::CShaderCompileQueue()
+{
+	m_uiPlaceholderProgram = 0;
+}
+
+CShaderCompileQueue::~CShaderCompileQueue()
+{
+	Release();
+}
+
+// Works out the shader stage from the file extension, as Game::Initialise used to.  Returns 0 for a name without one of
+// the extensions below, rather than guessing.
+int CShaderCompileQueue::ShaderTypeFromFileName(const string& sFileName)
+{
+	size_t iDot = sFileName.find_last_of('.');
+	if (iDot == string::npos || sFileName.find_first_of("\\/", iDot) != string::npos)
+		return 0;
+	string sExt = LowerCase(sFileName.substr(iDot + 1));
+	if (sExt == "vert") return GL_VERTEX_SHADER;
+	else if (sExt == "frag") return GL_FRAGMENT_SHADER;
+	else if (sExt == "geom") return GL_GEOMETRY_SHADER;
+	else if (sExt == "tcnl") return GL_TESS_CONTROL_SHADER;
+	else if (sExt == "tevl") return GL_TESS_EVALUATION_SHADER;
+	else if (sExt == "comp") return GL_COMPUTE_SHADER;
+	else return 0;
+}
+
+// File names are compared case-insensitively, since the watcher reports names as stored on disk
+string CShaderCompileQueue::LowerCase(string s)
+{
+	transform(s.begin(), s.end(), s.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+	return s;
+}
+
+// Creates the placeholder program and, optionally, starts the file watcher used for hot reloading
+void CShaderCompileQueue::Initialise(string sShaderDirectory, bool bHotReload)
+{
+	m_sShaderDirectory = sShaderDirectory;
+
+	// Let the driver use as many compiler threads as it likes
+	if (GLEW_KHR_parallel_shader_compile)
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+	else if (GLEW_ARB_parallel_shader_compile)
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+
+	CreatePlaceholderProgram();
+
+	if (bHotReload)
+		m_watcher.Start(sShaderDirectory);
+}
+
+// Compiles the placeholder program synchronously -- it is tiny, and everything else falls back on it
+void CShaderCompileQueue::CreatePlaceholderProgram()
+{
+	UINT uiVertexShader = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(uiVertexShader, 1, &s_sPlaceholderVertexShader, NULL);
+	glCompileShader(uiVertexShader);
+
+	UINT uiFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(uiFragmentShader, 1, &s_sPlaceholderFragmentShader, NULL);
+	glCompileShader(uiFragmentShader);
+
+	m_uiPlaceholderProgram = glCreateProgram();
+	glAttachShader(m_uiPlaceholderProgram, uiVertexShader);
+	glAttachShader(m_uiPlaceholderProgram, uiFragmentShader);
+	glLinkProgram(m_uiPlaceholderProgram);
+	glDeleteShader(uiVertexShader);
+	glDeleteShader(uiFragmentShader);
+
+	CShaderProgram::SetPlaceholderProgram(m_uiPlaceholderProgram);
+}
+
+// Registers a program and issues its compile and link.  pProgram uses the placeholder until the link completes.
+void CShaderCompileQueue::Submit(CShaderProgram* pProgram, const vector<string>& vShaderFileNames, const vector<string>& vDefines)
+{
+	ProgramSource source;
+	source.pProgram = pProgram;
+	source.vShaderFileNames = vShaderFileNames;
+	source.vDefines = vDefines;
+	m_vSources.push_back(source);
+
+	Issue((int)m_vSources.size() - 1, false);
+}
+
+// Starts compiling the shaders for one program and issues the link without waiting for either
+void CShaderCompileQueue::Issue(int iSource, bool bHotReload)
+{
+	ProgramSource& source = m_vSources[iSource];
+
+	// A newer edit replaces any compile of the same program that is still in flight
+	for (int i = (int)m_vPending.size() - 1; i >= 0; i--) {
+		if (m_vPending[i]->iSource == iSource) {
+			Discard(m_vPending[i]);
+			m_vPending.erase(m_vPending.begin() + i);
+		}
+	}
+
+	PendingProgram* pPending = new PendingProgram;
+	pPending->iSource = iSource;
+	pPending->bHotReload = bHotReload;
+	pPending->vShaders.resize(source.vShaderFileNames.size());
+	pPending->program.CreateProgram();
+
+	// A hot reload that cannot read a file (deleted, or caught halfway through being saved) keeps the old program and
+	// the old list of files, so the next edit of that file still finds it.  Only a startup failure gets a message box.
+	vector<string> vSourceFiles;
+	for (unsigned int i = 0; i < source.vShaderFileNames.size(); i++) {
+		CShader& shader = pPending->vShaders[i];
+		string sFile = m_sShaderDirectory + source.vShaderFileNames[i];
+		int iType = ShaderTypeFromFileName(sFile);
+		if (iType == 0) {
+			string sMessage = "Unknown shader type\n" + sFile + "\n";
+			if (bHotReload)
+				OutputDebugString(sMessage.c_str());
+			else
+				MessageBox(NULL, sMessage.c_str(), "Error", MB_ICONERROR);
+		}
+		if ((iType == 0 || !shader.LoadShader(sFile, iType, false, source.vDefines, !bHotReload)) && bHotReload) {
+			Discard(pPending);
+			return;
+		}
+		pPending->program.AddShaderToProgram(&shader);
+
+		// A file missing at startup is still watched, so creating it loads the program
+		const vector<string>& vFiles = shader.GetSourceFiles();
+		if (vFiles.empty())
+			vSourceFiles.push_back(LowerCase(sFile));
+		for (unsigned int j = 0; j < vFiles.size(); j++)
+			vSourceFiles.push_back(LowerCase(vFiles[j]));
+	}
+	source.vSourceFiles = vSourceFiles;
+
+	pPending->program.LinkProgram(false);
+	m_vPending.push_back(pPending);
+}
+
+// Finishes a pending program if the driver is done with it (or waits for it if bBlock is true).  Returns true if the
+// entry can be removed from the queue.
+bool CShaderCompileQueue::Complete(PendingProgram& pending, bool bBlock)
+{
+	if (!bBlock && !pending.program.IsLinkComplete())
+		return false;
+
+	UINT uiProgram = pending.program.GetProgramID();
+	int iLinkStatus = GL_FALSE;
+	glGetProgramiv(uiProgram, GL_LINK_STATUS, &iLinkStatus);
+
+	if (iLinkStatus == GL_TRUE) {
+		m_vSources[pending.iSource].pProgram->ReplaceProgram(uiProgram);
+	}
+	else {
+		// Report compile errors first, since they are the usual cause of a failed link
+		bool bCompiled = true;
+		for (unsigned int i = 0; i < pending.vShaders.size(); i++) {
+			if (pending.vShaders[i].IsLoaded() && !pending.vShaders[i].CheckCompileStatus(!pending.bHotReload))
+				bCompiled = false;
+		}
+
+		if (bCompiled) {
+			char sInfoLog[1024];
+			char sFinalMessage[1536];
+			int iLogLength;
+			glGetProgramInfoLog(uiProgram, 1024, &iLogLength, sInfoLog);
+			sprintf_s(sFinalMessage, "Error! Shader program wasn't linked! The linker returned:\n\n%s", sInfoLog);
+			if (pending.bHotReload)
+				OutputDebugString(sFinalMessage);
+			else
+				MessageBox(NULL, sFinalMessage, "Error", MB_ICONERROR);
+		}
+
+		// On a failed hot reload the previous version of the program stays in use
+		glDeleteProgram(uiProgram);
+	}
+
+	for (unsigned int i = 0; i < pending.vShaders.size(); i++)
+		pending.vShaders[i].DeleteShader();
+
+	return true;
+}
+
+// Polls the queue.  With parallel compile support every finished program is picked up without blocking; without it,
+// at most one program is finished per frame so that the blocking link cost is spread out.
+void CShaderCompileQueue::Update()
+{
+	// Recompile any program that uses a file which has been edited
+	vector<string> vChangedFiles;
+	if (m_watcher.PopChangedFiles(vChangedFiles)) {
+		for (unsigned int i = 0; i < vChangedFiles.size(); i++) {
+			string sChanged = LowerCase(vChangedFiles[i]);
+			for (unsigned int j = 0; j < m_vSources.size(); j++) {
+				const vector<string>& vFiles = m_vSources[j].vSourceFiles;
+				if (find(vFiles.begin(), vFiles.end(), sChanged) != vFiles.end())
+					Issue(j, true);
+			}
+		}
+	}
+
+	bool bParallel = CShader::IsParallelCompileSupported();
+	for (unsigned int i = 0; i < m_vPending.size(); ) {
+		if (Complete(*m_vPending[i], false)) {
+			delete m_vPending[i];
+			m_vPending.erase(m_vPending.begin() + i);
+			if (!bParallel)
+				break;
+		}
+		else i++;
+	}
+}
+
+// Deletes a program that will not be completed, with the shaders attached to it
+void CShaderCompileQueue::Discard(PendingProgram* pPending)
+{
+	glDeleteProgram(pPending->program.GetProgramID());
+	for (unsigned int i = 0; i < pPending->vShaders.size(); i++)
+		pPending->vShaders[i].DeleteShader();
+	delete pPending;
+}
+
+// Waits for every outstanding program.  Complete blocks on each link in turn, so no program is deleted while the
+// driver is still linking it.
+void CShaderCompileQueue::Finish()
+{
+	while (!m_vPending.empty()) {
+		Complete(*m_vPending[0], true);
+		delete m_vPending[0];
+		m_vPending.erase(m_vPending.begin());
+	}
+}
+
+// Returns the number of programs still compiling
+int CShaderCompileQueue::GetPendingCount()
+{
+	return (int)m_vPending.size();
+}
+
+// Stops the watcher and frees anything still in flight
+void CShaderCompileQueue::Release()
+{
+	m_watcher.Stop();
+
+	for (unsigned int i = 0; i < m_vPending.size(); i++)
+		Discard(m_vPending[i]);
+	m_vPending.clear();
+	m_vSources.clear();
+
+	if (m_uiPlaceholderProgram != 0) {
+		CShaderProgram::SetPlaceholderProgram(0);
+		glDeleteProgram(m_uiPlaceholderProgram);
+		m_uiPlaceholderProgram = 0;
+	}
+}
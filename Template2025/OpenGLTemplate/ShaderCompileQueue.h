@@ -0,0 +1,62 @@
+#pragma once
+
+#include "Common.h"
+#include "Shaders.h"
+#include "ShaderFileWatcher.h"
+
+// Compiles and links shader programs without stalling the game loop.  Programs are submitted once, the compile and
+// link are issued to the driver straight away, and Update() polls GL_COMPLETION_STATUS_KHR each frame to find out
+// when they are ready.  Until then, CShaderProgram::UseProgram() binds a cheap placeholder program instead.
+// Shader files that are edited on disk are recompiled through the same path, and the old program stays in use
+// until the new one has linked successfully.
+class CShaderCompileQueue
+{
+public:
+	CShaderCompileQueue();
+	~CShaderCompileQueue();
+
+	// Creates the placeholder program and starts watching sShaderDirectory for edits if bHotReload is true
+	void Initialise(string sShaderDirectory, bool bHotReload = true);
+
+	// Queues a program built from the given shader files (names relative to the shader directory), optionally
+	// compiled with a #define for each entry of vDefines
+	void Submit(CShaderProgram* pProgram, const vector<string>& vShaderFileNames, const vector<string>& vDefines = vector<string>());
+
+	// Polls outstanding compiles and hot reloads.  Call once per frame.
+	void Update();
+
+	// Blocks until every queued program has finished (e.g. before taking a screenshot or running a benchmark)
+	void Finish();
+
+	int GetPendingCount();
+	void Release();
+
+private:
+	struct ProgramSource {
+		CShaderProgram* pProgram;
+		vector<string> vShaderFileNames;
+		vector<string> vDefines;
+		vector<string> vSourceFiles;				// Every file read while compiling, including #includes
+	};
+
+	struct PendingProgram {
+		int iSource;								// Index into m_vSources
+		vector<CShader> vShaders;
+		CShaderProgram program;
+		bool bHotReload;							// Errors in a hot reload are reported without a message box
+	};
+
+	static int ShaderTypeFromFileName(const string& sFileName);
+	static string LowerCase(string s);
+
+	void Issue(int iSource, bool bHotReload);
+	bool Complete(PendingProgram& pending, bool bBlock);
+	void Discard(PendingProgram* pPending);
+	void CreatePlaceholderProgram();
+
+	string m_sShaderDirectory;
+	vector<ProgramSource> m_vSources;
+	vector<PendingProgram*> m_vPending;
+	UINT m_uiPlaceholderProgram;
+	CShaderFileWatcher m_watcher;
+};
@@ -0,0 +1,138 @@
+#include "ShaderFileWatcher.h"
+
+#include <map>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+CShaderFileWatcher::CShaderFileWatcher()
+{
+	m_bRunning = false;
+}
+
+CShaderFileWatcher::~CShaderFileWatcher()
+{
+	Stop();
+}
+
+// Starts a thread that watches sDirectory for files being written
+bool CShaderFileWatcher::Start(string sDirectory)
+{
+	if (m_bRunning)
+		return true;
+
+	m_sDirectory = sDirectory;
+	m_bRunning = true;
+	m_thread = std::thread(&CShaderFileWatcher::WatchThread, this);
+	return true;
+}
+
+// Signals the watcher thread to finish and waits for it
+void CShaderFileWatcher::Stop()
+{
+	if (!m_bRunning)
+		return;
+	m_bRunning = false;
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+// Hands over the list of changed files collected by the watcher thread
+bool CShaderFileWatcher::PopChangedFiles(vector<string>& vChangedFiles)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_vChangedFiles.empty())
+		return false;
+	vChangedFiles.swap(m_vChangedFiles);
+	m_vChangedFiles.clear();
+	return true;
+}
+
+// Records a changed file, ignoring repeats (editors often write a file more than once when saving)
+void CShaderFileWatcher::AddChangedFile(string sFile)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (find(m_vChangedFiles.begin(), m_vChangedFiles.end(), sFile) == m_vChangedFiles.end())
+		m_vChangedFiles.push_back(sFile);
+}
+
+#ifdef _WIN32
+
+// Windows: wait on a change notification for the directory, then compare last-write times to find which files changed.
+// The wait has a timeout so that the thread notices when it is asked to stop.
+void CShaderFileWatcher::WatchThread()
+{
+	map<string, unsigned long long> lastWriteTimes;
+
+	auto scanDirectory = [&](bool bReportChanges) {
+		WIN32_FIND_DATA findData;
+		HANDLE hFind = FindFirstFile((m_sDirectory + "*").c_str(), &findData);
+		if (hFind == INVALID_HANDLE_VALUE)
+			return;
+		do {
+			if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				continue;
+			unsigned long long writeTime = ((unsigned long long)findData.ftLastWriteTime.dwHighDateTime << 32) | findData.ftLastWriteTime.dwLowDateTime;
+			string sFile = m_sDirectory + findData.cFileName;
+			auto it = lastWriteTimes.find(sFile);
+			if (it == lastWriteTimes.end() || it->second != writeTime) {
+				if (bReportChanges)
+					AddChangedFile(sFile);
+				lastWriteTimes[sFile] = writeTime;
+			}
+		} while (FindNextFile(hFind, &findData));
+		FindClose(hFind);
+	};
+
+	scanDirectory(false);
+
+	HANDLE hChange = FindFirstChangeNotification(m_sDirectory.c_str(), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+	if (hChange == INVALID_HANDLE_VALUE)
+		return;
+
+	while (m_bRunning) {
+		if (WaitForSingleObject(hChange, 200) == WAIT_OBJECT_0) {
+			scanDirectory(true);
+			if (!FindNextChangeNotification(hChange))
+				break;
+		}
+	}
+	FindCloseChangeNotification(hChange);
+}
+
+#else
+
+// Linux: inotify reports the names of files that were closed after writing or moved into the directory
+void CShaderFileWatcher::WatchThread()
+{
+	int fd = inotify_init1(IN_NONBLOCK);
+	if (fd < 0)
+		return;
+
+	if (inotify_add_watch(fd, m_sDirectory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		close(fd);
+		return;
+	}
+
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	while (m_bRunning) {
+		pollfd pfd = { fd, POLLIN, 0 };
+		if (poll(&pfd, 1, 200) <= 0)
+			continue;
+
+		ssize_t length = read(fd, buffer, sizeof(buffer));
+		for (char* p = buffer; length > 0 && p < buffer + length; ) {
+			const inotify_event* pEvent = (const inotify_event*)p;
+			if (pEvent->len > 0)
+				AddChangedFile(m_sDirectory + pEvent->name);
+			p += sizeof(inotify_event) + pEvent->len;
+		}
+	}
+	close(fd);
+}
+
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "Common.h"
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+// Watches a directory of shader files on a background thread and records which files have been written to.
+// Uses directory change notifications on Windows and inotify on Linux, so the game loop never waits on the file system.
+class CShaderFileWatcher
+{
+public:
+	CShaderFileWatcher();
+	~CShaderFileWatcher();
+
+	bool Start(string sDirectory);					// Starts watching the directory (e.g. "resources\\shaders\\")
+	void Stop();									// Stops the watcher thread
+
+	// Moves the names of files changed since the last call into vChangedFiles.  Returns false if nothing changed.
+	bool PopChangedFiles(vector<string>& vChangedFiles);
+
+private:
+	void WatchThread();
+	void AddChangedFile(string sFile);
+
+	string m_sDirectory;
+	std::thread m_thread;
+	std::atomic<bool> m_bRunning;
+	std::mutex m_mutex;
+	vector<string> m_vChangedFiles;					// Full paths of changed files, protected by m_mutex
+};
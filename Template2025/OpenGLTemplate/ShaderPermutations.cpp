@@ -0,0 +1,55 @@
+#include "ShaderPermutations.h"
+
+CShaderPermutations::CShaderPermutations()
+{
+	m_pCompileQueue = NULL;
+}
+
+CShaderPermutations::~CShaderPermutations()
+{
+	Release();
+}
+
+// Sets up the permutation family.  No programs are compiled until GetProgram() is called.
+void CShaderPermutations::Create(CShaderCompileQueue* pCompileQueue, const vector<string>& vShaderFileNames, const vector<string>& vKeys)
+{
+	m_pCompileQueue = pCompileQueue;
+	m_vShaderFileNames = vShaderFileNames;
+	m_vKeys = vKeys;
+}
+
+// Looks up the variant for uiKeyMask, building it on first use.  Until a new variant has finished compiling, the
+// returned program binds the compile queue's placeholder program.
+CShaderProgram* CShaderPermutations::GetProgram(unsigned int uiKeyMask)
+{
+	std::map<unsigned int, CShaderProgram*>::iterator it = m_variants.find(uiKeyMask);
+	if (it != m_variants.end())
+		return it->second;
+
+	vector<string> vDefines;
+	for (unsigned int i = 0; i < m_vKeys.size(); i++) {
+		if (uiKeyMask & (1u << i))
+			vDefines.push_back(m_vKeys[i]);
+	}
+
+	CShaderProgram* pProgram = new CShaderProgram;
+	m_pCompileQueue->Submit(pProgram, m_vShaderFileNames, vDefines);
+	m_variants[uiKeyMask] = pProgram;
+	return pProgram;
+}
+
+// Returns the number of variants built so far
+int CShaderPermutations::GetVariantCount()
+{
+	return (int)m_variants.size();
+}
+
+// Deletes every variant
+void CShaderPermutations::Release()
+{
+	for (std::map<unsigned int, CShaderProgram*>::iterator it = m_variants.begin(); it != m_variants.end(); ++it) {
+		it->second->DeleteProgram();
+		delete it->second;
+	}
+	m_variants.clear();
+}
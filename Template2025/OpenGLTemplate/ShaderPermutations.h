@@ -0,0 +1,32 @@
+#pragma once
+
+#include <map>
+
+#include "Common.h"
+#include "Shaders.h"
+#include "ShaderCompileQueue.h"
+
+// A family of programs compiled from the same shader files with different features switched on at compile time.
+// Each feature is a #define key (e.g. "TEXTURED"), and a variant is selected with a bit mask where bit i turns on key i.
+// Variants are only compiled the first time they are asked for, through the compile queue, and are then cached.
+class CShaderPermutations
+{
+public:
+	CShaderPermutations();
+	~CShaderPermutations();
+
+	// vKeys gives the #define name for each bit of the mask, so its order must match the bits used by callers
+	void Create(CShaderCompileQueue* pCompileQueue, const vector<string>& vShaderFileNames, const vector<string>& vKeys);
+
+	// Returns the program for the given combination of keys, submitting it for compilation if it is new
+	CShaderProgram* GetProgram(unsigned int uiKeyMask);
+
+	int GetVariantCount();
+	void Release();
+
+private:
+	CShaderCompileQueue* m_pCompileQueue;
+	vector<string> m_vShaderFileNames;
+	vector<string> m_vKeys;
+	std::map<unsigned int, CShaderProgram*> m_variants;
+};
@@ -10,18 +10,54 @@ CShader::CShader()
 CShader::~CShader()
 {}
 
+// Returns true if the driver can compile and link shaders on its own threads.  In that case the
+// completion of a compile or link can be polled with GL_COMPLETION_STATUS_KHR without blocking.
+bool CShader::IsParallelCompileSupported()
+{
+	return GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+}
+
 // Loads a shader, stored as a text file with filename sFile.  The shader is of type iType (vertex, fragment, geometry, etc.)
-bool CShader::LoadShader(string sFile, int iType)
+// If bWaitForCompile is false, the compile is only issued and the result must later be checked with CheckCompileStatus()
+bool CShader::LoadShader(string sFile, int iType, bool bWaitForCompile)
+{
+	return LoadShader(sFile, iType, bWaitForCompile, vector<string>());
+}
+
+// Loads a shader as above, inserting "#define <name>" for each entry of vDefines just after the #version line.
+// This is used to compile permutations of one shader file with different features switched on.  The compile queue
+// turns off bShowMessageBox for hot reloads, so a file caught mid-save does not stop the game loop.
+bool CShader::LoadShader(string sFile, int iType, bool bWaitForCompile, const vector<string>& vDefines, bool bShowMessageBox)
 {
 	vector<string> sLines;
 
+	m_sFile = sFile;
+	m_vSourceFiles.clear();
+
 	if(!GetLinesFromFile(sFile, false, &sLines)) {
 		char message[1024];
 		sprintf_s(message, "Cannot load shader\n%s\n", sFile.c_str());
-		MessageBox(NULL, message, "Error", MB_ICONERROR);
+		if (bShowMessageBox)
+			MessageBox(NULL, message, "Error", MB_ICONERROR);
+		else
+			OutputDebugString(message);
 		return false;
 	}
 
+	if (!vDefines.empty()) {
+		int iInsertAt = 0;
+		for (int i = 0; i < (int)sLines.size(); i++) {
+			if (sLines[i].find("#version") != string::npos) {
+				iInsertAt = i + 1;
+				break;
+			}
+		}
+		vector<string> sDefineLines;
+		for (unsigned int i = 0; i < vDefines.size(); i++)
+			sDefineLines.push_back("#define " + vDefines[i] + "\n");
+		sLines.insert(sLines.begin() + iInsertAt, sDefineLines.begin(), sDefineLines.end());
+	}
+
 	const char** sProgram = new const char*[(int)sLines.size()];
 	for (int i = 0; i < (int)sLines.size(); i++) 
 		sProgram[i] = sLines[i].c_str();
@@ -33,6 +69,35 @@ bool CShader::LoadShader(string sFile, int iType)
 
 	delete[] sProgram;
 
+	m_iType = iType;
+	m_bLoaded = true;
+
+	if (!bWaitForCompile)
+		return true;
+
+	return CheckCompileStatus();
+}
+
+// Returns true once the compile issued by LoadShader has finished.  Without parallel compile support the
+// driver may compile lazily, so we report complete and let CheckCompileStatus() block instead.
+bool CShader::IsCompileComplete()
+{
+	if (!m_bLoaded)
+		return true;
+	if (!IsParallelCompileSupported())
+		return true;
+
+	int iComplete = GL_FALSE;
+	glGetShaderiv(m_uiShader, GL_COMPLETION_STATUS_KHR, &iComplete);
+	return iComplete == GL_TRUE;
+}
+
+// Checks the result of the compile, optionally showing the compiler log in a message box
+bool CShader::CheckCompileStatus(bool bShowMessageBox)
+{
+	if (!m_bLoaded)
+		return false;
+
 	int iCompilationStatus;
 	glGetShaderiv(m_uiShader, GL_COMPILE_STATUS, &iCompilationStatus);
 
@@ -43,26 +108,29 @@ bool CShader::LoadShader(string sFile, int iType)
 		int iLogLength;
 		glGetShaderInfoLog(m_uiShader, 1024, &iLogLength, sInfoLog);
 		char sShaderType[64];
-		if (iType == GL_VERTEX_SHADER)
+		if (m_iType == GL_VERTEX_SHADER)
 			sprintf_s(sShaderType, "vertex shader");
-		else if (iType == GL_FRAGMENT_SHADER)
+		else if (m_iType == GL_FRAGMENT_SHADER)
 			sprintf_s(sShaderType, "fragment shader");
-		else if (iType == GL_GEOMETRY_SHADER)
+		else if (m_iType == GL_GEOMETRY_SHADER)
 			sprintf_s(sShaderType, "geometry shader");
-		else if (iType == GL_TESS_CONTROL_SHADER)
+		else if (m_iType == GL_TESS_CONTROL_SHADER)
 			sprintf_s(sShaderType, "tesselation control shader");
-		else if (iType == GL_TESS_EVALUATION_SHADER)
+		else if (m_iType == GL_TESS_EVALUATION_SHADER)
 			sprintf_s(sShaderType, "tesselation evaluation shader");
 		else
 			sprintf_s(sShaderType, "unknown shader type");
 
-		sprintf_s(sFinalMessage, "Error in %s!\n%s\nShader file not compiled.  The compiler returned:\n\n%s", sShaderType, sFile.c_str(), sInfoLog);
+		sprintf_s(sFinalMessage, "Error in %s!\n%s\nShader file not compiled.  The compiler returned:\n\n%s", sShaderType, m_sFile.c_str(), sInfoLog);
 
-		MessageBox(NULL, sFinalMessage, "Error", MB_ICONERROR);
+		if (bShowMessageBox)
+			MessageBox(NULL, sFinalMessage, "Error", MB_ICONERROR);
+		else
+			OutputDebugString(sFinalMessage);
+
+		DeleteShader();
 		return false;
 	}
-	m_iType = iType;
-	m_bLoaded = true;
 
 	return true;
 }
@@ -75,10 +143,12 @@ bool CShader::GetLinesFromFile(string sFile, bool bIncludePart, vector<string>*
 	fopen_s(&fp, sFile.c_str(), "rt");
 	if(!fp)return false;
 
+	m_vSourceFiles.push_back(sFile);
+
 	string sDirectory;
 	int slashIndex = -1;
 
-	for (int i = (int)sFile.size()-1; i == 0; i--)
+	for (int i = (int)sFile.size()-1; i >= 0; i--)
 	{
 		if(sFile[i] == '\\' || sFile[i] == '/')
 		{
@@ -135,6 +205,18 @@ UINT CShader::GetShaderID()
 	return m_uiShader;
 }
 
+// Returns the name of the file the shader was loaded from
+string CShader::GetFileName()
+{
+	return m_sFile;
+}
+
+// Returns the shader file together with every file pulled in through #include
+const vector<string>& CShader::GetSourceFiles()
+{
+	return m_vSourceFiles;
+}
+
 // Deletes the shader and frees GPU memory
 void CShader::DeleteShader()
 {
@@ -144,8 +226,11 @@ void CShader::DeleteShader()
 	glDeleteShader(m_uiShader);
 }
 
+UINT CShaderProgram::s_uiPlaceholderProgram = 0;
+
 CShaderProgram::CShaderProgram()
 {
+	m_uiProgram = 0;
 	m_bLinked = false;
 }
 
@@ -166,10 +251,14 @@ bool CShaderProgram::AddShaderToProgram(CShader* shShader)
 	return true;
 }
 
-// Performs final linkage of the OpenGL shader program
-bool CShaderProgram::LinkProgram()
+// Performs final linkage of the OpenGL shader program.  If bWaitForLink is false, the link is only issued
+// and the program is not used until IsLinkComplete() returns true and the status has been checked.
+bool CShaderProgram::LinkProgram(bool bWaitForLink)
 {
 	glLinkProgram(m_uiProgram);
+	if (!bWaitForLink)
+		return true;
+
 	int iLinkStatus;
 	glGetProgramiv(m_uiProgram, GL_LINK_STATUS, &iLinkStatus);
 
@@ -188,6 +277,32 @@ bool CShaderProgram::LinkProgram()
 	return m_bLinked;
 }
 
+// Returns true once a link issued with LinkProgram(false) has finished, without blocking if possible
+bool CShaderProgram::IsLinkComplete()
+{
+	if (!CShader::IsParallelCompileSupported())
+		return true;
+
+	int iComplete = GL_FALSE;
+	glGetProgramiv(m_uiProgram, GL_COMPLETION_STATUS_KHR, &iComplete);
+	return iComplete == GL_TRUE;
+}
+
+// Returns true if the program is linked and ready to use
+bool CShaderProgram::IsLinked()
+{
+	return m_bLinked;
+}
+
+// Takes ownership of a program that has been compiled and linked elsewhere
+void CShaderProgram::ReplaceProgram(UINT uiProgram)
+{
+	if (m_uiProgram != 0 && m_uiProgram != uiProgram)
+		glDeleteProgram(m_uiProgram);
+	m_uiProgram = uiProgram;
+	m_bLinked = true;
+}
+
 // Deletes the program and frees memory on the GPU
 void CShaderProgram::DeleteProgram()
 {
@@ -197,11 +312,13 @@ void CShaderProgram::DeleteProgram()
 	glDeleteProgram(m_uiProgram);
 }
 
-// Instructs OpenGL to use this program
+// Instructs OpenGL to use this program, or the placeholder program if this one is not ready yet
 void CShaderProgram::UseProgram()
 {
 	if(m_bLinked)
 		glUseProgram(m_uiProgram);
+	else if (s_uiPlaceholderProgram != 0)
+		glUseProgram(s_uiPlaceholderProgram);
 }
 
 // Returns the OpenGL program ID
@@ -210,19 +327,33 @@ UINT CShaderProgram::GetProgramID()
 	return m_uiProgram;
 }
 
+// Returns the ID of the program that UseProgram() actually binds, so that uniforms go to the right place
+UINT CShaderProgram::GetActiveProgramID()
+{
+	if (!m_bLinked && s_uiPlaceholderProgram != 0)
+		return s_uiPlaceholderProgram;
+	return m_uiProgram;
+}
+
+// Sets the program used in place of programs that are still compiling
+void CShaderProgram::SetPlaceholderProgram(UINT uiProgram)
+{
+	s_uiPlaceholderProgram = uiProgram;
+}
+
 // A collection of functions to set uniform variables inside shaders
 
 // Setting floats
 
 void CShaderProgram::SetUniform(string sName, float* fValues, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(GetActiveProgramID(), sName.c_str());
 	glUniform1fv(iLoc, iCount, fValues);
 }
 
 void CShaderProgram::SetUniform(string sName, const float fValue)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(GetActiveProgramID(), sName.c_str());
 	glUniform1fv(iLoc, 1, &fValue);
 }
 
@@ -230,37 +361,37 @@ void CShaderProgram::SetUniform(string sName, const float fValue)
 
 void CShaderProgram::SetUniform(string sName, glm::vec2* vVectors, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(GetActiveProgramID(), sName.c_str());
 	glUniform2fv(iLoc, iCount, (GLfloat*)vVectors);
 }
 
 void CShaderProgram::SetUniform(string sName, const glm::vec2 vVector)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(GetActiveProgramID(), sName.c_str());
 	glUniform2fv(iLoc, 1, (GLfloat*)&vVector);
 }
 
 void CShaderProgram::SetUniform(string sName, glm::vec3* vVectors, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(GetActiveProgramID(), sName.c_str());
 	glUniform3fv(iLoc, iCount, (GLfloat*)vVectors);
 }
 
 void CShaderProgram::SetUniform(string sName, const glm::vec3 vVector)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(GetActiveProgramID(), sName.c_str());
 	glUniform3fv(iLoc, 1, (GLfloat*)&vVector);
 }
 
 void CShaderProgram::SetUniform(string sName, glm::vec4* vVectors, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(GetActiveProgramID(), sName.c_str());
 	glUniform4fv(iLoc, iCount, (GLfloat*)vVectors);
 }
 
 void CShaderProgram::SetUniform(string sName, const glm::vec4 vVector)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(GetActiveProgramID(), sName.c_str());
 	glUniform4fv(iLoc, 1, (GLfloat*)&vVector);
 }
 
@@ -268,13 +399,13 @@ void CShaderProgram::SetUniform(string sName, const glm::vec4 vVector)
 
 void CShaderProgram::SetUniform(string sName, glm::mat3* mMatrices, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(GetActiveProgramID(), sName.c_str());
 	glUniformMatrix3fv(iLoc, iCount, FALSE, (GLfloat*)mMatrices);
 }
 
 void CShaderProgram::SetUniform(string sName, const glm::mat3 mMatrix)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(GetActiveProgramID(), sName.c_str());
 	glUniformMatrix3fv(iLoc, 1, FALSE, (GLfloat*)&mMatrix);
 }
 
@@ -282,13 +413,13 @@ void CShaderProgram::SetUniform(string sName, const glm::mat3 mMatrix)
 
 void CShaderProgram::SetUniform(string sName, glm::mat4* mMatrices, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(GetActiveProgramID(), sName.c_str());
 	glUniformMatrix4fv(iLoc, iCount, FALSE, (GLfloat*)mMatrices);
 }
 
 void CShaderProgram::SetUniform(string sName, const glm::mat4 mMatrix)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(GetActiveProgramID(), sName.c_str());
 	glUniformMatrix4fv(iLoc, 1, FALSE, (GLfloat*)&mMatrix);
 }
 
@@ -296,12 +427,12 @@ void CShaderProgram::SetUniform(string sName, const glm::mat4 mMatrix)
 
 void CShaderProgram::SetUniform(string sName, int* iValues, int iCount)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(GetActiveProgramID(), sName.c_str());
 	glUniform1iv(iLoc, iCount, iValues);
 }
 
 void CShaderProgram::SetUniform(string sName, const int iValue)
 {
-	int iLoc = glGetUniformLocation(m_uiProgram, sName.c_str());
+	int iLoc = glGetUniformLocation(GetActiveProgramID(), sName.c_str());
 	glUniform1i(iLoc, iValue);
 }
\ No newline at end of file
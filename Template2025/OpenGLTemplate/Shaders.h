@@ -10,19 +10,29 @@ public:
 	CShader();
 	~CShader();
 
-	bool LoadShader(string sFile, int iType);
+	bool LoadShader(string sFile, int iType, bool bWaitForCompile = true);
+	// Adds a #define for each entry.  Without bShowMessageBox, a missing file is reported with OutputDebugString.
+	bool LoadShader(string sFile, int iType, bool bWaitForCompile, const vector<string>& vDefines, bool bShowMessageBox = true);
 	void DeleteShader();
 
 	bool GetLinesFromFile(string sFile, bool bIncludePart, vector<string>* vResult);
 
 	bool IsLoaded();
+	bool IsCompileComplete();						// Non-blocking when GL_KHR_parallel_shader_compile is available
+	bool CheckCompileStatus(bool bShowMessageBox = true);	// Blocks until compiled, then reports any errors
 	UINT GetShaderID();
+	string GetFileName();
+	const vector<string>& GetSourceFiles();		// The shader file and any files it #includes
+
+	static bool IsParallelCompileSupported();		// True if the driver exposes GL_KHR/ARB_parallel_shader_compile
 
 
 private:
 	UINT m_uiShader; // ID of shader
 	int m_iType; // GL_VERTEX_SHADER, GL_FRAGMENT_SHADER...
 	bool m_bLoaded; // Whether shader was loaded and compiled
+	string m_sFile; // File the shader was loaded from
+	vector<string> m_vSourceFiles; // All files read while loading, used for hot reloading
 };
 
 
@@ -36,11 +46,20 @@ public:
 	void DeleteProgram();
 
 	bool AddShaderToProgram(CShader* shShader);
-	bool LinkProgram();
+	bool LinkProgram(bool bWaitForLink = true);
+	bool IsLinkComplete();							// Non-blocking when GL_KHR_parallel_shader_compile is available
+	bool IsLinked();
+
+	// Adopts an already linked program, deleting the one currently held (used by the compile queue)
+	void ReplaceProgram(UINT uiProgram);
 
 	void UseProgram();
 
 	UINT GetProgramID();
+	UINT GetActiveProgramID();						// The program itself, or the placeholder while it is still compiling
+
+	// A cheap program used in place of any program that has not finished linking yet
+	static void SetPlaceholderProgram(UINT uiProgram);
 
 	// Setting vectors
 	void SetUniform(string sName, glm::vec2* vVectors, int iCount = 1);
@@ -70,4 +89,6 @@ public:
 private:
 	UINT m_uiProgram; // ID of program
 	bool m_bLinked; // Whether program was linked and is ready to use
+
+	static UINT s_uiPlaceholderProgram; // ID of the placeholder program (0 if none)
 };
\ No newline at end of file
@@ -10,16 +10,35 @@ CSkybox::~CSkybox()
 {}
 
 
+// Positive and negative x, y and z
+static const char* SKYBOX_FACES[6] = {
+	"resources\\skyboxes\\jajdarkland1\\flipped\\jajdarkland1_rt.jpg", "resources\\skyboxes\\jajdarkland1\\flipped\\jajdarkland1_lf.jpg",
+	"resources\\skyboxes\\jajdarkland1\\flipped\\jajdarkland1_up.jpg", "resources\\skyboxes\\jajdarkland1\\flipped\\jajdarkland1_dn.jpg",
+	"resources\\skyboxes\\jajdarkland1\\flipped\\jajdarkland1_bk.jpg", "resources\\skyboxes\\jajdarkland1\\flipped\\jajdarkland1_ft.jpg"
+};
+
 // Create a skybox of a given size with six textures
-void CSkybox::Create(float size)
+void CSkybox::Create(float size, CTextureLoader* pLoader, CThreadPool* pThreadPool)
 {
+	m_cubemapTexture.Create(SKYBOX_FACES[0], SKYBOX_FACES[1], SKYBOX_FACES[2], SKYBOX_FACES[3], SKYBOX_FACES[4], SKYBOX_FACES[5],
+		pLoader, pThreadPool);
+	CreateGeometry(size);
+}
 
-	m_cubemapTexture.Create("resources\\skyboxes\\jajdarkland1\\flipped\\jajdarkland1_rt.jpg", "resources\\skyboxes\\jajdarkland1\\flipped\\jajdarkland1_lf.jpg",
-		"resources\\skyboxes\\jajdarkland1\\flipped\\jajdarkland1_up.jpg", "resources\\skyboxes\\jajdarkland1\\flipped\\jajdarkland1_dn.jpg",
-		"resources\\skyboxes\\jajdarkland1\\flipped\\jajdarkland1_bk.jpg", "resources\\skyboxes\\jajdarkland1\\flipped\\jajdarkland1_ft.jpg");
+void CSkybox::Prepare(CThreadPool* pThreadPool)
+{
+	m_cubemapTexture.Prepare(SKYBOX_FACES[0], SKYBOX_FACES[1], SKYBOX_FACES[2], SKYBOX_FACES[3], SKYBOX_FACES[4], SKYBOX_FACES[5],
+		pThreadPool);
+}
 
-	
-	
+void CSkybox::Upload(float size)
+{
+	m_cubemapTexture.Upload();
+	CreateGeometry(size);
+}
+
+void CSkybox::CreateGeometry(float size)
+{
 	glGenVertexArrays(1, &m_vao);
 	glBindVertexArray(m_vao);
 
@@ -102,4 +121,8 @@ void CSkybox::Release()
 	m_cubemapTexture.Release();
 	glDeleteVertexArrays(1, &m_vao);
 	m_vbo.Release();
-}
\ No newline at end of file
+}
+CCubemap* CSkybox::GetCubemap()
+{
+	return &m_cubemapTexture;
+}
@@ -10,11 +10,19 @@ class CSkybox
 public:
 	CSkybox();
 	~CSkybox();
-	void Create(float size);
+	// The faces load in the background if given a loader, or are decoded at once on the pool's workers
+	void Create(float size, CTextureLoader* pLoader = NULL, CThreadPool* pThreadPool = NULL);
+	// Create without a loader, in two halves: Prepare reads or decodes the faces on any thread, then Upload creates
+	// the cube map and the geometry on the GL thread
+	void Prepare(CThreadPool* pThreadPool = NULL);
+	void Upload(float size);
 	void Render(int textureUnit);
 	void Release();
+	CCubemap* GetCubemap();
 
 private:
+	void CreateGeometry(float size);
+
 	UINT m_vao;
 	CVertexBufferObject m_vbo;
 	CCubemap m_cubemapTexture;
@@ -7,25 +7,33 @@
 #include <math.h>
 
 CSphere::CSphere()
-{}
+{
+	m_vao = 0;
+	m_instanceBuffer = 0;
+	m_pTexture = NULL;
+	memset(m_lodIndexCounts, 0, sizeof(m_lodIndexCounts));
+	memset(m_lodIndexOffsets, 0, sizeof(m_lodIndexOffsets));
+}
 
 CSphere::~CSphere()
 {}
 
 // Create a unit sphere 
-void CSphere::Create(string a_sDirectory, string a_sFilename, int slicesIn, int stacksIn)
+void CSphere::Create(string a_sDirectory, string a_sFilename, int slicesIn, int stacksIn, CTextureLoader* pLoader)
 {
 	// check if filename passed in -- if so, load texture
 
-	m_texture.Load(a_sDirectory+a_sFilename);
+	m_pTexture = CTextureCache::GetInstance().Acquire(a_sDirectory+a_sFilename, pLoader);
 
 	m_directory = a_sDirectory;
 	m_filename = a_sFilename;
 
-	m_texture.SetSamplerObjectParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	m_texture.SetSamplerObjectParameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	m_texture.SetSamplerObjectParameter(GL_TEXTURE_WRAP_S, GL_REPEAT);
-	m_texture.SetSamplerObjectParameter(GL_TEXTURE_WRAP_T, GL_REPEAT);
+	if (m_pTexture != NULL) {
+		m_pTexture->SetSamplerObjectParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		m_pTexture->SetSamplerObjectParameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		m_pTexture->SetSamplerObjectParameter(GL_TEXTURE_WRAP_S, GL_REPEAT);
+		m_pTexture->SetSamplerObjectParameter(GL_TEXTURE_WRAP_T, GL_REPEAT);
+	}
 	
 	glGenVertexArrays(1, &m_vao);
 	glBindVertexArray(m_vao);
@@ -35,6 +43,8 @@ void CSphere::Create(string a_sDirectory, string a_sFilename, int slicesIn, int
 	
 
 	// Compute vertex attributes and store in VBO
+	m_vertices.clear();
+	m_indices.clear();
 	int vertexCount = 0;
 	for (int stacks = 0; stacks < stacksIn; stacks++) {
 		float phi = (stacks / (float) (stacksIn - 1)) * (float) M_PI;
@@ -48,6 +58,7 @@ void CSphere::Create(string a_sDirectory, string a_sFilename, int slicesIn, int
 			m_vbo.AddVertexData(&v, sizeof(glm::vec3));
 			m_vbo.AddVertexData(&t, sizeof(glm::vec2));
 			m_vbo.AddVertexData(&n, sizeof(glm::vec3));
+			m_vertices.push_back(MeshVertex(v, t, n));
 
 			vertexCount++;
 
@@ -55,7 +66,6 @@ void CSphere::Create(string a_sDirectory, string a_sFilename, int slicesIn, int
 	}
 
 	// Compute indices and store in VBO
-	m_numTriangles = 0;
 	for (int stacks = 0; stacks < stacksIn; stacks++) {
 		for (int slices = 0; slices < slicesIn; slices++) {
 			unsigned int nextSlice = slices + 1;
@@ -66,19 +76,24 @@ void CSphere::Create(string a_sDirectory, string a_sFilename, int slicesIn, int
 			unsigned int index2 = stacks * (slicesIn+1) + nextSlice;
 			unsigned int index3 = nextStack * (slicesIn+1) + nextSlice;
 
-			m_vbo.AddIndexData(&index0, sizeof(unsigned int));
-			m_vbo.AddIndexData(&index1, sizeof(unsigned int));
-			m_vbo.AddIndexData(&index2, sizeof(unsigned int));
-			m_numTriangles++;
-
-			m_vbo.AddIndexData(&index2, sizeof(unsigned int));
-			m_vbo.AddIndexData(&index1, sizeof(unsigned int));
-			m_vbo.AddIndexData(&index3, sizeof(unsigned int));
-			m_numTriangles++;
+			unsigned int triangles[] = { index0, index1, index2, index2, index1, index3 };
+			m_indices.insert(m_indices.end(), triangles, triangles + 6);
 
 		}
 	}
 
+	// The levels of detail follow one another in the index buffer
+	vector<unsigned int> lods[CMeshSimplifier::LOD_COUNT];
+	CMeshSimplifier::BuildLods(&m_indices[0], (unsigned int)m_indices.size(), (const BYTE*)&m_vertices[0].position, sizeof(MeshVertex),
+		(unsigned int)m_vertices.size(), lods);
+	int offset = 0;
+	for (int i = 0; i < CMeshSimplifier::LOD_COUNT; i++) {
+		m_vbo.AddIndexData(&lods[i][0], (UINT)(lods[i].size() * sizeof(unsigned int)));
+		m_lodIndexCounts[i] = (int)lods[i].size();
+		m_lodIndexOffsets[i] = offset;
+		offset += m_lodIndexCounts[i] * sizeof(unsigned int);
+	}
+
 	m_vbo.UploadDataToGPU(GL_STATIC_DRAW);
 
 	GLsizei stride = 2*sizeof(glm::vec3)+sizeof(glm::vec2);
@@ -96,18 +111,58 @@ void CSphere::Create(string a_sDirectory, string a_sFilename, int slicesIn, int
 }
 
 // Render the sphere as a set of triangles
-void CSphere::Render()
+void CSphere::Render(int lod)
+{
+	lod = glm::clamp(lod, 0, CMeshSimplifier::LOD_COUNT - 1);
+	glBindVertexArray(m_vao);
+	if (m_pTexture != NULL)
+		m_pTexture->Bind();
+	glDrawElements(GL_TRIANGLES, m_lodIndexCounts[lod], GL_UNSIGNED_INT, BUFFER_OFFSET(m_lodIndexOffsets[lod]));
+
+}
+
+// Render one sphere per instance with a single draw call
+void CSphere::RenderInstanced(CInstanceBuffer& instances, int lod)
 {
+	if (instances.GetCount() == 0)
+		return;
+
+	lod = glm::clamp(lod, 0, CMeshSimplifier::LOD_COUNT - 1);
 	glBindVertexArray(m_vao);
-	m_texture.Bind();
-	glDrawElements(GL_TRIANGLES, m_numTriangles*3, GL_UNSIGNED_INT, 0);
+	instances.AttachToVertexArray(m_instanceBuffer);
+	if (m_pTexture != NULL)
+		m_pTexture->Bind();
+	glDrawElementsInstanced(GL_TRIANGLES, m_lodIndexCounts[lod], GL_UNSIGNED_INT, BUFFER_OFFSET(m_lodIndexOffsets[lod]),
+		instances.GetCount());
+}
 
+int CSphere::GetTriangleCount(int lod)
+{
+	return m_lodIndexCounts[glm::clamp(lod, 0, CMeshSimplifier::LOD_COUNT - 1)] / 3;
+}
+
+// Copy the sphere into a shared mesh arena.  The arena draws it untextured unless the caller binds m_pTexture's image.
+int CSphere::AddToArena(CMeshArena& arena)
+{
+	return arena.AddMesh(m_vertices, m_indices);
+}
+
+// The sphere's bounding box, from its vertices
+BoundingBox CSphere::GetBounds()
+{
+	BoundingBox bounds;
+	for (unsigned int i = 0; i < m_vertices.size(); i++)
+		bounds.Extend(m_vertices[i].position);
+	return bounds;
 }
 
 // Release memory on the GPU 
 void CSphere::Release()
 {
-	m_texture.Release();
+	if (m_pTexture != NULL) {
+		CTextureCache::GetInstance().Release(m_pTexture);
+		m_pTexture = NULL;
+	}
 	glDeleteVertexArrays(1, &m_vao);
 	m_vbo.Release();
 }
\ No newline at end of file
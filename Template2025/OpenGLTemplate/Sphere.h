@@ -2,21 +2,34 @@
 
 #include "Texture.h"
 #include "VertexBufferObjectIndexed.h"
+#include "InstanceBuffer.h"
+#include "MeshArena.h"
+#include "BoundingBox.h"
+#include "MeshSimplifier.h"
 
-// Class for generating a unit sphere
+// Class for generating a unit sphere.  Coarser levels of detail are built with CMeshSimplifier and kept after the full
+// sphere in the same index buffer.
 class CSphere
 {
 public:
 	CSphere();
 	~CSphere();
-	void Create(string directory, string front, int slicesIn, int stacksIn);
-	void Render();
+	void Create(string directory, string front, int slicesIn, int stacksIn, CTextureLoader* pLoader = NULL);	// The texture loads in the background if given a loader
+	void Render(int lod = 0);
+	void RenderInstanced(CInstanceBuffer& instances, int lod = 0);	// Draws one sphere per instance
+	int GetTriangleCount(int lod = 0);
+	int AddToArena(CMeshArena& arena);					// Copies the sphere into a shared mesh arena and returns its mesh id
+	BoundingBox GetBounds();							// Bounding box in object coordinates
 	void Release();
 private:
 	UINT m_vao;
+	UINT m_instanceBuffer;		// Instance buffer the VAO's instance attributes point at
 	CVertexBufferObjectIndexed m_vbo;
-	CTexture m_texture;
+	CTexture* m_pTexture;	// Shared through CTextureCache
+	vector<MeshVertex> m_vertices;	// CPU copy of the geometry, kept for AddToArena
+	vector<unsigned int> m_indices;
 	string m_directory;
 	string m_filename;
-	int m_numTriangles;
+	int m_lodIndexCounts[CMeshSimplifier::LOD_COUNT];
+	int m_lodIndexOffsets[CMeshSimplifier::LOD_COUNT];	// In bytes
 };
\ No newline at end of file
@@ -0,0 +1,162 @@
+#include "StreamingBuffer.h"
+
+CStreamingBuffer::CStreamingBuffer()
+{
+	m_uiBuffer = 0;
+	m_pMapped = NULL;
+	m_iRegionSize = 0;
+	m_iRegions = 0;
+	m_iCurrentRegion = 0;
+	m_iRegionUsed = 0;
+	for (int i = 0; i < MAX_REGIONS; i++)
+		m_fences[i] = 0;
+	m_iBytesThisFrame = m_iBytesLastFrame = 0;
+	m_iWaitsThisFrame = m_iWaitsLastFrame = 0;
+	m_iFailuresThisFrame = m_iFailuresLastFrame = 0;
+}
+
+CStreamingBuffer::~CStreamingBuffer()
+{
+	Release();
+}
+
+bool CStreamingBuffer::Create(GLsizeiptr iRegionSize, int iRegions)
+{
+	if (!GLEW_VERSION_4_4 && !GLEW_ARB_buffer_storage)
+		return false;
+
+	m_iRegionSize = iRegionSize;
+	m_iRegions = max(1, min(iRegions, (int)MAX_REGIONS));
+	m_iCurrentRegion = 0;
+	m_iRegionUsed = 0;
+
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &m_uiBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, m_uiBuffer);
+	glBufferStorage(GL_COPY_WRITE_BUFFER, m_iRegionSize * m_iRegions, NULL, flags);
+	m_pMapped = (BYTE*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, m_iRegionSize * m_iRegions, flags);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	if (m_pMapped == NULL) {
+		Release();
+		return false;
+	}
+	return true;
+}
+
+void CStreamingBuffer::BeginFrame()
+{
+	if (m_pMapped == NULL)
+		return;
+
+	m_iBytesLastFrame = m_iBytesThisFrame;
+	m_iWaitsLastFrame = m_iWaitsThisFrame;
+	m_iFailuresLastFrame = m_iFailuresThisFrame;
+	m_iBytesThisFrame = 0;
+	m_iWaitsThisFrame = 0;
+	m_iFailuresThisFrame = 0;
+
+	m_iCurrentRegion = (m_iCurrentRegion + 1) % m_iRegions;
+	m_iRegionUsed = 0;
+
+	GLsync& fence = m_fences[m_iCurrentRegion];
+	if (fence != 0) {
+		// Check without waiting first, so only real stalls are counted
+		GLenum result = glClientWaitSync(fence, 0, 0);
+		if (result == GL_TIMEOUT_EXPIRED) {
+			m_iWaitsThisFrame++;
+			do {
+				result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);	// 1 ms
+			} while (result == GL_TIMEOUT_EXPIRED);
+		}
+		glDeleteSync(fence);
+		fence = 0;
+	}
+}
+
+void CStreamingBuffer::EndFrame()
+{
+	if (m_pMapped == NULL)
+		return;
+
+	if (m_fences[m_iCurrentRegion] != 0)
+		glDeleteSync(m_fences[m_iCurrentRegion]);
+	m_fences[m_iCurrentRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void* CStreamingBuffer::Allocate(GLsizeiptr iSize, GLsizeiptr iAlignment, GLintptr& iOffset)
+{
+	if (m_pMapped == NULL)
+		return NULL;
+
+	GLsizeiptr iRegionStart = m_iCurrentRegion * m_iRegionSize;
+	GLsizeiptr iStart = ((iRegionStart + m_iRegionUsed + iAlignment - 1) / iAlignment) * iAlignment;
+	if (iStart + iSize > iRegionStart + m_iRegionSize) {
+		m_iFailuresThisFrame++;
+		return NULL;
+	}
+
+	m_iRegionUsed = iStart + iSize - iRegionStart;
+	m_iBytesThisFrame += iSize;
+	iOffset = iStart;
+	return m_pMapped + iStart;
+}
+
+UINT CStreamingBuffer::GetBuffer()
+{
+	return m_uiBuffer;
+}
+
+bool CStreamingBuffer::IsCreated()
+{
+	return m_pMapped != NULL;
+}
+
+GLsizeiptr CStreamingBuffer::GetBytesStreamed()
+{
+	return m_iBytesLastFrame;
+}
+
+int CStreamingBuffer::GetFenceWaits()
+{
+	return m_iWaitsLastFrame;
+}
+
+int CStreamingBuffer::GetFailedAllocations()
+{
+	return m_iFailuresLastFrame;
+}
+
+GLsizeiptr CStreamingBuffer::GetUniformBufferAlignment()
+{
+	GLint iAlignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &iAlignment);
+	return iAlignment;
+}
+
+GLsizeiptr CStreamingBuffer::GetStorageBufferAlignment()
+{
+	GLint iAlignment = 256;
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &iAlignment);
+	return iAlignment;
+}
+
+void CStreamingBuffer::Release()
+{
+	for (int i = 0; i < MAX_REGIONS; i++) {
+		if (m_fences[i] != 0) {
+			glDeleteSync(m_fences[i]);
+			m_fences[i] = 0;
+		}
+	}
+	if (m_uiBuffer != 0) {
+		if (m_pMapped != NULL) {
+			glBindBuffer(GL_COPY_WRITE_BUFFER, m_uiBuffer);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &m_uiBuffer);
+		m_uiBuffer = 0;
+	}
+	m_pMapped = NULL;
+}
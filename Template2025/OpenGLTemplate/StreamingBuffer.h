@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Common.h"
+
+// A ring of per-frame regions in one buffer that stays mapped for its whole life (glBufferStorage with persistent,
+// coherent mapping), for data that is rewritten every frame: instance data, draw commands, storage buffer contents.
+// Allocations bump a pointer through the current frame's region and are written directly through the mapping, with
+// no glBufferData or glBufferSubData calls.  EndFrame fences the region, and BeginFrame waits on the fence of the
+// region it is about to reuse, which was last written NUM_REGIONS frames earlier, so the GPU has normally finished
+// with it and the wait costs nothing.
+//
+// Needs GL 4.4 or GL_ARB_buffer_storage.  Create returns false without it, and callers keep using glBufferData.
+class CStreamingBuffer
+{
+public:
+	CStreamingBuffer();
+	~CStreamingBuffer();
+
+	bool Create(GLsizeiptr iRegionSize, int iRegions = 3);
+
+	void BeginFrame();							// Moves to the next region, waiting for the GPU if it is still using it
+	void EndFrame();							// Fences everything allocated this frame
+
+	// Returns a write pointer for iSize bytes at an offset into GetBuffer() that is a multiple of iAlignment, or NULL
+	// if this frame's region is full
+	void* Allocate(GLsizeiptr iSize, GLsizeiptr iAlignment, GLintptr& iOffset);
+
+	UINT GetBuffer();
+	bool IsCreated();
+
+	// Statistics for the last complete frame
+	GLsizeiptr GetBytesStreamed();
+	int GetFenceWaits();						// BeginFrame calls that had to wait for the GPU
+	int GetFailedAllocations();					// Allocations that did not fit in the region
+
+	void Release();
+
+	static const int MAX_REGIONS = 4;
+
+	// Alignments for ranges bound as uniform or storage buffers
+	static GLsizeiptr GetUniformBufferAlignment();
+	static GLsizeiptr GetStorageBufferAlignment();
+
+private:
+	UINT m_uiBuffer;
+	BYTE* m_pMapped;
+	GLsizeiptr m_iRegionSize;
+	int m_iRegions;
+	int m_iCurrentRegion;
+	GLsizeiptr m_iRegionUsed;					// Bytes used in the current region
+	GLsync m_fences[MAX_REGIONS];
+
+	GLsizeiptr m_iBytesThisFrame, m_iBytesLastFrame;
+	int m_iWaitsThisFrame, m_iWaitsLastFrame;
+	int m_iFailuresThisFrame, m_iFailuresLastFrame;
+};
@@ -0,0 +1,149 @@
+#include "TextObject.h"
+
+CTextObject::CTextObject()
+{
+	m_pFont = NULL;
+	m_iFirstVertex = 0;
+	m_iMaxChars = 0;
+	m_bFixedWidthDigits = true;
+	m_x = m_y = 0;
+	m_pixelSize = -1;
+	m_colour = glm::vec4(1.0f);
+	m_bVisible = true;
+	m_bDirty = false;
+	m_iKey = 0;
+	m_bKeySet = false;
+	m_bComplete = true;
+	m_uiPageMask = 0;
+	m_iEvictions = 0;
+	m_iArrivals = 0;
+}
+
+CTextObject::~CTextObject()
+{
+	Release();
+}
+
+void CTextObject::Create(CFreeTypeFont* pFont, int iMaxChars, bool bFixedWidthDigits)
+{
+	m_pFont = pFont;
+	m_iMaxChars = iMaxChars;
+	m_bFixedWidthDigits = bFixedWidthDigits;
+	m_iFirstVertex = pFont->AddTextObject(this, iMaxChars);
+	m_vVertices.assign(iMaxChars * 6, CFreeTypeFont::EmptyVertex());
+	m_bDirty = true;
+}
+
+void CTextObject::SetText(const string& text)
+{
+	if (text == m_text)
+		return;
+	m_text = text;
+	m_bDirty = true;
+}
+
+void CTextObject::Format(const char* text, ...)
+{
+	char buf[512];
+	va_list ap;
+	va_start(ap, text);
+	vsprintf_s(buf, text, ap);
+	va_end(ap);
+	if (m_text.compare(buf) == 0)
+		return;
+	m_text = buf;
+	m_bDirty = true;
+}
+
+void CTextObject::SetPosition(int x, int y)
+{
+	if (x == m_x && y == m_y)
+		return;
+	m_x = x;
+	m_y = y;
+	m_bDirty = true;
+}
+
+void CTextObject::SetPixelSize(int pixelSize)
+{
+	if (pixelSize == m_pixelSize)
+		return;
+	m_pixelSize = pixelSize;
+	m_bDirty = true;
+}
+
+void CTextObject::SetColour(const glm::vec4& colour)
+{
+	if (colour == m_colour)
+		return;
+	m_colour = colour;
+	m_bDirty = true;
+}
+
+void CTextObject::SetVisible(bool bVisible)
+{
+	if (bVisible == m_bVisible)
+		return;
+	m_bVisible = bVisible;
+	m_bDirty = true;
+}
+
+bool CTextObject::UpdateKey(int iKey)
+{
+	if (m_bKeySet && iKey == m_iKey)
+		return false;
+	m_iKey = iKey;
+	m_bKeySet = true;
+	return true;
+}
+
+void CTextObject::Refresh()
+{
+	if (m_pFont == NULL)
+		return;
+
+	// Keep the atlas pages this text is drawn from, and catch up if one was evicted anyway or a glyph it was waiting
+	// for has arrived
+	if (m_bVisible)
+		m_pFont->TouchPages(m_uiPageMask);
+	bool bStale = m_iEvictions != m_pFont->GetAtlasEvictions() || (!m_bComplete && m_iArrivals != m_pFont->GetGlyphArrivals());
+	if (!m_bDirty && !bStale)
+		return;
+	m_bDirty = false;
+	m_iEvictions = m_pFont->GetAtlasEvictions();
+	m_iArrivals = m_pFont->GetGlyphArrivals();
+
+	// One quad per character, empty ones included, so character i's quad is always in slot i
+	m_vLayout.clear();
+	m_bComplete = true;
+	m_uiPageMask = 0;
+	if (m_bVisible)
+		m_bComplete = m_pFont->Layout(m_text, m_x, m_y, m_pixelSize, m_colour, true, m_bFixedWidthDigits, m_vLayout, m_uiPageMask);
+	m_vLayout.resize(m_iMaxChars * 6, CFreeTypeFont::EmptyVertex());
+
+	// Only the span from the first to the last changed vertex is handed over
+	int iFirst = 0, iEnd = (int)m_vLayout.size();
+	while (iFirst < iEnd && memcmp(&m_vLayout[iFirst], &m_vVertices[iFirst], sizeof(TextVertex)) == 0)
+		iFirst++;
+	while (iEnd > iFirst && memcmp(&m_vLayout[iEnd - 1], &m_vVertices[iEnd - 1], sizeof(TextVertex)) == 0)
+		iEnd--;
+	if (iFirst == iEnd)
+		return;
+
+	m_vVertices.swap(m_vLayout);
+	m_pFont->UpdateRetained(m_iFirstVertex + iFirst, &m_vVertices[iFirst], iEnd - iFirst);
+}
+
+// The slots stay reserved in the font, but are cleared so nothing is drawn in them
+void CTextObject::Release()
+{
+	if (m_pFont == NULL)
+		return;
+	if (m_iMaxChars > 0) {
+		m_vLayout.assign(m_iMaxChars * 6, CFreeTypeFont::EmptyVertex());
+		m_pFont->UpdateRetained(m_iFirstVertex, &m_vLayout[0], (int)m_vLayout.size());
+	}
+	m_pFont->RemoveTextObject(this);
+	m_pFont = NULL;
+	m_vVertices.clear();
+}
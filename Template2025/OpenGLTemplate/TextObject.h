@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Common.h"
+#include "FreeTypeFont.h"
+
+// A piece of text that stays on screen from frame to frame, such as a HUD label or counter.  Its quads live in the
+// font's retained vertex buffer and are drawn by the font's Flush along with everything else.  They are only laid
+// out again when the text, position, size or colour changes, and then only the characters whose quads changed are
+// uploaded.  With fixed width digits, a changing number keeps every other character where it was, so updating a
+// timer uploads a digit or two.
+class CTextObject
+{
+public:
+	CTextObject();
+	~CTextObject();
+
+	// Reserves room for iMaxChars characters (code points, not bytes); longer text is cut short
+	void Create(CFreeTypeFont* pFont, int iMaxChars, bool bFixedWidthDigits = true);
+
+	// Each of these does nothing if the value is unchanged
+	void SetText(const string& text);
+	void Format(const char* text, ...);
+	void SetPosition(int x, int y);
+	void SetPixelSize(int pixelSize);
+	void SetColour(const glm::vec4& colour);
+	void SetVisible(bool bVisible);
+
+	// Returns true if iKey differs from the last call.  Lets callers skip formatting text that would come out the
+	// same, e.g. a timer keyed on the hundredths of a second it shows.
+	bool UpdateKey(int iKey);
+
+	// Called by the font's Flush: lays the text out again if anything changed, or if the glyphs it uses have moved or
+	// arrived in the atlas, and hands the font the changed quads
+	void Refresh();
+
+	void Release();
+
+private:
+	CFreeTypeFont* m_pFont;
+	int m_iFirstVertex;
+	int m_iMaxChars;
+	bool m_bFixedWidthDigits;
+
+	string m_text;
+	int m_x, m_y, m_pixelSize;
+	glm::vec4 m_colour;
+	bool m_bVisible;
+	bool m_bDirty;
+	int m_iKey;
+	bool m_bKeySet;
+
+	bool m_bComplete;							// False if some glyphs were still being rasterised at the last layout
+	unsigned int m_uiPageMask;					// Atlas pages the quads use
+	int m_iEvictions, m_iArrivals;				// The font's counts at the last layout
+
+	vector<TextVertex> m_vVertices;				// As last handed to the font
+	vector<TextVertex> m_vLayout;				// Scratch
+};
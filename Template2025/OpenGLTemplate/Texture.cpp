@@ -1,16 +1,32 @@
 #include "Common.h"
 
 #include "texture.h"
+#include "TextureLoader.h"
+#include "TextureStreamer.h"
+#include "CompressedImage.h"
 
 #include "include\freeimage\FreeImage.h"
 #pragma comment(lib, "lib/FreeImage.lib")
 
 CTexture::CTexture()
 {
+	m_textureID = 0;
+	m_samplerObjectID = 0;
 	m_mipMapsGenerated = false;
+	m_compressed = false;
+	m_memorySize = 0;
+	m_pLoader = NULL;
+	m_loadRequest = -1;
+	m_pStreamer = NULL;
 }
 CTexture::~CTexture()
-{}
+{
+	// The loader must not call back into a deleted texture
+	if (m_loadRequest >= 0)
+		m_pLoader->Cancel(m_loadRequest);
+	if (m_pStreamer != NULL)
+		m_pStreamer->Remove(this);
+}
 
 // Create a texture from the data stored in bData.  
 void CTexture::CreateFromData(BYTE* data, int width, int height, int bpp, GLenum format, bool generateMipMaps)
@@ -26,10 +42,12 @@ void CTexture::CreateFromData(BYTE* data, int width, int height, int bpp, GLenum
 	else
 		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
 	if(generateMipMaps)glGenerateMipmap(GL_TEXTURE_2D);
-	glGenSamplers(1, &m_samplerObjectID);
+	m_samplerObjectID = CTextureCache::GetInstance().AcquireSampler(m_samplerState);
 
 	m_path = "";
 	m_mipMapsGenerated = generateMipMaps;
+	m_compressed = false;
+	m_memorySize = GetMemorySize(width, height, bpp, generateMipMaps);
 	m_width = width;
 	m_height = height;
 	m_bpp = bpp;
@@ -38,6 +56,23 @@ void CTexture::CreateFromData(BYTE* data, int width, int height, int bpp, GLenum
 // Loads a 2D texture given the filename (sPath).  bGenerateMipMaps will generate a mipmapped texture if true
 bool CTexture::Load(string path, bool generateMipMaps)
 {
+	CCompressedImage compressed;
+	if (compressed.LoadConverted(path)) {
+		glGenTextures(1, &m_textureID);
+		glBindTexture(GL_TEXTURE_2D, m_textureID);
+		UploadCompressed(compressed, GL_TEXTURE_2D, GL_TEXTURE_2D, compressed.GetData());
+		m_samplerObjectID = CTextureCache::GetInstance().AcquireSampler(m_samplerState);
+
+		m_path = path;
+		m_mipMapsGenerated = compressed.GetLevelCount() > 1;
+		m_compressed = true;
+		m_memorySize = compressed.GetDataSize();
+		m_width = compressed.GetWidth();
+		m_height = compressed.GetHeight();
+		m_bpp = compressed.GetBitsPerPixel();
+		return true;
+	}
+
 	FREE_IMAGE_FORMAT fif = FIF_UNKNOWN;
 	FIBITMAP* dib(0);
 
@@ -80,14 +115,112 @@ bool CTexture::Load(string path, bool generateMipMaps)
 	return true; // Success
 }
 
+void CTexture::LoadAsync(CTextureLoader* pLoader, string path, bool generateMipMaps, glm::vec3 placeholderColour)
+{
+	BYTE data[3];
+	data[0] = (BYTE)(placeholderColour.b * 255);
+	data[1] = (BYTE)(placeholderColour.g * 255);
+	data[2] = (BYTE)(placeholderColour.r * 255);
+	CreateFromData(data, 1, 1, 24, GL_BGR, generateMipMaps);
+	m_path = path;
+
+	// The image goes into the placeholder's own texture object, so anything holding this texture picks it up
+	m_pLoader = pLoader;
+	m_loadRequest = pLoader->Load(path, m_textureID, GL_TEXTURE_2D, GL_TEXTURE_2D, [this](const CTextureLoader::Result& result) {
+		m_loadRequest = -1;
+		if (!result.bLoaded)
+			return;
+		// A converted image brings its own mip chain, and GL cannot generate mips for compressed formats anyway
+		if (result.bCompressed)
+			m_mipMapsGenerated = result.iLevels > 1;
+		else if (m_mipMapsGenerated)
+			glGenerateMipmap(GL_TEXTURE_2D);
+		m_compressed = result.bCompressed;
+		m_memorySize = result.bCompressed ? result.dataSize : GetMemorySize(result.iWidth, result.iHeight, result.iBpp, m_mipMapsGenerated);
+		m_width = result.iWidth;
+		m_height = result.iHeight;
+		m_bpp = result.iBpp;
+	});
+}
+
+// Each level is specified with glCompressedTexImage2D rather than into immutable storage, as the asynchronous path
+// uploads over a placeholder that was created mutable.  The base and max levels are set so a chain that stops short of
+// 1x1 is still complete.
+void CTexture::UploadCompressed(CCompressedImage& image, GLenum target, GLenum imageTarget, const BYTE* pData)
+{
+	for (int i = 0; i < image.GetLevelCount(); i++)
+		glCompressedTexImage2D(imageTarget, i, image.GetInternalFormat(), image.GetLevelWidth(i), image.GetLevelHeight(i), 0,
+			(GLsizei)image.GetLevelSize(i), pData + image.GetLevelOffset(i));
+	glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, image.GetLevelCount() - 1);
+}
+
+bool CTexture::LoadStreamed(CTextureStreamer* pStreamer, string path)
+{
+	if (!pStreamer->Add(this, path))
+		return false;
+	m_samplerObjectID = CTextureCache::GetInstance().AcquireSampler(m_samplerState);
+	m_path = path;
+	m_mipMapsGenerated = true;
+	m_compressed = true;
+	return true;
+}
+
+void CTexture::RequestDetail(float texels)
+{
+	if (m_pStreamer != NULL)
+		m_pStreamer->Request(this, texels);
+}
+
+// The streamer swaps in new storage whenever the resident levels change, and passes NULL when it stops streaming
+void CTexture::SetStreamedStorage(CTextureStreamer* pStreamer, UINT textureID, int width, int height, int bpp, size_t memorySize)
+{
+	m_pStreamer = pStreamer;
+	m_textureID = textureID;
+	m_width = width;
+	m_height = height;
+	m_bpp = bpp;
+	m_memorySize = memorySize;
+}
+
+bool CTexture::IsLoading()
+{
+	return m_loadRequest >= 0;
+}
+
 void CTexture::SetSamplerObjectParameter(GLenum parameter, GLenum value)
 {
-	glSamplerParameteri(m_samplerObjectID, parameter, value);
+	SamplerState state = m_samplerState;
+	switch (parameter) {
+	case GL_TEXTURE_MIN_FILTER: state.minFilter = value; break;
+	case GL_TEXTURE_MAG_FILTER: state.magFilter = value; break;
+	case GL_TEXTURE_WRAP_S: state.wrapS = value; break;
+	case GL_TEXTURE_WRAP_T: state.wrapT = value; break;
+	case GL_TEXTURE_WRAP_R: state.wrapR = value; break;
+	default: return;
+	}
+	SetSamplerState(state);
 }
 
 void CTexture::SetSamplerObjectParameterf(GLenum parameter, float value)
 {
-	glSamplerParameterf(m_samplerObjectID, parameter, value);
+	SamplerState state = m_samplerState;
+	switch (parameter) {
+	case GL_TEXTURE_MAX_ANISOTROPY_EXT: state.maxAnisotropy = value; break;
+	case GL_TEXTURE_LOD_BIAS: state.lodBias = value; break;
+	default: return;
+	}
+	SetSamplerState(state);
+}
+
+// Swaps to the shared sampler for the new state, leaving the old one as it is for whoever else uses it
+void CTexture::SetSamplerState(const SamplerState& state)
+{
+	CTextureCache& cache = CTextureCache::GetInstance();
+	UINT uiSampler = cache.AcquireSampler(state);
+	cache.ReleaseSampler(m_samplerObjectID);
+	m_samplerObjectID = uiSampler;
+	m_samplerState = state;
 }
 
 
@@ -102,8 +235,18 @@ void CTexture::Bind(int iTextureUnit)
 // Frees memory on the GPU of the texture
 void CTexture::Release()
 {
-	glDeleteSamplers(1, &m_samplerObjectID);
+	if (m_loadRequest >= 0) {
+		m_pLoader->Cancel(m_loadRequest);
+		m_loadRequest = -1;
+	}
+	if (m_pStreamer != NULL) {
+		m_pStreamer->Remove(this);
+		m_pStreamer = NULL;
+	}
+	CTextureCache::GetInstance().ReleaseSampler(m_samplerObjectID);
 	glDeleteTextures(1, &m_textureID);
+	m_samplerObjectID = 0;
+	m_textureID = 0;
 }
 
 int CTexture::GetWidth()
@@ -119,4 +262,21 @@ int CTexture::GetHeight()
 int CTexture::GetBPP()
 {
 	return m_bpp;
+}
+
+bool CTexture::IsCompressed()
+{
+	return m_compressed;
+}
+
+size_t CTexture::GetMemorySize()
+{
+	return m_memorySize;
+}
+
+// Drivers pad 24 bit images out to 32 bits, and a full mip chain adds a third
+size_t CTexture::GetMemorySize(int width, int height, int bpp, bool mipMaps)
+{
+	size_t size = (size_t)width * height * (bpp == 8 ? 1 : 4);
+	return mipMaps ? size * 4 / 3 : size;
 }
\ No newline at end of file
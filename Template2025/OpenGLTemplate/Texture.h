@@ -1,30 +1,68 @@
 #pragma once
 
+#include "TextureCache.h"
+
+class CTextureLoader;
+class CTextureStreamer;
+class CCompressedImage;
+
 // Class that provides a texture for texture mapping in OpenGL
 class CTexture
 {
 public:
 	void CreateFromData(BYTE* data, int width, int height, int bpp, GLenum format, bool generateMipMaps = false);
+	// Prefers a converted .ktx2 or .dds beside the image at path, which brings its own mip chain
 	bool Load(string path, bool generateMipMaps = true);
+
+	// Creates a 1x1 placeholder of placeholderColour straight away, and has pLoader replace it with the image at path
+	// once a worker has decoded it.  The texture can be bound and its sampler set up in the meantime.  If the image
+	// cannot be loaded, the placeholder stays.
+	void LoadAsync(CTextureLoader* pLoader, string path, bool generateMipMaps = true, glm::vec3 placeholderColour = glm::vec3(0.5f));
+	bool IsLoading();
+
+	// Streams the mip levels of the converted file beside the image at path, starting with the smallest.  Returns
+	// false if there is no converted file.
+	bool LoadStreamed(CTextureStreamer* pStreamer, string path);
+	void RequestDetail(float texels);			// Asks a streamed texture for enough detail to cover texels on screen
+	void SetStreamedStorage(CTextureStreamer* pStreamer, UINT textureID, int width, int height, int bpp, size_t memorySize);	// From the streamer
 	void Bind(int textureUnit = 0);
 
+	// The sampler comes from CTextureCache, shared with every texture set up the same way.  Only the parameters in
+	// SamplerState can be set.
 	void SetSamplerObjectParameter(GLenum parameter, GLenum value);
 	void SetSamplerObjectParameterf(GLenum parameter, float value);
 
 	int GetWidth();
 	int GetHeight();
 	int GetBPP();
+	bool IsCompressed();
+	size_t GetMemorySize();						// Estimated from the format the driver is likely to store, mips included
+
+	static size_t GetMemorySize(int width, int height, int bpp, bool mipMaps);
+
+	// Uploads every level of a block compressed image into imageTarget (the target itself, or a cube map face) of the
+	// texture bound to target.  pData is image.GetData(), or the offset of a copy of it in the bound pixel unpack buffer.
+	static void UploadCompressed(CCompressedImage& image, GLenum target, GLenum imageTarget, const BYTE* pData);
 
 	void Release();
 
 	CTexture();
 	~CTexture();
 private:
+	void SetSamplerState(const SamplerState& state);
+
 	int m_width, m_height, m_bpp; // Texture width, height, and bytes per pixel
 	UINT m_textureID; // Texture id
 	UINT m_samplerObjectID; // Sampler id
+	SamplerState m_samplerState;
 	bool m_mipMapsGenerated;
+	bool m_compressed;
+	size_t m_memorySize;
 
 	string m_path;
+
+	CTextureLoader* m_pLoader;
+	int m_loadRequest; // -1 unless an image is on its way
+	CTextureStreamer* m_pStreamer;
 };
 
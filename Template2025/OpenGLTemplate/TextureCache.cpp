@@ -0,0 +1,276 @@
+#include "TextureCache.h"
+#include "Texture.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+
+SamplerState::SamplerState()
+{
+	minFilter = GL_NEAREST_MIPMAP_LINEAR;
+	magFilter = GL_LINEAR;
+	wrapS = wrapT = wrapR = GL_REPEAT;
+	maxAnisotropy = 1.0f;
+	lodBias = 0.0f;
+}
+
+bool SamplerState::operator<(const SamplerState& other) const
+{
+	if (minFilter != other.minFilter) return minFilter < other.minFilter;
+	if (magFilter != other.magFilter) return magFilter < other.magFilter;
+	if (wrapS != other.wrapS) return wrapS < other.wrapS;
+	if (wrapT != other.wrapT) return wrapT < other.wrapT;
+	if (wrapR != other.wrapR) return wrapR < other.wrapR;
+	if (maxAnisotropy != other.maxAnisotropy) return maxAnisotropy < other.maxAnisotropy;
+	return lodBias < other.lodBias;
+}
+
+CTextureCache::CTextureCache()
+{
+	m_iShared = 0;
+	m_pStreamer = NULL;
+}
+
+CTextureCache& CTextureCache::GetInstance()
+{
+	static CTextureCache instance;
+
+	return instance;
+}
+
+void CTextureCache::SetStreamer(CTextureStreamer* pStreamer)
+{
+	m_pStreamer = pStreamer;
+}
+
+// Absolute, lower case and with one kind of slash, so "resources\\models\\..\\textures\\a.jpg" and
+// "Resources/Textures/A.jpg" find the same entry
+string CTextureCache::CanonicalPath(const string& path)
+{
+	char fullPath[MAX_PATH];
+	DWORD length = GetFullPathName(path.c_str(), MAX_PATH, fullPath, NULL);
+	string canonical = (length > 0 && length < MAX_PATH) ? string(fullPath, length) : path;
+	std::replace(canonical.begin(), canonical.end(), '/', '\\');
+	std::transform(canonical.begin(), canonical.end(), canonical.begin(), ::tolower);
+	return canonical;
+}
+
+// From the directory entry, without opening the file.  Missing files are 0, and never matched.
+unsigned long long CTextureCache::FileSizeOf(const string& path)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &attributes))
+		return 0;
+	return ((unsigned long long)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+}
+
+unsigned long long CTextureCache::HashFile(const string& path)
+{
+	CMappedFile file;
+	if (!file.Open(path))
+		return 0;
+	unsigned long long hash = file.GetHash();
+	file.Close();
+	return hash;
+}
+
+CTexture* CTextureCache::AddReference(CTexture* pTexture)
+{
+	m_textures[pTexture].iReferences++;
+	m_iShared++;
+	return pTexture;
+}
+
+CTexture* CTextureCache::Acquire(const string& path, CTextureLoader* pLoader, glm::vec3 placeholderColour)
+{
+	string canonical = CanonicalPath(path);
+	map<string, CTexture*>::iterator itPath = m_paths.find(canonical);
+	if (itPath != m_paths.end())
+		return AddReference(itPath->second);
+
+	// Only a file the same size as one already loaded can have the same contents, so the common case reads nothing
+	// here and leaves the file to the worker that decodes it.  When the sizes match, both files are hashed to be sure.
+	unsigned long long fileSize = FileSizeOf(path);
+	unsigned long long contentHash = 0;
+	typedef multimap<unsigned long long, CTexture*>::iterator SizeIterator;
+	std::pair<SizeIterator, SizeIterator> sameSize = m_sizes.equal_range(fileSize);
+	for (SizeIterator itSize = sameSize.first; fileSize != 0 && itSize != sameSize.second; ++itSize) {
+		if (contentHash == 0)
+			contentHash = HashFile(path);
+		TextureEntry& other = m_textures[itSize->second];
+		if (other.contentHash == 0)
+			other.contentHash = HashFile(other.path);
+		if (contentHash != 0 && contentHash == other.contentHash) {
+			m_paths[canonical] = itSize->second;
+			return AddReference(itSize->second);
+		}
+	}
+
+	// Converted textures are streamed; the rest are loaded whole
+	CTexture* pTexture = new CTexture;
+	bool bStreamed = m_pStreamer != NULL && pTexture->LoadStreamed(m_pStreamer, path);
+	if (!bStreamed && pLoader != NULL)
+		pTexture->LoadAsync(pLoader, path, true, placeholderColour);
+	else if (!bStreamed && !pTexture->Load(path, true)) {
+		delete pTexture;
+		return NULL;
+	}
+
+	TextureEntry& entry = m_textures[pTexture];
+	entry.path = canonical;
+	entry.fileSize = fileSize;
+	entry.contentHash = contentHash;
+	entry.iReferences = 1;
+	m_paths[canonical] = pTexture;
+	if (fileSize != 0)
+		m_sizes.insert(std::make_pair(fileSize, pTexture));
+	return pTexture;
+}
+
+CTexture* CTextureCache::AcquireColour(glm::vec3 colour)
+{
+	BYTE data[3];
+	data[0] = (BYTE)(colour.b * 255);
+	data[1] = (BYTE)(colour.g * 255);
+	data[2] = (BYTE)(colour.r * 255);
+
+	char key[32];
+	sprintf_s(key, "colour %02x%02x%02x", data[2], data[1], data[0]);
+	map<string, CTexture*>::iterator it = m_paths.find(key);
+	if (it != m_paths.end())
+		return AddReference(it->second);
+
+	CTexture* pTexture = new CTexture;
+	pTexture->CreateFromData(data, 1, 1, 24, GL_BGR, false);
+
+	TextureEntry& entry = m_textures[pTexture];
+	entry.path = key;
+	entry.fileSize = 0;
+	entry.contentHash = 0;
+	entry.iReferences = 1;
+	m_paths[key] = pTexture;
+	return pTexture;
+}
+
+void CTextureCache::Release(CTexture* pTexture)
+{
+	map<CTexture*, TextureEntry>::iterator it = m_textures.find(pTexture);
+	if (it == m_textures.end() || --it->second.iReferences > 0)
+		return;
+
+	for (map<string, CTexture*>::iterator itPath = m_paths.begin(); itPath != m_paths.end();) {
+		if (itPath->second == pTexture)
+			itPath = m_paths.erase(itPath);
+		else
+			++itPath;
+	}
+	typedef multimap<unsigned long long, CTexture*>::iterator SizeIterator;
+	std::pair<SizeIterator, SizeIterator> sameSize = m_sizes.equal_range(it->second.fileSize);
+	for (SizeIterator itSize = sameSize.first; itSize != sameSize.second; ++itSize) {
+		if (itSize->second == pTexture) {
+			m_sizes.erase(itSize);
+			break;
+		}
+	}
+	m_textures.erase(it);
+
+	pTexture->Release();
+	delete pTexture;
+}
+
+UINT CTextureCache::AcquireSampler(const SamplerState& state)
+{
+	map<SamplerState, SamplerEntry>::iterator it = m_samplers.find(state);
+	if (it != m_samplers.end()) {
+		it->second.iReferences++;
+		return it->second.uiSampler;
+	}
+
+	UINT uiSampler;
+	glGenSamplers(1, &uiSampler);
+	glSamplerParameteri(uiSampler, GL_TEXTURE_MIN_FILTER, state.minFilter);
+	glSamplerParameteri(uiSampler, GL_TEXTURE_MAG_FILTER, state.magFilter);
+	glSamplerParameteri(uiSampler, GL_TEXTURE_WRAP_S, state.wrapS);
+	glSamplerParameteri(uiSampler, GL_TEXTURE_WRAP_T, state.wrapT);
+	glSamplerParameteri(uiSampler, GL_TEXTURE_WRAP_R, state.wrapR);
+	glSamplerParameterf(uiSampler, GL_TEXTURE_LOD_BIAS, state.lodBias);
+	if (state.maxAnisotropy > 1.0f)
+		glSamplerParameterf(uiSampler, GL_TEXTURE_MAX_ANISOTROPY_EXT, state.maxAnisotropy);
+
+	SamplerEntry& entry = m_samplers[state];
+	entry.uiSampler = uiSampler;
+	entry.iReferences = 1;
+	m_samplerStates[uiSampler] = state;
+	return uiSampler;
+}
+
+void CTextureCache::ReleaseSampler(UINT uiSampler)
+{
+	map<UINT, SamplerState>::iterator itState = m_samplerStates.find(uiSampler);
+	if (itState == m_samplerStates.end())
+		return;
+	map<SamplerState, SamplerEntry>::iterator it = m_samplers.find(itState->second);
+	if (--it->second.iReferences > 0)
+		return;
+
+	glDeleteSamplers(1, &uiSampler);
+	m_samplers.erase(it);
+	m_samplerStates.erase(itState);
+}
+
+int CTextureCache::GetTextureCount()
+{
+	return (int)m_textures.size();
+}
+
+int CTextureCache::GetSamplerCount()
+{
+	return (int)m_samplers.size();
+}
+
+int CTextureCache::GetSharedCount()
+{
+	return m_iShared;
+}
+
+size_t CTextureCache::GetTextureBytes()
+{
+	size_t bytes = 0;
+	for (map<CTexture*, TextureEntry>::iterator it = m_textures.begin(); it != m_textures.end(); ++it)
+		bytes += it->first->GetMemorySize();
+	return bytes;
+}
+
+bool CTextureCache::DumpInventory(const string& path)
+{
+	FILE* pFile = NULL;
+	if (fopen_s(&pFile, path.c_str(), "w") != 0 || pFile == NULL)
+		return false;
+
+	fprintf(pFile, "Textures: %d, %.1f KB, %d acquires shared an existing texture\n", GetTextureCount(),
+		GetTextureBytes() / 1024.0f, m_iShared);
+	fprintf(pFile, "%10s %12s %10s %5s  %s\n", "KB", "Size", "Format", "Users", "Path");
+	for (map<CTexture*, TextureEntry>::iterator it = m_textures.begin(); it != m_textures.end(); ++it) {
+		CTexture* pTexture = it->first;
+		char size[32], format[32];
+		sprintf_s(size, "%dx%d", pTexture->GetWidth(), pTexture->GetHeight());
+		if (pTexture->IsLoading())
+			sprintf_s(format, "loading");
+		else if (pTexture->IsCompressed())
+			sprintf_s(format, "BC %dbpp", pTexture->GetBPP());
+		else
+			sprintf_s(format, "%dbpp", pTexture->GetBPP());
+		fprintf(pFile, "%10.1f %12s %10s %5d  %s\n", pTexture->GetMemorySize() / 1024.0f, size, format,
+			it->second.iReferences, it->second.path.c_str());
+	}
+
+	fprintf(pFile, "\nSamplers: %d\n", GetSamplerCount());
+	fprintf(pFile, "%8s %6s %6s %6s %6s %6s %6s %6s %5s\n", "Name", "Min", "Mag", "WrapS", "WrapT", "WrapR", "Aniso", "Bias", "Users");
+	for (map<SamplerState, SamplerEntry>::iterator it = m_samplers.begin(); it != m_samplers.end(); ++it) {
+		const SamplerState& state = it->first;
+		fprintf(pFile, "%8u %6x %6x %6x %6x %6x %6.1f %6.2f %5d\n", it->second.uiSampler, state.minFilter, state.magFilter,
+			state.wrapS, state.wrapT, state.wrapR, state.maxAnisotropy, state.lodBias, it->second.iReferences);
+	}
+
+	fclose(pFile);
+	return true;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "Common.h"
+
+#include <map>
+
+class CTexture;
+class CTextureLoader;
+class CTextureStreamer;
+
+// The state a sampler object is created with.  The defaults are OpenGL's own.
+struct SamplerState
+{
+	GLenum minFilter, magFilter;
+	GLenum wrapS, wrapT, wrapR;
+	float maxAnisotropy;
+	float lodBias;
+
+	SamplerState();
+	bool operator<(const SamplerState& other) const;
+};
+
+// Shares textures and sampler objects between everything that uses them.  A texture is looked up by its canonical
+// path, and failing that by its file's contents, so the same image reached by another path (or copied into another
+// model's folder) is only loaded once.  Contents are only hashed for files the same size as one already loaded.
+// Samplers are looked up by their state.  Both are reference counted, and deleted when the last user releases them.
+//
+// Users of a shared texture share its sampler too; CTexture swaps in another shared sampler when one of them changes
+// a parameter, rather than changing the one the others are using.
+class CTextureCache
+{
+public:
+	static CTextureCache& GetInstance();
+
+	// Textures acquired afterwards are streamed if they have a converted file.  Pass NULL before deleting the streamer.
+	void SetStreamer(CTextureStreamer* pStreamer);
+
+	// Returns the texture for the image at path, loading it the first time.  With a loader, it is loaded in the
+	// background behind a placeholder of placeholderColour.  Otherwise it is loaded now, and NULL is returned if it
+	// cannot be.
+	CTexture* Acquire(const string& path, CTextureLoader* pLoader = NULL, glm::vec3 placeholderColour = glm::vec3(0.5f));
+	CTexture* AcquireColour(glm::vec3 colour);	// A 1x1 texture of a single colour
+	void Release(CTexture* pTexture);
+
+	UINT AcquireSampler(const SamplerState& state);
+	void ReleaseSampler(UINT uiSampler);		// Ignores samplers that did not come from here
+
+	int GetTextureCount();
+	int GetSamplerCount();
+	int GetSharedCount();						// Acquires answered with a texture that was already loaded
+	size_t GetTextureBytes();					// Estimated, mips included
+
+	// Writes each texture with its size, format, estimated memory and users, and each sampler with its users
+	bool DumpInventory(const string& path);
+
+private:
+	CTextureCache();
+	CTextureCache(const CTextureCache&);
+	CTextureCache& operator=(const CTextureCache&);
+
+	static string CanonicalPath(const string& path);
+	static unsigned long long FileSizeOf(const string& path);
+	static unsigned long long HashFile(const string& path);
+	CTexture* AddReference(CTexture* pTexture);
+
+	struct TextureEntry {
+		string path;							// Canonical path, or the colour for AcquireColour
+		unsigned long long fileSize;
+		unsigned long long contentHash;			// 0 until another file of the same size is acquired
+		int iReferences;
+	};
+	map<CTexture*, TextureEntry> m_textures;
+	map<string, CTexture*> m_paths;				// Every path a texture has been acquired by
+	multimap<unsigned long long, CTexture*> m_sizes;	// Loaded files by size, to find the ones worth hashing
+
+	struct SamplerEntry {
+		UINT uiSampler;
+		int iReferences;
+	};
+	map<SamplerState, SamplerEntry> m_samplers;
+	map<UINT, SamplerState> m_samplerStates;	// To find a sampler's entry from its name
+	int m_iShared;
+	CTextureStreamer* m_pStreamer;
+};
@@ -0,0 +1,281 @@
+#include "TextureLoader.h"
+#include "ThreadPool.h"
+#include "StreamingBuffer.h"
+#include "Texture.h"
+
+#include "include\freeimage\FreeImage.h"
+
+CTextureLoader::CTextureLoader()
+{
+	m_pThreadPool = NULL;
+	m_pStaging = NULL;
+	m_iFrameBudget = DEFAULT_FRAME_BUDGET;
+	m_iNextRequest = 0;
+	m_iBytesUploaded = 0;
+	m_loadTime = 0.0;
+	m_iLoaded = 0;
+	m_iCompressed = 0;
+	m_textureBytes = 0;
+	m_pendingJobs = 0;
+}
+
+CTextureLoader::~CTextureLoader()
+{
+	Release();
+}
+
+void CTextureLoader::Create(CThreadPool* pThreadPool, GLsizeiptr iFrameBudget)
+{
+	m_pThreadPool = pThreadPool;
+	m_iFrameBudget = iFrameBudget;
+
+	// One region per frame in flight, so filling a region never waits on an upload the GPU is still reading
+	m_pStaging = new CStreamingBuffer;
+	m_pStaging->Create(iFrameBudget);
+}
+
+int CTextureLoader::Load(const string& path, UINT uiTexture, GLenum target, GLenum imageTarget, Callback onLoaded)
+{
+	if (m_requests.empty())
+		m_timer.Start();
+
+	int iRequest = m_iNextRequest++;
+	Request& request = m_requests[iRequest];
+	request.path = path;
+	request.uiTexture = uiTexture;
+	request.target = target;
+	request.imageTarget = imageTarget;
+	request.onLoaded = onLoaded;
+
+	auto decode = [this, iRequest, path]() {
+		Image image;
+		image.iRequest = iRequest;
+		image.result.bLoaded = Decode(path, image);
+
+		lock_guard<mutex> lock(m_resultMutex);
+		m_vFinished.push_back(std::move(image));
+		m_pendingJobs--;
+		m_workersDone.notify_all();
+	};
+
+	{
+		lock_guard<mutex> lock(m_resultMutex);
+		m_pendingJobs++;
+	}
+	if (m_pThreadPool != NULL)
+		m_pThreadPool->Submit(decode);
+	else
+		decode();
+	return iRequest;
+}
+
+// A cancelled image is still decoded, but is dropped when it arrives
+void CTextureLoader::Cancel(int iRequest)
+{
+	m_requests.erase(iRequest);
+}
+
+// Runs on a worker.  Only FreeImage is called here, never GL.
+bool CTextureLoader::Decode(const string& path, Image& image)
+{
+	image.result.bCompressed = false;
+	image.result.iWidth = image.result.iHeight = image.result.iBpp = 0;
+	image.result.iLevels = 1;
+	image.result.dataSize = 0;
+	if (image.compressed.LoadConverted(path)) {
+		image.result.bCompressed = true;
+		image.result.iWidth = image.compressed.GetWidth();
+		image.result.iHeight = image.compressed.GetHeight();
+		image.result.iBpp = image.compressed.GetBitsPerPixel();
+		image.result.iLevels = image.compressed.GetLevelCount();
+		image.result.dataSize = image.compressed.GetDataSize();
+		return true;
+	}
+
+	FREE_IMAGE_FORMAT fif = FreeImage_GetFileType(path.c_str(), 0);
+	if (fif == FIF_UNKNOWN)
+		fif = FreeImage_GetFIFFromFilename(path.c_str());
+	if (fif == FIF_UNKNOWN || !FreeImage_FIFSupportsReading(fif))
+		return false;
+
+	FIBITMAP* dib = FreeImage_Load(fif, path.c_str());
+	if (dib == NULL)
+		return false;
+
+	// Only 8, 24 and 32 bit images map onto a GL format; convert anything else (palettised, 16 bit) to 24 bit
+	int bpp = FreeImage_GetBPP(dib);
+	if (bpp != 8 && bpp != 24 && bpp != 32) {
+		FIBITMAP* converted = FreeImage_ConvertTo24Bits(dib);
+		FreeImage_Unload(dib);
+		dib = converted;
+		if (dib == NULL)
+			return false;
+	}
+
+	BYTE* pData = FreeImage_GetBits(dib);
+	image.result.iWidth = FreeImage_GetWidth(dib);
+	image.result.iHeight = FreeImage_GetHeight(dib);
+	image.result.iBpp = FreeImage_GetBPP(dib);
+	bool bValid = pData != NULL && image.result.iWidth > 0 && image.result.iHeight > 0;
+	if (bValid)
+		image.pixels.assign(pData, pData + FreeImage_GetPitch(dib) * image.result.iHeight);
+	FreeImage_Unload(dib);
+	return bValid;
+}
+
+void CTextureLoader::Update()
+{
+	m_iBytesUploaded = 0;
+	if (m_requests.empty() && m_ready.empty())
+		return;
+
+	{
+		lock_guard<mutex> lock(m_resultMutex);
+		for (unsigned int i = 0; i < m_vFinished.size(); i++)
+			m_ready.push_back(std::move(m_vFinished[i]));
+		m_vFinished.clear();
+	}
+
+	bool bStaging = m_pStaging != NULL && m_pStaging->IsCreated();
+	if (bStaging)
+		m_pStaging->BeginFrame();
+
+	while (!m_ready.empty()) {
+		Image& image = m_ready.front();
+		map<int, Request>::iterator it = m_requests.find(image.iRequest);
+		if (it == m_requests.end()) {
+			m_ready.pop_front();				// Cancelled
+			continue;
+		}
+
+		// At least one image goes up every frame, however large it is
+		GLsizeiptr iSize = (GLsizeiptr)(image.result.bCompressed ? image.compressed.GetDataSize() : image.pixels.size());
+		if (m_iBytesUploaded > 0 && m_iBytesUploaded + iSize > m_iFrameBudget)
+			break;
+
+		Request request = it->second;
+		m_requests.erase(it);
+		if (image.result.bLoaded) {
+			Upload(request, image);
+			m_iBytesUploaded += iSize;
+			m_iLoaded++;
+			if (image.result.bCompressed) {
+				m_iCompressed++;
+				m_textureBytes += image.result.dataSize;
+			} else
+				m_textureBytes += CTexture::GetMemorySize(image.result.iWidth, image.result.iHeight, image.result.iBpp, true);
+		} else {
+			char message[1024];
+			sprintf_s(message, "Cannot load image\n%s\n", request.path.c_str());
+			MessageBox(NULL, message, "Error", MB_ICONERROR);
+		}
+		request.onLoaded(image.result);
+		m_ready.pop_front();
+	}
+
+	if (bStaging)
+		m_pStaging->EndFrame();
+
+	if (m_requests.empty())
+		m_loadTime = m_timer.Elapsed();
+}
+
+void CTextureLoader::Upload(const Request& request, Image& image)
+{
+	if (image.result.bCompressed) {
+		UploadCompressed(request, image);
+		return;
+	}
+
+	GLenum format = GL_LUMINANCE, internalFormat = GL_LUMINANCE;
+	if (image.result.iBpp == 32) {
+		format = GL_BGRA;
+		internalFormat = GL_RGBA;
+	} else if (image.result.iBpp == 24) {
+		format = GL_BGR;
+		internalFormat = GL_RGB;
+	}
+
+	// Copy into this frame's staging region if it fits, and upload from there, so the driver does not need its own
+	// copy of the pixels before glTexImage2D returns
+	GLsizeiptr iSize = (GLsizeiptr)image.pixels.size();
+	GLintptr iOffset = 0;
+	void* pStaging = NULL;
+	if (m_pStaging != NULL && m_pStaging->IsCreated())
+		pStaging = m_pStaging->Allocate(iSize, 16, iOffset);
+
+	glBindTexture(request.target, request.uiTexture);
+	if (pStaging != NULL) {
+		memcpy(pStaging, &image.pixels[0], iSize);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pStaging->GetBuffer());
+		glTexImage2D(request.imageTarget, 0, internalFormat, image.result.iWidth, image.result.iHeight, 0, format, GL_UNSIGNED_BYTE, (const GLvoid*)iOffset);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	} else
+		glTexImage2D(request.imageTarget, 0, internalFormat, image.result.iWidth, image.result.iHeight, 0, format, GL_UNSIGNED_BYTE, &image.pixels[0]);
+}
+
+// As Upload, but the whole mip chain goes up through the staging region in one copy
+void CTextureLoader::UploadCompressed(const Request& request, Image& image)
+{
+	GLsizeiptr iSize = (GLsizeiptr)image.compressed.GetDataSize();
+	GLintptr iOffset = 0;
+	void* pStaging = NULL;
+	if (m_pStaging != NULL && m_pStaging->IsCreated())
+		pStaging = m_pStaging->Allocate(iSize, 16, iOffset);
+
+	glBindTexture(request.target, request.uiTexture);
+	if (pStaging != NULL) {
+		memcpy(pStaging, image.compressed.GetData(), iSize);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pStaging->GetBuffer());
+		CTexture::UploadCompressed(image.compressed, request.target, request.imageTarget, (const BYTE*)iOffset);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	} else
+		CTexture::UploadCompressed(image.compressed, request.target, request.imageTarget, image.compressed.GetData());
+}
+
+void CTextureLoader::WaitForWorkers()
+{
+	unique_lock<mutex> lock(m_resultMutex);
+	m_workersDone.wait(lock, [this]() { return m_pendingJobs == 0; });
+}
+
+int CTextureLoader::GetPendingCount()
+{
+	return (int)m_requests.size();
+}
+
+GLsizeiptr CTextureLoader::GetBytesUploaded()
+{
+	return m_iBytesUploaded;
+}
+
+double CTextureLoader::GetLoadTime()
+{
+	return m_loadTime;
+}
+
+int CTextureLoader::GetLoadedCount()
+{
+	return m_iLoaded;
+}
+
+int CTextureLoader::GetCompressedCount()
+{
+	return m_iCompressed;
+}
+
+size_t CTextureLoader::GetTextureBytes()
+{
+	return m_textureBytes;
+}
+
+// Drops everything outstanding without calling back
+void CTextureLoader::Release()
+{
+	WaitForWorkers();
+	m_vFinished.clear();
+	m_ready.clear();
+	m_requests.clear();
+	delete m_pStaging;
+	m_pStaging = NULL;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "Common.h"
+#include "HighResolutionTimer.h"
+#include "CompressedImage.h"
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+class CThreadPool;
+class CStreamingBuffer;
+
+// Loads images without holding up the GL thread.  Files are read and decoded with FreeImage on the worker threads, and
+// the decoded pixels are uploaded by Update, once a frame on the GL thread.  Uploads are copied into a ring of
+// persistently mapped pixel unpack buffer regions (a CStreamingBuffer of its own) and are held to a byte budget per
+// frame, so a burst of finished images is spread over several frames instead of stalling one.  An image larger than
+// the budget is uploaded on its own in a frame, straight from memory.
+//
+// Whoever requests an image keeps a placeholder bound in the meantime; the image is uploaded into the texture they
+// name, so nothing needs rebinding when it arrives.
+//
+// A converted .ktx2 or .dds beside an image is loaded in its place, with every level of its mip chain uploaded at once.
+class CTextureLoader
+{
+public:
+	CTextureLoader();
+	~CTextureLoader();
+
+	// Without a thread pool, images are decoded on the calling thread when they are requested
+	void Create(CThreadPool* pThreadPool, GLsizeiptr iFrameBudget = DEFAULT_FRAME_BUDGET);
+
+	struct Result {
+		bool bLoaded;							// False if the file could not be decoded
+		bool bCompressed;						// Block compressed, with iLevels levels already uploaded
+		int iWidth, iHeight, iBpp;
+		int iLevels;
+		size_t dataSize;						// Of every level, if bCompressed
+	};
+
+	// Called on the GL thread with the texture still bound to its target once the image is in place
+	typedef std::function<void(const Result& result)> Callback;
+
+	// Queues the image at path to be uploaded into imageTarget (the target itself, or a cube map face) of
+	// uiTexture.  Returns an id that can be passed to Cancel until the callback has been called.
+	int Load(const string& path, UINT uiTexture, GLenum target, GLenum imageTarget, Callback onLoaded);
+	void Cancel(int iRequest);
+
+	void Update();								// Uploads finished images, up to the frame budget
+
+	int GetPendingCount();						// Requests whose callback has not been called yet
+	GLsizeiptr GetBytesUploaded();				// In the last Update
+	double GetLoadTime();						// From the first request to the last upload, in ms
+	int GetLoadedCount();
+	int GetCompressedCount();					// Of those loaded
+	size_t GetTextureBytes();					// Taken up by the loaded images on the GPU, mips included
+
+	void Release();
+
+	static const int DEFAULT_FRAME_BUDGET = 4 * 1024 * 1024;
+
+private:
+	struct Request {
+		string path;
+		UINT uiTexture;
+		GLenum target, imageTarget;
+		Callback onLoaded;
+	};
+	struct Image {
+		int iRequest;
+		Result result;
+		vector<BYTE> pixels;					// Rows from the bottom, each padded to four bytes as FreeImage stores them
+		CCompressedImage compressed;			// Instead of pixels if result.bCompressed
+	};
+
+	static bool Decode(const string& path, Image& image);
+	void Upload(const Request& request, Image& image);
+	void UploadCompressed(const Request& request, Image& image);
+	void WaitForWorkers();
+
+	CThreadPool* m_pThreadPool;
+	CStreamingBuffer* m_pStaging;				// NULL, or not created, without buffer storage
+	GLsizeiptr m_iFrameBudget;
+	map<int, Request> m_requests;				// Only touched on the GL thread
+	deque<Image> m_ready;						// Decoded, waiting for budget
+	int m_iNextRequest;
+	GLsizeiptr m_iBytesUploaded;
+	CHighResolutionTimer m_timer;
+	double m_loadTime;
+	int m_iLoaded, m_iCompressed;
+	size_t m_textureBytes;
+
+	mutex m_resultMutex;
+	condition_variable m_workersDone;
+	vector<Image> m_vFinished;					// Protected by m_resultMutex
+	int m_pendingJobs;							// Protected by m_resultMutex
+};
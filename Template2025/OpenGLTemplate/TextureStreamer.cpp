@@ -0,0 +1,301 @@
+#include "TextureStreamer.h"
+#include "Texture.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+CTextureStreamer::CTextureStreamer()
+{
+	m_pThreadPool = NULL;
+	m_iBudget = DEFAULT_BUDGET;
+	m_iFrameBudget = DEFAULT_FRAME_BUDGET;
+	m_iNextStream = 0;
+	m_uiFrame = 0;
+	m_iResidentBytes = 0;
+	m_iRequestedBytes = 0;
+	m_pendingJobs = 0;
+}
+
+CTextureStreamer::~CTextureStreamer()
+{
+	Release();
+}
+
+void CTextureStreamer::Create(CThreadPool* pThreadPool, GLsizeiptr iBudget, GLsizeiptr iFrameBudget)
+{
+	m_pThreadPool = pThreadPool;
+	m_iBudget = iBudget;
+	m_iFrameBudget = iFrameBudget;
+}
+
+bool CTextureStreamer::Add(CTexture* pTexture, const string& path)
+{
+	Stream* pStream = new Stream;
+	string base = path.substr(0, path.find_last_of('.'));
+	bool bOpened = pStream->file.Open(base + ".ktx2") && pStream->image.LoadView(pStream->file.GetData(), pStream->file.GetSize());
+	if (!bOpened)
+		bOpened = pStream->file.Open(base + ".dds") && pStream->image.LoadView(pStream->file.GetData(), pStream->file.GetSize());
+	if (!bOpened) {
+		delete pStream;
+		return false;
+	}
+
+	// The tail is every level up to RESIDENT_SIZE across, or just the smallest if the chain stops short of that
+	CCompressedImage& image = pStream->image;
+	int iLevels = image.GetLevelCount();
+	pStream->iTailLevel = iLevels - 1;
+	while (pStream->iTailLevel > 0 && max(image.GetLevelWidth(pStream->iTailLevel - 1), image.GetLevelHeight(pStream->iTailLevel - 1)) <= RESIDENT_SIZE)
+		pStream->iTailLevel--;
+
+	pStream->pTexture = pTexture;
+	pStream->uiTexture = 0;
+	pStream->iTopLevel = iLevels;
+	pStream->iWantedLevel = pStream->iTailLevel;
+	pStream->iLoadingLevel = -1;
+	pStream->uiLastUsed = m_uiFrame;
+
+	int iStream = m_iNextStream++;
+	m_streams[iStream] = pStream;
+	m_textures[pTexture] = iStream;
+	SetTopLevel(*pStream, pStream->iTailLevel);
+	m_iResidentBytes += GetBytes(*pStream, pStream->iTailLevel);
+	return true;
+}
+
+// The texture keeps its current storage; only the streaming stops
+void CTextureStreamer::Remove(CTexture* pTexture)
+{
+	map<CTexture*, int>::iterator it = m_textures.find(pTexture);
+	if (it == m_textures.end())
+		return;
+
+	// A worker may still be reading from the file
+	Stream* pStream = m_streams[it->second];
+	if (pStream->iLoadingLevel >= 0) {
+		WaitForWorkers();
+		m_iResidentBytes -= (GLsizeiptr)pStream->image.GetLevelSize(pStream->iLoadingLevel);
+	}
+	m_iResidentBytes -= GetBytes(*pStream, pStream->iTopLevel);
+	m_streams.erase(it->second);
+	m_textures.erase(it);
+	delete pStream;
+}
+
+void CTextureStreamer::Request(CTexture* pTexture, float fTexels)
+{
+	map<CTexture*, int>::iterator it = m_textures.find(pTexture);
+	if (it == m_textures.end())
+		return;
+
+	// The finest level that still has at least fTexels across
+	Stream& stream = *m_streams[it->second];
+	float fSize = (float)max(stream.image.GetWidth(), stream.image.GetHeight());
+	int iLevel = fTexels >= fSize ? 0 : (int)floorf(log2f(fSize / max(fTexels, 1.0f)));
+	iLevel = min(iLevel, stream.iTailLevel);
+	if (stream.uiLastUsed != m_uiFrame || iLevel < stream.iWantedLevel)
+		stream.iWantedLevel = iLevel;
+	stream.uiLastUsed = m_uiFrame;
+}
+
+// Gives the stream new storage holding the levels from iTopLevel down.  Levels it already had are copied across on
+// the GPU; the rest are uploaded from the mapped file.
+void CTextureStreamer::SetTopLevel(Stream& stream, int iTopLevel)
+{
+	CCompressedImage& image = stream.image;
+	GLenum format = image.GetInternalFormat();
+	int iLevels = image.GetLevelCount();
+
+	UINT uiTexture;
+	glGenTextures(1, &uiTexture);
+	glBindTexture(GL_TEXTURE_2D, uiTexture);
+	glTexStorage2D(GL_TEXTURE_2D, iLevels - iTopLevel, format, image.GetLevelWidth(iTopLevel), image.GetLevelHeight(iTopLevel));
+	for (int i = iTopLevel; i < iLevels; i++) {
+		int iWidth = image.GetLevelWidth(i), iHeight = image.GetLevelHeight(i);
+		if (stream.uiTexture != 0 && i >= stream.iTopLevel)
+			glCopyImageSubData(stream.uiTexture, GL_TEXTURE_2D, i - stream.iTopLevel, 0, 0, 0,
+				uiTexture, GL_TEXTURE_2D, i - iTopLevel, 0, 0, 0, iWidth, iHeight, 1);
+		else
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, i - iTopLevel, 0, 0, iWidth, iHeight, format, (GLsizei)image.GetLevelSize(i),
+				image.GetData() + image.GetLevelOffset(i));
+	}
+
+	if (stream.uiTexture != 0)
+		glDeleteTextures(1, &stream.uiTexture);
+	stream.uiTexture = uiTexture;
+	stream.iTopLevel = iTopLevel;
+	stream.pTexture->SetStreamedStorage(this, uiTexture, image.GetWidth(), image.GetHeight(), image.GetBitsPerPixel(),
+		GetBytes(stream, iTopLevel));
+}
+
+GLsizeiptr CTextureStreamer::GetBytes(Stream& stream, int iTopLevel)
+{
+	GLsizeiptr iBytes = 0;
+	for (int i = iTopLevel; i < stream.image.GetLevelCount(); i++)
+		iBytes += (GLsizeiptr)stream.image.GetLevelSize(i);
+	return iBytes;
+}
+
+// Drops top levels from the least recently drawn streams that hold more than they were last asked for, until iBytes
+// are free.  When none are left, it falls back to the least recently drawn streams holding what they asked for, so
+// long as they were drawn before pKeep or hold more detail than pKeep will after its next level; the second keeps two
+// textures in view from taking a level from each other every frame.  Returns false if not enough could be freed;
+// what was dropped stays dropped.
+bool CTextureStreamer::Evict(GLsizeiptr iBytes, Stream* pKeep)
+{
+	while (iBytes > 0) {
+		Stream* pVictim = NULL;
+		Stream* pFallback = NULL;
+		for (map<int, Stream*>::iterator it = m_streams.begin(); it != m_streams.end(); ++it) {
+			Stream* pStream = it->second;
+			if (pStream == pKeep || pStream->iLoadingLevel >= 0 || pStream->iTopLevel >= pStream->iWantedLevel)
+				continue;
+			if (pVictim == NULL || pStream->uiLastUsed < pVictim->uiLastUsed)
+				pVictim = pStream;
+		}
+		for (map<int, Stream*>::iterator it = m_streams.begin(); pVictim == NULL && it != m_streams.end(); ++it) {
+			Stream* pStream = it->second;
+			if (pStream == pKeep || pStream->iLoadingLevel >= 0 || pStream->iTopLevel >= pStream->iTailLevel)
+				continue;
+			if (pKeep != NULL && pStream->uiLastUsed >= pKeep->uiLastUsed && pStream->iTopLevel >= pKeep->iTopLevel - 1)
+				continue;
+			if (pFallback == NULL || pStream->uiLastUsed < pFallback->uiLastUsed ||
+				(pStream->uiLastUsed == pFallback->uiLastUsed && pStream->iTopLevel < pFallback->iTopLevel))
+				pFallback = pStream;
+		}
+		if (pVictim == NULL)
+			pVictim = pFallback;
+		if (pVictim == NULL)
+			return false;
+
+		GLsizeiptr iFreed = (GLsizeiptr)pVictim->image.GetLevelSize(pVictim->iTopLevel);
+		SetTopLevel(*pVictim, pVictim->iTopLevel + 1);
+		m_iResidentBytes -= iFreed;
+		iBytes -= iFreed;
+	}
+	return true;
+}
+
+void CTextureStreamer::Update()
+{
+	unsigned int uiLastFrame = m_uiFrame++;
+
+	// Upload the levels the workers have read, within the frame budget but at least one a frame
+	vector<int> finished;
+	{
+		lock_guard<mutex> lock(m_resultMutex);
+		finished.swap(m_vFinished);
+	}
+	GLsizeiptr iUploaded = 0;
+	vector<int> deferred;
+	for (unsigned int i = 0; i < finished.size(); i++) {
+		map<int, Stream*>::iterator it = m_streams.find(finished[i]);
+		if (it == m_streams.end())
+			continue;
+		Stream& stream = *it->second;
+		GLsizeiptr iSize = (GLsizeiptr)stream.image.GetLevelSize(stream.iLoadingLevel);
+		if (iUploaded > 0 && iUploaded + iSize > m_iFrameBudget) {
+			deferred.push_back(finished[i]);
+			continue;
+		}
+		SetTopLevel(stream, stream.iLoadingLevel);
+		stream.iLoadingLevel = -1;
+		iUploaded += iSize;
+	}
+	if (!deferred.empty()) {
+		lock_guard<mutex> lock(m_resultMutex);
+		m_vFinished.insert(m_vFinished.end(), deferred.begin(), deferred.end());
+	}
+
+	// Streams not drawn last frame only need their tail
+	m_iRequestedBytes = 0;
+	vector<Stream*> wanting;
+	for (map<int, Stream*>::iterator it = m_streams.begin(); it != m_streams.end(); ++it) {
+		Stream& stream = *it->second;
+		if (stream.uiLastUsed != uiLastFrame)
+			stream.iWantedLevel = stream.iTailLevel;
+		m_iRequestedBytes += GetBytes(stream, stream.iWantedLevel);
+		if (stream.iWantedLevel < stream.iTopLevel && stream.iLoadingLevel < 0)
+			wanting.push_back(&stream);
+	}
+
+	// The streams furthest from what they asked for go first, one level each
+	std::sort(wanting.begin(), wanting.end(), [](const Stream* a, const Stream* b) {
+		return a->iTopLevel - a->iWantedLevel > b->iTopLevel - b->iWantedLevel;
+	});
+	for (unsigned int i = 0; i < wanting.size(); i++) {
+		Stream& stream = *wanting[i];
+		int iLevel = stream.iTopLevel - 1;
+		GLsizeiptr iSize = (GLsizeiptr)stream.image.GetLevelSize(iLevel);
+		if (m_iResidentBytes + iSize > m_iBudget && !Evict(m_iResidentBytes + iSize - m_iBudget, &stream))
+			continue;
+
+		// The level counts against the budget from now, so reads in flight cannot overcommit it
+		m_iResidentBytes += iSize;
+		stream.iLoadingLevel = iLevel;
+		int iStream = m_textures[stream.pTexture];
+		const BYTE* pLevel = stream.image.GetData() + stream.image.GetLevelOffset(iLevel);
+		auto read = [this, iStream, pLevel, iSize]() {
+			// Touch every page, so the OS reads the level in here rather than during the upload on the GL thread
+			volatile BYTE touched = 0;
+			for (GLsizeiptr i = 0; i < iSize; i += 4096)
+				touched ^= pLevel[i];
+
+			lock_guard<mutex> lock(m_resultMutex);
+			m_vFinished.push_back(iStream);
+			m_pendingJobs--;
+			m_workersDone.notify_all();
+		};
+
+		{
+			lock_guard<mutex> lock(m_resultMutex);
+			m_pendingJobs++;
+		}
+		if (m_pThreadPool != NULL)
+			m_pThreadPool->Submit(read);
+		else
+			read();
+	}
+}
+
+void CTextureStreamer::WaitForWorkers()
+{
+	unique_lock<mutex> lock(m_resultMutex);
+	m_workersDone.wait(lock, [this]() { return m_pendingJobs == 0; });
+}
+
+GLsizeiptr CTextureStreamer::GetResidentBytes()
+{
+	return m_iResidentBytes;
+}
+
+GLsizeiptr CTextureStreamer::GetRequestedBytes()
+{
+	return m_iRequestedBytes;
+}
+
+GLsizeiptr CTextureStreamer::GetBudget()
+{
+	return m_iBudget;
+}
+
+int CTextureStreamer::GetStreamCount()
+{
+	return (int)m_streams.size();
+}
+
+// The textures keep whatever levels they have, and stop streaming
+void CTextureStreamer::Release()
+{
+	WaitForWorkers();
+	m_vFinished.clear();
+	for (map<int, Stream*>::iterator it = m_streams.begin(); it != m_streams.end(); ++it) {
+		Stream* pStream = it->second;
+		pStream->pTexture->SetStreamedStorage(NULL, pStream->uiTexture, pStream->image.GetWidth(), pStream->image.GetHeight(),
+			pStream->image.GetBitsPerPixel(), GetBytes(*pStream, pStream->iTopLevel));
+		delete pStream;
+	}
+	m_streams.clear();
+	m_textures.clear();
+	m_iResidentBytes = 0;
+}
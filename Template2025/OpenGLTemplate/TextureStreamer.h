@@ -0,0 +1,86 @@
+#pragma once
+
+#include "Common.h"
+#include "CompressedImage.h"
+#include "MappedFile.h"
+
+#include <map>
+#include <mutex>
+#include <condition_variable>
+
+class CTexture;
+class CThreadPool;
+
+// Streams the mip levels of converted (.ktx2 or .dds) textures against a budget of texture memory.  A texture starts
+// with only its smallest levels, up to RESIDENT_SIZE across, which never leave.  As objects draw they ask for the
+// detail their size on screen needs, and Update brings in finer levels one at a time: a worker reads the level from
+// the mapped file, then it is uploaded on the GL thread under a per-frame byte budget.
+//
+// Immutable storage cannot give a level back, so a texture is given new storage with glTexStorage2D each time its top
+// level changes, and the levels it keeps are copied across on the GPU.  When the budget is full, the top levels of
+// the least recently drawn textures are dropped to make room, starting with textures that hold more detail than they
+// were last asked for.  Once those are down to what they asked for, textures drawn less recently, or holding more
+// detail than the one that needs the room, give up levels they are still using.
+class CTextureStreamer
+{
+public:
+	CTextureStreamer();
+	~CTextureStreamer();
+
+	// Without a thread pool, levels are read on the GL thread
+	void Create(CThreadPool* pThreadPool, GLsizeiptr iBudget = DEFAULT_BUDGET, GLsizeiptr iFrameBudget = DEFAULT_FRAME_BUDGET);
+
+	// Streams the converted file beside the image at path into pTexture, giving it storage for the smallest levels
+	// straight away.  Returns false, leaving the texture alone, if there is no converted file.
+	bool Add(CTexture* pTexture, const string& path);
+	void Remove(CTexture* pTexture);
+
+	// Asks for enough detail to draw pTexture across fTexels texels on screen.  The largest request in a frame wins;
+	// a texture that is not asked for in a frame only needs its smallest levels.
+	void Request(CTexture* pTexture, float fTexels);
+
+	void Update();								// Once a frame, on the GL thread
+
+	GLsizeiptr GetResidentBytes();
+	GLsizeiptr GetRequestedBytes();				// What the last frame's requests would take, if the budget allowed
+	GLsizeiptr GetBudget();
+	int GetStreamCount();
+
+	void Release();
+
+	static const GLsizeiptr DEFAULT_BUDGET = 64 * 1024 * 1024;
+	static const GLsizeiptr DEFAULT_FRAME_BUDGET = 2 * 1024 * 1024;
+	static const int RESIDENT_SIZE = 64;
+
+private:
+	struct Stream {
+		CTexture* pTexture;
+		CMappedFile file;
+		CCompressedImage image;					// A view into file
+		UINT uiTexture;							// Storage for the levels from iTopLevel down
+		int iTopLevel;							// Finest level resident
+		int iTailLevel;							// Levels from here down are always resident
+		int iWantedLevel;						// Finest level asked for in the last frame it was drawn
+		int iLoadingLevel;						// Being read by a worker, or -1
+		unsigned int uiLastUsed;				// Frame it was last asked for
+	};
+
+	GLsizeiptr GetBytes(Stream& stream, int iTopLevel);	// Of the levels from iTopLevel down
+	void SetTopLevel(Stream& stream, int iTopLevel);
+	bool Evict(GLsizeiptr iBytes, Stream* pKeep);
+	void WaitForWorkers();
+
+	CThreadPool* m_pThreadPool;
+	GLsizeiptr m_iBudget, m_iFrameBudget;
+	map<int, Stream*> m_streams;
+	map<CTexture*, int> m_textures;
+	int m_iNextStream;
+	unsigned int m_uiFrame;
+	GLsizeiptr m_iResidentBytes;				// Including levels being read
+	GLsizeiptr m_iRequestedBytes;
+
+	mutex m_resultMutex;
+	condition_variable m_workersDone;
+	vector<int> m_vFinished;					// Streams whose level has been read.  Protected by m_resultMutex
+	int m_pendingJobs;							// Protected by m_resultMutex
+};
@@ -0,0 +1,119 @@
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <memory>
+#include <algorithm>
+
+CThreadPool::CThreadPool()
+{
+	m_bQuit = false;
+}
+
+CThreadPool::~CThreadPool()
+{
+	Release();
+}
+
+void CThreadPool::Create(int iThreads)
+{
+	Release();
+
+	if (iThreads <= 0)
+		iThreads = std::max((int)std::thread::hardware_concurrency() - 1, 1);
+
+	m_bQuit = false;
+	for (int i = 0; i < iThreads; i++)
+		m_vThreads.push_back(std::thread(&CThreadPool::WorkerMain, this));
+}
+
+void CThreadPool::Release()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_bQuit = true;
+	}
+	m_jobAvailable.notify_all();
+
+	for (unsigned int i = 0; i < m_vThreads.size(); i++)
+		m_vThreads[i].join();
+	m_vThreads.clear();
+}
+
+int CThreadPool::GetThreadCount()
+{
+	return (int)m_vThreads.size();
+}
+
+void CThreadPool::Submit(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_jobs.push_back(job);
+	}
+	m_jobAvailable.notify_one();
+}
+
+// Workers keep running jobs until asked to quit and the queue is empty
+void CThreadPool::WorkerMain()
+{
+	for (;;) {
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_jobAvailable.wait(lock, [this]() { return m_bQuit || !m_jobs.empty(); });
+			if (m_jobs.empty())
+				return;
+			job = m_jobs.front();
+			m_jobs.pop_front();
+		}
+		job();
+	}
+}
+
+void CThreadPool::ParallelFor(int iCount, const std::function<void(int)>& task)
+{
+	if (iCount <= 0)
+		return;
+
+	// The state is shared with the helpers, and outlives this call for any helper that only starts once the work has
+	// all been done.  Such a helper finds no index left and returns without touching task.
+	struct Loop {
+		std::atomic<int> next;
+		int iCount;
+		const std::function<void(int)>* pTask;
+		int iFinished;							// Protected by mutex
+		std::mutex mutex;
+		std::condition_variable done;
+	};
+	std::shared_ptr<Loop> loop = std::make_shared<Loop>();
+	loop->next = 0;
+	loop->iCount = iCount;
+	loop->pTask = &task;
+	loop->iFinished = 0;
+
+	// Each helper, and the calling thread, takes the next index until none are left.  The caller only waits for
+	// indices that have been taken and are still running, never for helpers still in the queue, so it is not held up
+	// by other jobs and cannot deadlock when called from a worker.
+	auto run = [](Loop& loop) {
+		int iDone = 0;
+		for (int i = loop.next++; i < loop.iCount; i = loop.next++) {
+			(*loop.pTask)(i);
+			iDone++;
+		}
+		if (iDone > 0) {
+			std::lock_guard<std::mutex> lock(loop.mutex);
+			loop.iFinished += iDone;
+			if (loop.iFinished == loop.iCount)
+				loop.done.notify_all();
+		}
+	};
+
+	int iHelpers = std::min((int)m_vThreads.size(), iCount - 1);
+	for (int h = 0; h < iHelpers; h++)
+		Submit([loop, run]() { run(*loop); });
+
+	run(*loop);
+
+	std::unique_lock<std::mutex> lock(loop->mutex);
+	loop->done.wait(lock, [&]() { return loop->iFinished == iCount; });
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+// A fixed set of worker threads that run queued jobs.  Only depends on the standard library, so the classes that use
+// it stay free of Windows and OpenGL calls.
+class CThreadPool
+{
+public:
+	CThreadPool();
+	~CThreadPool();
+
+	// Starts iThreads workers.  With 0, one worker is started per hardware thread, less one for the calling thread.
+	void Create(int iThreads = 0);
+	void Release();								// Finishes queued jobs and stops the workers
+
+	int GetThreadCount();
+
+	// Queues a job to run on a worker
+	void Submit(std::function<void()> job);
+
+	// Calls task(i) for every i in [0, iCount), sharing the work between the workers and the calling thread, and
+	// returns when every call has finished.  Runs everything on the calling thread if there are no workers, or if they
+	// are all busy, so it may be called from a job.
+	void ParallelFor(int iCount, const std::function<void(int)>& task);
+
+private:
+	void WorkerMain();
+
+	std::vector<std::thread> m_vThreads;
+	std::deque<std::function<void()>> m_jobs;	// Protected by m_mutex
+	std::mutex m_mutex;
+	std::condition_variable m_jobAvailable;
+	bool m_bQuit;
+};
@@ -1,44 +1,197 @@
-#version 400 core
+#version 430 core
 
-in vec3 vColour;			// Interpolated colour using colour calculated in the vertex shader
+// Compile-time keys (inserted by CShaderPermutations after the #version line):
+//   SKYBOX   - sample the cube map with the interpolated world position
+//   TEXTURED - modulate the lit colour with sampler0
+//   FOG      - blend towards fogColor with exponential-squared fog
+//   INSTANCED - take the model matrix and a colour tint from the instance buffer
+//   DRAW_DATA - take the model matrix and material from CRenderQueue's draw data, indexed by gl_DrawIDARB
+//   GPU_CULLED - with DRAW_DATA, index the draw data through CGpuCuller's visible instance list instead
+
+in vec3 vEyePosition;		// Interpolated eye space position
+in vec3 vEyeNormal;			// Interpolated eye space normal
 in vec2 vTexCoord;			// Interpolated texture coordinate using texture coordinate from the vertex shader
 in float fogDepth;          // Recieve fog depth from vertex shader
+in vec3 worldPosition;
+
+#ifdef INSTANCED
+flat in vec4 vInstanceColour;	// rgb tints the material, a scales its emission
+#endif
+
+#ifdef DRAW_DATA
+flat in int vDrawIndex;
+#endif
 
 out vec4 vOutputColour;		// The output colour
 
-uniform sampler2D sampler0;  // The texture sampler
+#ifdef SKYBOX
 uniform samplerCube CubeMapTex;
-uniform bool bUseTexture;    // A flag indicating if texture-mapping should be applied
-uniform bool renderSkybox;
-in vec3 worldPosition;
+#else
+
+// Structure holding light information:  its position as well as ambient, diffuse, and specular colours
+struct LightInfo
+{
+	vec4 position;
+	vec3 La;
+	vec3 Ld;
+	vec3 Ls;
+};
+
+// Structure holding material information:  its ambient, diffuse, specular and emissive colours, and shininess
+struct MaterialInfo
+{
+	vec3 Ma;
+	vec3 Md;
+	vec3 Ms;
+	vec3 Me;
+	float shininess;
+};
+
+// Lights and materials passed in as uniform variables from client programme
+uniform LightInfo light1; 
+uniform MaterialInfo material1; 
+
+// Point lights, assigned to clusters by CClusteredLighting.  The bindings match its *_BUFFER_BINDING constants.
+struct PointLight
+{
+	vec4 positionRadius;	// Eye space position and radius of influence
+	vec4 colourIntensity;
+};
+
+layout (std430, binding = 0) readonly buffer PointLights { PointLight pointLights[]; };
+layout (std430, binding = 1) readonly buffer LightClusters { uvec2 lightClusters[]; };	// (offset, count) into lightIndices
+layout (std430, binding = 2) readonly buffer LightIndices { uint lightIndices[]; };
+
+// Cluster grid:  screen tiles of tileSize pixels, and depth slices spaced exponentially
+uniform struct ClusterInfo
+{
+	vec2 tileSize;
+	int countX;
+	int countY;
+	int countZ;
+	float depthScale;		// slice = log(depth) * depthScale + depthBias
+	float depthBias;
+} clusterInfo;
+
+#ifdef DRAW_DATA
+// Per-draw data written by CRenderQueue, bound at its DRAW_DATA_BUFFER_BINDING
+struct DrawData
+{
+	mat4 modelMatrix;
+	vec4 ambientShininess;	// Ma, shininess
+	vec4 diffuse;			// Md
+	vec4 specular;			// Ms
+	vec4 emissive;			// Me
+};
+
+layout (std430, binding = 3) readonly buffer DrawDataBuffer { DrawData drawData[]; };
+#endif
 
-// Fog uniforms
-uniform bool fogEnabled = false;
+#endif
+
+#ifdef TEXTURED
+uniform sampler2D sampler0;  // The texture sampler
+#endif
+
+#ifdef FOG
 uniform vec3 fogColor = vec3(0.5, 0.5, 0.5);
 uniform float fogDensity = 0.002;
+#endif
 
-void main()
+#ifndef SKYBOX
+
+// This function implements the Phong shading model
+// The code is based on the OpenGL 4.0 Shading Language Cookbook, Chapter 2, pp. 62 - 63, with a few tweaks. 
+// Please see Chapter 2 of the book for a detailed discussion.
+vec3 PhongModel(MaterialInfo material, vec3 eyePosition, vec3 eyeNorm)
 {
+	vec3 s = normalize(vec3(light1.position) - eyePosition);
+	vec3 v = normalize(-eyePosition);
+	vec3 r = reflect(-s, eyeNorm);
+	vec3 n = eyeNorm;
+	vec3 ambient = light1.La * material.Ma;
+	float sDotN = max(dot(s, n), 0.0f);
+	vec3 diffuse = light1.Ld * material.Md * sDotN;
+	vec3 specular = vec3(0.0f);
+	float eps = 0.000001f; // add eps to shininess below -- pow not defined if second argument is 0 (as described in GLSL documentation)
+	if (sDotN > 0.0f) 
+		specular = light1.Ls * material.Ms * pow(max(dot(r, v), 0.0f), material.shininess + eps);
+	
 
+	return ambient + diffuse + specular;
 
-	if (renderSkybox) {
-		vOutputColour = texture(CubeMapTex, worldPosition);
+}
 
-	} else {
+// Diffuse and specular light from the point lights in this fragment's cluster.  The falloff reaches zero at the
+// light's radius, so lights outside the cluster could not contribute anyway.
+vec3 ClusteredPointLights(MaterialInfo material, vec3 eyePosition, vec3 n)
+{
+	ivec2 tile = ivec2(gl_FragCoord.xy / clusterInfo.tileSize);
+	int slice = int(log(-eyePosition.z) * clusterInfo.depthScale + clusterInfo.depthBias);
+	tile = clamp(tile, ivec2(0), ivec2(clusterInfo.countX - 1, clusterInfo.countY - 1));
+	slice = clamp(slice, 0, clusterInfo.countZ - 1);
+	uvec2 cluster = lightClusters[tile.x + clusterInfo.countX * (tile.y + clusterInfo.countY * slice)];
 
-		// Get the texel colour from the texture sampler
-		vec4 vTexColour = texture(sampler0, vTexCoord);	
+	vec3 v = normalize(-eyePosition);
+	vec3 colour = vec3(0.0f);
+	for (uint i = 0; i < cluster.y; i++) {
+		PointLight light = pointLights[lightIndices[cluster.x + i]];
+		vec3 toLight = light.positionRadius.xyz - eyePosition;
+		float distanceSquared = dot(toLight, toLight);
+		float radius = light.positionRadius.w;
+		if (distanceSquared >= radius * radius)
+			continue;
 
-		if (bUseTexture)
-			vOutputColour = vTexColour*vec4(vColour, 1.0f);	// Combine object colour and texture 
-		else
-			vOutputColour = vec4(vColour, 1.0f);	// Just use the colour instead
-	}
+		// Inverse square falloff, windowed so that it is zero at the radius
+		float ratio = distanceSquared / (radius * radius);
+		float window = (1.0f - ratio * ratio);
+		float attenuation = window * window / (distanceSquared + 1.0f);
 
-	if (fogEnabled) {
-			float fogFactor = exp(-fogDensity * fogDensity * fogDepth * fogDepth);
-            fogFactor = clamp(fogFactor, 0.0, 1.0);
-            vOutputColour = mix(vec4(fogColor, 1.0), vOutputColour, fogFactor);
+		vec3 s = toLight * inversesqrt(distanceSquared);
+		float sDotN = max(dot(s, n), 0.0f);
+		vec3 radiance = light.colourIntensity.rgb * light.colourIntensity.a * attenuation;
+		vec3 specular = vec3(0.0f);
+		if (sDotN > 0.0f)
+			specular = material.Ms * pow(max(dot(reflect(-s, n), v), 0.0f), material.shininess + 0.000001f);
+		colour += radiance * (material.Md * sDotN + specular);
 	}
-	
+	return colour;
+}
+
+#endif
+
+void main()
+{
+#if defined(SKYBOX)
+	vOutputColour = texture(CubeMapTex, worldPosition);
+#else
+	MaterialInfo material = material1;
+#ifdef INSTANCED
+	material.Ma *= vInstanceColour.rgb;
+	material.Md *= vInstanceColour.rgb;
+	material.Me *= vInstanceColour.rgb * vInstanceColour.a;
+#elif defined(DRAW_DATA)
+	material.Ma = drawData[vDrawIndex].ambientShininess.xyz;
+	material.Md = drawData[vDrawIndex].diffuse.xyz;
+	material.Ms = drawData[vDrawIndex].specular.xyz;
+	material.Me = drawData[vDrawIndex].emissive.xyz;
+	material.shininess = drawData[vDrawIndex].ambientShininess.w;
+#endif
+
+	vec3 n = normalize(vEyeNormal);
+	vec3 vColour = PhongModel(material, vEyePosition, n) + ClusteredPointLights(material, vEyePosition, n) + material.Me;
+
+#if defined(TEXTURED)
+	// Combine object colour and texture 
+	vOutputColour = texture(sampler0, vTexCoord)*vec4(vColour, 1.0f);
+#else
+	vOutputColour = vec4(vColour, 1.0f);	// Just use the colour
+#endif
+#endif
+
+#ifdef FOG
+	float fogFactor = exp(-fogDensity * fogDensity * fogDepth * fogDepth);
+	fogFactor = clamp(fogFactor, 0.0, 1.0);
+	vOutputColour = mix(vec4(fogColor, 1.0), vOutputColour, fogFactor);
+#endif
 }
@@ -1,4 +1,8 @@
-#version 400 core
+#version 430 core
+
+#ifdef DRAW_DATA
+#extension GL_ARB_shader_draw_parameters : require
+#endif
 
 // Structure for matrices
 uniform struct Matrices
@@ -6,86 +10,101 @@ uniform struct Matrices
 	mat4 projMatrix;
 	mat4 modelViewMatrix; 
 	mat3 normalMatrix;
+	mat4 viewMatrix;		// Used by the INSTANCED variant, where the model matrix comes from the instance buffer
 } matrices;
 
-// Structure holding light information:  its position as well as ambient, diffuse, and specular colours
-struct LightInfo
-{
-	vec4 position;
-	vec3 La;
-	vec3 Ld;
-	vec3 Ls;
-};
-
-// Structure holding material information:  its ambient, diffuse, and specular colours, and shininess
-struct MaterialInfo
-{
-	vec3 Ma;
-	vec3 Md;
-	vec3 Ms;
-	float shininess;
-};
-
-// Lights and materials passed in as uniform variables from client programme
-uniform LightInfo light1; 
-uniform MaterialInfo material1; 
-
 // Layout of vertex attributes in VBO
 layout (location = 0) in vec3 inPosition;
 layout (location = 1) in vec2 inCoord;
 layout (location = 2) in vec3 inNormal;
 
-// Vertex colour output to fragment shader -- using Gouraud (interpolated) shading
-out vec3 vColour;	// Colour computed using reflectance model
-out vec2 vTexCoord;	// Texture coordinate
+#ifdef COMPACT_VERTEX
+// inPosition arrives as 0 - 1 across the mesh's bounds (see CompactVertex)
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+#endif
 
-out vec3 worldPosition;	// used for skybox
+#ifdef INSTANCED
+// Per-instance attributes from CInstanceBuffer
+layout (location = 3) in mat4 inModelMatrix;	// Locations 3 - 6
+layout (location = 7) in vec4 inInstanceColour;
 
-out float fogDepth; // used for Fog
+flat out vec4 vInstanceColour;
+#endif
 
-// This function implements the Phong shading model
-// The code is based on the OpenGL 4.0 Shading Language Cookbook, Chapter 2, pp. 62 - 63, with a few tweaks. 
-// Please see Chapter 2 of the book for a detailed discussion.
-vec3 PhongModel(vec4 eyePosition, vec3 eyeNorm)
+#ifdef DRAW_DATA
+// Per-draw data written by CRenderQueue, bound at its DRAW_DATA_BUFFER_BINDING
+struct DrawData
 {
-	vec3 s = normalize(vec3(light1.position - eyePosition));
-	vec3 v = normalize(-eyePosition.xyz);
-	vec3 r = reflect(-s, eyeNorm);
-	vec3 n = eyeNorm;
-	vec3 ambient = light1.La * material1.Ma;
-	float sDotN = max(dot(s, n), 0.0f);
-	vec3 diffuse = light1.Ld * material1.Md * sDotN;
-	vec3 specular = vec3(0.0f);
-	float eps = 0.000001f; // add eps to shininess below -- pow not defined if second argument is 0 (as described in GLSL documentation)
-	if (sDotN > 0.0f) 
-		specular = light1.Ls * material1.Ms * pow(max(dot(r, v), 0.0f), material1.shininess + eps);
-	
+	mat4 modelMatrix;
+	vec4 ambientShininess;	// Ma, shininess
+	vec4 diffuse;			// Md
+	vec4 specular;			// Ms
+	vec4 emissive;			// Me
+};
+
+layout (std430, binding = 3) readonly buffer DrawDataBuffer { DrawData drawData[]; };
+
+uniform int drawDataOffset;		// Index of the first draw of the current multi-draw
+
+#ifdef GPU_CULLED
+// Visible instances written by CGpuCuller's cull pass.  Each command's instances start at its baseInstance.
+layout (std430, binding = 4) readonly buffer InstanceIndexBuffer { uint instanceIndices[]; };
+#endif
+
+flat out int vDrawIndex;
+#endif
+
+// Eye space position and normal, interpolated so that lighting is computed per fragment
+out vec3 vEyePosition;
+out vec3 vEyeNormal;
+out vec2 vTexCoord;	// Texture coordinate
 
-	return ambient + diffuse + specular;
+out vec3 worldPosition;	// used for skybox
 
-}
+out float fogDepth; // used for Fog
 
 // This is the entry point into the vertex shader
 void main()
 {	
 
+#ifdef COMPACT_VERTEX
+	vec3 position = positionOffset + inPosition * positionScale;
+#else
+	vec3 position = inPosition;
+#endif
+
 // Save the world position for rendering the skybox
-	worldPosition = inPosition;
+	worldPosition = position;
+
+#ifdef INSTANCED
+	mat4 modelViewMatrix = matrices.viewMatrix * inModelMatrix;
+	mat3 normalMatrix = transpose(inverse(mat3(modelViewMatrix)));
+	vInstanceColour = inInstanceColour;
+#elif defined(DRAW_DATA)
+#ifdef GPU_CULLED
+	vDrawIndex = int(instanceIndices[gl_BaseInstanceARB + gl_InstanceID]);
+#else
+	vDrawIndex = drawDataOffset + gl_DrawIDARB;
+#endif
+	mat4 modelViewMatrix = matrices.viewMatrix * drawData[vDrawIndex].modelMatrix;
+	mat3 normalMatrix = transpose(inverse(mat3(modelViewMatrix)));
+#else
+	mat4 modelViewMatrix = matrices.modelViewMatrix;
+	mat3 normalMatrix = matrices.normalMatrix;
+#endif
 
 	// Transform the vertex spatial position using 
-	gl_Position = matrices.projMatrix * matrices.modelViewMatrix * vec4(inPosition, 1.0f);
+	gl_Position = matrices.projMatrix * modelViewMatrix * vec4(position, 1.0f);
 	
 	// Get the vertex normal and vertex position in eye coordinates
-	vec3 vEyeNorm = normalize(matrices.normalMatrix * inNormal);
-	vec4 vEyePosition = matrices.modelViewMatrix * vec4(inPosition, 1.0f);
-		
-	// Apply the Phong model to compute the vertex colour
-	vColour = PhongModel(vEyePosition, vEyeNorm);
+	vEyePosition = vec3(modelViewMatrix * vec4(position, 1.0f));
+	vEyeNormal = normalMatrix * inNormal;
 	
 	// Pass through the texture coordinate
 	vTexCoord = inCoord;
 
 	// Calculate fog depth
-	fogDepth = length(vEyePosition.xyz);
+	fogDepth = length(vEyePosition);
 } 
-	
\ No newline at end of file
+	
@@ -1,13 +1,41 @@
 #version 400 core
 
-in vec2 vTexCoord;
+in vec3 vTexCoord;
+in vec4 vColour;
 out vec4 vOutputColour;
 
-uniform sampler2D sampler0;
-uniform vec4 vColour;
+uniform sampler2DArray sampler0;		// Glyph atlas pages
+
+// Distance field fonts store the distance to the outline, with 0.5 on it and larger values inside
+uniform bool bDistanceField;
+uniform float fOutlineWidth;		// In distance field units
+uniform vec4 vOutlineColour;
+uniform vec2 vShadowOffset;			// In atlas texture coordinates
+uniform vec4 vShadowColour;
 
 void main()
 {
-	vec4 vTexColour = texture(sampler0, vTexCoord);	// Get the texel colour from the image
-	vOutputColour = vec4(vTexColour.r) * vColour;			// The texel colour is a grayscale value -- apply to RGBA and combine with vColor
-}
\ No newline at end of file
+	if (!bDistanceField) {
+		vec4 vTexColour = texture(sampler0, vTexCoord);	// Get the coverage from the glyph atlas
+		vOutputColour = vec4(vTexColour.r) * vColour;			// The texel colour is a grayscale value -- apply to RGBA and combine with the text colour
+		return;
+	}
+
+	// Antialias over about a pixel on screen, whatever size the text is drawn at
+	float fDistance = texture(sampler0, vTexCoord).r;
+	float fSmoothing = 0.7 * fwidth(fDistance);
+	float fEdge = 0.5 - fOutlineWidth * step(0.001, vOutlineColour.a);
+	float fFill = smoothstep(0.5 - fSmoothing, 0.5 + fSmoothing, fDistance);
+	float fShape = smoothstep(fEdge - fSmoothing, fEdge + fSmoothing, fDistance);
+
+	// The fill over its outline
+	vec4 vGlyph = mix(vOutlineColour, vColour, fFill);
+	vGlyph.a *= fShape;
+
+	// The glyph over its shadow, a copy of the outlined shape sampled from further up and left
+	float fShadowDistance = texture(sampler0, vTexCoord - vec3(vShadowOffset, 0.0)).r;
+	float fShadow = vShadowColour.a * smoothstep(fEdge - fSmoothing, fEdge + fSmoothing, fShadowDistance);
+	float fAlpha = vGlyph.a + fShadow * (1.0 - vGlyph.a);
+	vec3 vRGB = (vGlyph.rgb * vGlyph.a + vShadowColour.rgb * fShadow * (1.0 - vGlyph.a)) / max(fAlpha, 0.0001);
+	vOutputColour = vec4(vRGB, fAlpha);
+}
@@ -4,20 +4,22 @@
 uniform struct Matrices
 {
 	mat4 projMatrix;
-	mat4 modelViewMatrix;
 } matrices;
 
-// Layout of vertex attributes in VBO
+// Layout of vertex attributes in VBO.  Glyph quads are already in screen space, with their atlas coordinates and colour.
 layout (location = 0) in vec2 inPosition;
-layout (location = 1) in vec2 inCoord;
+layout (location = 1) in vec3 inCoord;			// z is the atlas page
+layout (location = 2) in vec4 inColour;
 
-out vec2 vTexCoord;
+out vec3 vTexCoord;
+out vec4 vColour;
 
 void main()
 {
 	// Transform the point
-	gl_Position = matrices.projMatrix * matrices.modelViewMatrix * vec4(inPosition, 0.0, 1.0);
+	gl_Position = matrices.projMatrix * vec4(inPosition, 0.0, 1.0);
 
-	// Pass through the texture coord
+	// Pass through the texture coord and colour
 	vTexCoord = inCoord;
+	vColour = inColour;
 }
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include "Tests.h"
+#include "MeshOptimiser.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+// A grid of GRID x GRID quads, two triangles each, with its triangles in a shuffled order so the vertex cache starts
+// out doing badly
+static const unsigned int GRID = 32;
+
+static void CreateShuffledGrid(std::vector<glm::vec3>& vPositions, std::vector<unsigned int>& vIndices)
+{
+	vPositions.clear();
+	for (unsigned int y = 0; y <= GRID; y++)
+		for (unsigned int x = 0; x <= GRID; x++)
+			vPositions.push_back(glm::vec3((float)x, (float)y, 0.0f));
+
+	std::vector<unsigned int> vTriangles;
+	for (unsigned int y = 0; y < GRID; y++) {
+		for (unsigned int x = 0; x < GRID; x++) {
+			unsigned int v = y * (GRID + 1) + x;
+			unsigned int quad[6] = { v, v + 1, v + GRID + 2, v, v + GRID + 2, v + GRID + 1 };
+			vTriangles.insert(vTriangles.end(), quad, quad + 6);
+		}
+	}
+
+	std::vector<unsigned int> vOrder(vTriangles.size() / 3);
+	for (unsigned int t = 0; t < vOrder.size(); t++)
+		vOrder[t] = t;
+	srand(1);
+	for (unsigned int t = (unsigned int)vOrder.size() - 1; t > 0; t--)
+		std::swap(vOrder[t], vOrder[rand() % (t + 1)]);
+
+	vIndices.clear();
+	for (unsigned int t = 0; t < vOrder.size(); t++)
+		vIndices.insert(vIndices.end(), vTriangles.begin() + vOrder[t] * 3, vTriangles.begin() + vOrder[t] * 3 + 3);
+}
+
+// Each triangle as its corner positions, rotated so the smallest comes first (which keeps the winding), then sorted,
+// so two index buffers drawing the same triangles compare equal whatever the order and numbering
+static std::vector<std::vector<float>> GetTriangleSet(const std::vector<glm::vec3>& vPositions, const std::vector<unsigned int>& vIndices)
+{
+	std::vector<std::vector<float>> triangles;
+	for (unsigned int t = 0; t + 2 < vIndices.size(); t += 3) {
+		std::vector<float> corners;
+		for (int k = 0; k < 3; k++) {
+			const glm::vec3& p = vPositions[vIndices[t + k]];
+			corners.push_back(p.x);
+			corners.push_back(p.y);
+			corners.push_back(p.z);
+		}
+		std::vector<float> best = corners;
+		for (int k = 1; k < 3; k++) {
+			std::rotate(corners.begin(), corners.begin() + 3, corners.end());
+			best = std::min(best, corners);
+		}
+		triangles.push_back(best);
+	}
+	std::sort(triangles.begin(), triangles.end());
+	return triangles;
+}
+
+TEST(VertexCacheOrderKeepsTrianglesAndLowersMisses)
+{
+	std::vector<glm::vec3> vPositions;
+	std::vector<unsigned int> vIndices;
+	CreateShuffledGrid(vPositions, vIndices);
+	unsigned int iIndexCount = (unsigned int)vIndices.size(), iVertexCount = (unsigned int)vPositions.size();
+
+	std::vector<unsigned int> vOptimised = vIndices;
+	CMeshOptimiser::OptimiseVertexCache(&vOptimised[0], iIndexCount, iVertexCount);
+
+	CHECK(GetTriangleSet(vPositions, vOptimised) == GetTriangleSet(vPositions, vIndices));
+	float fBefore = CMeshOptimiser::CountCacheMisses(&vIndices[0], iIndexCount, iVertexCount) / (float)(iIndexCount / 3);
+	float fAfter = CMeshOptimiser::CountCacheMisses(&vOptimised[0], iIndexCount, iVertexCount) / (float)(iIndexCount / 3);
+	CHECK(fAfter < fBefore);
+	CHECK(fAfter < 1.0f);
+}
+
+// The whole import pipeline: overdraw clustering and vertex renumbering must not lose the cache order's gains
+TEST(FullOptimisationKeepsTrianglesAndLowersMisses)
+{
+	std::vector<glm::vec3> vPositions;
+	std::vector<unsigned int> vIndices;
+	CreateShuffledGrid(vPositions, vIndices);
+	unsigned int iIndexCount = (unsigned int)vIndices.size(), iVertexCount = (unsigned int)vPositions.size();
+
+	std::vector<glm::vec3> vOptimisedPositions = vPositions;
+	std::vector<unsigned int> vOptimised = vIndices;
+	CMeshOptimiser::OptimiseVertexCache(&vOptimised[0], iIndexCount, iVertexCount);
+	CMeshOptimiser::OptimiseOverdraw(&vOptimised[0], iIndexCount, (const unsigned char*)&vOptimisedPositions[0],
+		sizeof(glm::vec3), iVertexCount);
+	CMeshOptimiser::OptimiseVertexFetch((unsigned char*)&vOptimisedPositions[0], sizeof(glm::vec3), &vOptimised[0],
+		iIndexCount, iVertexCount);
+
+	CHECK(GetTriangleSet(vOptimisedPositions, vOptimised) == GetTriangleSet(vPositions, vIndices));
+	CHECK(CMeshOptimiser::CountCacheMisses(&vOptimised[0], iIndexCount, iVertexCount) <
+		CMeshOptimiser::CountCacheMisses(&vIndices[0], iIndexCount, iVertexCount));
+
+	// Vertex fetch order: each vertex is first used after the one before it
+	unsigned int iNext = 0;
+	for (unsigned int i = 0; i < iIndexCount; i++) {
+		CHECK(vOptimised[i] <= iNext);
+		if (vOptimised[i] == iNext)
+			iNext++;
+	}
+}
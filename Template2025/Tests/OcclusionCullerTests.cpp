@@ -0,0 +1,149 @@
+#include "Tests.h"
+#include "OcclusionCuller.h"
+#include "ThreadPool.h"
+#include "include/glm/gtc/matrix_transform.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+// Looking down -z from the origin, with the aspect ratio of the culler's depth buffer
+static glm::mat4 GetViewProjection()
+{
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)COcclusionCuller::WIDTH / COcclusionCuller::HEIGHT, 0.5f, 5000.0f);
+	return projection * glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+}
+
+static int CountUncovered(COcclusionCuller& culler)
+{
+	const float* pDepth = culler.GetDepthBuffer();
+	int iUncovered = 0;
+	for (int i = 0; i < COcclusionCuller::WIDTH * COcclusionCuller::HEIGHT; i++)
+		if (pDepth[i] >= 1.0f)
+			iUncovered++;
+	return iUncovered;
+}
+
+// A 20x20 wall filling the screen.  Its faces are split along their diagonals, which a rasteriser without a fill rule
+// can leave uncovered.
+TEST(WallHidesBoxBehindIt)
+{
+	COcclusionCuller culler;
+	culler.Create(NULL);
+	culler.AddOccluderBox(BoundingBox(glm::vec3(-10.0f, -10.0f, -11.0f), glm::vec3(10.0f, 10.0f, -9.0f)), glm::mat4(1.0f));
+	culler.Render(GetViewProjection());
+
+	CHECK(CountUncovered(culler) == 0);
+	CHECK(!culler.TestBox(BoundingBox(glm::vec3(-1.0f, -1.0f, -31.0f), glm::vec3(1.0f, 1.0f, -29.0f))));
+	CHECK(culler.TestBox(BoundingBox(glm::vec3(-1.0f, -1.0f, -6.0f), glm::vec3(1.0f, 1.0f, -4.0f))));
+}
+
+// A wall of many small triangles, with the inner vertices moved about so the shared edges run at every angle
+TEST(MeshWithSharedEdgesHasNoCracks)
+{
+	const int GRID = 24;
+	std::vector<glm::vec3> vPositions;
+	srand(1);
+	for (int y = 0; y <= GRID; y++) {
+		for (int x = 0; x <= GRID; x++) {
+			glm::vec2 jitter(0.0f);
+			if (x > 0 && x < GRID && y > 0 && y < GRID)
+				jitter = glm::vec2(rand() / (float)RAND_MAX - 0.5f, rand() / (float)RAND_MAX - 0.5f) * 0.6f;
+			glm::vec2 p = (glm::vec2((float)x, (float)y) + jitter) / (float)GRID * 40.0f - 20.0f;
+			vPositions.push_back(glm::vec3(p, -10.0f));
+		}
+	}
+	std::vector<unsigned int> vIndices;
+	for (int y = 0; y < GRID; y++) {
+		for (int x = 0; x < GRID; x++) {
+			unsigned int i = y * (GRID + 1) + x;
+			unsigned int quad[6] = { i, i + 1, i + GRID + 2, i, i + GRID + 2, i + GRID + 1 };
+			vIndices.insert(vIndices.end(), quad, quad + 6);
+		}
+	}
+
+	COcclusionCuller culler;
+	culler.Create(NULL);
+	culler.AddOccluder(vPositions, vIndices, glm::mat4(1.0f));
+	culler.Render(GetViewProjection());
+	CHECK(CountUncovered(culler) == 0);
+}
+
+// Squares split along alternate diagonals, with every corner on a pixel centre, so many pixel centres lie exactly on
+// the shared edges.  Drawn one triangle at a time, each pixel inside must be covered by exactly one of them.
+TEST(SharedEdgesCoverPixelsOnce)
+{
+	const int CELL = 20, CELLS_X = 6, CELLS_Y = 4;
+	const glm::vec2 origin(20.5f, 20.5f);
+	glm::mat4 pixels = glm::ortho(0.0f, (float)COcclusionCuller::WIDTH, 0.0f, (float)COcclusionCuller::HEIGHT, -1.0f, 1.0f);
+
+	std::vector<int> coverage(COcclusionCuller::WIDTH * COcclusionCuller::HEIGHT, 0);
+	for (int cy = 0; cy < CELLS_Y; cy++) {
+		for (int cx = 0; cx < CELLS_X; cx++) {
+			glm::vec2 p = origin + glm::vec2((float)cx, (float)cy) * (float)CELL;
+			glm::vec3 corners[4] = { glm::vec3(p, 0.0f), glm::vec3(p.x + CELL, p.y, 0.0f),
+				glm::vec3(p.x + CELL, p.y + CELL, 0.0f), glm::vec3(p.x, p.y + CELL, 0.0f) };
+			unsigned int triangles[2][3] = { { 0, 1, 2 }, { 0, 2, 3 } };
+			if ((cx + cy) % 2 == 1) {
+				unsigned int other[2][3] = { { 0, 1, 3 }, { 1, 2, 3 } };
+				memcpy(triangles, other, sizeof(triangles));
+			}
+			for (int t = 0; t < 2; t++) {
+				COcclusionCuller culler;
+				culler.Create(NULL);
+				culler.AddOccluder(std::vector<glm::vec3>(corners, corners + 4), std::vector<unsigned int>(triangles[t], triangles[t] + 3), glm::mat4(1.0f));
+				culler.Render(pixels);
+				const float* pDepth = culler.GetDepthBuffer();
+				for (unsigned int i = 0; i < coverage.size(); i++)
+					if (pDepth[i] < 1.0f)
+						coverage[i]++;
+			}
+		}
+	}
+
+	// Centres on the outer border may go either way
+	bool bOnce = true;
+	for (int y = 0; y < COcclusionCuller::HEIGHT; y++) {
+		for (int x = 0; x < COcclusionCuller::WIDTH; x++) {
+			int iCount = coverage[y * COcclusionCuller::WIDTH + x];
+			bool bInside = x + 0.5f > origin.x && x + 0.5f < origin.x + CELLS_X * CELL && y + 0.5f > origin.y && y + 0.5f < origin.y + CELLS_Y * CELL;
+			if (iCount > 1 || (bInside && iCount != 1))
+				bOnce = false;
+		}
+	}
+	CHECK(bOnce);
+}
+
+// Triangles crossing the near plane and reaching far beyond the screen are clipped, not dropped
+TEST(ClippedFloorStillOccludes)
+{
+	COcclusionCuller culler;
+	culler.Create(NULL);
+	culler.AddOccluderBox(BoundingBox(glm::vec3(-1000.0f, -3.0f, -1000.0f), glm::vec3(1000.0f, -2.0f, 1000.0f)), glm::mat4(1.0f));
+	culler.Render(GetViewProjection());
+	CHECK(culler.GetRasterisedTriangleCount() > 0);
+	CHECK(!culler.TestBox(BoundingBox(glm::vec3(-1.0f, -10.0f, -50.0f), glm::vec3(1.0f, -8.0f, -48.0f))));
+}
+
+TEST(PooledAndSerialRasterisationMatch)
+{
+	srand(2);
+	CThreadPool pool;
+	pool.Create(3);
+	COcclusionCuller serial, pooled;
+	serial.Create(NULL);
+	pooled.Create(&pool);
+	for (int i = 0; i < 3000; i++) {
+		glm::vec3 centre(rand() % 200 - 100.0f, rand() % 100 - 50.0f, -20.0f - rand() % 300);
+		glm::vec3 size(1.0f + rand() % 8, 1.0f + rand() % 8, 1.0f + rand() % 8);
+		glm::mat4 model = glm::rotate(glm::mat4(1.0f), rand() / (float)RAND_MAX * 6.283f, glm::vec3(0.0f, 1.0f, 0.0f));
+		BoundingBox box(centre - size, centre + size);
+		serial.AddOccluderBox(box, model);
+		pooled.AddOccluderBox(box, model);
+	}
+	serial.Render(GetViewProjection());
+	pooled.Render(GetViewProjection());
+
+	CHECK(serial.GetRasterisedTriangleCount() == pooled.GetRasterisedTriangleCount());
+	CHECK(memcmp(serial.GetDepthBuffer(), pooled.GetDepthBuffer(), sizeof(float) * COcclusionCuller::WIDTH * COcclusionCuller::HEIGHT) == 0);
+	CHECK(CountUncovered(serial) < COcclusionCuller::WIDTH * COcclusionCuller::HEIGHT);
+}
@@ -0,0 +1,32 @@
+#include "Tests.h"
+
+#include <cstdio>
+
+static bool s_bFailed = false;
+
+std::vector<TestCase>& GetTests()
+{
+	static std::vector<TestCase> tests;
+	return tests;
+}
+
+void ReportFailure(const char* file, int line, const char* expression)
+{
+	printf("  %s(%d): CHECK(%s) failed\n", file, line, expression);
+	s_bFailed = true;
+}
+
+int main()
+{
+	int iFailed = 0;
+	std::vector<TestCase>& tests = GetTests();
+	for (unsigned int i = 0; i < tests.size(); i++) {
+		s_bFailed = false;
+		tests[i].function();
+		printf("%s %s\n", s_bFailed ? "FAIL" : "pass", tests[i].name);
+		if (s_bFailed)
+			iFailed++;
+	}
+	printf("%d of %d tests passed\n", (int)tests.size() - iFailed, (int)tests.size());
+	return iFailed;
+}
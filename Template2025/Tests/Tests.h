@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+
+// A small test runner for the classes that make no OpenGL or Windows calls, so they can be checked on any machine
+// without a GPU.  TEST registers a function, CHECK records a failure without stopping it, and main runs every test
+// and returns the number that failed.
+typedef void (*TestFunction)();
+
+struct TestCase {
+	const char* name;
+	TestFunction function;
+};
+
+std::vector<TestCase>& GetTests();
+void ReportFailure(const char* file, int line, const char* expression);
+
+struct TestRegistration {
+	TestRegistration(const char* name, TestFunction function)
+	{
+		TestCase test = { name, function };
+		GetTests().push_back(test);
+	}
+};
+
+#define TEST(name) \
+	static void name(); \
+	static TestRegistration name##Registration(#name, name); \
+	static void name()
+
+#define CHECK(expression) \
+	do { if (!(expression)) ReportFailure(__FILE__, __LINE__, #expression); } while (0)
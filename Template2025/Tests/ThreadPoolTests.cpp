@@ -0,0 +1,94 @@
+#include "Tests.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+
+// Runs body on its own thread and fails the run outright if it has not finished within the time limit, since a
+// deadlocked pool cannot be recovered
+static void RunWithTimeout(const std::function<void()>& body, int iSeconds)
+{
+	std::packaged_task<void()> task(body);
+	std::future<void> finished = task.get_future();
+	std::thread thread(std::move(task));
+	if (finished.wait_for(std::chrono::seconds(iSeconds)) != std::future_status::ready) {
+		ReportFailure(__FILE__, __LINE__, "finished within the time limit");
+		printf("FAIL (timed out, giving up)\n");
+		fflush(stdout);
+		std::_Exit(1);
+	}
+	thread.join();
+}
+
+TEST(ParallelForCallsEveryIndexOnce)
+{
+	CThreadPool pool;
+	pool.Create(3);
+	std::vector<std::atomic<int>> calls(1000);
+	for (unsigned int i = 0; i < calls.size(); i++)
+		calls[i] = 0;
+	pool.ParallelFor((int)calls.size(), [&](int i) { calls[i]++; });
+
+	bool bOnce = true;
+	for (unsigned int i = 0; i < calls.size(); i++)
+		bOnce = bOnce && calls[i] == 1;
+	CHECK(bOnce);
+}
+
+TEST(ParallelForWithoutWorkersRunsOnCaller)
+{
+	CThreadPool pool;
+	std::thread::id caller = std::this_thread::get_id();
+	bool bOnCaller = true;
+	pool.ParallelFor(16, [&](int) { bOnCaller = bOnCaller && std::this_thread::get_id() == caller; });
+	CHECK(bOnCaller);
+}
+
+// With every worker blocked, the caller does all the work itself and returns without waiting for its helpers
+TEST(ParallelForDoesNotWaitBehindQueuedJobs)
+{
+	CThreadPool pool;
+	pool.Create(2);
+	std::promise<void> release;
+	std::shared_future<void> released = release.get_future().share();
+	for (int i = 0; i < 2; i++)
+		pool.Submit([released]() { released.wait(); });
+
+	std::atomic<int> iCalls(0);
+	RunWithTimeout([&]() { pool.ParallelFor(6, [&](int) { iCalls++; }); }, 10);
+	CHECK(iCalls == 6);
+	release.set_value();
+}
+
+TEST(NestedParallelForFromWorkersFinishes)
+{
+	CThreadPool pool;
+	pool.Create(2);
+	std::atomic<int> iCalls(0);
+	RunWithTimeout([&]() {
+		pool.ParallelFor(8, [&](int) {
+			pool.ParallelFor(8, [&](int) { iCalls++; });
+		});
+	}, 10);
+	CHECK(iCalls == 64);
+}
+
+TEST(ParallelForFromSubmittedJobsFinishes)
+{
+	CThreadPool pool;
+	pool.Create(2);
+	std::atomic<int> iCalls(0), iJobs(0);
+	RunWithTimeout([&]() {
+		for (int j = 0; j < 4; j++)
+			pool.Submit([&]() {
+				pool.ParallelFor(32, [&](int) { iCalls++; });
+				iJobs++;
+			});
+		while (iJobs < 4)
+			std::this_thread::yield();
+	}, 10);
+	CHECK(iCalls == 128);
+}
@@ -0,0 +1,406 @@
+#include "BlockEncoder.h"
+#include "ThreadPool.h"
+
+#include <cfloat>
+
+// BC7 interpolation weights for four bit indices, out of 64
+static const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Mean and principal axis of 16 points with iDims coordinates each, by power iteration on their covariance
+static void PrincipalAxis(const float* pPoints, int iDims, float* pMean, float* pAxis)
+{
+	float covariance[4][4] = {};
+	for (int d = 0; d < iDims; d++) {
+		pMean[d] = 0.0f;
+		for (int i = 0; i < 16; i++)
+			pMean[d] += pPoints[i * iDims + d];
+		pMean[d] /= 16.0f;
+	}
+	for (int i = 0; i < 16; i++)
+		for (int a = 0; a < iDims; a++)
+			for (int b = 0; b < iDims; b++)
+				covariance[a][b] += (pPoints[i * iDims + a] - pMean[a]) * (pPoints[i * iDims + b] - pMean[b]);
+
+	for (int d = 0; d < iDims; d++)
+		pAxis[d] = 1.0f;
+	for (int iteration = 0; iteration < 8; iteration++) {
+		float next[4] = {};
+		float fLength = 0.0f;
+		for (int a = 0; a < iDims; a++) {
+			for (int b = 0; b < iDims; b++)
+				next[a] += covariance[a][b] * pAxis[b];
+			fLength = max(fLength, fabsf(next[a]));
+		}
+		if (fLength < 1e-6f)
+			return;								// The points are all the same, so any axis will do
+		for (int d = 0; d < iDims; d++)
+			pAxis[d] = next[d] / fLength;
+	}
+}
+
+// The endpoints at either end of the points' spread along the axis
+static void AxisExtents(const float* pPoints, int iDims, const float* pMean, const float* pAxis, float* pLow, float* pHigh)
+{
+	float fLengthSquared = 0.0f;
+	for (int d = 0; d < iDims; d++)
+		fLengthSquared += pAxis[d] * pAxis[d];
+	float tMin = 0.0f, tMax = 0.0f;
+	for (int i = 0; i < 16 && fLengthSquared > 0.0f; i++) {
+		float t = 0.0f;
+		for (int d = 0; d < iDims; d++)
+			t += (pPoints[i * iDims + d] - pMean[d]) * pAxis[d];
+		t /= fLengthSquared;
+		tMin = min(tMin, t);
+		tMax = max(tMax, t);
+	}
+	for (int d = 0; d < iDims; d++) {
+		pLow[d] = min(max(pMean[d] + pAxis[d] * tMin, 0.0f), 255.0f);
+		pHigh[d] = min(max(pMean[d] + pAxis[d] * tMax, 0.0f), 255.0f);
+	}
+}
+
+// Least squares endpoints for points given their weights (0 at the first endpoint, 1 at the second).  Returns false
+// if the weights do not pin both endpoints down.
+static bool RefitEndpoints(const float* pPoints, int iDims, const float weights[16], float* pFirst, float* pSecond)
+{
+	float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+	float ax[4] = {}, bx[4] = {};
+	for (int i = 0; i < 16; i++) {
+		float a = 1.0f - weights[i], b = weights[i];
+		aa += a * a;
+		bb += b * b;
+		ab += a * b;
+		for (int d = 0; d < iDims; d++) {
+			ax[d] += a * pPoints[i * iDims + d];
+			bx[d] += b * pPoints[i * iDims + d];
+		}
+	}
+	float fDeterminant = aa * bb - ab * ab;
+	if (fabsf(fDeterminant) < 1e-6f)
+		return false;
+	for (int d = 0; d < iDims; d++) {
+		pFirst[d] = min(max((ax[d] * bb - bx[d] * ab) / fDeterminant, 0.0f), 255.0f);
+		pSecond[d] = min(max((bx[d] * aa - ax[d] * ab) / fDeterminant, 0.0f), 255.0f);
+	}
+	return true;
+}
+
+static unsigned short Pack565(const float colour[3])
+{
+	int r = (int)(colour[0] * 31.0f / 255.0f + 0.5f);
+	int g = (int)(colour[1] * 63.0f / 255.0f + 0.5f);
+	int b = (int)(colour[2] * 31.0f / 255.0f + 0.5f);
+	return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+static void Unpack565(unsigned short packed, float colour[3])
+{
+	int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+	colour[0] = (float)((r << 3) | (r >> 2));
+	colour[1] = (float)((g << 2) | (g >> 4));
+	colour[2] = (float)((b << 3) | (b >> 2));
+}
+
+void CBlockEncoder::EncodeImage(const BYTE* pRgba, int iWidth, int iHeight, CCompressedImage::Format format, vector<BYTE>& blocks,
+	CThreadPool* pThreadPool)
+{
+	int iBlocksX = (iWidth + 3) / 4, iBlocksY = (iHeight + 3) / 4;
+	int iBlockBytes = CCompressedImage::GetBlockBytes(format);
+	blocks.resize(CCompressedImage::GetLevelSize(format, iWidth, iHeight));
+
+	auto encodeRow = [&](int by) {
+		BYTE texels[64];
+		for (int bx = 0; bx < iBlocksX; bx++) {
+			for (int y = 0; y < 4; y++) {
+				int iy = min(by * 4 + y, iHeight - 1);
+				for (int x = 0; x < 4; x++) {
+					int ix = min(bx * 4 + x, iWidth - 1);
+					memcpy(&texels[(y * 4 + x) * 4], &pRgba[(iy * iWidth + ix) * 4], 4);
+				}
+			}
+			BYTE* pBlock = &blocks[(by * iBlocksX + bx) * iBlockBytes];
+			switch (format) {
+			case CCompressedImage::FORMAT_BC1: EncodeBC1(texels, pBlock); break;
+			case CCompressedImage::FORMAT_BC3: EncodeBC3(texels, pBlock); break;
+			case CCompressedImage::FORMAT_BC5: EncodeBC5(texels, pBlock); break;
+			case CCompressedImage::FORMAT_BC7: EncodeBC7(texels, pBlock); break;
+			}
+		}
+	};
+
+	if (pThreadPool != NULL)
+		pThreadPool->ParallelFor(iBlocksY, encodeRow);
+	else
+		for (int by = 0; by < iBlocksY; by++)
+			encodeRow(by);
+}
+
+void CBlockEncoder::Downsample(const BYTE* pRgba, int iWidth, int iHeight, bool bLinear, vector<BYTE>& half)
+{
+	static float toLinear[256];
+	static bool bTableReady = false;
+	if (!bTableReady) {
+		for (int i = 0; i < 256; i++) {
+			float c = i / 255.0f;
+			toLinear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+		}
+		bTableReady = true;
+	}
+
+	int iHalfWidth = max(iWidth / 2, 1), iHalfHeight = max(iHeight / 2, 1);
+	half.resize(iHalfWidth * iHalfHeight * 4);
+	for (int y = 0; y < iHalfHeight; y++) {
+		int y0 = min(y * 2, iHeight - 1), y1 = min(y * 2 + 1, iHeight - 1);
+		for (int x = 0; x < iHalfWidth; x++) {
+			int x0 = min(x * 2, iWidth - 1), x1 = min(x * 2 + 1, iWidth - 1);
+			const BYTE* pTexels[4] = { &pRgba[(y0 * iWidth + x0) * 4], &pRgba[(y0 * iWidth + x1) * 4],
+				&pRgba[(y1 * iWidth + x0) * 4], &pRgba[(y1 * iWidth + x1) * 4] };
+			BYTE* pOut = &half[(y * iHalfWidth + x) * 4];
+			for (int c = 0; c < 4; c++) {
+				float fSum = 0.0f;
+				for (int i = 0; i < 4; i++)
+					fSum += (bLinear || c == 3) ? pTexels[i][c] / 255.0f : toLinear[pTexels[i][c]];
+				float fAverage = fSum / 4.0f;
+				if (!bLinear && c != 3)
+					fAverage = fAverage <= 0.0031308f ? fAverage * 12.92f : 1.055f * powf(fAverage, 1.0f / 2.4f) - 0.055f;
+				pOut[c] = (BYTE)(min(max(fAverage, 0.0f), 1.0f) * 255.0f + 0.5f);
+			}
+		}
+	}
+}
+
+// Picks the nearest of the four colours for each texel.  The endpoints are put in the order that selects the four
+// colour palette; if they are equal, BC1 falls back to three colours, but index 0 still gives the endpoint.
+float CBlockEncoder::FitBC1(const float colours[16][3], unsigned short endpoints[2], unsigned int& indices)
+{
+	if (endpoints[0] < endpoints[1])
+		swap(endpoints[0], endpoints[1]);
+
+	float palette[4][3];
+	Unpack565(endpoints[0], palette[0]);
+	Unpack565(endpoints[1], palette[1]);
+	int iColours = endpoints[0] == endpoints[1] ? 1 : 4;
+	for (int c = 0; c < 3; c++) {
+		palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+		palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+	}
+
+	indices = 0;
+	float fError = 0.0f;
+	for (int i = 0; i < 16; i++) {
+		int iBest = 0;
+		float fBest = FLT_MAX;
+		for (int p = 0; p < iColours; p++) {
+			float fDistance = 0.0f;
+			for (int c = 0; c < 3; c++)
+				fDistance += (colours[i][c] - palette[p][c]) * (colours[i][c] - palette[p][c]);
+			if (fDistance < fBest) {
+				fBest = fDistance;
+				iBest = p;
+			}
+		}
+		indices |= (unsigned int)iBest << (2 * i);
+		fError += fBest;
+	}
+	return fError;
+}
+
+void CBlockEncoder::EncodeBC1(const BYTE* pTexels, BYTE* pBlock)
+{
+	float colours[16][3];
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 3; c++)
+			colours[i][c] = pTexels[i * 4 + c];
+
+	float mean[3], axis[3], low[3], high[3];
+	PrincipalAxis(&colours[0][0], 3, mean, axis);
+	AxisExtents(&colours[0][0], 3, mean, axis, low, high);
+	unsigned short endpoints[2] = { Pack565(high), Pack565(low) };
+	unsigned int indices;
+	float fError = FitBC1(colours, endpoints, indices);
+
+	// Weight of the second endpoint for each index
+	const float WEIGHTS[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+	for (int iteration = 0; iteration < 2 && endpoints[0] != endpoints[1]; iteration++) {
+		float weights[16];
+		for (int i = 0; i < 16; i++)
+			weights[i] = WEIGHTS[(indices >> (2 * i)) & 3];
+		float first[3], second[3];
+		if (!RefitEndpoints(&colours[0][0], 3, weights, first, second))
+			break;
+		unsigned short refitted[2] = { Pack565(first), Pack565(second) };
+		unsigned int refittedIndices;
+		float fRefittedError = FitBC1(colours, refitted, refittedIndices);
+		if (fRefittedError >= fError)
+			break;
+		fError = fRefittedError;
+		endpoints[0] = refitted[0];
+		endpoints[1] = refitted[1];
+		indices = refittedIndices;
+	}
+
+	pBlock[0] = (BYTE)(endpoints[0] & 0xFF);
+	pBlock[1] = (BYTE)(endpoints[0] >> 8);
+	pBlock[2] = (BYTE)(endpoints[1] & 0xFF);
+	pBlock[3] = (BYTE)(endpoints[1] >> 8);
+	for (int i = 0; i < 4; i++)
+		pBlock[4 + i] = (BYTE)((indices >> (8 * i)) & 0xFF);
+}
+
+// The eight value mode, with the largest value first: the rest are spread evenly between the two
+void CBlockEncoder::EncodeBC4(const BYTE* pTexels, int iChannel, BYTE* pBlock)
+{
+	int iLow = 255, iHigh = 0;
+	for (int i = 0; i < 16; i++) {
+		iLow = min(iLow, (int)pTexels[i * 4 + iChannel]);
+		iHigh = max(iHigh, (int)pTexels[i * 4 + iChannel]);
+	}
+	pBlock[0] = (BYTE)iHigh;
+	pBlock[1] = (BYTE)iLow;
+
+	float palette[8];
+	palette[0] = (float)iHigh;
+	palette[1] = (float)iLow;
+	for (int i = 2; i < 8; i++)
+		palette[i] = ((8 - i) * iHigh + (i - 1) * iLow) / 7.0f;
+
+	unsigned long long indices = 0;
+	for (int i = 0; i < 16 && iHigh != iLow; i++) {
+		float fValue = pTexels[i * 4 + iChannel];
+		int iBest = 0;
+		for (int p = 1; p < 8; p++)
+			if (fabsf(fValue - palette[p]) < fabsf(fValue - palette[iBest]))
+				iBest = p;
+		indices |= (unsigned long long)iBest << (3 * i);
+	}
+	for (int i = 0; i < 6; i++)
+		pBlock[2 + i] = (BYTE)((indices >> (8 * i)) & 0xFF);
+}
+
+void CBlockEncoder::EncodeBC3(const BYTE* pTexels, BYTE* pBlock)
+{
+	EncodeBC4(pTexels, 3, pBlock);
+	EncodeBC1(pTexels, pBlock + 8);
+}
+
+void CBlockEncoder::EncodeBC5(const BYTE* pTexels, BYTE* pBlock)
+{
+	EncodeBC4(pTexels, 0, pBlock);
+	EncodeBC4(pTexels, 1, pBlock + 8);
+}
+
+// Mode 6 endpoints are seven bits a channel plus a low bit shared by the endpoint's four channels
+void CBlockEncoder::QuantiseBC7(const float endpoint[4], BYTE quantised[4], BYTE& pBit)
+{
+	float fBestError = FLT_MAX;
+	for (int p = 0; p < 2; p++) {
+		BYTE candidate[4];
+		float fError = 0.0f;
+		for (int c = 0; c < 4; c++) {
+			int q = min(max((int)((endpoint[c] - p) / 2.0f + 0.5f), 0), 127);
+			candidate[c] = (BYTE)q;
+			float fValue = (float)((q << 1) | p);
+			fError += (fValue - endpoint[c]) * (fValue - endpoint[c]);
+		}
+		if (fError < fBestError) {
+			fBestError = fError;
+			pBit = (BYTE)p;
+			memcpy(quantised, candidate, 4);
+		}
+	}
+}
+
+float CBlockEncoder::FitBC7(const float colours[16][4], const BYTE endpoints[2][4], BYTE indices[16])
+{
+	float palette[16][4];
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 4; c++)
+			palette[i][c] = (float)(((64 - BC7_WEIGHTS[i]) * endpoints[0][c] + BC7_WEIGHTS[i] * endpoints[1][c] + 32) >> 6);
+
+	float fError = 0.0f;
+	for (int i = 0; i < 16; i++) {
+		int iBest = 0;
+		float fBest = FLT_MAX;
+		for (int p = 0; p < 16; p++) {
+			float fDistance = 0.0f;
+			for (int c = 0; c < 4; c++)
+				fDistance += (colours[i][c] - palette[p][c]) * (colours[i][c] - palette[p][c]);
+			if (fDistance < fBest) {
+				fBest = fDistance;
+				iBest = p;
+			}
+		}
+		indices[i] = (BYTE)iBest;
+		fError += fBest;
+	}
+	return fError;
+}
+
+void CBlockEncoder::EncodeBC7(const BYTE* pTexels, BYTE* pBlock)
+{
+	float colours[16][4];
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 4; c++)
+			colours[i][c] = pTexels[i * 4 + c];
+
+	float mean[4], axis[4], fitted[2][4];
+	PrincipalAxis(&colours[0][0], 4, mean, axis);
+	AxisExtents(&colours[0][0], 4, mean, axis, fitted[0], fitted[1]);
+
+	BYTE quantised[2][4], pBits[2], endpoints[2][4], indices[16];
+	for (int e = 0; e < 2; e++) {
+		QuantiseBC7(fitted[e], quantised[e], pBits[e]);
+		for (int c = 0; c < 4; c++)
+			endpoints[e][c] = (BYTE)((quantised[e][c] << 1) | pBits[e]);
+	}
+	float fError = FitBC7(colours, endpoints, indices);
+
+	for (int iteration = 0; iteration < 2; iteration++) {
+		float weights[16];
+		for (int i = 0; i < 16; i++)
+			weights[i] = BC7_WEIGHTS[indices[i]] / 64.0f;
+		if (!RefitEndpoints(&colours[0][0], 4, weights, fitted[0], fitted[1]))
+			break;
+		BYTE refittedQuantised[2][4], refittedPBits[2], refitted[2][4], refittedIndices[16];
+		for (int e = 0; e < 2; e++) {
+			QuantiseBC7(fitted[e], refittedQuantised[e], refittedPBits[e]);
+			for (int c = 0; c < 4; c++)
+				refitted[e][c] = (BYTE)((refittedQuantised[e][c] << 1) | refittedPBits[e]);
+		}
+		float fRefittedError = FitBC7(colours, refitted, refittedIndices);
+		if (fRefittedError >= fError)
+			break;
+		fError = fRefittedError;
+		memcpy(quantised, refittedQuantised, sizeof(quantised));
+		memcpy(pBits, refittedPBits, sizeof(pBits));
+		memcpy(indices, refittedIndices, sizeof(indices));
+	}
+
+	// The first texel's index is stored without its top bit, so it must be below 8: swap the endpoints if it is not
+	if (indices[0] & 8) {
+		for (int c = 0; c < 4; c++)
+			swap(quantised[0][c], quantised[1][c]);
+		swap(pBits[0], pBits[1]);
+		for (int i = 0; i < 16; i++)
+			indices[i] = (BYTE)(15 - indices[i]);
+	}
+
+	// Fields go in from the lowest bit: the mode (bit 6 set), the endpoints a channel at a time, the p-bits, the indices
+	memset(pBlock, 0, 16);
+	int iBit = 0;
+	auto write = [&](unsigned int value, int iBits) {
+		for (int i = 0; i < iBits; i++, iBit++)
+			if (value & (1u << i))
+				pBlock[iBit >> 3] |= (BYTE)(1 << (iBit & 7));
+	};
+	write(1 << 6, 7);
+	for (int c = 0; c < 4; c++) {
+		write(quantised[0][c], 7);
+		write(quantised[1][c], 7);
+	}
+	write(pBits[0], 1);
+	write(pBits[1], 1);
+	write(indices[0], 3);
+	for (int i = 1; i < 16; i++)
+		write(indices[i], 4);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "CompressedImage.h"
+
+class CThreadPool;
+
+// CPU encoders for the block compressed formats, used offline by the converter.  Each 4x4 block is fitted by taking the
+// endpoints from the principal axis of its texels, choosing the nearest palette entry for each texel, and then
+// refitting the endpoints to those choices by least squares while that lowers the error.
+//
+// BC7 is encoded with mode 6 only: one pair of RGBA endpoints and sixteen levels per block.  It has no partitions, so
+// blocks with several distinct colours fare worse than under a full BC7 search, but it is far quicker and still beats
+// BC3 on smooth images.
+class CBlockEncoder
+{
+public:
+	// Encodes an RGBA image (rows in order, 4 bytes a texel) into blocks, sharing the rows of blocks between the
+	// workers if given a thread pool.  Blocks past the edge repeat the edge texels.
+	static void EncodeImage(const BYTE* pRgba, int iWidth, int iHeight, CCompressedImage::Format format, vector<BYTE>& blocks,
+		CThreadPool* pThreadPool = NULL);
+
+	// Halves an RGBA image with a box filter.  Unless bLinear, colour is averaged in linear light rather than on the
+	// sRGB values, which would darken each level.  Alpha is always averaged as it is.
+	static void Downsample(const BYTE* pRgba, int iWidth, int iHeight, bool bLinear, vector<BYTE>& half);
+
+	// Single blocks, from 16 RGBA texels in rows
+	static void EncodeBC1(const BYTE* pTexels, BYTE* pBlock);
+	static void EncodeBC3(const BYTE* pTexels, BYTE* pBlock);
+	static void EncodeBC5(const BYTE* pTexels, BYTE* pBlock);			// Red and green
+	static void EncodeBC7(const BYTE* pTexels, BYTE* pBlock);
+
+private:
+	static void EncodeBC4(const BYTE* pTexels, int iChannel, BYTE* pBlock);	// One channel, as BC3 alpha and BC5 use
+	static float FitBC1(const float colours[16][3], unsigned short endpoints[2], unsigned int& indices);
+	static float FitBC7(const float colours[16][4], const BYTE endpoints[2][4], BYTE indices[16]);
+	static void QuantiseBC7(const float endpoint[4], BYTE quantised[4], BYTE& pBit);
+};
@@ -0,0 +1,132 @@
+#include "Common.h"
+#include "CompressedImage.h"
+#include "BlockEncoder.h"
+#include "ThreadPool.h"
+#include "HighResolutionTimer.h"
+
+#include "include\freeimage\FreeImage.h"
+
+// Converts images into block compressed KTX2 or DDS files with a precomputed mip chain.  The game picks a converted
+// file up in place of the source image when it sits beside it with the same name, e.g. grassfloor01.ktx2 beside
+// grassfloor01.jpg.
+//
+// Usage: TextureConverter [-bc1|-bc3|-bc5|-bc7] [-linear] [-nomips] [-dds] image...
+//   -bc1 ... -bc7	Block format.  By default, BC3 for images with any transparency and BC1 otherwise.
+//   -linear		The image is data, such as a normal map, rather than sRGB colour, so mips are averaged as stored
+//   -nomips		Only the top level
+//   -dds			Write DDS rather than KTX2
+
+static bool ConvertImage(const string& input, int iFormat, bool bLinear, bool bMipMaps, bool bDds, CThreadPool* pThreadPool)
+{
+	CHighResolutionTimer timer;
+	timer.Start();
+
+	FREE_IMAGE_FORMAT fif = FreeImage_GetFileType(input.c_str(), 0);
+	if (fif == FIF_UNKNOWN)
+		fif = FreeImage_GetFIFFromFilename(input.c_str());
+	FIBITMAP* dib = NULL;
+	if (fif != FIF_UNKNOWN && FreeImage_FIFSupportsReading(fif))
+		dib = FreeImage_Load(fif, input.c_str());
+	FIBITMAP* dib32 = dib != NULL ? FreeImage_ConvertTo32Bits(dib) : NULL;
+	if (dib != NULL)
+		FreeImage_Unload(dib);
+	if (dib32 == NULL) {
+		fprintf(stderr, "Cannot load image %s\n", input.c_str());
+		return false;
+	}
+
+	// Rows stay in FreeImage's order, bottom first, as the game uploads them
+	int iWidth = FreeImage_GetWidth(dib32), iHeight = FreeImage_GetHeight(dib32);
+	vector<BYTE> rgba(iWidth * iHeight * 4);
+	bool bTransparent = false;
+	for (int y = 0; y < iHeight; y++) {
+		const BYTE* pRow = FreeImage_GetScanLine(dib32, y);
+		for (int x = 0; x < iWidth; x++) {
+			BYTE* pTexel = &rgba[(y * iWidth + x) * 4];
+			pTexel[0] = pRow[x * 4 + FI_RGBA_RED];
+			pTexel[1] = pRow[x * 4 + FI_RGBA_GREEN];
+			pTexel[2] = pRow[x * 4 + FI_RGBA_BLUE];
+			pTexel[3] = pRow[x * 4 + FI_RGBA_ALPHA];
+			bTransparent = bTransparent || pTexel[3] != 255;
+		}
+	}
+	FreeImage_Unload(dib32);
+
+	CCompressedImage::Format format = (CCompressedImage::Format)iFormat;
+	if (iFormat < 0)
+		format = bTransparent ? CCompressedImage::FORMAT_BC3 : CCompressedImage::FORMAT_BC1;
+
+	// Each level is filtered from the full precision level above it, not from the compressed one
+	CCompressedImage image;
+	image.Create(format, iWidth, iHeight, !bLinear);
+	int iLevelWidth = iWidth, iLevelHeight = iHeight;
+	size_t uncompressedSize = 0;
+	while (true) {
+		vector<BYTE> blocks;
+		CBlockEncoder::EncodeImage(&rgba[0], iLevelWidth, iLevelHeight, format, blocks, pThreadPool);
+		image.AddLevel(blocks);
+		uncompressedSize += rgba.size();
+		if (!bMipMaps || (iLevelWidth == 1 && iLevelHeight == 1))
+			break;
+		vector<BYTE> half;
+		CBlockEncoder::Downsample(&rgba[0], iLevelWidth, iLevelHeight, bLinear, half);
+		rgba.swap(half);
+		iLevelWidth = max(iLevelWidth / 2, 1);
+		iLevelHeight = max(iLevelHeight / 2, 1);
+	}
+
+	string output = input.substr(0, input.find_last_of('.')) + (bDds ? ".dds" : ".ktx2");
+	if (!(bDds ? image.SaveDds(output) : image.SaveKtx2(output))) {
+		fprintf(stderr, "Cannot write %s\n", output.c_str());
+		return false;
+	}
+
+	const char* FORMAT_NAMES[] = { "BC1", "BC3", "BC5", "BC7" };
+	printf("%s: %dx%d %s, %d levels, %.1f KB as RGBA8 -> %.1f KB (%.1fx) in %.0f ms\n", output.c_str(), iWidth, iHeight,
+		FORMAT_NAMES[format], image.GetLevelCount(), uncompressedSize / 1024.0f, image.GetDataSize() / 1024.0f,
+		(float)uncompressedSize / image.GetDataSize(), timer.Elapsed());
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	int iFormat = -1;
+	bool bLinear = false, bMipMaps = true, bDds = false;
+	vector<string> inputs;
+	for (int i = 1; i < argc; i++) {
+		string argument = argv[i];
+		if (argument == "-bc1")
+			iFormat = CCompressedImage::FORMAT_BC1;
+		else if (argument == "-bc3")
+			iFormat = CCompressedImage::FORMAT_BC3;
+		else if (argument == "-bc5")
+			iFormat = CCompressedImage::FORMAT_BC5;
+		else if (argument == "-bc7")
+			iFormat = CCompressedImage::FORMAT_BC7;
+		else if (argument == "-linear")
+			bLinear = true;
+		else if (argument == "-nomips")
+			bMipMaps = false;
+		else if (argument == "-dds")
+			bDds = true;
+		else if (argument[0] == '-') {
+			fprintf(stderr, "Unknown option %s\n", argument.c_str());
+			return 1;
+		} else
+			inputs.push_back(argument);
+	}
+	if (inputs.empty()) {
+		printf("Usage: TextureConverter [-bc1|-bc3|-bc5|-bc7] [-linear] [-nomips] [-dds] image...\n");
+		return 1;
+	}
+
+	FreeImage_Initialise();
+	CThreadPool threadPool;
+	threadPool.Create();
+	bool bSucceeded = true;
+	for (unsigned int i = 0; i < inputs.size(); i++)
+		bSucceeded = ConvertImage(inputs[i], iFormat, bLinear, bMipMaps, bDds, &threadPool) && bSucceeded;
+	threadPool.Release();
+	FreeImage_DeInitialise();
+	return bSucceeded ? 0 : 1;
+}